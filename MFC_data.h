@@ -26,10 +26,14 @@ struct MFC_flows{
     timestamp = 0.0;
     memset(&values,0,sizeof(values));
     memset(&names,0,sizeof(names));
-    memset(&names,0,sizeof(flow_type));
+    memset(&flow_type,0,sizeof(flow_type));
     memset(&validity,0,sizeof(validity));
   }
-  // TO IMPLEMENT: == operator ignoring timestamp info
+  /// same MFCs, flows and validities, the timestamp of the reading is ignored
+  bool operator==(const MFC_flows& other) const{
+    return memcmp(values, other.values, sizeof(values)) == 0 && memcmp(names, other.names, sizeof(names)) == 0
+      && memcmp(flow_type, other.flow_type, sizeof(flow_type)) == 0 && memcmp(validity, other.validity, sizeof(validity)) == 0;
+  }
 };
 
 
@@ -3,6 +3,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "aioUsbApi.h"
 
@@ -173,31 +174,26 @@ freeBulkXferRec(bulkXferRec   *pBulkXferRecord)
 
 
 
+// position in aioDevs.aioDevList of each device index, -1 if there is no
+// AIO device with that index. Filled by AIO_Usb_GetDevices so that the
+// lookup does not scan the device list on every API call
+int devListIndex[MAX_DEV_INDEX];
+
+// protects the handle pool (devHandle and handleRefCount of aioDevList)
+pthread_mutex_t devHandleMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
 // returns the index in the aio device list corresponding
 // to the input device index
 int
 getListIndex(int devIdx)
 {
-  int idx;
-  int devFound;
-
-  // find the right entry in the list
-  for (idx  = 0; idx < aioDevs.numAIODevs; idx++)
-  {
-    if (aioDevs.aioDevList[idx].devIdx == devIdx)
-    {
-      devFound = 1;
-      break;
-    }
-  }
-  if (devFound)
-   return (idx);
-  else
+  if (devIdx < 0 || devIdx >= MAX_DEV_INDEX || devListIndex[devIdx] < 0)
   {
     debug("DBG>>GetListIndex : No entry in lust for devIdx = %d\n",devIdx);
     return (ERROR_NO_AIO_DEVS_FOUND);
-   }
- 
+  }
+  return (devListIndex[devIdx]);
 }
 
 
@@ -380,6 +376,10 @@ for (j=0;j<16;j++)
 
 
 
+// returns the open handle of the device. The handle is opened on the first
+// call and shared by all later callers: each call takes a reference that
+// must be given back with releaseDevHandle, the handle is closed when the
+// last reference is released
 struct libusb_device_handle *
 getDevHandle(int devIdx)
 {
@@ -389,18 +389,20 @@ getDevHandle(int devIdx)
   struct libusb_device_handle *devHandle;
   int                          productId;
 
-  ret = AIO_UsbValidateDeviceIndex(devIdx);
-  if (ret > ERROR_SUCCESS)
+  idx = getListIndex(devIdx);
+  if (idx >= aioDevs.numAIODevs)
   {
-    debug("DBG>>getDevHandle : invalid dev Index = %d \n",(unsigned int)devIdx); 
+    debug("DBG>>getDevHandle : No Entry in lust for devIdex = %d\n",(unsigned int)devIdx); 
     return (NULL);
   }
 
-  idx = getListIndex(devIdx);
-  if (ret > ERROR_SUCCESS)
+  pthread_mutex_lock(&devHandleMutex);
+  if (aioDevs.aioDevList[idx].devHandle != NULL)
   {
-    debug("DBG>>getDevHandle : No Entry in lust for devIdex = %d\n",(unsigned int)devIdx); 
-    return (NULL);
+    aioDevs.aioDevList[idx].handleRefCount++;
+    devHandle = aioDevs.aioDevList[idx].devHandle;
+    pthread_mutex_unlock(&devHandleMutex);
+    return (devHandle);
   }
 
    // get the descriptor for this device 
@@ -410,24 +412,48 @@ getDevHandle(int devIdx)
  
   // changed because  libusb_open_with_VID_PID does not allow multiple USB-DIO 96 to be connected at the same time: http://libusb.sourceforge.net/api-1.0/group__dev.html#ga11ba48adb896b1492bbd3d0bf7e0f665
   //devHandle = libusb_open_device_with_vid_pid(NULL,0x1605,productId);
+  devHandle = NULL;
   ret = libusb_open(device, &devHandle);
-  if (ret!= 0){
+  if (ret!= 0 || devHandle == NULL){
+   pthread_mutex_unlock(&devHandleMutex);
    fprintf(stderr, "libusb_open() for device %d failed with error %d. \n",devIdx,ret);
+   debug("DBG>>getDevHandle : Cannot Get Device Handle for ProductId=0x%x devIdx=%d\n",productId,(unsigned int)devIdx); 
    return NULL;
   }
-  //
 
-  if (devHandle == NULL)
-    debug("DBG>>getDevHandle : Cannot Get Device Handle for ProductId=0x%x devIdx=%d\n",productId,(unsigned int)devIdx); 
+  aioDevs.aioDevList[idx].devHandle      = devHandle;
+  aioDevs.aioDevList[idx].handleRefCount = 1;
+  pthread_mutex_unlock(&devHandleMutex);
+  return (devHandle);
+} 
+
 
-  if (ret < 0)
+// gives back a reference taken with getDevHandle, closes the handle
+// when it is not used anymore
+void
+releaseDevHandle(int devIdx)
+{
+  int idx;
+
+  idx = getListIndex(devIdx);
+  if (idx >= aioDevs.numAIODevs)
   {
-    debug("DBG>>getDevHandle : could not get device handle devIdx = %d \n",(unsigned int)devIdx); 
-    return (NULL);
+    debug("DBG>>releaseDevHandle : No Entry in lust for devIdex = %d\n",(unsigned int)devIdx); 
+    return;
   }
-  else 
-   return (devHandle);
-} 
+
+  pthread_mutex_lock(&devHandleMutex);
+  if (aioDevs.aioDevList[idx].handleRefCount > 0)
+  {
+    aioDevs.aioDevList[idx].handleRefCount--;
+    if (aioDevs.aioDevList[idx].handleRefCount == 0)
+    {
+      libusb_close(aioDevs.aioDevList[idx].devHandle);
+      aioDevs.aioDevList[idx].devHandle = NULL;
+    }
+  }
+  pthread_mutex_unlock(&devHandleMutex);
+}
 
 //struct timespec      bulkPollTime;
 
@@ -519,12 +545,7 @@ AIO_UsbValidateDeviceIndex(int  devIdx)
   }
 
   // so make sure the input device exists
-  for (i = 0; i < aioDevs.numAIODevs; i++)
-  {
-    if (aioDevs.aioDevList[i].devIdx == devIdx)
-      devFound = 1; 
-  }
-  if (devFound)
+  if (getListIndex(devIdx) < aioDevs.numAIODevs)
     return (devIdx);
   else
   {
@@ -617,10 +638,12 @@ AIO_Usb_GetDevices(aioDeviceInfo  *pAioDeviceInfo)
   int         ret;
 
         // initialize the aio dev list
+        AIO_Usb_DIO_ClearDevices();
         aioDevs.numAIODevs = 0;
         for (i = 0; i < MAX_USB_DEVICES; i++)
         {
           aioDevs.aioDevList[i].devHandle		= NULL;
+          aioDevs.aioDevList[i].handleRefCount		= 0;
           aioDevs.aioDevList[i].device       		= NULL; 
           aioDevs.aioDevList[i].devIdx       		= NO_DEVICE;
           aioDevs.aioDevList[i].productId		= 0;
@@ -677,12 +700,14 @@ AIO_Usb_GetDevices(aioDeviceInfo  *pAioDeviceInfo)
                   return (ERROR_COULD_NOT_GET_DESCRIPTOR);
                 }
 
-		if (desc.idVendor == ACCES_VENDOR_ID)
+		if (desc.idVendor == ACCES_VENDOR_ID && j < MAX_USB_DEVICES && i < MAX_DEV_INDEX)
                 {
 
 
+                    // keep a reference, the device list is freed below
                     aioDevs.aioDevList[j].devHandle    = NULL;
-                    aioDevs.aioDevList[j].device       = dev; 
+                    aioDevs.aioDevList[j].device       = libusb_ref_device(dev); 
+                    devListIndex[i]                    = j;
                     aioDevs.aioDevList[j].devIdx       = i; 
                     aioDevs.aioDevList[j].productId   = desc.idProduct;
                     aioDevs.numAIODevs++;
@@ -946,6 +971,7 @@ AIO_Usb_ADC_SetCal(unsigned long  devIdx,
    if (calFile == NULL)
    {
      debug("DBG>> AIO_SetCal: cannot open calFile : %s \n",calFileName);
+     releaseDevHandle(devIdx);
      return (ERROR_CAL_FILE_NOT_FOUND);
    }
    // fill data with the data in the file
@@ -960,6 +986,7 @@ AIO_Usb_ADC_SetCal(unsigned long  devIdx,
   if (ret < 0)
   {
     debug("DBG>> AIO_SetCal: usb_claim_interface failed 0x%0x err=%d\n",(unsigned int)devIdx,ret);
+   releaseDevHandle(devIdx);
    return (ERROR_LIBUSB_CLAIM_INTF_FAILED);
   }
 
@@ -992,6 +1019,7 @@ AIO_Usb_ADC_SetCal(unsigned long  devIdx,
       ret = libusb_release_interface(handle,0); 
       debug("DBG>> AIO_SetCal: usb_bulk_write failed devIdx=%d err=%d\n",(unsigned int)devIdx,ret);
       debug("DBG>> AIO_DIO_StreamFrame : Wrote %d of %d bytes \n",(unsigned int)dataWritten,(unsigned int)numBytes);
+      releaseDevHandle(devIdx);
       return (ERROR_USB_BULK_WRITE_FAILED);
     }
 
@@ -1009,6 +1037,7 @@ AIO_Usb_ADC_SetCal(unsigned long  devIdx,
     {
       debug("DBG>> AIO_Usb_SetCal: usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
       ret = libusb_release_interface(handle,0); 
+      releaseDevHandle(devIdx);
       return (ERROR_USB_CONTROL_MSG_FAILED);
     }
 
@@ -1016,12 +1045,12 @@ AIO_Usb_ADC_SetCal(unsigned long  devIdx,
    }
 
   ret = libusb_release_interface(handle,0); 
+  releaseDevHandle(devIdx);
   if (ret < 0)
   {
     debug("DBG>> AIO_SetCal: usb_release_interface failed 0x%0x \n",(unsigned int)devIdx);
     return (ERROR_USB_CONTROL_MSG_FAILED);
   }
-  libusb_close(handle);
   return (ERROR_SUCCESS);
 }
 
@@ -1155,7 +1184,7 @@ AIO_Usb_ADC_SetConfig(unsigned long devIdx,
                           pCfgBuf,
                           20, 
                           TIMEOUT_1_SEC);
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_ADC_SetConfig: usb_control_msg failed ; dev=%d err=%d\n",(unsigned int)devIdx,ret);
@@ -1242,7 +1271,7 @@ AIO_Usb_ADC_GetConfig (unsigned        long devIdx,
                           20, 
                           TIMEOUT_1_SEC);
    
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
 						  
     
    if (ret < 0)
@@ -1322,7 +1351,7 @@ AIO_Usb_ADC_RangeAll (unsigned        long devIdx,
                           (unsigned char *)pCfgBuf,
                           16, 
                           TIMEOUT_1_SEC);
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_ADC_RangeAll: usb_control_msg failed ; dev=%d err=%d\n",(unsigned int)devIdx,ret);
@@ -1424,13 +1453,12 @@ AIO_Usb_ADC_Range1 (unsigned        long devIdx,
                           (unsigned char *)cfgBuf,
                           16, 
                           TIMEOUT_1_SEC);
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_ADC_Range1: usb_control_msg failed ; dev=%d err=%d\n",(unsigned int)devIdx,ret);
     return (ERROR_USB_CONTROL_MSG_FAILED);
    }
-    libusb_close(handle);
     return (ERROR_SUCCESS);
 }
 
@@ -1866,7 +1894,7 @@ AIO_Usb_CTR_8254ModeLoad(unsigned       long devIdx,
                           pData,  //unused 
                           0, 
                           TIMEOUT_1_SEC);
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_CTR8254ModeLoad : usb_control_msg failed ; dev=%d err=%d\n",(unsigned int)devIdx,ret);
@@ -1974,7 +2002,7 @@ AIO_Usb_CTR_8254Mode(unsigned  long devIdx,
                           0, 
                           TIMEOUT_1_SEC);
 						  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_CTR8254_Mode : usb_control_msg failed ; (unsigned int)dev=%d err=%d\n",(unsigned int)devIdx,ret);
@@ -2008,9 +2036,24 @@ AIO_Usb_DIO_ClearDevices(void)
 
  int i;
  
+  // close the pooled handles and give back the devices kept by AIO_Usb_GetDevices
+  pthread_mutex_lock(&devHandleMutex);
+  for (i=0; i < aioDevs.numAIODevs && i < MAX_USB_DEVICES; i++)
+  {
+    if (aioDevs.aioDevList[i].devHandle != NULL)
+      libusb_close(aioDevs.aioDevList[i].devHandle);
+    if (aioDevs.aioDevList[i].device != NULL)
+      libusb_unref_device(aioDevs.aioDevList[i].device);
+  }
+  for (i=0; i < MAX_DEV_INDEX; i++)
+    devListIndex[i] = -1;
+  aioDevs.numAIODevs = 0;
+  pthread_mutex_unlock(&devHandleMutex);
+
   for (i=0; i < MAX_USB_DEVICES; i++)
   {
           aioDevs.aioDevList[i].devHandle		= NULL;
+          aioDevs.aioDevList[i].handleRefCount		= 0;
           aioDevs.aioDevList[i].device       		= NULL; 
           aioDevs.aioDevList[i].devIdx       		= NO_DEVICE;
           aioDevs.aioDevList[i].productId		= 0;
@@ -2116,7 +2159,7 @@ AIO_Usb_WriteAll(unsigned long  devIdx,
 								  pData,
 								  4, 
 								  TIMEOUT_1_SEC);*/
-	libusb_close(handle);
+	releaseDevHandle(devIdx);
   if (ret  < 0 ) 
   {
     debug("DBG>> AIO_Usb_WriteAll: usb_control_msg failed on WRITE_TO_DEV dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -2198,7 +2241,7 @@ AIO_Usb_DIO_ReadAll (unsigned long   devIdx,
 									  pData,
 									  4, 
 									  TIMEOUT_1_SEC);*/
-		libusb_close(handle);
+		releaseDevHandle(devIdx);
 		
 		if (ret < 0)
 		{
@@ -2325,6 +2368,7 @@ if (Hz > 50000)
    if ( aioDevs.aioDevList[listIdx].sampleReadInProgress)
    {
       debug("DBG>>AIO_BulkAquire : A SampleReadBulkAquire is already in progress for devIdx=%d . Can only have 1 pending at a time\n",(unsigned int)devIdx);
+      releaseDevHandle(devIdx);
       return (ERROR_BULK_AQUIRE_BUSY);
    }
    else
@@ -2392,7 +2436,7 @@ if (Hz > 50000)
    if (ret < 0)
    {
     debug("DBG>> bulkAquire: usb_claim_interface failed 0x%0x err=%d\n",(unsigned int)devIdx,ret);
-
+    releaseDevHandle(devIdx);
     return (ERROR_LIBUSB_CLAIM_INTF_FAILED);
    }
  
@@ -2410,7 +2454,7 @@ if (Hz > 50000)
                           0, 
                           TIMEOUT_5_SEC);
 						  
-  libusb_close(handle);						  
+  releaseDevHandle(devIdx);						  
    if (ret < 0)
    {
     debug("DBG>> AIO_BulkAquire: usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -2423,6 +2467,11 @@ if (Hz > 50000)
 
   
     handle = getDevHandle(devIdx); 
+    if (handle == NULL)
+    {
+     debug("DBG>> AIO_Usb_BulkAquire : could not get device handle devIdx=%d \n",(unsigned int)devIdx);
+     return (ERROR_COULD_NOT_GET_DEVHANDLE);
+    }
     ret = libusb_claim_interface(handle,0); 
 int count;	
    
@@ -2434,7 +2483,6 @@ int count;
                                  &dataRead,
                                 5000);//TIMEOUT_5_SEC); 
   				  
-    libusb_close(handle);
 
 	tmpHz = 0;
 	
@@ -2464,6 +2512,7 @@ float volts;
 
 
     ret = libusb_release_interface(handle,0);
+    releaseDevHandle(devIdx);
      return (ERROR_SUCCESS);
 
 
@@ -2710,7 +2759,7 @@ AIO_ADC_Usb_BulkAcquire (unsigned long  devIdx,
 }
      // libusb_close(handle);
      // start the Clock 
-libusb_close(handle);
+releaseDevHandle(devIdx);
 
      ret = CTR_StartOutputFreq(devIdx,
                                0,
@@ -3012,7 +3061,7 @@ AIO_Usb_DIO_ConfigureEx (unsigned long  devIdx,
                           6, 
                           TIMEOUT_1_SEC);
 						  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_DIO_ConfigureEx : usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -3168,7 +3217,7 @@ AIO_Usb_DIO_Configure(unsigned long  devIdx,
 									6, 
 									TIMEOUT_1_SEC);
 */	  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_DIO_Configure : usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -3206,7 +3255,7 @@ AIO_Usb_Write1(unsigned long  devIdx,
 
   int                 tmp;
   int                 ret;
-  unsigned char       dataRead[4];
+  unsigned char       dataRead[14];     // AIO_Usb_DIO_ReadAll reads the 14 bytes of the 96-channel board
   //unsigned char       writeBack[4];
   //unsigned long       dataReadAsLong    = 0;
   //unsigned long       dataToWriteAsLong = 0;
@@ -3262,6 +3311,7 @@ AIO_Usb_Write1(unsigned long  devIdx,
    if (ret < 0)
    {
      debug("DBG>> AIO_Usb_Write1 : ReadAll failed = 0x%0x err=%d",(unsigned int)devIdx,ret);
+     releaseDevHandle(devIdx);
      return (ret);
    }
 /********
@@ -3313,7 +3363,7 @@ AIO_Usb_Write1(unsigned long  devIdx,
                         6, 
                         TIMEOUT_1_SEC);
 						
-  libusb_close(handle);
+  releaseDevHandle(devIdx);
   //  write them back
   if (ret  < 0 ) 
   {
@@ -3600,7 +3650,7 @@ AIO_Usb_CTR_8254Load(unsigned       long devIdx,
                           2, 
                           TIMEOUT_1_SEC);
 						  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_CTR8254Load : usb_control_msg failed ; (unsigned int)dev=%d err=%d\n",(unsigned int)devIdx,ret);
@@ -3732,7 +3782,7 @@ AIO_Usb_CTR_8254ReadModeLoad(unsigned        long devIdx,
                           2, 
                           TIMEOUT_1_SEC);
 						  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_CTR8254ReadModeLoade: usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -3837,7 +3887,7 @@ AIO_Usb_CTR_8254Read(unsigned        long devIdx,
                           2, 
                           TIMEOUT_1_SEC);
 						  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_CTR8254Read : usb_control_msg failed ; dev=%d err=%d\n",(unsigned int)devIdx,ret);
@@ -3917,7 +3967,7 @@ AIO_Usb_ADC_GetImmediate(unsigned         long devIdx,
                           (unsigned char *)sample,
                           2, 
                           TIMEOUT_1_SEC);
-  libusb_close(handle);				  
+  releaseDevHandle(devIdx);				  
 						  
     
    if (ret < 0)
@@ -4041,7 +4091,7 @@ AIO_Usb_ADC_ADMode(unsigned long    devIdx,
 			              16, 
                         TIMEOUT_1_SEC);
 						
-	  libusb_close(handle);
+	  releaseDevHandle(devIdx);
 		
 	   if (ret < 0)
 	   {
@@ -4111,7 +4161,7 @@ AIO_Usb_ADC_ADMode(unsigned long    devIdx,
 				  1, 
 				  TIMEOUT_1_SEC);
 				  
-	   libusb_close(handle);
+	   releaseDevHandle(devIdx);
 	   if (ret < 0)
 	   {
 	    debug("DBG>> AIO_Usb_QueryCal : usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -4207,7 +4257,7 @@ AIO_Usb_CustomEEPROMWrite(unsigned long  devIdx,
     {
        debug("DBG>>AIO_Usb_CustomEEPROMWrite: EEPROM addr range exceeded. StartAddr=0x%0x size=0x%0x\n",(unsigned int)startAddr,(unsigned int)dataSize);
        debug("      Max allowable address is 0x1FF \n");
-
+       releaseDevHandle(devIdx);
        return (ERROR_EEPROM_ADDR_OUT_OF_RANGE);
     }
 
@@ -4220,7 +4270,7 @@ AIO_Usb_CustomEEPROMWrite(unsigned long  devIdx,
                           dataSize, 
                           TIMEOUT_1_SEC);
 						  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_CustomEEPROMWrite: usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -4315,7 +4365,7 @@ AIO_Usb_CustomEEPROMRead(unsigned long   devIdx,
     {
        debug("DBG>>AIO_Usb_CustomEEPROMWrite: EEPROM addr range exceeded. StartAddr=0x%0x size=0x%0x\n",(unsigned int)startAddr,(unsigned int)dataSize);
        debug("      Max allowable address is 0x1FF \n");
-
+       releaseDevHandle(devIdx);
        return (ERROR_EEPROM_ADDR_OUT_OF_RANGE);
     }
 
@@ -4327,7 +4377,7 @@ AIO_Usb_CustomEEPROMRead(unsigned long   devIdx,
                           (unsigned char *)pData, 
                           dataSize, 
                           TIMEOUT_1_SEC);
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_CustomEEPROMRead: usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -4405,7 +4455,7 @@ AIO_Usb_ClearFIFO(unsigned long   devIdx,
                           0, 
                           TIMEOUT_1_SEC);
 						  
-   libusb_close(handle);
+   releaseDevHandle(devIdx);
    if (ret < 0)
    {
     debug("DBG>> AIO_Usb_ClearFIFO usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -4607,7 +4657,7 @@ AIO_Usb_DIO_StreamSetClocks(unsigned long   devIdx,
                           5, 
                           TIMEOUT_5_SEC);
 						  
-	libusb_close(handle);				  
+	releaseDevHandle(devIdx);				  
     if (ret < 0)
     {
       debug("DBG>> AIO_Usb_DIO_StreamSetClocks: usb_control_msg failed ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
@@ -4714,6 +4764,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
   if (ret < 0)
   {
     debug("DBG>> AIO_Usb_DIO_StreamFrame : usb_claim_interface failed 0x%0x err=%d\n",(unsigned int)devIdx,ret);
+   releaseDevHandle(devIdx);
    return (ERROR_LIBUSB_CLAIM_INTF_FAILED);
   }
 
@@ -4732,11 +4783,11 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
                           0, 
                           TIMEOUT_5_SEC);
 						  
-	libusb_close(handle);
     if (ret < 0)
     {
       debug("DBG>> AIO_Usb_DIO_StreamFrame : usb_control_msg failed for Stream Input Operation  ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
       ret = libusb_release_interface(handle,0); 
+      releaseDevHandle(devIdx);
       return (ERROR_USB_CONTROL_MSG_FAILED);
     }
 
@@ -4786,6 +4837,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
          if (pBulkXferRec == NULL)
          {
            debug("DBG>> DIO_StreamFrame : MAX_PENDING_XFERS EXceeded \n");
+           releaseDevHandle(devIdx);
            return (ERROR_MAX_XFERS_EXCEEDED);
          }
 
@@ -4811,6 +4863,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
           freeBulkXferRec(pBulkXferRec);
           debug("DBG>> DIO_StreamFrame : libusb_submit_transfer failed ; ret = %d\n",ret);
           ret = libusb_release_interface(handle,0); 
+          releaseDevHandle(devIdx);
           return (ERROR_LIBUSB_SUBMIT_XFER_FAILED);
         }
 
@@ -4837,6 +4890,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
        if (ret < 0 )
        {
          debug("DBG>>AIO_Usb_DIO_StreamFramee: FATAL SYSTEM ERROR : libusb_handle_events failed status=%d\n",ret);
+         releaseDevHandle(devIdx);
          return (ERROR_LIBUSB_HANDLE_EVENTS_FAILED);
        }
 
@@ -4869,6 +4923,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
         aioDevs.aioDevList[listIdx].sampleReadInProgress   = 0;
 
         debug("DBG>>DIO_StreamFrame  : READ FAILURE Exceeded maximum number of bulkXfer read timeouts(5)\n");
+        releaseDevHandle(devIdx);
         return (ERROR_READ_TIMEOUT);
      }
 
@@ -4890,6 +4945,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
     {
       debug("DBG>> AIO_Usb_DIO_StreamFrame : usb_control_msg failed for Stream Output Operation  ; dev=0x%0x err=%d\n",(unsigned int)devIdx,ret);
       ret = libusb_release_interface(handle,0); 
+      releaseDevHandle(devIdx);
       return (ERROR_USB_CONTROL_MSG_FAILED);
     }
 
@@ -4912,6 +4968,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
     {
       debug("DBG>> AIO_DIO_StreamFrame : usb_bulk_write failed devIdx=%d err=%d\n",(unsigned int)devIdx,ret);
       ret = libusb_release_interface(handle,0); 
+      releaseDevHandle(devIdx);
       return (ERROR_USB_BULK_WRITE_FAILED);
     }
 
@@ -4927,6 +4984,7 @@ AIO_Usb_DIO_StreamFrame(unsigned long   devIdx,
                                       &writeClk);
 
   ret = libusb_release_interface(handle,0); 
+  releaseDevHandle(devIdx);
   if (ret < 0)
   {
     debug("DBG>> AIO_Usb_DIO_StremFrame : usb_release_interface failed 0x%0x \n",(unsigned int)devIdx);
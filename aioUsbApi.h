@@ -229,6 +229,7 @@
 #define USB_DIO_16			0x800F
 
 #define MAX_USB_DEVICES 		32
+#define MAX_DEV_INDEX 			256	// device indices are positions in the libusb device list
 
 
 #define BYTES_PER_READ			512	
@@ -260,7 +261,8 @@ void *waitForReads(void *arg);
 
 typedef struct
 {
-  struct libusb_device_handle *devHandle;
+  struct libusb_device_handle *devHandle;   // shared open handle, see getDevHandle
+  int                          handleRefCount;
   struct libusb_device        *device;
 
   unsigned long  devIdx;
@@ -327,6 +329,9 @@ AIO_Usb_ListDevices();
 struct libusb_device_handle *
 getDevHandle(int devIdx);
 
+void
+releaseDevHandle(int devIdx);
+
 int
 AIO_UsbValidateDeviceIndex(int  devIdx); 
 
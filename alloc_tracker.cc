@@ -0,0 +1,176 @@
+//
+//  alloc_tracker.cc
+//  allocation hooks of the real-time regions, compiled only with -DALLOC_TRACKING (see alloc_tracker.h)
+//
+//  The hooks must not allocate themselves: the statistics are a fixed table, and the reports are formatted
+//  with snprintf into a buffer on the stack and written to stderr with write().
+//
+
+#ifdef ALLOC_TRACKING
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <new>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "alloc_tracker.h"
+
+const unsigned int MAX_REPORTS = 10; ///< allocations printed per region, the others are only counted
+
+static rt_region_stats regions[MAX_RT_REGIONS];
+static unsigned int nb_regions = 0;
+static pthread_mutex_t regions_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread unsigned long thread_allocations = 0;
+static __thread int current_region = -1;
+
+
+// =============================================================================
+// counts an allocation of the calling thread, and adds it to its region
+static void count_allocation(size_t size){
+  thread_allocations++;
+  int r = current_region;
+  if (r < 0){
+    return;
+  }
+  unsigned long n = __sync_add_and_fetch(&regions[r].allocations, 1);
+  __sync_add_and_fetch(&regions[r].bytes, size);
+  if (n <= MAX_REPORTS){
+    char message[128];
+    int length = snprintf(message, sizeof(message), "ALLOC in real-time region %s: %lu bytes (allocation %lu)\n", regions[r].name, (unsigned long)size, n);
+    if (write(STDERR_FILENO, message, length) < 0){
+      // nothing to do, the allocation is counted anyway
+    }
+  }
+}
+
+// =============================================================================
+// index of the region, registered by its first entry. The regions are only appended and published by nb_regions,
+// so the regions already registered are found without the mutex, which only serializes the registrations
+static int find_region(const char* name){
+  unsigned int n = __atomic_load_n(&nb_regions, __ATOMIC_ACQUIRE);
+  for (unsigned int i(0); i < n; i++){
+    if (regions[i].name == name || strcmp(regions[i].name, name) == 0){
+      return i;
+    }
+  }
+  pthread_mutex_lock(&regions_mutex);
+  int r (-1);
+  for (unsigned int i(n); i < nb_regions && r < 0; i++){
+    if (strcmp(regions[i].name, name) == 0){
+      r = i;
+    }
+  }
+  if (r < 0 && nb_regions < MAX_RT_REGIONS){
+    r = nb_regions;
+    regions[r].name = name;
+    __atomic_store_n(&nb_regions, nb_regions + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&regions_mutex);
+  return r;
+}
+
+// =============================================================================
+rt_region::rt_region(const char* name){
+  int r = find_region(name);
+  if (r >= 0){
+    __sync_add_and_fetch(&regions[r].entries, 1);
+  }
+  previous = current_region;
+  current_region = r;
+}
+
+// =============================================================================
+rt_region::~rt_region(){
+  current_region = previous;
+}
+
+// =============================================================================
+unsigned long rt_region::get_thread_allocations(){
+  return thread_allocations;
+}
+
+// =============================================================================
+unsigned int rt_region::get_stats(rt_region_stats* stats, unsigned int max){
+  unsigned int n = __atomic_load_n(&nb_regions, __ATOMIC_ACQUIRE);
+  n = (n < max) ? n : max;
+  memcpy(stats, regions, n * sizeof(rt_region_stats));
+  return n;
+}
+
+
+// =============================================================================
+//            HOOKS
+// =============================================================================
+
+#ifdef __GLIBC__
+// the C library allocations are counted too (strdup, libusb...), operator new goes through malloc
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+
+void* malloc(size_t size){
+  count_allocation(size);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size){
+  count_allocation(n * size);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void* p, size_t size){
+  count_allocation(size);
+  return __libc_realloc(p, size);
+}
+}
+#endif
+
+// =============================================================================
+void* operator new(size_t size){
+#ifndef __GLIBC__
+  count_allocation(size);
+#endif
+  void* p = malloc(size ? size : 1);
+  if (p == NULL){
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size){
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept{
+#ifndef __GLIBC__
+  count_allocation(size);
+#endif
+  return malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& nt) noexcept{
+  return operator new(size, nt);
+}
+
+void operator delete(void* p) noexcept{
+  free(p);
+}
+
+void operator delete[](void* p) noexcept{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept{
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept{
+  free(p);
+}
+
+#endif // ALLOC_TRACKING
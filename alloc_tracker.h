@@ -0,0 +1,78 @@
+//
+//  alloc_tracker.h
+//  allocations in the real-time regions of the valve controller, counted when it is built with -DALLOC_TRACKING (make alloc-check)
+//
+//  After startup, the pulse path of the executor and the trigger threads must not allocate: an allocation can wait
+//  for a lock of the allocator or fault in a new page. The regions are marked with a scoped object:
+//
+//    {
+//      rt_region region("pulse");
+//      ...
+//    }
+//
+//  With ALLOC_TRACKING, the global operator new and malloc/calloc/realloc count the allocations of each thread,
+//  and every allocation made inside a region is added to the statistics of the region (the first ones are printed).
+//  A region is registered by its first entry, the later entries find it without taking a lock.
+//  Without ALLOC_TRACKING, rt_region is empty and nothing is hooked.
+//
+
+#ifndef __alloc_tracker_h
+#define __alloc_tracker_h
+
+#include <cstddef>
+
+const unsigned int MAX_RT_REGIONS = 16;
+
+/// allocations counted in a real-time region
+struct rt_region_stats{
+  const char* name;
+  unsigned long entries;      ///< times the region was entered
+  unsigned long allocations;  ///< allocations made inside the region, by any thread
+  unsigned long bytes;
+};
+
+#ifdef ALLOC_TRACKING
+
+class rt_region {
+
+public:
+  explicit rt_region(const char* name);
+  ~rt_region();
+
+  /// \return true if the allocations are counted (built with ALLOC_TRACKING)
+  static bool is_enabled(){
+    return true;
+  }
+
+  /// \return allocations made by the calling thread since it started
+  static unsigned long get_thread_allocations();
+
+  /// \brief copies the statistics of the regions entered so far
+  /// \return number of regions
+  static unsigned int get_stats(rt_region_stats* stats, unsigned int max);
+
+private:
+  int previous;  ///< region of the thread before this one, regions can be nested
+};
+
+#else
+
+class rt_region {
+
+public:
+  explicit rt_region(const char* name){}
+
+  static bool is_enabled(){
+    return false;
+  }
+  static unsigned long get_thread_allocations(){
+    return 0;
+  }
+  static unsigned int get_stats(rt_region_stats* stats, unsigned int max){
+    return 0;
+  }
+};
+
+#endif // ALLOC_TRACKING
+
+#endif
@@ -0,0 +1,475 @@
+//
+//  bench_latency.cpp
+//  end-to-end latency benchmark of the valve controller (make bench-latency): emulated triggers are driven through the
+//  code of the valve controller (poll_ITC18_trigger or connect_to_Flytracker, and execute_config_instructions),
+//  with the USB-DIO-96 emulator (dio_device.h) and a bus of mass flow controllers (mfc_emulator or real controllers)
+//
+//  usage: bench_latency -c comport [-p Igor|Flytracker] [-n pulses] [-d pulse_ms] [-u usb_latency_us]
+//                       [-e edge_p99_us] [-g log_p99_us] [-o results.json]
+//    -c  serial port of the MFC bus with controllers A (carrier, 5 SLPM), B (boost, 5 SLPM) and C (odour 1, 1 SLPM)
+//    -p  partner (default Igor): Igor triggers with an edge on port 11 of the board, Flytracker with a PULSE_QUERY
+//    -n  number of pulses (default 200), -d duration of a pulse in ms (default 2)
+//    -u  latency of the emulated USB transfers in us (default 0)
+//    -e  budget of the p99 of edge_to_frame in us, -g budget of the p99 of frame_to_log in us (default 0: no budget)
+//    -o  file of the results (default bench_latency.json)
+//
+//  edge_to_frame: from the trigger (edge written on the input port, or PULSE_QUERY sent) to the pulse frame leaving the host
+//  frame_to_log:  from the pulse frame to its line in the logfile
+//  The triggers are spaced by more than the 1 s WAIT that follows each pulse with an external trigger, so that every
+//  trigger finds the executor waiting for it: a pulse takes a little more than 1 s.
+//  The results (percentiles, mean, standard deviation and histogram with power of 2 buckets, in us) are written as JSON.
+//  Returns 1 if a p99 exceeds its budget, or if the real-time regions allocated (built with -DALLOC_TRACKING, make alloc-check).
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "valve_controller.h"
+#include "alloc_tracker.h"
+#include "netutils.h"
+#include "utils.h"
+
+using namespace std;
+
+const uint16_t TCP_PORT2 = 8125; // port used for connection between Flytracker and valve controller
+const unsigned int FRAME_TIMEOUT = 1000000; // us a frame is waited for before the benchmark is aborted
+const unsigned int WARMUP_TIMEOUT = 10000000; // us the frame of the warm-up pulse is waited for, the flows are set before the first pulse
+const unsigned int WARMUP_PULSES = 1; // first pulses are not measured, the executor only waits for the trigger once the initial instructions are done
+const unsigned int MFC_WAIT = 1000000; // us of the WAIT after a pulse followed by a pulse with an external trigger (see Configuration::extract_instructions)
+const unsigned int INTER_PULSE = MFC_WAIT + 50000; // us between the end of a pulse and the next trigger, the executor is back to waiting for the trigger
+const unsigned int NB_BUCKETS = 24; // histogram buckets [2^k, 2^(k+1)[ us
+const std::string BENCH_ALIAS = "Odour1_1V_A"; // alias of the pulses
+
+/// parameters of the thread that executes the instructions
+struct executor_param{
+  Configuration* config;
+  dio_boards* boards;
+  vector <partner_funct_param>* partner_function_table;
+  int polling_function_idx;
+  pthread_event* start_event;
+  pthread_event* trigger_event;
+  pthread_event* mfc_event;
+  MFC_param* mfc_param;
+  thread_param* param;
+  volatile bool done;
+  bool success;
+};
+
+/// parameters of the thread that watches the logfile
+struct log_watch_param{
+  string logfile;
+  volatile bool stop;
+  vector <double> pulse_lines;  ///< time at which each pulse line appeared in the logfile
+};
+
+
+// =============================================================================
+void* run_executor(void* ptr_to_param){
+  executor_param* p = (executor_param*) ptr_to_param;
+  start_thread(*p->config, "scheduler");
+  p->success = execute_config_instructions(*p->config, *p->boards, *p->partner_function_table, p->polling_function_idx,
+    *p->start_event, *p->trigger_event, *p->mfc_event, *p->mfc_param, *p->param);
+  report_threads(*p->config);
+  p->done = true;
+  return NULL;
+}
+
+// =============================================================================
+// follows the logfile and timestamps the lines of pulses: timestamp_start partner_ts ITC_ts alias duration name
+void* watch_log(void* ptr_to_param){
+  log_watch_param* p = (log_watch_param*) ptr_to_param;
+  int fd = open(p->logfile.c_str(), O_RDONLY);
+  if (fd < 0){
+    perror("Unable to open logfile");
+    return NULL;
+  }
+  string line;
+  while (!p->stop){
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0){
+      usleep(20);
+      continue;
+    }
+    double now = time_real();
+    for (ssize_t i(0); i < n; i++){
+      if (buf[i] != '\n'){
+        line += buf[i];
+        continue;
+      }
+      vector <string> words;
+      chop_line(line, words);
+      if (words.size() > 4 && words[3] == BENCH_ALIAS){
+        p->pulse_lines.push_back(now);
+      }
+      line.clear();
+    }
+  }
+  close(fd);
+  return NULL;
+}
+
+// =============================================================================
+// waits for a frame of the emulator with port 9 (odour) equal to odor, returns its timestamp or -1
+// next is the index of the first frame not checked yet, only the new frames are copied so that the mutex of the
+// emulator is not held against the executor that latches the frames
+double wait_frame(emulated_dio_device& emulator, bool odor, unsigned int timeout, unsigned long& next){
+  double start = time_monotonic();
+  emulated_dio_device::frame f;
+  while ((time_monotonic() - start) * 1000000 < timeout){
+    while (emulator.get_frame(next, f)){
+      next++;
+      if (f.board == 0 && (f.data[9] != 0) == odor){
+        return f.timestamp;
+      }
+    }
+    usleep(10);
+  }
+  return -1;
+}
+
+// =============================================================================
+// statistics of latencies in s, as a JSON object in us, returns the p99
+double write_stats(ostream& out, const string& name, vector <double> latency, double budget){
+  sort(latency.begin(), latency.end());
+  double sum (0.0);
+  double sum2 (0.0);
+  unsigned int histogram[NB_BUCKETS] = {0};
+  for (unsigned int i(0); i < latency.size(); i++){
+    double us = latency[i] * 1000000;
+    sum += us;
+    sum2 += us * us;
+    unsigned int k (0);
+    while (k + 1 < NB_BUCKETS && us >= (double)(2u << k)){
+      k++;
+    }
+    histogram[k]++;
+  }
+  unsigned int n = latency.size();
+  double mean = n ? sum / n : 0;
+  double stddev = n ? sqrt(max(0.0, sum2 / n - mean * mean)) : 0;
+  double pct[3] = {0.5, 0.99, 0.999};
+  double value[3] = {0, 0, 0};
+  for (unsigned int j(0); j < 3 && n > 0; j++){
+    unsigned int i = (unsigned int)ceil(pct[j] * n);
+    value[j] = latency[min(n, max(1u, i)) - 1] * 1000000;
+  }
+  out<<"  \""<<name<<"\": {\"count\": "<<n
+     <<", \"min_us\": "<<to_stringHP(n ? latency[0] * 1000000 : 0, 1)
+     <<", \"p50_us\": "<<to_stringHP(value[0], 1)
+     <<", \"p99_us\": "<<to_stringHP(value[1], 1)
+     <<", \"p999_us\": "<<to_stringHP(value[2], 1)
+     <<", \"max_us\": "<<to_stringHP(n ? latency[n - 1] * 1000000 : 0, 1)
+     <<", \"mean_us\": "<<to_stringHP(mean, 1)
+     <<", \"stddev_us\": "<<to_stringHP(stddev, 1)
+     <<", \"budget_p99_us\": "<<to_stringHP(budget, 1)
+     <<", \"histogram\": [";
+  for (unsigned int k(0); k < NB_BUCKETS; k++){
+    out<<(k ? ", " : "")<<"{\"lt_us\": "<<(2u << k)<<", \"count\": "<<histogram[k]<<"}";
+  }
+  out<<"]}";
+  cout<<name<<": p50 "<<to_stringHP(value[0], 1)<<" us, p99 "<<to_stringHP(value[1], 1)<<" us, p999 "<<to_stringHP(value[2], 1)
+      <<" us, max "<<to_stringHP(n ? latency[n - 1] * 1000000 : 0, 1)<<" us, stddev "<<to_stringHP(stddev, 1)<<" us"<<endl;
+  return value[1];
+}
+
+// =============================================================================
+// configuration of the benchmark: pulses of odour 1 triggered by the partner
+bool write_config(const string& filename, const string& dir, const string& comport, const string& partner, unsigned int nb_pulses, unsigned int duration){
+  ofstream f(filename.c_str());
+  if (!f.is_open()){
+    cerr<<"Unable to write configuration file "<<filename<<endl;
+    return false;
+  }
+  f<<"RIG behavior"<<endl;
+  f<<"DEVICE emulator"<<endl;
+  f<<"LOGFILE "<<dir<<"/latency.log"<<endl;
+  f<<"MFCLOG "<<dir<<"/latency_mfc.log"<<endl;
+  f<<"COMPORT "<<comport<<endl;
+  f<<"MFC A 5 C"<<endl;
+  f<<"MFC B 5 B"<<endl;
+  f<<"MFC C 1 1"<<endl;
+  f<<"PARTNER "<<partner<<endl;
+  f<<"FLIES 1"<<endl;
+  f<<"TRIGGER external"<<endl;
+  f<<"PULSEWAIT 0"<<endl;
+  f<<"FLYFLOW 2"<<endl;
+  for (unsigned int i(0); i < WARMUP_PULSES + nb_pulses; i++){
+    f<<"PULSE "<<BENCH_ALIAS<<" "<<duration<<" 0.5 bench"<<endl;
+  }
+  return true;
+}
+
+
+// =============================================================================
+//            MAIN
+// =============================================================================
+
+int main(int argc, char* argv[]){
+
+  string comport;
+  string partner ("Igor");
+  unsigned int nb_pulses (200);
+  unsigned int duration (2);
+  unsigned int usb_latency (0);
+  double edge_budget (0);
+  double log_budget (0);
+  string output ("bench_latency.json");
+  for (int i(1); i + 1 < argc; i += 2){
+    string arg = argv[i];
+    if (arg == "-c"){
+      comport = argv[i + 1];
+    }else if (arg == "-p"){
+      partner = argv[i + 1];
+    }else if (arg == "-n"){
+      nb_pulses = atoi(argv[i + 1]);
+    }else if (arg == "-d"){
+      duration = atoi(argv[i + 1]);
+    }else if (arg == "-u"){
+      usb_latency = atoi(argv[i + 1]);
+    }else if (arg == "-e"){
+      edge_budget = atof(argv[i + 1]);
+    }else if (arg == "-g"){
+      log_budget = atof(argv[i + 1]);
+    }else if (arg == "-o"){
+      output = argv[i + 1];
+    }
+  }
+  if (comport.empty() || nb_pulses == 0 || (partner != "Igor" && partner != "Flytracker")){
+    cerr<<"Usage: "<<argv[0]<<" -c comport [-p Igor|Flytracker] [-n pulses] [-d pulse_ms] [-u usb_latency_us] [-e edge_p99_us] [-g log_p99_us] [-o results.json]"<<endl;
+    return 1;
+  }
+
+  char dir_template[] = "/tmp/bench_latency.XXXXXX";
+  if (mkdtemp(dir_template) == NULL){
+    perror("Unable to create directory for the benchmark");
+    return 1;
+  }
+  string dir = dir_template;
+  string config_file = dir + "/latency.config";
+  if (!write_config(config_file, dir, comport, partner, nb_pulses, duration)){
+    return 1;
+  }
+  Configuration config;
+  if (!config.read_config_file(config_file)){
+    return 1;
+  }
+  set_realtime();
+  lock_memory();
+
+  // boards emulated in-process, as with DEVICE emulator
+  emulated_dio_device* emulator = new emulated_dio_device;
+  emulator->set_latency(usb_latency);
+  dio_boards boards;
+  boards.device = emulator;
+  boards.nb = valve_alias::get_profile().get_nb_boards();
+  pthread_mutex_init(&boards.mutex, NULL);
+  boards.connected = true;
+  boards.lost_since = 0.0;
+  boards.restored_at = 0.0;
+  if (!boards.device->open(boards.nb)){
+    return 1;
+  }
+  for (unsigned int b(0); b < boards.nb; b++){
+    default_frame(b, boards.shadow[b]);
+    boards.device->configure(b, boards.shadow[b]);
+  }
+
+  // threads of the valve controller, as started by its main
+  pthread_t thread;
+  pthread_event mfc_event;
+  MFC_param mfc_param;
+  mfc_param.event = &mfc_event;
+  mfc_param.stop = false;
+  mfc_param.ptr_to_config = &config;
+  mfc_param.stream = NULL;
+  pthread_mutex_init(&mfc_param.mutex, NULL);
+  pthread_create(&thread, NULL, collect_flow_data, &mfc_param);
+  pthread_detach(thread);
+
+  usb_monitor_param usb_param;
+  usb_param.boards = &boards;
+  usb_param.ptr_config = &config;
+  usb_param.stop = false;
+  pthread_create(&thread, NULL, usb_monitor, &usb_param);
+  pthread_detach(thread);
+
+  pthread_event start_event;
+  pthread_event trigger_event;
+  thread_param param;
+  param.stop = false;
+  pthread_mutex_init(&param.mutex, NULL);
+  param.event = &start_event;
+  param.ptr_config = &config;
+  param.partner_timestamp = -1.0;
+  param.partner_clock_time = -1.0;
+  param.partner_clock_error = 0.0;
+  param.query_received = 0.0;
+  param.boards = NULL;
+
+  vector <partner_funct_param> partner_function_table;
+  int polling_function_idx (-1);
+  poll_param polling_param;
+  int s (-1);
+  if (partner == "Igor"){
+    polling_param.ITC18_timestamp = 0.0;
+    polling_param.triggered = false;
+    polling_param.stop = false;
+    pthread_mutex_init(&polling_param.mutex, NULL);
+    pthread_mutex_init(&polling_param.mutex_data, NULL);
+    polling_param.boards = &boards;
+    polling_param.events = &param.events;
+    polling_param.ptr_config = &config;
+    polling_param.event = &trigger_event;
+    partner_funct_param igor;
+    igor.ptr_to_partner_function = poll_ITC18_trigger;
+    igor.ptr_to_partner_param = &polling_param;
+    partner_function_table.push_back(igor);
+    polling_function_idx = 0;
+    pthread_create(&thread, NULL, poll_ITC18_trigger, &polling_param);
+    pthread_detach(thread);
+  }else{
+    pthread_create(&thread, NULL, connect_to_Flytracker, &param);
+    pthread_detach(thread);
+    // connect as the Flytracker, with a start delay of 0
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TCP_PORT2);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (unsigned int attempt(0); attempt < 100 && s < 0; attempt++){
+      s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+      if (connect(s, (sockaddr*)&addr, sizeof(addr)) < 0){
+        close(s);
+        s = -1;
+        usleep(10000);
+      }
+    }
+    uint32_t start_delay (0);
+    if (s < 0 || send(s, &start_delay, sizeof(start_delay), 0) != sizeof(start_delay)){
+      cerr<<"Unable to connect to the valve controller as Flytracker."<<endl;
+      return 1;
+    }
+    disable_nagle(s);
+    start_event.wait();
+  }
+  mfc_event.signal();
+
+  log_watch_param log_param;
+  log_param.logfile = config.get_logfile();
+  log_param.stop = false;
+  pthread_t log_thread;
+  pthread_create(&log_thread, NULL, watch_log, &log_param);
+
+  executor_param exec;
+  exec.config = &config;
+  exec.boards = &boards;
+  exec.partner_function_table = &partner_function_table;
+  exec.polling_function_idx = polling_function_idx;
+  exec.start_event = &start_event;
+  exec.trigger_event = &trigger_event;
+  exec.mfc_event = &mfc_event;
+  exec.mfc_param = &mfc_param;
+  exec.param = &param;
+  exec.done = false;
+  exec.success = false;
+  pthread_t exec_thread;
+  pthread_create(&exec_thread, NULL, run_executor, &exec);
+
+  // one trigger per pulse, the next trigger is given once the interval frame is written
+  vector <double> edge_to_frame;
+  vector <double> frame_times;
+  usleep(100000);
+  for (unsigned int i(0); i < WARMUP_PULSES + nb_pulses && !exec.done; i++){
+    emulator->clear_frames();
+    unsigned long next (0);
+    double edge = time_real();
+    if (partner == "Igor"){
+      emulator->set_inputs(0, 0, 1);
+    }else{
+      bool confirmed (false);
+      if (send(s, &PULSE_QUERY, sizeof(PULSE_QUERY), 0) != sizeof(PULSE_QUERY) || block_recv(s, 1000, &confirmed, sizeof(confirmed)) != sizeof(confirmed)
+          || send(s, &edge, sizeof(edge), 0) != sizeof(edge)){
+        cerr<<"PULSE_QUERY failed."<<endl;
+        break;
+      }
+    }
+    double frame = wait_frame(*emulator, true, i < WARMUP_PULSES ? WARMUP_TIMEOUT : FRAME_TIMEOUT, next);
+    if (frame < 0){
+      cerr<<"No frame for pulse "<<i<<"."<<endl;
+      break;
+    }
+    if (i >= WARMUP_PULSES){
+      edge_to_frame.push_back(frame - edge);
+    }
+    frame_times.push_back(frame);
+    if (wait_frame(*emulator, false, FRAME_TIMEOUT, next) < 0){
+      cerr<<"No interval frame after pulse "<<i<<"."<<endl;
+      break;
+    }
+    if (partner == "Igor"){
+      emulator->set_inputs(0, 0, 0);
+    }
+    usleep(INTER_PULSE);
+  }
+  pthread_join(exec_thread, NULL);
+  usleep(100000);
+  log_param.stop = true;
+  pthread_join(log_thread, NULL);
+
+  vector <double> frame_to_log;
+  for (unsigned int i(WARMUP_PULSES); i < frame_times.size() && i < log_param.pulse_lines.size(); i++){
+    frame_to_log.push_back(log_param.pulse_lines[i] - frame_times[i]);
+  }
+
+  ofstream out(output.c_str());
+  out<<"{"<<endl;
+  out<<"  \"partner\": \""<<partner<<"\", \"pulses\": "<<nb_pulses<<", \"pulse_ms\": "<<duration<<", \"usb_latency_us\": "<<usb_latency<<","<<endl;
+  double edge_p99 = write_stats(out, "edge_to_frame", edge_to_frame, edge_budget);
+  out<<","<<endl;
+  double log_p99 = write_stats(out, "frame_to_log", frame_to_log, log_budget);
+  // allocations in the real-time regions of the executor and trigger threads
+  rt_region_stats regions[MAX_RT_REGIONS];
+  unsigned int nb_regions = rt_region::get_stats(regions, MAX_RT_REGIONS);
+  unsigned long rt_allocations (0);
+  out<<","<<endl<<"  \"alloc_tracking\": "<<(rt_region::is_enabled() ? "true" : "false")<<", \"rt_regions\": [";
+  for (unsigned int i(0); i < nb_regions; i++){
+    out<<(i ? ", " : "")<<"{\"name\": \""<<regions[i].name<<"\", \"entries\": "<<regions[i].entries
+       <<", \"allocations\": "<<regions[i].allocations<<", \"bytes\": "<<regions[i].bytes<<"}";
+    cout<<"real-time region "<<regions[i].name<<": "<<regions[i].entries<<" entries, "<<regions[i].allocations<<" allocations"<<endl;
+    rt_allocations += regions[i].allocations;
+  }
+  out<<"]";
+  bool passed = exec.success && edge_to_frame.size() == nb_pulses && frame_to_log.size() == nb_pulses
+    && (edge_budget <= 0 || edge_p99 <= edge_budget) && (log_budget <= 0 || log_p99 <= log_budget) && rt_allocations == 0;
+  out<<","<<endl<<"  \"passed\": "<<(passed ? "true" : "false")<<endl<<"}"<<endl;
+  out.close();
+  cout<<"Results written to "<<output<<endl;
+
+  if (!passed){
+    cerr<<"Latency benchmark failed";
+    if (edge_budget > 0 && edge_p99 > edge_budget){
+      cerr<<", edge_to_frame p99 "<<to_stringHP(edge_p99, 1)<<" us > "<<edge_budget<<" us";
+    }
+    if (log_budget > 0 && log_p99 > log_budget){
+      cerr<<", frame_to_log p99 "<<to_stringHP(log_p99, 1)<<" us > "<<log_budget<<" us";
+    }
+    if (rt_allocations > 0){
+      cerr<<", "<<rt_allocations<<" allocations in real-time regions";
+    }
+    cerr<<"."<<endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+//
+//  clock_sync.cc
+//  offset and drift between the clock of a partner and the clock of the valve controller (see clock_sync.h)
+//
+
+#include "clock_sync.h"
+
+
+// =============================================================================
+clock_sync::clock_sync(){
+  reset();
+}
+
+// =============================================================================
+void clock_sync::reset(){
+  next = 0;
+  exchanges = 0;
+  best.time = 0.0;
+  best.offset = 0.0;
+  best.round_trip = 0.0;
+  drift = 0.0;
+}
+
+// =============================================================================
+bool clock_sync::add(double t1, double t2, double t3, double t4){
+  double round_trip = (t4 - t1) - (t3 - t2);
+  if (t1 <= 0 || t4 < t1 || t3 < t2 || round_trip < 0){
+    return false;
+  }
+  exchange& e = window[next];
+  e.time = (t2 + t3) / 2;
+  e.offset = ((t2 - t1) + (t3 - t4)) / 2;
+  e.round_trip = round_trip;
+  next = (next + 1) % CLOCK_WINDOW;
+  exchanges++;
+  estimate();
+  return true;
+}
+
+// =============================================================================
+// shortest exchange of the window, and of each half of it for the drift
+void clock_sync::estimate(){
+  unsigned int n = (exchanges < CLOCK_WINDOW) ? exchanges : CLOCK_WINDOW;
+  unsigned int oldest = (next + CLOCK_WINDOW - n) % CLOCK_WINDOW;
+  const exchange* older = &window[oldest];
+  const exchange* newer = &window[(next + CLOCK_WINDOW - 1) % CLOCK_WINDOW];
+  for (unsigned int k(0); k < n; k++){
+    const exchange& e = window[(oldest + k) % CLOCK_WINDOW];
+    if (k < n / 2 && e.round_trip < older->round_trip){
+      older = &e;
+    }else if (k >= n / 2 && e.round_trip < newer->round_trip){
+      newer = &e;
+    }
+  }
+  best = (older->round_trip < newer->round_trip) ? *older : *newer;
+  if (newer->time - older->time >= CLOCK_DRIFT_SPAN){
+    drift = (newer->offset - older->offset) / (newer->time - older->time);
+  }
+}
+
+// =============================================================================
+bool clock_sync::is_valid(){
+  return exchanges > 0;
+}
+
+// =============================================================================
+double clock_sync::to_controller(double partner_time){
+  double approx = partner_time + best.offset;
+  return approx + drift * (approx - best.time);
+}
+
+// =============================================================================
+double clock_sync::get_offset(){
+  return best.offset;
+}
+
+// =============================================================================
+double clock_sync::get_drift(){
+  return drift;
+}
+
+// =============================================================================
+double clock_sync::get_error(){
+  return best.round_trip / 2;
+}
+
+// =============================================================================
+unsigned long clock_sync::get_exchanges(){
+  return exchanges;
+}
@@ -0,0 +1,68 @@
+//
+//  clock_sync.h
+//  offset and drift between the clock of a partner and the clock of the valve controller (PING_QUERY, see data_format.h)
+//
+//  An exchange gives four times: t1 the partner sends the ping, t2 the valve controller receives it, t3 the valve
+//  controller answers, t4 the partner receives the answer. As with NTP, the offset of the controller clock is
+//  ((t2 - t1) + (t3 - t4)) / 2 and the round trip of the link is (t4 - t1) - (t3 - t2); the offset is exact if the
+//  link takes as long both ways, and wrong by at most half the round trip otherwise. A round trip lengthened by the
+//  scheduling of one side does not bias the estimate: the offset is the one of the exchange with the shortest round
+//  trip among the last CLOCK_WINDOW, and its half round trip is the uncertainty. The drift is the slope between the
+//  shortest exchange of the older half of the window and the one of the newer half, once they are CLOCK_DRIFT_SPAN apart.
+//
+//  Both sides can keep an estimate: the valve controller gets t4 with the next ping, the partner has the four times
+//  as soon as the answer arrives.
+//
+
+#ifndef __clock_sync_h
+#define __clock_sync_h
+
+const unsigned int CLOCK_WINDOW = 64;  ///< exchanges kept for the estimate
+const double CLOCK_DRIFT_SPAN = 20.0;  ///< s, shortest time between the two exchanges of the drift
+
+class clock_sync {
+
+public:
+  clock_sync();
+
+  /// \brief forgets the exchanges, for a new partner
+  void reset();
+
+  /// \brief adds an exchange, t1 and t4 with the clock of the partner, t2 and t3 with the clock of the controller
+  /// \return false if the times are not consistent (the exchange is ignored)
+  bool add(double t1, double t2, double t3, double t4);
+
+  /// \return true once an exchange was added
+  bool is_valid();
+
+  /// \return time of the controller clock at partner_time of the partner clock
+  double to_controller(double partner_time);
+
+  /// \return controller time - partner time, in s, at the shortest exchange
+  double get_offset();
+
+  /// \return change of the offset per second of the controller clock
+  double get_drift();
+
+  /// \return s, largest error of the offset: half the shortest round trip
+  double get_error();
+
+  /// \return exchanges added since reset
+  unsigned long get_exchanges();
+
+private:
+  void estimate();
+
+  struct exchange{
+    double time;  ///< controller time of the exchange, between t2 and t3
+    double offset;
+    double round_trip;
+  };
+  exchange window[CLOCK_WINDOW];  ///< the last exchanges, the newest at (next + CLOCK_WINDOW - 1) % CLOCK_WINDOW
+  unsigned int next;
+  unsigned long exchanges;
+  exchange best;  ///< shortest round trip of the window
+  double drift;
+};
+
+#endif
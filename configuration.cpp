@@ -8,6 +8,8 @@
 // ! the extract_instruction code assumes there are 5 flow types only: 1,2,3,B,C If more exist, need to adjust code!
 
 
+#include <climits> // NAME_MAX
+
 #include "configuration.h"
 
 
@@ -18,10 +20,23 @@ const unsigned int MAX_PULSE = 4294967; // maximum pulse length in ms
 //MAX_LENGTH = 63; ///< maximum length of strings for odor name, defined in data_format.h
 const unsigned int NBMFC = 1; ///< total number of flow controller that are needed
 //const unsigned int PULSE_WAIT = 4 ; // nb of seconds to wait after pulse
-const unsigned int MAX_FLIES = 15; // maximum nb of flies that can be exposed to the airflow at the same time
 
 static std::vector <char> FLOW_TYPE = make_vector<char>() <<'1'<<'2'<<'3'<<'C'<<'B';
 
+// frees the information attached to an instruction
+static void free_instruction(instruct& istr){
+  if (istr.etype=="MFCSET"){
+    delete (flowchange*)istr.einfo;
+  }else if (istr.etype=="MFCSET2"){
+    delete (double_flowchange*)istr.einfo;
+  }else if(istr.etype=="PULSE"){
+    delete (pulse*)istr.einfo;
+  }else if (istr.etype== "WAIT" || istr.etype== "WAITSTOP"){
+    delete (double*)istr.einfo; 
+  }
+  istr.einfo = NULL;
+}
+
 static void write_data(ofstream& g, flow_data& flow, const double timestamp){
 	g<<flow.ID<<",";
 	g.precision(11);
@@ -42,19 +57,35 @@ Configuration::Configuration(){
   partner = "";
   logfile = "";
   trigger = "internal";
+  device = "usb";
+  for (unsigned int i(0); i < NB_RT_THREADS; i++){
+    thread_policies[i].set = false;
+    thread_policies[i].policy = 0;
+    thread_policies[i].priority = 0;
+  }
   config_filename = "";
   comport_name="";
   comport_handle=-1;
   mfclogfile="";
+  shmstream="";
+  flow_threshold = -1.0;
+  fast_trigger = false;
+  rig_defaulted = false;
   nb_mfc = 0;
   nb_events = 0;
   totalflow = 0.0;
   pulsewait = MAX_DELAY;
+  pulsegrid = 0.0;
   max_air_flow = 0.0;
   flies = 0;
   waitstop_event = false;
+  tail_totflow = 0.0;
+  table_closed = false;
   pthread_mutex_init(&mutex_MFC_com, NULL);
   pthread_mutex_init(&MFC_data_mutex, NULL);
+  pthread_mutex_init(&instructions_mutex, NULL);
+  pthread_mutex_init(&append_mutex, NULL);
+  pthread_mutex_init(&log_mutex, NULL);
 
 }
 
@@ -62,20 +93,43 @@ Configuration::Configuration(){
 Configuration::~Configuration(){
   //delete events from event_table
   for (unsigned int i(0); i < instructions.size(); i++){
-    if (instructions[i].etype=="MFCSET"){
-      delete (flowchange*)instructions[i].einfo;
-    }else if(instructions[i].etype=="PULSE"){
-      delete (pulse*)instructions[i].einfo;
-    }else if (instructions[i].etype== "WAIT"){
-      delete (double*)instructions[i].einfo; 
-    }
+    free_instruction(instructions[i]);
   }
 
   pthread_mutex_destroy(&mutex_MFC_com);
   pthread_mutex_destroy(&MFC_data_mutex);
+  pthread_mutex_destroy(&instructions_mutex);
+  pthread_mutex_destroy(&append_mutex);
+  pthread_mutex_destroy(&log_mutex);
   g.close();
 }
 
+// =============================================================================
+string Configuration::get_shmstream(){
+  return shmstream;
+}
+
+// =============================================================================
+double Configuration::get_flow_threshold(){
+  return (flow_threshold < 0) ? 0.0 : flow_threshold;
+}
+
+// =============================================================================
+// configuration files without RIG (written before the rig profiles) get the rig of the build, with a warning
+bool Configuration::use_default_rig(){
+  if (valve_alias::get_profile().is_loaded()){
+    return true;
+  }
+  cerr<<"Warning: no RIG specified before the first line that needs it, the rig "<<DEFAULT_RIG<<" of the build is used."<<endl;
+  rig_defaulted = true;
+  return valve_alias::load_profile(DEFAULT_RIG);
+}
+
+// =============================================================================
+bool Configuration::get_fast_trigger(){
+  return fast_trigger;
+}
+
 // =============================================================================
 string Configuration::get_partner(){
   return partner;
@@ -83,7 +137,10 @@ string Configuration::get_partner(){
 
 // =============================================================================
 unsigned int Configuration::get_nb_pulses(){
-  return nb_pulses;
+  pthread_mutex_lock(&instructions_mutex);
+  unsigned int n = nb_pulses;
+  pthread_mutex_unlock(&instructions_mutex);
+  return n;
 }
 
 //=============================================================================
@@ -117,7 +174,16 @@ string Configuration::get_comport_name(){
 
 // =============================================================================
 void Configuration::log(string message){
+  pthread_mutex_lock(&log_mutex);
   g<<message<<endl;
+  pthread_mutex_unlock(&log_mutex);
+}
+
+// =============================================================================
+void Configuration::log(const char* message){
+  pthread_mutex_lock(&log_mutex);
+  g<<message<<endl;
+  pthread_mutex_unlock(&log_mutex);
 }
 
 
@@ -126,11 +192,26 @@ std::string Configuration::get_trigger(){
   return trigger;
 }
 
+// =============================================================================
+std::string Configuration::get_device(){
+  return device;
+}
+
+// =============================================================================
+const thread_policy& Configuration::get_thread_policy(unsigned int idx){
+  return thread_policies[idx];
+}
+
 // =============================================================================
 double Configuration::get_pulsewait(){
     return pulsewait;
 }
 
+// =============================================================================
+double Configuration::get_pulsegrid(){
+  return pulsegrid;
+}
+
 
 
 // =============================================================================
@@ -157,6 +238,11 @@ bool Configuration::get_interval_pulse(pulse& p){
   return false;
 }
 
+// =============================================================================
+string Configuration::get_logfile(){
+  return logfile;
+}
+
 // =============================================================================
 string Configuration::get_mfclog(){
   return mfclogfile;
@@ -164,16 +250,23 @@ string Configuration::get_mfclog(){
 
 // =============================================================================
 int Configuration::get_nb_instructions(){
-  return instructions.size();
+  pthread_mutex_lock(&instructions_mutex);
+  int n = instructions.size();
+  pthread_mutex_unlock(&instructions_mutex);
+  return n;
 }
 
 //=============================================================================
+// instructions can be appended by the socket thread while the main thread executes them, hence the mutex
 bool Configuration::get_instruction(unsigned int idx, instruct& command) {
-  if (idx >= 0 && idx < instructions.size()){
+  bool found (false);
+  pthread_mutex_lock(&instructions_mutex);
+  if (idx < instructions.size()){
     command = instructions[idx];
-    return true;
+    found = true;
   }
-  return false;
+  pthread_mutex_unlock(&instructions_mutex);
+  return found;
 }
 
 
@@ -227,11 +320,18 @@ void Configuration::init_MFC_data(){
     pthread_mutex_unlock(&MFC_data_mutex);
     ctr++;
   }
+  pthread_mutex_lock(&MFC_data_mutex);
+  MFC_published.write(MFC_data);
+  pthread_mutex_unlock(&MFC_data_mutex);
 }
 
 // =============================================================================
 void Configuration::log_flow_data(ofstream& g1){
   int ctr (0);
+  // the sample of all the MFCs is published at once
+  double sample_time (0.0);
+  double values[MAX_MFC];
+  char names[MAX_MFC];
   for (std::map <char, FlowController>::iterator iter = mfc_map.begin(); iter != mfc_map.end(); iter++){
     flow_data tmp;
     pthread_mutex_lock(&mutex_MFC_com);
@@ -248,83 +348,109 @@ void Configuration::log_flow_data(ofstream& g1){
     //  tmp.mass_flow;
     //}
 
-    pthread_mutex_lock(&MFC_data_mutex);
-    MFC_data.timestamp = timestamp;
-    MFC_data.names[ctr] = iter->first;
-    MFC_data.values[ctr] = tmp.mass_flow;
-    pthread_mutex_unlock(&MFC_data_mutex);
-    ctr++;
+    if (ctr < MAX_MFC){
+      sample_time = timestamp;
+      names[ctr] = iter->first;
+      values[ctr] = tmp.mass_flow;
+      ctr++;
+    }
+  }
+  if (ctr == 0){
+    return;
   }
+  pthread_mutex_lock(&MFC_data_mutex);
+  MFC_data.timestamp = sample_time;
+  memcpy(MFC_data.names, names, ctr * sizeof(names[0]));
+  memcpy(MFC_data.values, values, ctr * sizeof(values[0]));
+  MFC_published.write(MFC_data);
+  pthread_mutex_unlock(&MFC_data_mutex);
 }
 
 // =============================================================================
 void Configuration::convert_pulse_to_flowtypes(const string& pulse_type, std::vector <char>& flow_types_valid){
-  if (pulse_type == "Carrier"){
-    flow_types_valid.push_back('C'); // carrier air
-    flow_types_valid.push_back('B'); // boost air
-  }else{
-    flow_types_valid.push_back('C'); // carrier air
-    // find out which other flow goes to flies -> alias are of type Odor1_ Odor_2 Odor3_ Control1_ Control2_ Control3_ Blend12
-    // determine types based on properties of alias
-    if (pulse_type[0]=='C'){ // Control 1 or Control 2 or Control 3
-      flow_types_valid.push_back(pulse_type[7]);
-    }else if(pulse_type[0]=='O'){ // Odor 1 or Odor 2 or Odor 3
-      flow_types_valid.push_back(pulse_type[4]);
-    }else if(pulse_type[0]=='B'){ // Blend12, Blend23, Blend 13 or Blend123
-      flow_types_valid.push_back(pulse_type[5]);
-      flow_types_valid.push_back(pulse_type[6]);
-      if (pulse_type[7]=='3'){
-        flow_types_valid.push_back(pulse_type[7]);
-      }
-    }else{
-      cerr<<"There had been an error. Please quit program."<<endl;
-    }
+  // flows that go to the flies are precomputed with the alias in the rig profile
+  const alias_entry* entry = valve_alias::lookup(pulse_type);
+  if (entry == NULL){
+    cerr<<"There had been an error. Please quit program."<<endl;
+    return;
   }
+  flow_types_valid = flow_types_from_bits(entry->flow_types);
 }
 
 // =============================================================================
 void Configuration::update_flow_destination(const string& pulse_type){
  
+  // flows that go to the flies are precomputed with the alias, the set of bits is used directly so that nothing is allocated during a pulse
+  const alias_entry* entry = valve_alias::lookup(pulse_type);
+  if (entry == NULL){
+    cerr<<"There had been an error. Please quit program."<<endl;
+    return;
+  }
+  update_flow_destination(entry->flow_types);
+}
+
+// =============================================================================
+void Configuration::update_flow_destination(uint8_t flow_types){
+
   // set validity to false for every flow
   bool tmp_validity[MAX_MFC]; 
   memset(&tmp_validity,0,sizeof(tmp_validity));
 
-  vector <char> flow_types_valid;
-  flow_types_valid.resize(0);
-  convert_pulse_to_flowtypes(pulse_type, flow_types_valid);
-  //cout<<"size filled: "<<flow_types_valid.size()<<endl;
-
-  // for each flow type in map, indicate that flow should be set to true 
-  for (unsigned int i(0); i < flow_types_valid.size(); i++){
-    for (unsigned int j(0); j < MAX_MFC; j++){
-      if (flow_types_valid[i] == MFC_data.flow_type[j]){
-        tmp_validity[j]=true;
-      } 
+  // for each flow type of the alias, indicate that flow should be set to true 
+  for (unsigned int j(0); j < MAX_MFC; j++){
+    if (flow_type_bit(MFC_data.flow_type[j]) & flow_types){
+      tmp_validity[j]=true;
     }
   }
 
   pthread_mutex_lock(&MFC_data_mutex);
   memcpy(&MFC_data.validity, &tmp_validity, sizeof(MFC_data.validity));
+  MFC_published.write(MFC_data);
   pthread_mutex_unlock(&MFC_data_mutex);
   
 }
 
+// =============================================================================
+bool Configuration::is_flow_to_flies(char ID, const string& pulse_type){
+  map <char, FlowController>::iterator it = mfc_map.find(ID);
+  const alias_entry* entry = valve_alias::lookup(pulse_type);
+  if (it == mfc_map.end() || entry == NULL){
+    // unknown MFC or alias, considered as going to the flies
+    return true;
+  }
+  return (flow_type_bit(it->second.get_flowtype()) & entry->flow_types) != 0;
+}
+
 // =============================================================================
 MFC_flows Configuration::get_MFC_data(){
   MFC_flows tmp;
-  pthread_mutex_lock(&MFC_data_mutex);
-  tmp = MFC_data;
-  pthread_mutex_unlock(&MFC_data_mutex);
+  MFC_published.read(tmp);
   return tmp;
 }
 
+// =============================================================================
+MFC_flows Configuration::get_MFC_data(uint64_t& generation){
+  MFC_flows tmp;
+  generation = MFC_published.read(tmp);
+  return tmp;
+}
+
+// =============================================================================
+uint64_t Configuration::get_MFC_generation(){
+  return MFC_published.get_generation();
+}
+
 
 // =============================================================================
 void Configuration::set_interval_pulse(double interval){
   interval_pulse.odor_alias ="Carrier";
   interval_pulse.duration = interval;
   interval_pulse.name = "Carrier_air";
-  interval_pulse.valve_blocks = valve_alias::parse_alias(interval_pulse.odor_alias);
+  const alias_entry* entry = valve_alias::lookup(interval_pulse.odor_alias);
+  if (entry != NULL){
+    interval_pulse.valve_blocks = entry->valves;
+    interval_pulse.mask = entry->mask;
+  }
 }
 
 
@@ -399,6 +525,53 @@ bool Configuration::read_config_file(string filename){
               cerr<<"Warning: in line "<<s<<endl<<" parameters after word "<< mfclogfile<< " are ignored."<<endl;
             }
             
+          }else if (word_table[0] == "RIG"){
+            if (rig_defaulted){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The rig needs to be specified before INTERVAL, ARENA, TRIGGER and the pulses, the rig "<<DEFAULT_RIG<<" of the build is already in use."<<endl;
+              return false;
+            }
+            if (valve_alias::get_profile().is_loaded()){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The rig has already been specified. You cannot specify it twice."<<endl;
+              return false;
+            }
+            if (!valve_alias::load_profile(word_table[1])){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              return false;
+            }
+
+          }else if (word_table[0] == "DEVICE"){
+            device = word_table[1];
+            if (device != "usb" && device != "emulator"){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The device is unknown (usb or emulator)."<<endl;
+              return false;
+            }
+            if (nb_words >2){
+              cerr<<"Warning: in line "<<s<<endl<<" parameters after word "<< device<< " are ignored."<<endl;
+            }
+
+          }else if (word_table[0] == "THREAD"){
+            int idx = rt_thread_index(nb_words > 1 ? word_table[1] : "");
+            if (idx < 0){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The thread is unknown (trigger, scheduler, usb, serial, network, setpoint or logger)."<<endl;
+              return false;
+            }
+            if (thread_policies[idx].set){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The policy of thread "<<word_table[1]<<" has already been specified."<<endl;
+              return false;
+            }
+            if (!parse_thread_policy(word_table, 2, thread_policies[idx])){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              return false;
+            }
+            if (nb_words > 5){
+              cerr<<"Warning: in line "<<s<<endl<<" parameters after the CPU list are ignored."<<endl;
+            }
+
           }else if (word_table[0] =="COMPORT"){
             comport_name = word_table[1];
             // check if comport is valid
@@ -506,6 +679,9 @@ bool Configuration::read_config_file(string filename){
             }
           
           }else if (word_table[0] == "INTERVAL"){  // duration in seconds
+            if (!use_default_rig()){
+              return false;
+            }
             if (interval > 0){
               cerr<<"The interval has already been specified. You cannot specify it twice."<<endl;
               cerr<<"Error in configuration file in line: "<<s<<endl;
@@ -541,6 +717,45 @@ bool Configuration::read_config_file(string filename){
             set_interval_pulse(corrected_interval);
             set_pulsewait(pulsewait);
           
+          }else if (word_table[0] == "PULSEGRID"){  // period in seconds
+            if (pulsegrid > 0){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The pulse grid has already been specified. You cannot specify it twice."<<endl;
+              return false;
+            }
+            pulsegrid = (nb_words > 1) ? atof(word_table[1].c_str()) : 0.0;
+            if (pulsegrid <= 0 || pulsegrid > MAX_DELAY){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The period of the pulse grid is invalid, it needs to be ]0 "<<MAX_DELAY<<"] seconds."<<endl;
+              return false;
+            }
+
+          }else if (word_table[0] == "SHMSTREAM"){  // name of the shared memory, /name
+            if (!shmstream.empty()){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The event stream has already been specified. You cannot specify it twice."<<endl;
+              return false;
+            }
+            shmstream = (nb_words > 1) ? word_table[1] : "";
+            if (shmstream.size() < 2 || shmstream.size() > NAME_MAX || shmstream[0] != '/' || shmstream.find('/', 1) != string::npos){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The name of the event stream is invalid, it needs to be /name without other slash."<<endl;
+              return false;
+            }
+
+          }else if (word_table[0] == "FLOWTHRESHOLD"){  // SLPM
+            if (flow_threshold >= 0){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The flow threshold has already been specified. You cannot specify it twice."<<endl;
+              return false;
+            }
+            flow_threshold = (nb_words > 1) ? atof(word_table[1].c_str()) : -1.0;
+            if (flow_threshold < 0){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The flow threshold is invalid, it needs to be a flow rate >= 0 SLPM."<<endl;
+              return false;
+            }
+
           }else if (word_table[0] == "FLIES"){
             if (flies != 0){
               cerr<<"Error: The number of flies has already been declared."<<endl;
@@ -554,7 +769,30 @@ bool Configuration::read_config_file(string filename){
               return false;
             }         
 
+          }else if (word_table[0] == "ARENA"){  // fly channel_offset
+            if (flies == 0 || nb_pulses > 0){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The arenas need to be specified after RIG and FLIES, and before the pulses."<<endl;
+              return false;
+            }
+            if (!use_default_rig()){
+              return false;
+            }
+            int fly = (nb_words > 2) ? atoi(word_table[1].c_str()) : -1;
+            int offset = (nb_words > 2) ? atoi(word_table[2].c_str()) : -1;
+            arena_offsets.resize(flies, -1);
+            if (fly < 0 || fly >= (int)flies || arena_offsets[fly] >= 0 || offset < 0
+                || offset >= (int)(valve_alias::get_profile().get_nb_boards() * NB_VALVE_CHANNELS)){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The arena is invalid: the fly needs to be between 0 and "<<flies - 1<<" and given once, the offset a channel of the boards of the rig."<<endl;
+              return false;
+            }
+            arena_offsets[fly] = offset;
+
           }else if (word_table[0] == "TRIGGER"){
+            if (!use_default_rig()){
+              return false;
+            }
             trigger = word_table[1];
             if (trigger != "external" && trigger != "internal"){
               cerr<<"Error in configuration file in line: "<<s<<endl;
@@ -628,6 +866,9 @@ bool Configuration::read_config_file(string filename){
 					
           // PULSE event
           }else if(word_table[0] == "PULSE"){  /// requires at least 4 words plus optional descriptor
+            if (!use_default_rig()){
+              return false;
+            }
             if (waitstop_event){
 				      cerr<<"WARNING: the event: "<<s<<" will not be executed because there is a preceeding waitstop event!"<<endl;						
 			      }
@@ -636,88 +877,11 @@ bool Configuration::read_config_file(string filename){
               return false;
             }
             
-            if (nb_words < 4){ // minimal PULSE command has 4 words plus 1 optional one
-              cerr<<"Error in configuration file in line: "<<s<<endl;
-              cerr<<"Incomplete pulse information."<<endl;
-              return false;
-            }
-            
-            string word = word_table[1];
             pulse tmp;
-            vector <int> valve_blocks = valve_alias::parse_alias(word);
-            tmp.odor_alias = word;
-            if (valve_blocks.empty()){
-              cerr<<"Error in configuration file in line: "<<s<<endl;
-              return false;
-            }
-            // determine nb of flow types for pulse (requires that MFCs have been all declared)
-            std::size_t found = word.find_first_of("123"); // find first digit in alias,: indicates flow type
-            if (found==string::npos){
-              cerr<<"Error in configuration file in line: "<<s<<endl;
-              cerr<<"Error: could not identify flow types from alias "<<word<<"."<<endl;
-              return false;
-            }
-            unsigned int nbflows(1); //expected nb of flowrates for this pulse
-            if (isdigit(word[found+1])){
-              nbflows++;
-              if (isdigit(word[found+2])){
-                nbflows++;
-              }
-            }               
-            
-            // get pulse duration (in ms)
-            unsigned int dur = atoi(word_table[2].c_str());
-            if (dur > MAX_PULSE || dur < 0){
-              cerr<<"Error in configuration file in line: "<<s<<endl;
-              cerr<<"The specified pulse duration is invalid."<<endl;
+            if (!parse_pulse(word_table, s, tmp)){
               return false;
             }
-            tmp.duration = dur;
-            tmp.valve_blocks = valve_blocks;
             
-            // get flow rates
-            if (nb_words < (3 + nbflows)){
-              cerr<<"Error in configuration file in line: "<<s<<endl;
-              cerr<<"Missing flow rates."<<endl;
-              return false;
-            }
-            // for each flow type in pulse, there should be a flowrate, however unused flowtypes are not specified
-            double summed_flow (0.0); 
-            for (unsigned int i(0); i< nbflows; i++){
-              // search MFC corresponding to flow type
-              map <char, char>::iterator iter;
-              iter = flow_MFC_LUT.find(word[found+i]);
-              if (iter == flow_MFC_LUT.end()){
-                cerr<<"Error: unable to find a MFC that controls a flow of type: "<<word[found+i]<<endl;
-                return false;
-              }
-              double flux = atof(word_table[3+i].c_str()); // flow for single fly
-              flux = flux*flies; // calculate flow for all flies
-              if (flux < 0 || flux > totalflow){
-                cerr<<"Error: the specifid flow is invalid (either because it is negative or because it is higher than the specified totalflux."<<endl;
-                return false;
-              }
-              summed_flow+= flux;
-              // add flow rate info into pulse map with ID of flow type 
-              tmp.MFC_flow[iter->first]=flux;
-            }
-            tmp.MFC_flow['B']=summed_flow;// Boost flow corresponds to summed flow rate of pulses
-            
-            // get optional description
-            if (nb_words > (3 + nbflows)){
-              tmp.name = word_table[3 + nbflows];
-              if (tmp.name.length()> MAX_LENGTH){
-                char odor[MAX_LENGTH];
-                strncpy(odor, tmp.name.c_str(), sizeof(odor));
-                odor[sizeof(odor) - 1] = 0;
-                cerr<<"Warning: "<<tmp.name<<" will be truncated to "<< (string)odor<<" when sent to a partner."<<endl;
-              }
-              // add name to map LUT (TO BE IMPLEMENTED!!!!)
-                
-              if (nb_words> (4 + nbflows)){
-                cerr<<"Warning: All characters after "<<tmp.name<<" were ignored."<<endl;
-              }
-            }
             //add event
             event ev;
             ev.etype = word_table[0];
@@ -747,6 +911,13 @@ bool Configuration::read_config_file(string filename){
             event_table.push_back(ev);
             nb_events++;
 						waitstop_event = true; 
+					}else if (word_table[0] == "FASTTRIGGER"){
+            if (fast_trigger){
+              cerr<<"Error in configuration file in line: "<<s<<endl;
+              cerr<<"The fast trigger has already been specified. You cannot specify it twice."<<endl;
+              return false;
+            }
+            fast_trigger = true;
 					}else{
           	cerr<<"Error in configuration file in line: "<<s<<endl;
           	cerr<<"Parameters are missing."<<endl;
@@ -758,6 +929,9 @@ bool Configuration::read_config_file(string filename){
   }
 
   // check that all mandatory parameters are present   
+  if (!use_default_rig()){
+    return false;
+  }
   if (comport_name == ""){
     cerr<<"Missing information in configuration file."<<endl;
     cerr<<"No serial communication port specified."<<endl;
@@ -813,10 +987,40 @@ bool Configuration::read_config_file(string filename){
     g<<"CONFIG "<<config_input[i]<<endl;
   }
 
+  if (pulsegrid > 0 && trigger != "internal"){
+    cerr<<"Error in configuration file: PULSEGRID needs TRIGGER internal, the partner decides when the pulses are given."<<endl;
+    return false;
+  }
+
+  if (fast_trigger && (partner != "Flytracker" || trigger != "external" || !arena_offsets.empty())){
+    cerr<<"Error in configuration file: FASTTRIGGER needs PARTNER Flytracker and TRIGGER external without ARENA, the network thread opens the valves of the one pulse armed by the scheduler."<<endl;
+    return false;
+  }
+
+  if (!arena_offsets.empty()){
+    if (partner != "Flytracker" || trigger != "external"){
+      cerr<<"Error in configuration file: ARENA needs PARTNER Flytracker and TRIGGER external, each fly is triggered by the partner."<<endl;
+      return false;
+    }
+    for (unsigned int i(0); i < arena_offsets.size(); i++){
+      if (arena_offsets[i] < 0){
+        cerr<<"Error in configuration file: no ARENA for fly "<<i<<", every fly needs its arena."<<endl;
+        return false;
+      }
+    }
+    // the pulses got the valves of the arenas when they were parsed, the interval air may come before the arenas
+    if (!map_arenas(interval_pulse)){
+      return false;
+    }
+  }
+
   // convert events to list of instructions for valve controller
   if (!extract_instructions()){
     return false;
   }
+  if (!arena_offsets.empty() && !check_arena_flows(instructions, false)){
+    return false;
+  }
   
 
   cout<<"Data will be logged to "<<logfile<<endl;
@@ -827,6 +1031,9 @@ bool Configuration::read_config_file(string filename){
       //cout<<"The minimum interval duration is "<<interval<<"ms"<<endl;
     }else{
       cout<<"with intervals of "<<interval<<"ms; triggered internally."<<endl;
+      if (pulsegrid > 0){
+        cout<<"Pulse onsets are on a grid of "<<pulsegrid<<" s."<<endl;
+      }
     }
   }
   if (delay == 0){
@@ -842,6 +1049,132 @@ bool Configuration::read_config_file(string filename){
 }
 
 
+// =============================================================================
+// validates a PULSE line (already chopped into words) and fills in the pulse structure
+// used both for the configuration file and for instructions appended at run-time
+bool Configuration::parse_pulse(const vector <string>& word_table, const string& s, pulse& tmp){
+  if (word_table.size() < 4){ // minimal PULSE command has 4 words plus 1 optional one
+    cerr<<"Error in configuration file in line: "<<s<<endl;
+    cerr<<"Incomplete pulse information."<<endl;
+    return false;
+  }
+  
+  string word = word_table[1];
+  const alias_entry* entry = valve_alias::lookup(word);
+  tmp.odor_alias = word;
+  if (entry == NULL){
+    cerr<<"Error in configuration file in line: "<<s<<endl;
+    return false;
+  }
+  // flow types of odours going to the fly, in the order of the flow rates of the PULSE line
+  vector <char> odour_flows = flow_types_from_bits(entry->flow_types & (FLOW_BIT_ODOR1 | FLOW_BIT_ODOR2 | FLOW_BIT_ODOR3));
+  if (odour_flows.empty()){
+    cerr<<"Error in configuration file in line: "<<s<<endl;
+    cerr<<"Error: could not identify flow types from alias "<<word<<"."<<endl;
+    return false;
+  }
+  unsigned int nbflows = odour_flows.size(); //expected nb of flowrates for this pulse
+
+  // get pulse duration (in ms)
+  unsigned int dur = atoi(word_table[2].c_str());
+  if (dur > MAX_PULSE || dur < 0){
+    cerr<<"Error in configuration file in line: "<<s<<endl;
+    cerr<<"The specified pulse duration is invalid."<<endl;
+    return false;
+  }
+  tmp.duration = dur;
+  tmp.valve_blocks = entry->valves;
+  tmp.mask = entry->mask;
+  if (!map_arenas(tmp)){
+    cerr<<"Error in configuration file in line: "<<s<<endl;
+    return false;
+  }
+  
+  // get flow rates
+  if (word_table.size() < (3 + nbflows)){
+    cerr<<"Error in configuration file in line: "<<s<<endl;
+    cerr<<"Missing flow rates."<<endl;
+    return false;
+  }
+  // for each flow type in pulse, there should be a flowrate, however unused flowtypes are not specified
+  double summed_flow (0.0); 
+  for (unsigned int i(0); i< nbflows; i++){
+    // search MFC corresponding to flow type
+    map <char, char>::iterator iter;
+    iter = flow_MFC_LUT.find(odour_flows[i]);
+    if (iter == flow_MFC_LUT.end()){
+      cerr<<"Error: unable to find a MFC that controls a flow of type: "<<odour_flows[i]<<endl;
+      return false;
+    }
+    double flux = atof(word_table[3+i].c_str()); // flow for single fly
+    flux = flux*flies; // calculate flow for all flies
+    if (flux < 0 || flux > totalflow){
+      cerr<<"Error: the specifid flow is invalid (either because it is negative or because it is higher than the specified totalflux."<<endl;
+      return false;
+    }
+    summed_flow+= flux;
+    // add flow rate info into pulse map with ID of flow type 
+    tmp.MFC_flow[iter->first]=flux;
+  }
+  tmp.MFC_flow['B']=summed_flow;// Boost flow corresponds to summed flow rate of pulses
+  
+  // get optional description
+  if (word_table.size() > (3 + nbflows)){
+    tmp.name = word_table[3 + nbflows];
+    if (tmp.name.length()> MAX_LENGTH){
+      char odor[MAX_LENGTH];
+      strncpy(odor, tmp.name.c_str(), sizeof(odor));
+      odor[sizeof(odor) - 1] = 0;
+      cerr<<"Warning: "<<tmp.name<<" will be truncated to "<< (string)odor<<" when sent to a partner."<<endl;
+    }
+    // add name to map LUT (TO BE IMPLEMENTED!!!!)
+      
+    if (word_table.size()> (4 + nbflows)){
+      cerr<<"Warning: All characters after "<<tmp.name<<" were ignored."<<endl;
+    }
+  }
+  return true;
+}
+
+
+// =============================================================================
+// valves of the pulse in the arena of each fly, the shifted valves need to be on the boards of the rig
+bool Configuration::map_arenas(pulse& p){
+  p.fly_masks.assign(arena_offsets.size(), valve_mask());
+  unsigned int nb_valves = valve_alias::get_profile().get_nb_boards() * NB_VALVE_CHANNELS;
+  for (unsigned int f(0); f < arena_offsets.size(); f++){
+    for (unsigned int i(0); i < p.valve_blocks.size(); i++){
+      unsigned int valve = p.valve_blocks[i] + (arena_offsets[f] < 0 ? 0 : arena_offsets[f]);
+      if (valve >= nb_valves){
+        cerr<<"Error: valve "<<p.valve_blocks[i]<<" of "<<p.odor_alias<<" is beyond the boards of the rig in the arena of fly "<<f<<"."<<endl;
+        return false;
+      }
+      p.fly_masks[f].set(valve);
+    }
+  }
+  return true;
+}
+
+// =============================================================================
+// the arenas share the MFCs: a fly whose pulse comes later than the pulse of another fly would get the flows set for the
+// next pulse of the other fly, so the set points can only come before the first pulse, and the pulses need the same flows
+bool Configuration::check_arena_flows(const vector <instruct>& program, bool after_pulse){
+  for (unsigned int i(0); i < program.size(); i++){
+    if (program[i].etype == "PULSE"){
+      after_pulse = true;
+    }else if (after_pulse && (program[i].etype == "MFCSET" || program[i].etype == "MFCSET2")){
+      cerr<<"Error: with ARENA, the pulses need the flows of the first pulse, the flies share the MFCs and are triggered independently."<<endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// =============================================================================
+unsigned int Configuration::get_nb_arenas(){
+  return arena_offsets.size();
+}
+
 // =============================================================================
 int Configuration::find_next_event(unsigned int i){
   bool found (false);
@@ -864,7 +1197,7 @@ int Configuration::find_next_event(unsigned int i){
 // =============================================================================
 // adds MFCSET instructions for boost and carrier air & updates current_flow map
 // returns true if successful, false if error
-bool Configuration::update_boost_carrier_flow(double boostflow, double carrierflow, map <char, double>& current_flow, bool user){
+bool Configuration::update_boost_carrier_flow(vector <instruct>& program, double boostflow, double carrierflow, map <char, double>& current_flow, bool user){
 
   // add two MFCSET instructions to set carrier and boost
   instruct tmp;
@@ -894,7 +1227,7 @@ bool Configuration::update_boost_carrier_flow(double boostflow, double carrierfl
   flch->flow_carrier  = carrierflow; // flowrate
   
   tmp.einfo = flch;
-  instructions.push_back(tmp);
+  program.push_back(tmp);
   
   //update flows in current_flow map
   current_flow['B'] = boostflow;
@@ -907,7 +1240,7 @@ bool Configuration::update_boost_carrier_flow(double boostflow, double carrierfl
 // =============================================================================
 // adds MFCSET instructions for pulse if needed & updates current_flow accordingly
 // returns true if successful, false if error
-bool Configuration::update_flow_rate_for_next_pulse(const event& ev, map <char, double>& current_flow){
+bool Configuration::update_flow_rate_for_next_pulse(vector <instruct>& program, const event& ev, map <char, double>& current_flow){
   // if the current flows differ from those needed for the pulse, also add MFCSET commands for the flows for pulses
   // to do that scan flows of pulse, for every pulse flow that is not a boost or carrier type, compare flow rates to current ones
   // if they differ, add a MFCSET command for that flow
@@ -940,7 +1273,7 @@ bool Configuration::update_flow_rate_for_next_pulse(const event& ev, map <char,
         flch->ID = iter->second; //ID of MFC
         flch->flow = iter2->second; // set flow rate to that needed for pulse
         istr.einfo = flch;
-        instructions.push_back(istr);
+        program.push_back(istr);
       }
       current_flow[iter3->first] = iter2->second;// update flow also in current flow map
     }
@@ -959,8 +1292,8 @@ void Configuration::update_current_with_pulse_flows(map <char, double>& current_
 
 
 // =============================================================================
-void Configuration::display_instructions(ostream& output){
-  for (unsigned int i (0); i< instructions.size(); i++){
+void Configuration::display_instructions(ostream& output, unsigned int first){
+  for (unsigned int i (first); i< instructions.size(); i++){
      output<<"INSTRUCT ["<<i<<"] "<<instructions[i].etype<< " (" <<instructions[i].user<<") -> ";
      if (instructions[i].etype == "WAIT"){
         output<<" "<<*(double*)instructions[i].einfo<<" sec"<<endl;
@@ -985,14 +1318,14 @@ void Configuration::display_instructions(ostream& output){
 }
 
 // =============================================================================
-void Configuration::add_wait(double delay, bool user){
+void Configuration::add_wait(vector <instruct>& program, double delay, bool user){
   instruct tmp;
   double* t = new double (delay);
   // copy event to instruction table
   tmp.user = user; // event specified by user
   tmp.etype = "WAIT";
   tmp.einfo = t;
-  instructions.push_back(tmp);   
+  program.push_back(tmp);   
 }
 
 // =============================================================================
@@ -1034,12 +1367,12 @@ bool Configuration::extract_instructions(){
         // update event_table entry: add carrier flow to pulse
         //(((pulse*)event_table[i].einfo)-> MFC_flow).insert(pair < char,double> ('C', carrierflow));
         
-        if (!update_boost_carrier_flow(boostflow, carrierflow, current_flow, true)){
+        if (!update_boost_carrier_flow(instructions, boostflow, carrierflow, current_flow, true)){
           return false;
         }
         //cout<<"after boost"<<endl;
         // update flow rates for pulse if needed, will update current_flow automatically
-        if (!update_flow_rate_for_next_pulse(event_table[idx], current_flow)){
+        if (!update_flow_rate_for_next_pulse(instructions, event_table[idx], current_flow)){
           return false;
         }
 
@@ -1059,7 +1392,7 @@ bool Configuration::extract_instructions(){
         }
         
         // NEW: add a 1sec wait after MFC flow changes
-        add_wait(1, false);
+        add_wait(instructions, 1, false);
         
       // if there is no future event or the future event is TOTALFLOW event -> totflow can be split proportionally to range between MFC carrier and MFC boost
       }else{
@@ -1080,17 +1413,15 @@ bool Configuration::extract_instructions(){
           cerr<<"Error: could not find MFC ID of boost air. "<<endl;
           return false;
         }
-        bool MFC_change = false;
         int range_boost = mfc_map[iter->second].get_range();
         double boostflow = totflow * (range_boost/(double)max_air_flow); //flow contribtion of each controller is proportional to total range
                 // update flow in current_flow map
         current_flow['C'] = carrierflow;
         current_flow['B'] = boostflow;
-        if (!update_boost_carrier_flow(boostflow, carrierflow, current_flow, false)){
+        if (!update_boost_carrier_flow(instructions, boostflow, carrierflow, current_flow, false)){
           return false;
         }else{
-          add_wait(1, false);
-          MFC_change = true;
+          add_wait(instructions, 1, false);
         }
         
       }
@@ -1105,7 +1436,7 @@ bool Configuration::extract_instructions(){
       tmp.einfo = t;
       instructions.push_back(tmp);
       */
-      add_wait((*(double*)event_table[i].einfo), true);
+      add_wait(instructions, (*(double*)event_table[i].einfo), true);
       
 		// event is a Waitstop: means that system remains in current configuration and runs until stopped with CTRL+C  
     }else if(event_table[i].etype == "WAITSTOP"){
@@ -1133,7 +1464,7 @@ bool Configuration::extract_instructions(){
       tmp.einfo = pls;
       instructions.push_back(tmp);
       
-      add_wait(pulsewait, false);
+      add_wait(instructions, pulsewait, false);
 
       // need to update current_flow with values from pulse
       update_current_with_pulse_flows(current_flow, ((pulse*)event_table[i].einfo)->MFC_flow);
@@ -1145,7 +1476,7 @@ bool Configuration::extract_instructions(){
       // if there an event in the future and it is a pulse, adjust flow rates for the pulse if needed, if it is a different event or no event, do nothing
       if(idx != -1 && event_table[idx].etype == "PULSE"){
         // adjust flow rates
-        if (!update_flow_rate_for_next_pulse(event_table[idx], current_flow)){
+        if (!update_flow_rate_for_next_pulse(instructions, event_table[idx], current_flow)){
           return false;
         }else{
           MFC_change = true;
@@ -1154,7 +1485,7 @@ bool Configuration::extract_instructions(){
         if (((pulse*)event_table[idx].einfo)->MFC_flow['B'] != current_flow['B']){ // current boost and next pulse differ, adjust boost & carrier
           double boostflow = ((pulse*)event_table[idx].einfo)->MFC_flow['B'];
           double carrierflow = totflow - boostflow;
-          if (!update_boost_carrier_flow(boostflow, carrierflow, current_flow, false)){
+          if (!update_boost_carrier_flow(instructions, boostflow, carrierflow, current_flow, false)){
             return false;
           }else{
             MFC_change = true;
@@ -1170,17 +1501,21 @@ bool Configuration::extract_instructions(){
           cerr<<" The duration of the interval complement is invalid (<= 0). Revise."<<endl;
           return false;
         }
-        add_wait(interval_complement, false);
+        add_wait(instructions, interval_complement, false);
       }else{
         if (MFC_change){
           // if external trigger, then there is a 1sec wait after MFC changes
-          add_wait(1, false);
+          add_wait(instructions, 1, false);
         }
       }
       
     }
   }
 
+  // keep flow state at the end of the table, appended instructions start from there
+  tail_flow = current_flow;
+  tail_totflow = totflow;
+
   //delete events from event_table
   for (unsigned int i(0); i < event_table.size(); i++){
     if (event_table[i].etype=="FLYFLOW"){
@@ -1195,10 +1530,166 @@ bool Configuration::extract_instructions(){
 
   //
   //display_instructions(cout);
-  display_instructions(g);
+  display_instructions(g, 0);
   return true; 
 }
 
 
+// =============================================================================
+// validates instructions received at run-time (same syntax as PULSE and WAIT lines of the configuration file),
+// compiles them the way extract_instructions does and appends them to the tail of the instruction table.
+// either all lines are appended or none. returns the number of pulses appended, -1 in case of error
+// the appends of several partners are serialized: each one is compiled from the tail left by the previous one
+int Configuration::append_instructions(const string& text){
+  pthread_mutex_lock(&append_mutex);
+  int new_pulses = compile_append(text);
+  pthread_mutex_unlock(&append_mutex);
+  return new_pulses;
+}
+
+// =============================================================================
+// called by the scheduler when it has no instruction left to execute: an append received before is executed,
+// the table is closed otherwise and the later appends are rejected, so that the partner knows they will not run
+bool Configuration::close_table(int executed){
+  pthread_mutex_lock(&append_mutex);
+  bool closed = (get_nb_instructions() <= executed);
+  if (closed){
+    table_closed = true;
+  }
+  pthread_mutex_unlock(&append_mutex);
+  return closed;
+}
+
+// =============================================================================
+// compiles the appended lines from the tail of the table and commits them, called with append_mutex held
+int Configuration::compile_append(const string& text){
+  if (table_closed){
+    cerr<<"Append rejected: the run reached the end of the instruction table, appended instructions would never be executed."<<endl;
+    return -1;
+  }
+  if (waitstop_event){
+    cerr<<"Append rejected: the instruction table ends with WAITSTOP, appended instructions would never be executed."<<endl;
+    return -1;
+  }
+  if (pulsewait == MAX_DELAY || tail_totflow == 0){
+    cerr<<"Append rejected: pulsewait and total flow need to be specified in the configuration file to append pulses."<<endl;
+    return -1;
+  }
+  
+  vector <instruct> program; // compiled instructions, only added to the table if all lines are valid
+  map <char, double> current_flow = tail_flow;
+  vector <string> accepted_lines;
+  unsigned int new_pulses(0);
+  bool valid(true);
+  
+  stringstream ss(text);
+  string s;
+  while (valid && getline(ss, s)){
+    if (!s.empty() && s[s.length()-1] == '\r'){
+      s.erase(s.length()-1);
+    }
+    if (s.empty() || s[0] == '#'){
+      continue;
+    }
+    vector <string> word_table;
+    unsigned int nb_words = chop_line(s, word_table);
+    
+    if (word_table[0] == "PULSE"){
+      pulse tmp;
+      if (!parse_pulse(word_table, s, tmp)){
+        valid = false;
+        break;
+      }
+      event ev;
+      ev.etype = word_table[0];
+      ev.einfo = &tmp;
+      
+      // bring the odour flows to those of the pulse, adjust boost and carrier if needed
+      unsigned int before = program.size();
+      if (!update_flow_rate_for_next_pulse(program, ev, current_flow)){
+        valid = false;
+        break;
+      }
+      if (tmp.MFC_flow['B'] != current_flow['B']){
+        double boostflow = tmp.MFC_flow['B'];
+        if (!update_boost_carrier_flow(program, boostflow, tail_totflow - boostflow, current_flow, false)){
+          valid = false;
+          break;
+        }
+      }
+      if (program.size() > before){
+        add_wait(program, 1, false); // time needed for MFCs changes to converge
+      }
+      
+      instruct istr;
+      pulse* pls = new pulse (tmp);
+      pls->MFC_flow['C'] = tail_totflow - tmp.MFC_flow['B'];
+      istr.user = true;
+      istr.etype = word_table[0];
+      istr.einfo = pls;
+      program.push_back(istr);
+      add_wait(program, pulsewait, false);
+      update_current_with_pulse_flows(current_flow, pls->MFC_flow);
+      
+      if (trigger == "internal"){
+        double interval_complement = interval - pulsewait;
+        if (interval_complement <= 0.0){
+          cerr<<" The duration of the interval complement is invalid (<= 0). Revise."<<endl;
+          valid = false;
+          break;
+        }
+        add_wait(program, interval_complement, false);
+      }
+      new_pulses++;
+      
+    }else if (word_table[0] == "WAIT" && nb_words >= 2){
+      unsigned int delay = atoi(word_table[1].c_str()); // time to wait in seconds
+      if (delay > MAX_DELAY){
+        cerr<<"Error in appended line "<<s<<endl;
+        cerr<<"The delay to wait exceeds the maximum possible."<<endl;
+        valid = false;
+        break;
+      }
+      add_wait(program, (double)delay, true);
+    
+    }else{
+      cerr<<"Error in appended line: "<<s<<endl;
+      cerr<<"Only PULSE and WAIT instructions can be appended at run-time."<<endl;
+      valid = false;
+      break;
+    }
+    accepted_lines.push_back(s);
+  }
+  
+  // with arenas, the table already has the first pulse if it has pulses
+  if (valid && !arena_offsets.empty() && !check_arena_flows(program, nb_pulses > 0)){
+    valid = false;
+  }
+  if (!valid || program.empty()){
+    for (unsigned int i(0); i < program.size(); i++){
+      free_instruction(program[i]);
+    }
+    return -1;
+  }
+  
+  // commit to the live instruction table
+  pthread_mutex_lock(&instructions_mutex);
+  unsigned int first = instructions.size();
+  instructions.insert(instructions.end(), program.begin(), program.end());
+  nb_pulses += new_pulses;
+  tail_flow = current_flow;
+  pthread_mutex_lock(&log_mutex);
+  for (unsigned int i(0); i < accepted_lines.size(); i++){
+    g<<"APPEND "<<accepted_lines[i]<<endl;
+  }
+  display_instructions(g, first);
+  pthread_mutex_unlock(&log_mutex);
+  pthread_mutex_unlock(&instructions_mutex);
+  
+  cout<<"Appended "<<program.size()<<" instructions ("<<new_pulses<<" pulses)."<<endl;
+  return new_pulses;
+}
+
+
 
 
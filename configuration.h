@@ -10,15 +10,23 @@
 // ============== configuration file format ===============
 //  # This is a comment
 //  LOGFILE /Users/danielle/path/to/logfile
+//  RIG behavior || physiology || /path/to/rig/profile
+//  DEVICE usb || emulator
+//  THREAD trigger || scheduler || usb || serial || network || setpoint || logger FIFO || RR || OTHER priority [cpus]
 //  COMPORT /dev/tty_path/to/serial/port
 //  MFC addr max_range flow_type
 //  MFCLOG /Users/danielle/path/to/mfcdatafile
 //  PARTNER Igor || Flytracker
 //  DELAY Delay_in_sec
 //  FLIES nb_flies
+//  ARENA fly channel_offset
 //  TRIGGER internal || external
+//  FASTTRIGGER
 //  INTERVAL duration_between_pulses_in_ms(default = 0)
 //  PULSEWAIT duration_in_seconds_to_wait_after_pulse(default=0)
+//  PULSEGRID period_in_seconds
+//  SHMSTREAM /name
+//  FLOWTHRESHOLD SLPM(default = 0)
 //  FLYFLOW flowrate_per_fly(SLPM)
 //  PULSE vial_code duration_in_ms flowrate [flowrate [flowrate]] [optional_descriptor_of_odour_pulse]
 //  WAIT sec
@@ -27,8 +35,25 @@
 //# internal command:
 //  MFCSET addr flowrate
 
+//# run-time append (APPEND_QUERY from the partner, see data_format.h):
+//  PULSE and WAIT lines with the syntax above are validated, compiled and appended to the tail of the instruction table
+
 //#
+//  RIG needs to be specified before INTERVAL, ARENA, TRIGGER and PULSE, it selects the valve aliases of the rig (see vo_alias.h). Without RIG
+//     the rig the program was built for is used with a warning (DEFAULT_RIG: make behavior or make physiology)
+//  DEVICE selects the output boards: usb (default) drives the USB-DIO-96 boards, emulator runs the valve controller without hardware (see dio_device.h)
+//  THREAD sets the scheduling class, priority and CPUs (e.g. 2, 0,1 or 0-3) of a thread, other threads keep SCHED_FIFO 50 on all CPUs (see rt_thread.h)
 //  COMPORT needs to be specified before MFCs
+//  PULSEGRID puts the onsets of the pulses on an absolute grid t0 + k*period (t0: first pulse), only with TRIGGER internal. A late pulse
+//     does not delay the next ones, a pulse whose instructions take longer than a period goes to the next free slot (see execute_config_instructions)
+//  SHMSTREAM publishes the pulses, triggers and MFC readings in the POSIX shared memory /name, for the partners on the same host (see shm_stream.h)
+//  ARENA gives every fly (0 to nb_flies - 1) its own valves: the valves of the aliases shifted by channel_offset. With ARENA lines
+//     (one per fly, after FLIES and before the pulses, only with PARTNER Flytracker and TRIGGER external) every fly goes through the
+//     instructions with its own cursor, and its pulses are triggered by the FLY_PULSE_QUERY of its fly (see data_format.h)
+//  FASTTRIGGER opens the valves of a pulse from the network thread as soon as the PULSE_QUERY of the partner arrives, before the query
+//     is acknowledged and the timestamp read: the scheduler arms the frame of the next pulse while it waits for the trigger. Only with
+//     PARTNER Flytracker and TRIGGER external, without ARENA (see execute_config_instructions)
+//  FLOWTHRESHOLD is the smallest change of the flow of an MFC that is sent to the partner (FLOW_QUERY, TOPIC_FLOW), a change of validity is always sent
 //  MFC: addr is address of controller (a letter between [B-Z]) and flowrate is the set point of the flow rate values between [>0 max_range], flow_type is a character specifying the type of airflow that is controlled by MFC: 1=odor1, 2=odor2, 3=odor3, C=carrier, B=Boost
 //  PARTNER can be Igor, Flytracker
 //  DELAY positiv number which is the delay in seconds before valve controller is started, only possible if no partner is specified
@@ -62,19 +87,16 @@
 #include <pthread.h> // enable threads
 #include <ctype.h>  // contains isdigit funciton
 
-#ifdef BEHAVIOR
-#include "vo_alias_behavior.h"
-#endif
-#ifdef PHYSIOLOGY
-#include "vo_alias_physiology.h"
-#endif
-
+#include "vo_alias.h"
 #include "utils.h"
 #include "flow_controller.h"
 #include "data_format.h"
 #include "MFC_data.h"
+#include "seqlock.h"
+#include "rt_thread.h"
 
 
+const unsigned int MAX_FLIES = 15; // maximum nb of flies that can be exposed to the airflow at the same time
 
 struct event{
   std::string etype;  ///< type of event :either flow change event or pulse event
@@ -85,6 +107,8 @@ struct event{
 struct pulse {
   std::string odor_alias;///< odor alias, defines blocks of valves that should be opened for this givien odor. defined in vo_alias.h, listed in alias.txt
   std::vector <int> valve_blocks;  ///< block of valves that need to be opened
+  valve_mask mask;  ///< same valves as a mask of the board channels, precomputed from the rig profile
+  std::vector <valve_mask> fly_masks;  ///< valves of each fly, shifted to its arena (ARENA), empty without arenas
   std::map <char, double> MFC_flow; ///< ID is flow type, associated values is flow rate during pulse
   int duration;  ///< duration of pulse 
   std::string name;  ///< user-defined name for pulse, e.g. name of odour
@@ -123,32 +147,64 @@ public:
   bool balance_carrier_boost(char ID_carrier, double carrier_flow, char ID_boost, double boost_flow);
   std::string get_comport_name();
   std::string get_trigger();
+  std::string get_device();
+  const thread_policy& get_thread_policy(unsigned int idx);
   //bool get_pulse(unsigned int idx, pulse& p); // replace by get_event
   unsigned int update_pulses_delievered();
   void set_interval_pulse(double interval);
   bool get_interval_pulse(pulse& p);
   double get_pulsewait();
+  double get_pulsegrid();
+  std::string get_shmstream();
+  double get_flow_threshold();
+  /// \return true if the network thread opens the valves of the armed pulse when the trigger arrives (FASTTRIGGER)
+  bool get_fast_trigger();
   void log(std::string message);
+  /// same as log(std::string), does not allocate (used in the real-time region of the pulses)
+  void log(const char* message);
   void init_MFC_data();
   void log_flow_data(std::ofstream& g);
   void update_flow_destination(const std::string& pulse_type);
+  /// \brief same as update_flow_destination(pulse_type) for the union of the flow types (FLOW_BIT_*, see vo_alias.h) of
+  ///   the pulses open at once in the arenas
+  void update_flow_destination(uint8_t flow_types);
+  /// \return true if the flow of MFC ID goes to the flies while the valves of pulse_type are open
+  bool is_flow_to_flies(char ID, const std::string& pulse_type);
 
+  std::string get_logfile();
   std::string get_mfclog();
   unsigned int get_nb_events();
   bool get_event(unsigned int idx, std::string& e);
+  /// flows of the MFCs and validity of the current pulse, copied without lock
   MFC_flows get_MFC_data();
+  /// \param generation of the copy, see get_MFC_generation
+  MFC_flows get_MFC_data(uint64_t& generation);
+  /// \return changes with the flows or the validity, a reader compares it to the generation of its last copy
+  uint64_t get_MFC_generation();
   bool extract_instructions();
   int get_nb_instructions();
   bool get_instruction(unsigned int idx, instruct& command);
+  int append_instructions(const std::string& text);
+  /// the run reached the end of the table with instruction executed as the next one, the appends are rejected from then on
+  /// \return false if instructions were appended since, the run goes on with them
+  bool close_table(int executed);
+  /// \return number of flies with their own valves and cursor (ARENA), 0 if the flies share the pulses
+  unsigned int get_nb_arenas();
   
 private:
   
   void update_current_with_pulse_flows(std::map <char, double>& current_flow, std::map <char, double>& MFC_flow_pulse); 
-  bool update_flow_rate_for_next_pulse(const event& ev, std::map <char, double>& current_flow);
-  bool update_boost_carrier_flow(double boostflow, double carrierflow, std::map <char, double>& current_flow, bool user);
+  bool update_flow_rate_for_next_pulse(std::vector <instruct>& program, const event& ev, std::map <char, double>& current_flow);
+  bool update_boost_carrier_flow(std::vector <instruct>& program, double boostflow, double carrierflow, std::map <char, double>& current_flow, bool user);
+  bool parse_pulse(const std::vector <std::string>& word_table, const std::string& s, pulse& p);
+  bool map_arenas(pulse& p);
+  /// \return false if a set point comes after a pulse, after_pulse if the program follows a pulse
+  bool check_arena_flows(const std::vector <instruct>& program, bool after_pulse);
+  int compile_append(const std::string& text);
+  bool use_default_rig();
   int find_next_event(unsigned int i);
-  void display_instructions(std::ostream& output);
-  void add_wait(double delay, bool user);
+  void display_instructions(std::ostream& output, unsigned int first);
+  void add_wait(std::vector <instruct>& program, double delay, bool user);
   void set_pulsewait(double p); /// < duration in seconds
   void convert_pulse_to_flowtypes(const std::string& pulse_type, std::vector <char>& flow_types_valid);
 
@@ -163,7 +219,9 @@ private:
   pulse interval_pulse;
   std::vector <event> event_table;
   double pulsewait;  // delay before boos-carrier change in us
+  double pulsegrid;  ///< period in seconds of the grid of the pulse onsets, 0 if the pulses follow each other
   unsigned int flies; ///< nb of flies exposed to airflow
+  std::vector <int> arena_offsets;  ///< channel offset of the valves of each fly (ARENA), -1 if not given, empty without ARENA
 
   std::map <char, FlowController> mfc_map;  ///< flow controller map, indexed by ID
   unsigned int nb_mfc; ///< counter for nb of MFCs connected
@@ -171,16 +229,29 @@ private:
   std::string config_filename;
   std::string partner;
   std::string trigger;
+  std::string device; ///< type of output device (usb or emulator)
+  thread_policy thread_policies[NB_RT_THREADS]; ///< scheduling of the threads (THREAD keyword)
   std::string logfile;  ///< path of logfile
   std::string mfclogfile;  ///< path of logfile
+  std::string shmstream;  ///< name of the shared memory of the event stream, empty without SHMSTREAM
+  double flow_threshold;  ///< SLPM, -1 without FLOWTHRESHOLD
+  bool fast_trigger;  ///< FASTTRIGGER
+  bool rig_defaulted;  ///< no RIG before the first line that needed the rig, DEFAULT_RIG was loaded
   
-  MFC_flows MFC_data;
-  pthread_mutex_t MFC_data_mutex; ///<LUT with flow type and MFC ID, needed to determine for each pulse for which MFC the flow rate needs to be checked
-  std::map <char, char> flow_MFC_LUT;  /// LUT contains flow type and associated MFC ID
+  MFC_flows MFC_data;  ///< copy of the writers (MFC thread, scheduler), published to MFC_published
+  pthread_mutex_t MFC_data_mutex; ///< serializes the writers of MFC_data, the readers do not take it
+  seqlock <MFC_flows> MFC_published;  ///< MFC_data as the readers get it
+  std::map <char, char> flow_MFC_LUT;  ///< LUT with flow type and MFC ID, needed to determine for each pulse for which MFC the flow rate needs to be checked
   double totalflow; // total flowrate delivered to fly/flies
   double max_air_flow; // maximum flow of boost and carrier MFC combined
   bool waitstop_event; 
   std::vector <instruct> instructions;
+  pthread_mutex_t instructions_mutex; ///< instructions can be appended by the socket thread while they are executed
+  std::map <char, double> tail_flow; ///< flow rate per flow type at the end of the instruction table, starting point for appended instructions
+  double tail_totflow; ///< total flow at the end of the instruction table
+  bool table_closed; ///< the run reached the end of the table, set under append_mutex
+  pthread_mutex_t append_mutex; ///< held from the read of the tail to the commit of an append, the scheduler does not take it
+  pthread_mutex_t log_mutex; ///< logfile is written by the main thread and by the socket thread (appended instructions)
   
   std::ofstream g; // logfile with config info and instructions
 };
@@ -11,9 +11,25 @@
 
 #include <stdint.h>
 
-const uint8_t DATA_QUERY = 1;
+const uint8_t DATA_QUERY = 1; ///< answered with a bool, true if followed by the oldest data_packet the partner did not read yet
 const uint8_t PULSE_QUERY = 2;
 const uint8_t FLOW_QUERY = 3;
+const uint8_t APPEND_QUERY = 4; ///< followed by uint32_t length and length bytes of PULSE/WAIT lines (configuration file syntax), answered with a bool
+const uint32_t MAX_APPEND_LENGTH = 65536; ///< maximum size in bytes of instructions appended in one query
+const uint8_t EVENTS_QUERY = 5; ///< answered with an events_header followed by nb_events event_record: all the events the partner did not read yet
+const uint32_t EVENT_RING_SIZE = 64; ///< events kept for the partners, a partner that lags further behind loses the oldest ones
+const uint8_t SUBSCRIBE_QUERY = 6; ///< followed by a subscribe_request, answered with a bool: if true the connection is in push mode
+const uint8_t HELLO_QUERY = 7; ///< followed by uint16_t version of the frames, answered with a FRAME_HELLO: from then on every answer is a frame (see wire_format.h)
+const uint8_t PING_QUERY = 8; ///< followed by a clock_ping, answered with a clock_pong: estimate of the offset of the clocks (see clock_sync.h)
+const uint8_t FLY_PULSE_QUERY = 9; ///< followed by uint8_t fly, then as PULSE_QUERY: triggers the next pulse of that fly (ARENA, see configuration.h); PULSE_QUERY is fly 0
+
+// push mode: the valve controller sends the topics of the subscription as they happen, every message is a push_header
+// followed by length bytes of payload. Queries are still accepted, their answer is the payload of a TOPIC_REPLY message.
+// With PULSE_QUERY the partner sends its timestamp right away, the trigger is confirmed by a TOPIC_TRIGGER message.
+const uint32_t TOPIC_EVENTS = 1;  ///< events_header and event_record of the valves
+const uint32_t TOPIC_TRIGGER = 2;  ///< trigger_ack of every trigger
+const uint32_t TOPIC_FLOW = 4;  ///< MFC_flows when they changed, at most every flow_interval_ms
+const uint32_t TOPIC_REPLY = 0x80;  ///< answer to a query, same bytes as without subscription
 const uint8_t MAX_LENGTH = 63;  ///< maximum length of strings for odor name, same as in configuration.h
 
 
@@ -25,5 +41,50 @@ struct data_packet{
   char odor[MAX_LENGTH + 1]; // allow for MAX_LENGTH character strings + terminator
 };
 
+/// event of the valves, with its sequence number (EVENTS_QUERY)
+struct event_record{
+  uint64_t seq;  ///< starts at 1, increases by 1 per event
+  data_packet data;
+};
+
+/// trigger received by the valve controller (TOPIC_TRIGGER)
+struct trigger_ack{
+  uint64_t seq;  ///< starts at 1, increases by 1 per trigger
+  double timestamp;  ///< time at which the valve controller received the trigger
+  double partner_timestamp;  ///< timestamp sent with PULSE_QUERY, -1 for the ITC18 trigger of Igor
+};
+
+/// SUBSCRIBE_QUERY
+struct subscribe_request{
+  uint32_t topics;  ///< TOPIC_EVENTS | TOPIC_TRIGGER | TOPIC_FLOW
+  uint32_t flow_interval_ms;  ///< minimum time between two TOPIC_FLOW messages
+};
+
+/// PING_QUERY, sent every few seconds by a partner whose timestamps are to be converted to the controller clock
+struct clock_ping{
+  double partner_sent;  ///< time_real of the partner when it sends the ping
+  double partner_received;  ///< time_real of the partner when it received the previous clock_pong, 0 for the first ping
+};
+
+/// answer to PING_QUERY, with time_real of the valve controller
+struct clock_pong{
+  double partner_sent;  ///< of the ping
+  double received;  ///< when the ping was received
+  double sent;  ///< when the answer was sent
+};
+
+/// message of the push mode
+struct push_header{
+  uint32_t topic;
+  uint32_t length;  ///< bytes of payload that follow
+};
+
+/// answer to EVENTS_QUERY, the records follow in the order of their sequence numbers
+struct events_header{
+  uint32_t nb_events;  ///< records that follow
+  uint32_t lost;  ///< events overwritten before the partner read them, the sequence numbers jump by as many
+  uint64_t next_seq;  ///< sequence number of the next event
+};
+
 
 #endif /* defined(____DATA_FORMAT__) */
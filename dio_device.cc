@@ -0,0 +1,615 @@
+//
+//  dio_device.cc
+//  output boards of the valve controller: USB-DIO-96 boards (libusb) or in-process emulator
+//
+
+#include <iostream>
+#include <cstring>
+#include <unistd.h>  // usleep
+#include <dlfcn.h>   // dlsym, hotplug API
+#include <sys/time.h>
+
+#include "aioUsbApi.h"  ///< include API of USB-DIO-96 device from www.accesio.com
+#include "dio_device.h"
+#include "utils.h"
+
+using namespace std;
+
+const unsigned int RECORDED_FRAMES = 4096; ///< last frames kept by the emulator, older frames are overwritten
+
+// hotplug API of libusb 1.0.16 and later, which the libusb.h of the boards does not declare: the functions are looked up
+// when the monitor thread starts, with an older library the disconnections are only detected by failed transfers
+const uint32_t HOTPLUG_CAPABILITY = 0x0001;  ///< LIBUSB_CAP_HAS_HOTPLUG
+const int HOTPLUG_DEVICE_LEFT = 0x02;        ///< LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT
+const int HOTPLUG_NO_FLAGS = 0;              ///< LIBUSB_HOTPLUG_NO_FLAGS
+const int HOTPLUG_MATCH_ANY = -1;            ///< LIBUSB_HOTPLUG_MATCH_ANY
+
+typedef int (*hotplug_callback_fn)(libusb_context*, libusb_device*, int, void*);
+typedef int (*has_capability_fn)(uint32_t);
+typedef int (*register_callback_fn)(libusb_context*, int, int, int, int, int, hotplug_callback_fn, void*, int*);
+typedef void (*deregister_callback_fn)(libusb_context*, int);
+
+/// completion of the writes to the boards of one frame
+struct frame_write;
+
+/// completion of the write to one board
+struct board_write{
+  bool done;
+  int status;
+  double timestamp;
+  frame_write* frame;
+};
+
+/// transfers of a frame still submitted, plus one held by write until all are submitted. completed is set by the last
+/// release for handle_events_completed, whichever thread handles the events (the monitor thread does too)
+struct frame_write{
+  unsigned int pending;
+  int completed;
+};
+
+
+// =============================================================================
+dio_device::~dio_device(){
+}
+
+// =============================================================================
+dio_device* dio_device::create(const string& type){
+  if (type == "usb"){
+    return new usb_dio_device;
+  }else if (type == "emulator"){
+    return new emulated_dio_device;
+  }
+  return NULL;
+}
+
+
+// =============================================================================
+//            USB-DIO-96 boards
+// =============================================================================
+
+usb_dio_device::usb_dio_device(){
+  initialised = false;
+  nb = 0;
+  for (unsigned int b(0); b < MAX_BOARDS; b++){
+    deviceIdx[b] = -1;
+    handle[b] = NULL;
+    transfer[b] = NULL;
+  }
+  hotplug_checked = false;
+  hotplug = false;
+  unplugged = false;
+}
+
+// =============================================================================
+usb_dio_device::~usb_dio_device(){
+  if (hotplug){
+    deregister_callback_fn deregister = (deregister_callback_fn)dlsym(RTLD_DEFAULT, "libusb_hotplug_deregister_callback");
+    if (deregister != NULL){
+      deregister(NULL, hotplug_handle);
+    }
+  }
+  close();
+}
+
+// =============================================================================
+// re-enumerates the devices and opens the first nb boards found, with their transfers
+bool usb_dio_device::open(unsigned int nb_required){
+  if (!initialised){
+    AIO_Init();		// This should be called BEFORE any other function in the API
+    initialised = true;
+  }
+  close();
+	// to populate the list of Acces devices, comes from aioUsbApi.h
+  aioDeviceInfo aioDevices;
+  if (AIO_Usb_GetDevices(&aioDevices) > ERROR_SUCCESS){
+    cerr<<"Could not connect to USB-DIO-96 device."<<endl;
+    return false;
+  }
+  if (nb_required > (unsigned int)aioDevices.numAIODevs || nb_required > MAX_BOARDS){
+    cerr<<"The rig needs "<<nb_required<<" USB-DIO-96 boards, "<<aioDevices.numAIODevs<<" found."<<endl;
+    return false;
+  }
+  for (unsigned int b(0); b < nb_required; b++){
+    int idx = aioDevices.aioDevList[b].devIdx;
+    int ret = AIO_UsbValidateDeviceIndex(idx);
+    if (ret > ERROR_SUCCESS){
+      cerr<<"Invalid device Index = "<< idx<<endl;
+      close();
+      return false;
+    }
+    // get USB handle for device
+    deviceIdx[b] = idx;
+    handle[b] = getDevHandle(idx);
+    if (handle[b] == NULL){
+      cerr<<"Could not get device handle device Idx="<< idx<<endl;
+      close();
+      return false;
+    }
+    transfer[b] = libusb_alloc_transfer(0);
+    nb++;
+    if (transfer[b] == NULL){
+      cerr<<"Could not allocate USB transfer for device Idx="<< idx<<endl;
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+// =============================================================================
+void usb_dio_device::close(){
+  for (unsigned int b(0); b < nb; b++){
+    if (transfer[b] != NULL){
+      libusb_free_transfer(transfer[b]);
+      transfer[b] = NULL;
+    }
+    releaseDevHandle(deviceIdx[b]);
+    handle[b] = NULL;
+  }
+  nb = 0;
+}
+
+// =============================================================================
+unsigned int usb_dio_device::get_nb_boards() const{
+  return nb;
+}
+
+// =============================================================================
+// Just sets up the board for our use: all but the last two ports are used as output
+bool usb_dio_device::configure(unsigned int board, const unsigned char* data){
+  if (board >= nb){
+    return false;
+  }
+	unsigned char mask[2];
+	unsigned int triState = 0;
+  unsigned char frame[DIO_FRAME_SIZE];
+  memcpy(frame, data, DIO_FRAME_SIZE);
+
+	mask[0]=255;	//sets the first 8 port direction bits to 1, i.e. output
+  //	mask[1]=0;	//sets the rest of the board for input
+	mask[1]=3;	//sets ports 8 and 9 for output, 10 and 11 for input. Port 11 is reserved for the trigger and port 10 can be GPIO
+
+  //writes and configures
+	int ret = AIO_Usb_DIO_Configure (deviceIdx[board], triState, mask, frame);
+
+	if (ret > ERROR_SUCCESS){
+		cout<<endl<<"DIO_Configure Failed dev ="<<deviceIdx[board]<<", err="<<ret<<"."<<endl<<"Have you run the Access Loader?"<<endl;
+    return false;
+	}
+  return true;
+}
+
+// =============================================================================
+bool usb_dio_device::write_board(unsigned int board, const unsigned char* data){
+  unsigned char pData[DIO_FRAME_SIZE];
+  memcpy(pData, data, DIO_FRAME_SIZE);
+
+  //changed to 12 (DPM: not 14!) to accommodate 96-channel card
+  int ret = libusb_control_transfer(handle[board], USB_WRITE_TO_DEV, DIO_WRITE, 0, 0, pData, DIO_FRAME_SIZE, TIMEOUT_1_SEC);
+
+  if (ret  < 0 ){
+		cerr<<" usb_control_msg failed on WRITE_TO_DEV "<<(unsigned int)deviceIdx[board] << endl;
+		return false;
+	}
+  return true;
+}
+
+// =============================================================================
+static void release_write(frame_write* frame){
+  if (__atomic_sub_fetch(&frame->pending, 1, __ATOMIC_ACQ_REL) == 0){
+    __atomic_store_n(&frame->completed, 1, __ATOMIC_RELEASE);
+  }
+}
+
+// =============================================================================
+// called by libusb when the write to a board completed
+static void board_write_callback(libusb_transfer* transfer){
+  board_write* w = (board_write*)transfer->user_data;
+  w->timestamp = time_real();
+  w->status = transfer->status;
+  w->done = true;
+  release_write(w->frame);
+}
+
+// =============================================================================
+// handles the USB events for at most tv, or waits for the thread that handles them (the monitor thread), until the
+// frame is completed. The libusb headers of the boards have no libusb_handle_events_timeout_completed, this is its loop
+static int handle_events_completed(struct timeval* tv, int* completed){
+  int ret (0);
+  if (libusb_try_lock_events(NULL) == 0){
+    if (!__atomic_load_n(completed, __ATOMIC_ACQUIRE)){
+      ret = libusb_handle_events_locked(NULL, tv);
+    }
+    libusb_unlock_events(NULL);
+    return ret;
+  }
+  libusb_lock_event_waiters(NULL);
+  // the callbacks run with the events locked, the waiters are woken when the other thread unlocks them
+  if (!__atomic_load_n(completed, __ATOMIC_ACQUIRE) && libusb_event_handler_active(NULL)){
+    libusb_wait_for_event(NULL, tv);
+  }
+  libusb_unlock_event_waiters(NULL);
+  return 0;
+}
+
+// =============================================================================
+// handles the USB events until the callbacks of all submitted transfers ran, the transfers still pending are cancelled
+// if handling the events fails or if they are not completed after their timeout. The callbacks write to the stack of
+// write, it cannot return before
+static bool wait_writes(frame_write& frame, libusb_transfer* const transfer[], const board_write writes[], unsigned int nb){
+  bool success (true);
+  bool cancelled (false);
+  double deadline = time_monotonic() + 2 * TIMEOUT_1_SEC / 1000.0;
+  while (!__atomic_load_n(&frame.completed, __ATOMIC_ACQUIRE)){
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
+    int ret = handle_events_completed(&tv, &frame.completed);
+    if (cancelled || __atomic_load_n(&frame.completed, __ATOMIC_ACQUIRE)){
+      continue;
+    }
+    if (ret < 0 && ret != LIBUSB_ERROR_INTERRUPTED){
+      cerr<<" Handling USB events failed, err="<<ret<<"."<<endl;
+    }else if (time_monotonic() > deadline){
+      cerr<<" USB transfers not completed after their timeout."<<endl;
+    }else{
+      continue;
+    }
+    for (unsigned int b(0); b < nb; b++){
+      if (!writes[b].done){
+        libusb_cancel_transfer(transfer[b]);
+      }
+    }
+    cancelled = true;
+    success = false;
+  }
+  return success;
+}
+
+// =============================================================================
+// a single board is written with a synchronous transfer, several boards with asynchronous transfers:
+// all transfers are submitted before waiting for the first completion
+bool usb_dio_device::write(const unsigned char data[][DIO_FRAME_SIZE], double& first, double& last){
+  if (nb == 0){
+    return false;
+  }
+  if (nb == 1){
+    bool written = write_board(0, data[0]);
+    first = time_real();
+    last = first;
+    return written;
+  }
+
+  board_write writes[MAX_BOARDS];
+  frame_write frame;
+  frame.pending = nb + 1;
+  frame.completed = 0;
+  bool success (true);
+  for (unsigned int b(0); b < nb; b++){
+    writes[b].done = false;
+    writes[b].status = LIBUSB_TRANSFER_ERROR;
+    writes[b].timestamp = 0;
+    writes[b].frame = &frame;
+    libusb_fill_control_setup(buffer[b], USB_WRITE_TO_DEV, DIO_WRITE, 0, 0, DIO_FRAME_SIZE);
+    memcpy(buffer[b] + LIBUSB_CONTROL_SETUP_SIZE, data[b], DIO_FRAME_SIZE);
+    libusb_fill_control_transfer(transfer[b], handle[b], buffer[b], board_write_callback, &writes[b], TIMEOUT_1_SEC);
+    if (libusb_submit_transfer(transfer[b]) < 0){
+      cerr<<" Submitting transfer failed on WRITE_TO_DEV "<<(unsigned int)deviceIdx[b]<<endl;
+      writes[b].done = true;
+      release_write(&frame);
+      success = false;
+    }
+  }
+  // the callbacks can run in the monitor thread before the last transfer is submitted
+  release_write(&frame);
+
+  // wait for the completion of all transfers (they time out after TIMEOUT_1_SEC)
+  if (!wait_writes(frame, transfer, writes, nb)){
+    return false;
+  }
+
+  first = 0;
+  last = 0;
+  for (unsigned int b(0); b < nb; b++){
+    if (writes[b].status != LIBUSB_TRANSFER_COMPLETED){
+      cerr<<" usb_control_msg failed on WRITE_TO_DEV "<<(unsigned int)deviceIdx[b]<<endl;
+      success = false;
+      continue;
+    }
+    if (first == 0 || writes[b].timestamp < first){
+      first = writes[b].timestamp;
+    }
+    if (writes[b].timestamp > last){
+      last = writes[b].timestamp;
+    }
+  }
+  return success;
+}
+
+// =============================================================================
+bool usb_dio_device::read(unsigned int board, unsigned char* data){
+  if (board >= nb){
+    return false;
+  }
+  int ret = libusb_control_transfer(handle[board], USB_READ_FROM_DEV, DIO_READ, 0, 0, data, DIO_FRAME_SIZE, TIMEOUT_1_SEC);
+  return ret >= 0;
+}
+
+// =============================================================================
+// called by libusb when an ACCES device is unplugged
+int usb_dio_device::hotplug_callback(libusb_context* ctx, libusb_device* device, int event, void* user_data){
+  usb_dio_device* dev = (usb_dio_device*) user_data;
+  if (event == HOTPLUG_DEVICE_LEFT){
+    dev->unplugged = true;
+  }
+  return 0;
+}
+
+// =============================================================================
+// disconnections are reported by libusb hotplug events when the library and the platform support them, the callback is
+// registered by the first call (from the monitor thread). Without hotplug, disconnections are only detected by failed
+// transfers and watch only waits
+bool usb_dio_device::watch(unsigned int timeout){
+  if (!hotplug_checked){
+    hotplug_checked = true;
+    has_capability_fn has_capability = (has_capability_fn)dlsym(RTLD_DEFAULT, "libusb_has_capability");
+    register_callback_fn register_callback = (register_callback_fn)dlsym(RTLD_DEFAULT, "libusb_hotplug_register_callback");
+    if (has_capability != NULL && register_callback != NULL && has_capability(HOTPLUG_CAPABILITY)){
+      int ret = register_callback(NULL, HOTPLUG_DEVICE_LEFT, HOTPLUG_NO_FLAGS, ACCES_VENDOR_ID, HOTPLUG_MATCH_ANY, HOTPLUG_MATCH_ANY,
+        hotplug_callback, this, &hotplug_handle);
+      hotplug = (ret == LIBUSB_SUCCESS);
+    }
+    if (!hotplug){
+      cout<<"USB hotplug events unavailable, disconnections are detected by failed transfers."<<endl;
+    }
+  }
+
+  if (hotplug){
+    struct timeval tv;
+    tv.tv_sec = timeout / 1000000;
+    tv.tv_usec = timeout % 1000000;
+    libusb_handle_events_timeout(NULL, &tv);
+  }else{
+    usleep(timeout);
+  }
+  if (unplugged){
+    unplugged = false;
+    return true;
+  }
+  return false;
+}
+
+// =============================================================================
+string usb_dio_device::get_type() const{
+  return "usb";
+}
+
+
+// =============================================================================
+//            EMULATOR
+// =============================================================================
+
+emulated_dio_device::emulated_dio_device(){
+  pthread_mutex_init(&mutex, NULL);
+  nb = 0;
+  connected = true;
+  unplugged = false;
+  latency = 0;
+  memset(ports, 0, sizeof(ports));
+  memset(direction, 0, sizeof(direction));
+  for (unsigned int b(0); b < MAX_BOARDS; b++){
+    configured[b] = false;
+  }
+  // frames are recorded by the thread that writes them, which must not allocate during a pulse (see alloc_tracker.h):
+  // the ring is allocated once, and the frames of long runs overwrite the oldest ones
+  frames.resize(RECORDED_FRAMES);
+  nb_frames = 0;
+}
+
+// =============================================================================
+emulated_dio_device::~emulated_dio_device(){
+  pthread_mutex_destroy(&mutex);
+}
+
+// =============================================================================
+bool emulated_dio_device::open(unsigned int nb_required){
+  pthread_mutex_lock(&mutex);
+  bool opened = connected && nb_required <= MAX_BOARDS;
+  if (opened){
+    nb = nb_required;
+  }else{
+    nb = 0;
+  }
+  pthread_mutex_unlock(&mutex);
+  if (!opened){
+    cerr<<"Could not connect to USB-DIO-96 device."<<endl;
+    return false;
+  }
+  cout<<"USB-DIO-96 emulator: "<<nb_required<<" board(s)."<<endl;
+  return true;
+}
+
+// =============================================================================
+void emulated_dio_device::close(){
+  pthread_mutex_lock(&mutex);
+  nb = 0;
+  pthread_mutex_unlock(&mutex);
+}
+
+// =============================================================================
+unsigned int emulated_dio_device::get_nb_boards() const{
+  pthread_mutex_lock(&mutex);
+  unsigned int n = nb;
+  pthread_mutex_unlock(&mutex);
+  return n;
+}
+
+// =============================================================================
+// same port directions as the boards: ports 0-9 are outputs, ports 10 and 11 inputs
+bool emulated_dio_device::configure(unsigned int board, const unsigned char* data){
+  unsigned char toBoard[DIO_FRAME_SIZE + 2];
+  memcpy(toBoard, data, DIO_FRAME_SIZE);
+  toBoard[DIO_FRAME_SIZE] = 255;
+  toBoard[DIO_FRAME_SIZE + 1] = 3;
+  if (control_transfer(board, USB_WRITE_TO_DEV, DIO_CONFIG, toBoard, DIO_FRAME_SIZE + 2) < 0){
+    cout<<endl<<"DIO_Configure Failed on emulated board "<<board<<"."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// the boards of the emulator complete their transfers at once, after the emulated latency
+bool emulated_dio_device::write(const unsigned char data[][DIO_FRAME_SIZE], double& first, double& last){
+  pthread_mutex_lock(&mutex);
+  unsigned int n = nb;
+  unsigned int us = latency;
+  pthread_mutex_unlock(&mutex);
+  if (n == 0){
+    return false;
+  }
+  if (us > 0){
+    usleep(us);
+  }
+  bool success (true);
+  for (unsigned int b(0); b < n; b++){
+    unsigned char frame[DIO_FRAME_SIZE];
+    memcpy(frame, data[b], DIO_FRAME_SIZE);
+    if (control_transfer(b, USB_WRITE_TO_DEV, DIO_WRITE, frame, DIO_FRAME_SIZE) < 0){
+      cerr<<" usb_control_msg failed on WRITE_TO_DEV emulated board "<<b<<endl;
+      success = false;
+    }
+  }
+  first = time_real();
+  last = first;
+  return success;
+}
+
+// =============================================================================
+bool emulated_dio_device::read(unsigned int board, unsigned char* data){
+  return control_transfer(board, USB_READ_FROM_DEV, DIO_READ, data, DIO_FRAME_SIZE) >= 0;
+}
+
+// =============================================================================
+bool emulated_dio_device::watch(unsigned int timeout){
+  usleep(timeout);
+  pthread_mutex_lock(&mutex);
+  bool u = unplugged;
+  unplugged = false;
+  pthread_mutex_unlock(&mutex);
+  return u;
+}
+
+// =============================================================================
+string emulated_dio_device::get_type() const{
+  return "emulator";
+}
+
+// =============================================================================
+bool emulated_dio_device::is_output(unsigned int board, unsigned int port) const{
+  return (direction[board][port / 8] >> (port % 8)) & 1;
+}
+
+// =============================================================================
+// writes the output ports of a frame and records it (mutex must be locked)
+void emulated_dio_device::latch(unsigned int board, const unsigned char* data){
+  frame f;
+  f.timestamp = time_real();
+  f.board = board;
+  for (unsigned int p(0); p < DIO_FRAME_SIZE; p++){
+    if (is_output(board, p)){
+      ports[board][p] = data[p];
+    }
+  }
+  memcpy(f.data, ports[board], DIO_FRAME_SIZE);
+  frames[nb_frames % frames.size()] = f;
+  nb_frames++;
+}
+
+// =============================================================================
+int emulated_dio_device::control_transfer(unsigned int board, uint8_t request_type, uint8_t request, unsigned char* data, uint16_t length){
+  int ret (length);
+  pthread_mutex_lock(&mutex);
+  if (!connected){
+    ret = LIBUSB_ERROR_NO_DEVICE;
+  }else if (board >= nb || data == NULL){
+    ret = LIBUSB_ERROR_INVALID_PARAM;
+  }else if (request_type == USB_WRITE_TO_DEV && request == DIO_CONFIG && length == DIO_FRAME_SIZE + 2){
+    memcpy(direction[board], data + DIO_FRAME_SIZE, 2);
+    configured[board] = true;
+    latch(board, data);
+  }else if (!configured[board]){
+    ret = LIBUSB_ERROR_PIPE;  // a board that has not been configured stalls
+  }else if (request_type == USB_WRITE_TO_DEV && request == DIO_WRITE && length == DIO_FRAME_SIZE){
+    latch(board, data);
+  }else if (request_type == USB_READ_FROM_DEV && request == DIO_READ && length == DIO_FRAME_SIZE){
+    memcpy(data, ports[board], DIO_FRAME_SIZE);
+  }else{
+    ret = LIBUSB_ERROR_NOT_SUPPORTED;
+  }
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+
+// =============================================================================
+void emulated_dio_device::set_inputs(unsigned int board, unsigned char port10, unsigned char port11){
+  if (board >= MAX_BOARDS){
+    return;
+  }
+  pthread_mutex_lock(&mutex);
+  ports[board][10] = port10;
+  ports[board][11] = port11;
+  pthread_mutex_unlock(&mutex);
+}
+
+// =============================================================================
+vector<emulated_dio_device::frame> emulated_dio_device::get_frames() const{
+  pthread_mutex_lock(&mutex);
+  unsigned long first = (nb_frames > frames.size()) ? nb_frames - frames.size() : 0;
+  vector<frame> f;
+  f.reserve(nb_frames - first);
+  for (unsigned long i(first); i < nb_frames; i++){
+    f.push_back(frames[i % frames.size()]);
+  }
+  pthread_mutex_unlock(&mutex);
+  return f;
+}
+
+// =============================================================================
+bool emulated_dio_device::get_frame(unsigned long i, frame& f) const{
+  pthread_mutex_lock(&mutex);
+  bool found = i < nb_frames && i + frames.size() >= nb_frames;
+  if (found){
+    f = frames[i % frames.size()];
+  }
+  pthread_mutex_unlock(&mutex);
+  return found;
+}
+
+// =============================================================================
+void emulated_dio_device::clear_frames(){
+  pthread_mutex_lock(&mutex);
+  nb_frames = 0;
+  pthread_mutex_unlock(&mutex);
+}
+
+// =============================================================================
+void emulated_dio_device::set_latency(unsigned int us){
+  pthread_mutex_lock(&mutex);
+  latency = us;
+  pthread_mutex_unlock(&mutex);
+}
+
+// =============================================================================
+// unplugged boards lose their configuration, like the real boards which are powered by the USB link
+void emulated_dio_device::set_connected(bool c){
+  pthread_mutex_lock(&mutex);
+  if (connected && !c){
+    unplugged = true;
+    for (unsigned int b(0); b < MAX_BOARDS; b++){
+      configured[b] = false;
+    }
+  }
+  connected = c;
+  pthread_mutex_unlock(&mutex);
+}
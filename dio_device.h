@@ -0,0 +1,156 @@
+//
+//  dio_device.h
+//  output boards of the valve controller (USB-DIO-96, www.accesio.com), behind an interface so that the valve controller
+//  runs either with the boards (libusb) or with an in-process emulator (DEVICE keyword of the configuration file)
+//
+//  The emulator answers the control transfers of a USB-DIO-96 board (DIO_CONFIG, DIO_WRITE, DIO_READ), keeps the state
+//  of the 12 ports of each board and timestamps every output frame. Test code drives the inputs (ports 10 and 11,
+//  port 11 carries the ITC18 trigger) with set_inputs, so that the whole execution of a configuration can run without hardware.
+//
+
+#ifndef __dio_device_h
+#define __dio_device_h
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "libusb.h" ///< http://libusb.sourceforge.net/api-1.0/
+#include "vo_alias.h" // MAX_BOARDS
+
+const unsigned int DIO_FRAME_SIZE = 12; ///< ports of a USB-DIO-96 board, 0-9 are outputs, 10-11 are inputs
+
+
+class dio_device {
+
+public:
+  virtual ~dio_device();
+
+  /// \brief creates the device selected in the configuration file
+  /// \param type usb or emulator
+  /// \return the device, or NULL if the type is unknown
+  static dio_device* create(const std::string& type);
+
+  /// \brief opens the first nb boards found
+  /// \return true if nb boards could be opened
+  virtual bool open(unsigned int nb) = 0;
+
+  /// closes the boards, they can be opened again (e.g. after the USB link dropped)
+  virtual void close() = 0;
+
+  virtual unsigned int get_nb_boards() const = 0;
+
+  /// \brief sets the port directions of a board (0-9 outputs, 10-11 inputs) and writes the frame
+  virtual bool configure(unsigned int board, const unsigned char* data) = 0;
+
+  /// \brief writes one frame to each open board, boards are written concurrently
+  /// \param first, last completion times of the first and of the last board
+  virtual bool write(const unsigned char data[][DIO_FRAME_SIZE], double& first, double& last) = 0;
+
+  /// \brief reads the 12 ports of a board
+  virtual bool read(unsigned int board, unsigned char* data) = 0;
+
+  /// \brief waits up to timeout us for device events
+  /// \return true if a board was unplugged since the last call
+  virtual bool watch(unsigned int timeout) = 0;
+
+  virtual std::string get_type() const = 0;
+};
+
+
+/// USB-DIO-96 boards driven through aioUsbApi and libusb
+class usb_dio_device : public dio_device {
+
+public:
+  usb_dio_device();
+  ~usb_dio_device();
+
+  bool open(unsigned int nb);
+  void close();
+  unsigned int get_nb_boards() const;
+  bool configure(unsigned int board, const unsigned char* data);
+  bool write(const unsigned char data[][DIO_FRAME_SIZE], double& first, double& last);
+  bool read(unsigned int board, unsigned char* data);
+  bool watch(unsigned int timeout);
+  std::string get_type() const;
+
+private:
+  bool write_board(unsigned int board, const unsigned char* data);
+  static int hotplug_callback(libusb_context* ctx, libusb_device* device, int event, void* user_data);
+
+  bool initialised;  ///< AIO_Init called
+  unsigned int nb;   ///< number of boards open
+  int deviceIdx[MAX_BOARDS];
+  libusb_device_handle* handle[MAX_BOARDS];
+  libusb_transfer* transfer[MAX_BOARDS];  ///< preallocated transfers for concurrent writes
+  unsigned char buffer[MAX_BOARDS][LIBUSB_CONTROL_SETUP_SIZE + DIO_FRAME_SIZE];  ///< setup packet followed by the 12 port bytes
+  bool hotplug_checked;  ///< hotplug registration attempted
+  bool hotplug;          ///< hotplug events available on this platform
+  int hotplug_handle;     ///< libusb_hotplug_callback_handle
+  volatile bool unplugged;  ///< set by the hotplug callback
+};
+
+
+/// in-process emulator of USB-DIO-96 boards
+class emulated_dio_device : public dio_device {
+
+public:
+  /// output frame written to a board
+  struct frame {
+    double timestamp;  ///< time at which the frame was latched on the outputs
+    unsigned int board;
+    unsigned char data[DIO_FRAME_SIZE];
+  };
+
+  emulated_dio_device();
+  ~emulated_dio_device();
+
+  bool open(unsigned int nb);
+  void close();
+  unsigned int get_nb_boards() const;
+  bool configure(unsigned int board, const unsigned char* data);
+  bool write(const unsigned char data[][DIO_FRAME_SIZE], double& first, double& last);
+  bool read(unsigned int board, unsigned char* data);
+  bool watch(unsigned int timeout);
+  std::string get_type() const;
+
+  /// \brief handles a control transfer the way a USB-DIO-96 board does: DIO_CONFIG (12 port bytes followed by 2 direction bytes),
+  ///   DIO_WRITE (12 port bytes, only output ports change) and DIO_READ (12 port bytes)
+  /// \return number of bytes transferred, or a negative LIBUSB_ERROR code
+  int control_transfer(unsigned int board, uint8_t request_type, uint8_t request, unsigned char* data, uint16_t length);
+
+  /// sets the inputs of a board, port 11 carries the trigger signal of the ITC18
+  void set_inputs(unsigned int board, unsigned char port10, unsigned char port11);
+
+  /// \return the output frames written since the last call to clear_frames, in the order they were written
+  ///   (the last RECORDED_FRAMES, see dio_device.cc)
+  std::vector<frame> get_frames() const;
+  /// \brief copies the frame i written since the last call to clear_frames, without copying the others
+  /// \return false if fewer than i + 1 frames were written, or if the frame was overwritten
+  bool get_frame(unsigned long i, frame& f) const;
+  void clear_frames();
+
+  /// duration of a transfer in us (0 by default), to emulate the latency of the USB link
+  void set_latency(unsigned int us);
+
+  /// \brief emulates unplugging (false) and plugging back (true) the boards
+  void set_connected(bool c);
+
+private:
+  bool is_output(unsigned int board, unsigned int port) const;
+  void latch(unsigned int board, const unsigned char* data);
+
+  mutable pthread_mutex_t mutex;
+  unsigned int nb;      ///< number of boards open
+  bool connected;       ///< false while the boards are unplugged
+  bool unplugged;       ///< boards unplugged since the last call to watch
+  unsigned int latency; ///< duration of a transfer in us
+  unsigned char ports[MAX_BOARDS][DIO_FRAME_SIZE];
+  unsigned char direction[MAX_BOARDS][2];  ///< output mask of the ports, as written by DIO_CONFIG
+  bool configured[MAX_BOARDS];
+  std::vector<frame> frames;  ///< ring of the last output frames with their timestamp, allocated by the constructor
+  unsigned long nb_frames;    ///< frames written since the last call to clear_frames, frame i is frames[i % frames.size()]
+};
+
+#endif
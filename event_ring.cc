@@ -0,0 +1,143 @@
+//
+//  event_ring.cc
+//  events of the valves for the partners (see event_ring.h)
+//
+
+#include <cstring>
+#include <cstdio>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "event_ring.h"
+
+
+// =============================================================================
+event_ring::event_ring(){
+  memset(records, 0, sizeof(records));
+  next_seq = 1;
+  last_trigger.seq = 0;
+  last_trigger.timestamp = 0.0;
+  last_trigger.partner_timestamp = -1.0;
+  stream = NULL;
+  pthread_mutex_init(&mutex, NULL);
+  // the writer never waits for a reader, wake-ups are dropped when the pipe is full
+  if (pipe(wake) == 0){
+    fcntl(wake[0], F_SETFL, fcntl(wake[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake[1], F_SETFL, fcntl(wake[1], F_GETFL) | O_NONBLOCK);
+  }else{
+    perror("Unable to create the wake-up pipe of the events");
+    wake[0] = -1;
+    wake[1] = -1;
+  }
+}
+
+// =============================================================================
+event_ring::~event_ring(){
+  if (wake[0] >= 0){
+    close(wake[0]);
+    close(wake[1]);
+  }
+  pthread_mutex_destroy(&mutex);
+}
+
+// =============================================================================
+// signals the pipe, nothing to do if it is full: the reader has not woken up yet
+static void signal_wake(int fd){
+  char c (1);
+  if (fd >= 0 && write(fd, &c, 1) < 0){
+    return;
+  }
+}
+
+// =============================================================================
+void event_ring::attach_stream(shm_stream* stream){
+  this->stream = stream;
+}
+
+// =============================================================================
+void event_ring::push(const data_packet& data){
+  pthread_mutex_lock(&mutex);
+  event_record& r = records[next_seq % EVENT_RING_SIZE];
+  r.seq = next_seq;
+  r.data = data;
+  next_seq++;
+  pthread_mutex_unlock(&mutex);
+  if (stream != NULL){
+    stream->publish(SHM_PULSE, &data, sizeof(data));
+  }
+  signal_wake(wake[1]);
+}
+
+// =============================================================================
+unsigned int event_ring::read(uint64_t& cursor, event_record* out, unsigned int max, uint32_t& lost){
+  pthread_mutex_lock(&mutex);
+  // oldest event still in the ring
+  uint64_t oldest = (next_seq > EVENT_RING_SIZE) ? next_seq - EVENT_RING_SIZE : 1;
+  lost = 0;
+  if (cursor < oldest){
+    lost = oldest - cursor;
+    cursor = oldest;
+  }
+  unsigned int n (0);
+  while (cursor < next_seq && n < max){
+    out[n++] = records[cursor % EVENT_RING_SIZE];
+    cursor++;
+  }
+  pthread_mutex_unlock(&mutex);
+  return n;
+}
+
+// =============================================================================
+uint64_t event_ring::get_next_seq(){
+  pthread_mutex_lock(&mutex);
+  uint64_t seq = next_seq;
+  pthread_mutex_unlock(&mutex);
+  return seq;
+}
+
+// =============================================================================
+void event_ring::push_trigger(double timestamp, double partner_timestamp){
+  pthread_mutex_lock(&mutex);
+  last_trigger.seq++;
+  last_trigger.timestamp = timestamp;
+  last_trigger.partner_timestamp = partner_timestamp;
+  trigger_ack ack = last_trigger;
+  pthread_mutex_unlock(&mutex);
+  if (stream != NULL){
+    stream->publish(SHM_TRIGGER, &ack, sizeof(ack));
+  }
+  signal_wake(wake[1]);
+}
+
+// =============================================================================
+bool event_ring::read_trigger(uint64_t& cursor, trigger_ack& ack){
+  pthread_mutex_lock(&mutex);
+  bool found = (last_trigger.seq >= cursor);
+  if (found){
+    ack = last_trigger;
+    cursor = last_trigger.seq + 1;
+  }
+  pthread_mutex_unlock(&mutex);
+  return found;
+}
+
+// =============================================================================
+uint64_t event_ring::get_next_trigger(){
+  pthread_mutex_lock(&mutex);
+  uint64_t seq = last_trigger.seq + 1;
+  pthread_mutex_unlock(&mutex);
+  return seq;
+}
+
+// =============================================================================
+int event_ring::get_wake_fd(){
+  return wake[0];
+}
+
+// =============================================================================
+void event_ring::clear_wake(){
+  char buffer[64];
+  while (wake[0] >= 0 && ::read(wake[0], buffer, sizeof(buffer)) > 0){
+  }
+}
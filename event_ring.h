@@ -0,0 +1,67 @@
+//
+//  event_ring.h
+//  events of the valves for the partners: a bounded ring of data_packet with sequence numbers
+//
+//  The scheduler pushes an event at every change of the valves (start and end of the pulses). Every connection of a
+//  partner reads the ring with its own cursor, the sequence number of the next event it has not read yet, so a partner
+//  does not miss an event that another one read, nor an event that a later one replaced. When a partner lags behind by
+//  more than EVENT_RING_SIZE events, the oldest ones are lost and counted for that partner.
+//  The last trigger is kept as well, for the acknowledgements of the push mode. Every event and trigger is signaled on
+//  a pipe (get_wake_fd), so that a subscribed partner is served as soon as something happens. The events and the
+//  triggers are also written to the shared memory stream, when there is one (see shm_stream.h).
+//
+
+#ifndef __event_ring_h
+#define __event_ring_h
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "data_format.h"
+#include "shm_stream.h"
+
+class event_ring {
+
+public:
+  event_ring();
+  ~event_ring();
+
+  /// \brief events and triggers are also published on stream from now on
+  void attach_stream(shm_stream* stream);
+
+  /// \brief adds an event, the oldest one is overwritten when the ring is full (does not allocate)
+  void push(const data_packet& data);
+
+  /// \brief copies the events from sequence number cursor on, and moves the cursor past them
+  /// \param lost events that were overwritten before the reader reached them
+  /// \return number of records copied, at most max
+  unsigned int read(uint64_t& cursor, event_record* records, unsigned int max, uint32_t& lost);
+
+  /// \return sequence number of the next event, cursor of a reader that only wants the events to come
+  uint64_t get_next_seq();
+
+  /// \brief records a trigger, only the last one is kept (does not allocate)
+  void push_trigger(double timestamp, double partner_timestamp);
+
+  /// \brief last trigger, if its sequence number is cursor or later; cursor is moved past it
+  bool read_trigger(uint64_t& cursor, trigger_ack& ack);
+
+  /// \return sequence number of the next trigger
+  uint64_t get_next_trigger();
+
+  /// \return descriptor readable when an event or a trigger was pushed, see clear_wake
+  int get_wake_fd();
+
+  /// \brief empties the wake-up pipe, before the events are read
+  void clear_wake();
+
+private:
+  event_record records[EVENT_RING_SIZE];  ///< event seq is at index seq % EVENT_RING_SIZE
+  uint64_t next_seq;
+  trigger_ack last_trigger;
+  int wake[2];  ///< pipe, a byte is written for every event and trigger
+  shm_stream* stream;  ///< NULL without stream
+  pthread_mutex_t mutex;
+};
+
+#endif
@@ -0,0 +1,215 @@
+//
+//  event_scheduler.cc
+//  timer wheel and executors of the scheduler (see event_scheduler.h)
+//
+
+#include <iostream>
+#include <cmath>
+
+#include "event_scheduler.h"
+#include "valve_controller.h" // start_thread
+
+using namespace std;
+
+
+// =============================================================================
+timer_wheel::timer_wheel(double origin){
+  this->origin = origin;
+  current = 0;
+  count = 0;
+  for (unsigned int s(0); s < WHEEL_SLOTS; s++){
+    slots[s] = -1;
+  }
+  for (unsigned int n(0); n < WHEEL_CAPACITY; n++){
+    nodes[n].next = (n + 1 < WHEEL_CAPACITY) ? n + 1 : -1;
+  }
+  free_nodes = 0;
+}
+
+// =============================================================================
+long timer_wheel::tick_of(double t){
+  return (long)floor((t - origin) / WHEEL_TICK);
+}
+
+// =============================================================================
+bool timer_wheel::schedule(const scheduled_action& a){
+  if (free_nodes == -1){
+    return false;
+  }
+  int n = free_nodes;
+  free_nodes = nodes[n].next;
+  nodes[n].action = a;
+  nodes[n].tick = max(tick_of(a.due), current);
+  nodes[n].next = -1;
+
+  // appended at the end of its slot, so that actions due at the same time keep their order
+  int* link = &slots[nodes[n].tick % WHEEL_SLOTS];
+  while (*link != -1){
+    link = &nodes[*link].next;
+  }
+  *link = n;
+  count++;
+  return true;
+}
+
+// =============================================================================
+bool timer_wheel::next_due(double& due){
+  if (count == 0){
+    return false;
+  }
+  // first slot of the current turn that has an action for its tick
+  for (long t(current); t < current + (long)WHEEL_SLOTS; t++){
+    bool found (false);
+    for (int n = slots[t % WHEEL_SLOTS]; n != -1; n = nodes[n].next){
+      if (nodes[n].tick == t && (!found || nodes[n].action.due < due)){
+        due = nodes[n].action.due;
+        found = true;
+      }
+    }
+    if (found){
+      return true;
+    }
+  }
+  // all the actions are due after this turn
+  bool found (false);
+  for (unsigned int s(0); s < WHEEL_SLOTS; s++){
+    for (int n = slots[s]; n != -1; n = nodes[n].next){
+      if (!found || nodes[n].action.due < due){
+        due = nodes[n].action.due;
+        found = true;
+      }
+    }
+  }
+  return found;
+}
+
+// =============================================================================
+bool timer_wheel::pop(double now, scheduled_action& a){
+  // actions scheduled in the past are in the current tick
+  long now_tick = max(tick_of(now), current);
+  if (count == 0){
+    current = now_tick;
+    return false;
+  }
+  while (current <= now_tick){
+    // earliest action of the current tick, the slot also holds the actions of the next turns
+    int* best_link (NULL);
+    for (int* link = &slots[current % WHEEL_SLOTS]; *link != -1; link = &nodes[*link].next){
+      if (nodes[*link].tick == current && (best_link == NULL || nodes[*link].action.due < nodes[*best_link].action.due)){
+        best_link = link;
+      }
+    }
+    if (best_link != NULL){
+      int n = *best_link;
+      if (nodes[n].action.due > now){
+        // later in the current tick
+        return false;
+      }
+      *best_link = nodes[n].next;
+      a = nodes[n].action;
+      nodes[n].next = free_nodes;
+      free_nodes = n;
+      count--;
+      return true;
+    }
+    current++;
+  }
+  return false;
+}
+
+// =============================================================================
+unsigned int timer_wheel::size(){
+  return count;
+}
+
+
+// =============================================================================
+action_executor::action_executor(){
+  jobs.resize(EXECUTOR_CAPACITY);
+  head = 0;
+  tail = 0;
+  pthread_mutex_init(&mutex, NULL);
+  stopping = false;
+  started = false;
+  config = NULL;
+  name = "";
+  run = NULL;
+  context = NULL;
+}
+
+// =============================================================================
+action_executor::~action_executor(){
+  stop();
+  pthread_mutex_destroy(&mutex);
+}
+
+// =============================================================================
+bool action_executor::start(Configuration& config, const char* name, run_function run, void* context){
+  this->config = &config;
+  this->name = name;
+  this->run = run;
+  this->context = context;
+  stopping = false;
+  if (pthread_create(&thread, NULL, thread_function, this) != 0){
+    cerr<<"Could not start the "<<name<<" executor."<<endl;
+    return false;
+  }
+  started = true;
+  return true;
+}
+
+// =============================================================================
+void action_executor::post(const executor_job& job){
+  pthread_mutex_lock(&mutex);
+  while ((tail + 1) % EXECUTOR_CAPACITY == head){
+    pthread_mutex_unlock(&mutex);
+    space_event.wait();
+    pthread_mutex_lock(&mutex);
+  }
+  jobs[tail] = job;
+  tail = (tail + 1) % EXECUTOR_CAPACITY;
+  pthread_mutex_unlock(&mutex);
+  job_event.signal();
+}
+
+// =============================================================================
+void action_executor::stop(){
+  if (!started){
+    return;
+  }
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_mutex_unlock(&mutex);
+  job_event.signal();
+  pthread_join(thread, NULL);
+  started = false;
+}
+
+// =============================================================================
+void* action_executor::thread_function(void* ptr_to_executor){
+  action_executor* e = (action_executor*) ptr_to_executor;
+  start_thread(*e->config, e->name);
+  executor_job job;
+  while (true){
+    pthread_mutex_lock(&e->mutex);
+    // the event is only a wake-up, the queue is checked again before waiting
+    while (e->head == e->tail && !e->stopping){
+      pthread_mutex_unlock(&e->mutex);
+      e->job_event.wait();
+      pthread_mutex_lock(&e->mutex);
+    }
+    if (e->head == e->tail){
+      // stopping, and nothing left to execute
+      pthread_mutex_unlock(&e->mutex);
+      return NULL;
+    }
+    bool was_full = ((e->tail + 1) % EXECUTOR_CAPACITY == e->head);
+    job = e->jobs[e->head];
+    e->head = (e->head + 1) % EXECUTOR_CAPACITY;
+    pthread_mutex_unlock(&e->mutex);
+    if (was_full){
+      e->space_event.signal();
+    }
+    e->run(job, e->context);
+  }
+}
@@ -0,0 +1,129 @@
+//
+//  event_scheduler.h
+//  timer wheel of the scheduler and executors of the actions it hands over (see execute_config_instructions)
+//
+//  Every instruction gets an absolute due time (time_monotonic) on the timeline of the run: the end of a pulse is due
+//  its duration after the valves opened, WAIT moves the timeline, MFCSET changes a set point. The scheduler thread
+//  takes the due actions from the wheel and drives the valves itself (the trigger latency does not include a thread
+//  switch), the other resources have their own executor thread:
+//
+//    valves    scheduler thread   pulses and interval air
+//    setpoint  action_executor    MFCSET and MFCSET2 on the serial port
+//    logger    action_executor    lines of the logfile
+//
+//  Actions of different resources overlap: the set point of the next pulse goes out while the valves of the current
+//  one are open when its MFC does not feed the flies, and writing the logfile never delays a valve.
+//  The wheel and the queues of the executors are allocated once, scheduling and posting do not allocate.
+//
+
+#ifndef __event_scheduler_h
+#define __event_scheduler_h
+
+#include <vector>
+#include <pthread.h>
+
+#include "pthread_event.h"
+#include "configuration.h"
+
+const double WHEEL_TICK = 0.001;  ///< width of a slot of the wheel, in s
+const unsigned int WHEEL_SLOTS = 1024;  ///< one turn of the wheel, actions due later wait in their slot for the next turns
+const unsigned int WHEEL_CAPACITY = 256;  ///< actions pending at the same time
+const unsigned int EXECUTOR_CAPACITY = 256;  ///< jobs queued per executor, post() waits when the queue is full
+const unsigned int LOG_MESSAGE_SIZE = 256;  ///< longest line of the logfile written during a pulse
+
+enum action_type {
+  ACTION_INTERVAL,  ///< end of a pulse, interval air (info: NULL)
+  ACTION_MFCSET,    ///< set point of an MFC (info: flowchange)
+  ACTION_MFCSET2,   ///< set points of carrier and boost (info: double_flowchange)
+  ACTION_LOG        ///< line of the logfile (text of the job)
+};
+
+/// action on the timeline of the run
+struct scheduled_action{
+  int type;     ///< action_type
+  double due;   ///< time_monotonic at which the action is executed
+  void* info;   ///< einfo of the instruction, the instruction table keeps it alive
+};
+
+/// action handed to an executor
+struct executor_job{
+  scheduled_action action;
+  char text[LOG_MESSAGE_SIZE];
+};
+
+
+/// hashed timer wheel: an action goes to the slot of its tick, and is taken when the wheel reaches that tick
+class timer_wheel {
+
+public:
+  /// \param origin time of tick 0 (time_monotonic)
+  explicit timer_wheel(double origin);
+
+  /// \brief adds an action, an action already due is taken at the next pop
+  /// \return false if the wheel is full
+  bool schedule(const scheduled_action& a);
+
+  /// \return false if no action is pending, otherwise due is the time of the earliest one
+  bool next_due(double& due);
+
+  /// \brief takes the earliest action due at time now, actions due at the same time are taken in the order they were scheduled
+  /// \return false if no action is due
+  bool pop(double now, scheduled_action& a);
+
+  unsigned int size();
+
+private:
+  long tick_of(double t);
+
+  struct node{
+    scheduled_action action;
+    long tick;  ///< absolute tick, the slot is tick % WHEEL_SLOTS
+    int next;   ///< next node of the slot, or of the free list
+  };
+
+  node nodes[WHEEL_CAPACITY];
+  int slots[WHEEL_SLOTS];  ///< first node of each slot
+  int free_nodes;
+  long current;  ///< tick reached by the wheel
+  unsigned int count;
+  double origin;
+};
+
+
+/// thread that executes the jobs of a resource in the order they are posted
+class action_executor {
+
+public:
+  typedef void (*run_function)(const executor_job& job, void* context);
+
+  action_executor();
+  ~action_executor();
+
+  /// \brief starts the thread, with the THREAD policy of name (see rt_thread.h)
+  bool start(Configuration& config, const char* name, run_function run, void* context);
+
+  /// \brief queues a job, waits if the queue is full (the executor is late by EXECUTOR_CAPACITY jobs)
+  void post(const executor_job& job);
+
+  /// \brief executes the jobs already queued, then ends the thread
+  void stop();
+
+private:
+  static void* thread_function(void* ptr_to_executor);
+
+  std::vector <executor_job> jobs;  ///< ring of queued jobs
+  unsigned int head;  ///< next job to execute
+  unsigned int tail;  ///< next free place
+  pthread_mutex_t mutex;
+  pthread_event job_event;  ///< a job was posted, or the executor is stopping
+  pthread_event space_event;  ///< a job was taken from a full queue
+  bool stopping;
+  bool started;
+  pthread_t thread;
+  Configuration* config;
+  const char* name;
+  run_function run;
+  void* context;
+};
+
+#endif
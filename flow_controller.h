@@ -28,6 +28,9 @@ struct flow_data{
   std::string gas;
 };
 
+/// parses a data line of a mass flow controller: ID pressure temperature volumetric_flow mass_flow setpoint gas
+bool parse_mfc_data(std::stringstream& ss, flow_data& flow);
+
 
 class FlowController{
 
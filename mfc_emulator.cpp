@@ -0,0 +1,325 @@
+//
+//  mfc_emulator.cpp
+//  emulates a serial bus of mass flow controllers on a pseudo-terminal, so that FlowController, the rs232 functions
+//  and the MFC thread of the valve controller can run (and be load-tested) without controllers
+//
+//  usage: mfc_emulator [-b baudrate] [-l link] MFC [MFC ...]
+//    MFC      addr,range[,latency_ms[,drop_rate[,tau_s]]]  e.g. B,5,10,0.01,0.3
+//             addr and range as for the MFC keyword of the configuration file, latency_ms is the time the controller
+//             takes to answer (default 0), drop_rate the fraction of answers that are lost (default 0), tau_s the
+//             time constant with which the flow settles on the setpoint (default 0: immediately)
+//    -b       baud rate of the emulated line (default 19200, as FlowController), every byte takes 10 bits
+//    -l       symbolic link to the pseudo-terminal, to be used as COMPORT in the configuration file
+//
+//  commands answered (Alicat protocol, as sent by FlowController):
+//    addr\r              data line: addr pressure temperature volumetric_flow mass_flow setpoint gas
+//    addr<setpoint>\r    sets the setpoint (in 1/64000 of the range) and answers the data line
+//    *@=addr\r           changes the address of the controllers, no answer
+//    *rNNN\r  *RNN=\r    reads a register, every controller answers "addr NNN = value"
+//    *WNN=value\r        writes a register, no answer
+//
+//  the statistics of each controller are printed when the emulator is stopped (CTRL+C)
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+
+#include "utils.h"
+
+using namespace std;
+
+const int DEFAULT_BAUDRATE = 19200; ///< baud rate of FlowController
+const int FULL_SCALE_FLOW = 64000;  ///< setpoint that corresponds to the range of the controller
+const unsigned int BITS_PER_BYTE = 10; ///< 8N1: start bit, 8 data bits, stop bit
+const double IDLE_WAIT = 0.001;    ///< s, longest sleep of the main loop
+
+/// emulated mass flow controller
+struct emulated_mfc{
+  char addr;
+  unsigned int range;  ///< SLPM
+  double latency;      ///< time in s between the end of a command and the start of the answer
+  double drop_rate;    ///< fraction of answers that are lost
+  double tau;          ///< time constant in s of the flow
+  double setpoint;     ///< SLPM
+  double flow;         ///< SLPM
+  map <int, int> registers;
+  unsigned long commands;
+  unsigned long replies;
+  unsigned long dropped;
+};
+
+static volatile bool stop = false;
+
+
+// =============================================================================
+void stop_emulator(int sig){
+  stop = true;
+}
+
+// =============================================================================
+// parses addr,range[,latency_ms[,drop_rate[,tau_s]]]
+bool parse_mfc(const string& arg, emulated_mfc& mfc){
+  vector <string> fields;
+  stringstream ss(arg);
+  string field;
+  while (getline(ss, field, ',')){
+    fields.push_back(field);
+  }
+  if (fields.size() < 2 || fields.size() > 5 || fields[0].size() != 1){
+    cerr<<"Invalid controller: "<<arg<<" (addr,range[,latency_ms[,drop_rate[,tau_s]]])"<<endl;
+    return false;
+  }
+  mfc.addr = fields[0][0];
+  mfc.range = atoi(fields[1].c_str());
+  mfc.latency = fields.size() > 2 ? atof(fields[2].c_str()) / 1000 : 0;
+  mfc.drop_rate = fields.size() > 3 ? atof(fields[3].c_str()) : 0;
+  mfc.tau = fields.size() > 4 ? atof(fields[4].c_str()) : 0;
+  mfc.setpoint = 0;
+  mfc.flow = 0;
+  mfc.commands = 0;
+  mfc.replies = 0;
+  mfc.dropped = 0;
+  if (mfc.range == 0 || mfc.latency < 0 || mfc.drop_rate < 0 || mfc.drop_rate > 1 || mfc.tau < 0){
+    cerr<<"Invalid controller: "<<arg<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// data line of a controller, in the format read by parse_mfc_data (flow_controller.cpp)
+string data_line(const emulated_mfc& mfc){
+  char line[128];
+  snprintf(line, sizeof(line), "%c +014.70 +025.00 %+08.3f %+08.3f %+08.3f Air\r", mfc.addr, mfc.flow, mfc.flow, mfc.setpoint);
+  return line;
+}
+
+// =============================================================================
+// first-order settling of the flow on the setpoint
+void settle(vector <emulated_mfc>& mfcs, double dt){
+  for (unsigned int i(0); i < mfcs.size(); i++){
+    if (mfcs[i].tau == 0){
+      mfcs[i].flow = mfcs[i].setpoint;
+    }else{
+      mfcs[i].flow += (mfcs[i].setpoint - mfcs[i].flow) * (1 - exp(-dt / mfcs[i].tau));
+    }
+  }
+}
+
+// =============================================================================
+// queues the answer of a controller, unless it is dropped
+void answer(emulated_mfc& mfc, const string& text, double end_of_command, multimap <double, string>& pending){
+  if (mfc.drop_rate > 0 && rand() < mfc.drop_rate * ((double)RAND_MAX + 1)){
+    mfc.dropped++;
+    return;
+  }
+  mfc.replies++;
+  pending.insert(make_pair(end_of_command + mfc.latency, text));
+}
+
+// =============================================================================
+// executes a command received at time t (end of the line terminator on the emulated line)
+void execute(const string& cmd, double t, vector <emulated_mfc>& mfcs, multimap <double, string>& pending){
+  if (cmd.empty()){
+    return;
+  }
+  if (cmd[0] == '*'){
+    // broadcast commands, every controller executes them
+    for (unsigned int i(0); i < mfcs.size(); i++){
+      emulated_mfc& mfc = mfcs[i];
+      mfc.commands++;
+      if (cmd.compare(0, 3, "*@=") == 0 && cmd.size() == 4){
+        mfc.addr = cmd[3];
+      }else if (cmd.size() > 2 && (cmd[1] == 'r' || cmd[1] == 'R')){
+        int reg = atoi(cmd.c_str() + 2);
+        answer(mfc, string(1, mfc.addr) + " " + to_stringHP(reg, 0, 3, '0') + " = " + to_string(mfc.registers[reg]) + "\r", t, pending);
+      }else if (cmd.size() > 2 && cmd[1] == 'W' && cmd.find('=') != string::npos){
+        int reg = atoi(cmd.c_str() + 2);
+        mfc.registers[reg] = atoi(cmd.c_str() + cmd.find('=') + 1);
+      }
+    }
+    return;
+  }
+
+  for (unsigned int i(0); i < mfcs.size(); i++){
+    emulated_mfc& mfc = mfcs[i];
+    if (mfc.addr != cmd[0]){
+      continue;
+    }
+    mfc.commands++;
+    string value = cmd.substr(1);
+    if (!value.empty()){
+      if (value.find_first_not_of("0123456789") != string::npos){
+        return; // unknown command
+      }
+      mfc.setpoint = atoi(value.c_str()) * (double)mfc.range / FULL_SCALE_FLOW;
+    }
+    answer(mfc, data_line(mfc), t, pending);
+    return;
+  }
+}
+
+// =============================================================================
+// creates the pseudo-terminal, returns the master, the slave is kept open (in raw mode) so that the master
+// does not report a hang-up between two runs of the valve controller
+int open_pty(string& slave_name, int& slave){
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1){
+    perror("Could not create pseudo-terminal");
+    return -1;
+  }
+  slave_name = ptsname(master);
+  slave = open(slave_name.c_str(), O_RDWR | O_NOCTTY);
+  if (slave == -1){
+    perror("Could not open pseudo-terminal");
+    close(master);
+    return -1;
+  }
+  termios settings;
+  tcgetattr(slave, &settings);
+  cfmakeraw(&settings);
+  tcsetattr(slave, TCSANOW, &settings);
+  return master;
+}
+
+
+// =============================================================================
+//            MAIN
+// =============================================================================
+
+int main(int argc, char* argv[]){
+
+  int baudrate (DEFAULT_BAUDRATE);
+  string link;
+  vector <emulated_mfc> mfcs;
+  for (int i(1); i < argc; i++){
+    string arg = argv[i];
+    if (arg == "-b" && i + 1 < argc){
+      baudrate = atoi(argv[++i]);
+    }else if (arg == "-l" && i + 1 < argc){
+      link = argv[++i];
+    }else{
+      emulated_mfc mfc;
+      if (!parse_mfc(arg, mfc)){
+        return 1;
+      }
+      mfcs.push_back(mfc);
+    }
+  }
+  if (mfcs.empty() || baudrate <= 0){
+    cerr<<"Usage: "<<argv[0]<<" [-b baudrate] [-l link] addr,range[,latency_ms[,drop_rate[,tau_s]]] [...]"<<endl;
+    return 1;
+  }
+
+  string slave_name;
+  int slave (-1);
+  int master = open_pty(slave_name, slave);
+  if (master == -1){
+    return 1;
+  }
+  if (!link.empty()){
+    struct stat st;
+    if (lstat(link.c_str(), &st) == 0 && S_ISLNK(st.st_mode)){
+      unlink(link.c_str());
+    }
+    if (symlink(slave_name.c_str(), link.c_str()) == -1){
+      perror("Could not create link to pseudo-terminal");
+      return 1;
+    }
+  }
+  cout<<"MFC bus emulated on "<<(link.empty() ? slave_name : link + " -> " + slave_name)<<" at "<<baudrate<<" baud, "<<mfcs.size()<<" controller(s)."<<endl;
+
+  signal(SIGINT, stop_emulator);
+  signal(SIGTERM, stop_emulator);
+
+  const double byte_time = BITS_PER_BYTE / (double)baudrate;
+  multimap <double, string> pending;  ///< answers by time at which they start on the line
+  string out;               ///< bytes on their way to the host
+  double next_out (0.0);    ///< time at which the next byte of out is delivered
+  double rx_free (0.0);     ///< time at which the line from the host is free
+  string cmd;
+  double last = time_monotonic();
+
+  while (!stop){
+    double now = time_monotonic();
+    settle(mfcs, now - last);
+    last = now;
+
+    // answers go out one after the other, each byte takes byte_time on the line
+    while (!pending.empty() && pending.begin()->first <= now){
+      if (out.empty() && next_out < pending.begin()->first){
+        next_out = pending.begin()->first;
+      }
+      out += pending.begin()->second;
+      pending.erase(pending.begin());
+    }
+    unsigned int n (0);
+    while (n < out.size() && next_out + byte_time <= now){
+      next_out += byte_time;
+      n++;
+    }
+    if (n > 0){
+      if (write(master, out.data(), n) != (ssize_t)n){
+        perror("Could not write to pseudo-terminal");
+      }
+      out.erase(0, n);
+    }
+
+    // sleep until the next byte or answer is due, or a command arrives
+    double wait = IDLE_WAIT;
+    if (!out.empty()){
+      wait = min(wait, next_out + byte_time - now);
+    }
+    if (!pending.empty()){
+      wait = min(wait, pending.begin()->first - now);
+    }
+    wait = max(wait, 0.0);
+    timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = wait * 1000000;
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(master, &set);
+    if (select(master + 1, &set, NULL, NULL, &tv) <= 0){
+      continue;
+    }
+
+    char buf[256];
+    ssize_t received = read(master, buf, sizeof(buf));
+    now = time_monotonic();
+    for (ssize_t i(0); i < received; i++){
+      // the host writes faster than the line: bytes arrive at the baud rate
+      rx_free = max(rx_free, now) + byte_time;
+      if (buf[i] == '\r'){
+        execute(cmd, rx_free, mfcs, pending);
+        cmd.clear();
+      }else{
+        cmd += buf[i];
+      }
+    }
+  }
+
+  cout<<endl<<"addr commands replies dropped setpoint flow"<<endl;
+  for (unsigned int i(0); i < mfcs.size(); i++){
+    cout<<mfcs[i].addr<<" "<<mfcs[i].commands<<" "<<mfcs[i].replies<<" "<<mfcs[i].dropped<<" "<<to_stringHP(mfcs[i].setpoint, 3)<<" "<<to_stringHP(mfcs[i].flow, 3)<<endl;
+  }
+  if (!link.empty()){
+    unlink(link.c_str());
+  }
+  close(slave);
+  close(master);
+  return 0;
+}
@@ -0,0 +1,367 @@
+//
+//  micro_bench.cpp
+//  micro-benchmarks of the helpers on the critical paths of the valve controller (make micro_bench):
+//  alias lookup, frame building and set_channel, parsing of MFC data lines, string formatting of the logfile,
+//  retrieval of instructions and wake-up of pthread_event
+//
+//  usage: micro_bench [-n iterations] [-r rig]
+//    -n  iterations of each benchmark (default 100000, the wake-up benchmark runs a tenth of them)
+//    -r  rig profile of the aliases (default behavior)
+//
+//  prints ns/op and allocations/op of each benchmark. Allocations are counted by the global operator new of
+//  this program, in all threads.
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <new>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "valve_controller.h"
+#include "flow_controller.h"
+#include "utils.h"
+
+using namespace std;
+
+const unsigned int DEFAULT_ITERATIONS = 100000;
+const unsigned int WARMUP_ITERATIONS = 1000;
+const unsigned int WAKE_DIVIDER = 10; // the wake-up benchmark switches threads twice per iteration
+const unsigned int NB_BENCH_PULSES = 100; // pulses of the configuration used by get_instruction
+
+static volatile unsigned long nb_allocations = 0;
+static volatile unsigned long sink = 0; // results of the benchmarks, so that they are not optimized away
+
+
+// =============================================================================
+// counts the allocations of the whole program
+void* operator new(size_t size){
+  __sync_fetch_and_add(&nb_allocations, 1);
+  void* p = malloc(size ? size : 1);
+  if (p == NULL){
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size){
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept{
+  free(p);
+}
+
+void operator delete[](void* p) noexcept{
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept{
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept{
+  free(p);
+}
+
+
+/// benchmark: op is run iterations times on arg
+struct bench_case{
+  std::string name;
+  void (*op)(void*);
+  void* arg;
+  unsigned int divider;  ///< the benchmark runs iterations / divider times
+};
+
+/// state of the benchmarks that need more than an argument
+struct frame_arg{
+  const valve_mask* mask;
+  unsigned int nb_boards;
+};
+
+struct channel_arg{
+  dio_boards* boards;
+  emulated_dio_device* emulator;
+  const valve_mask* mask;
+  unsigned long count;
+};
+
+struct mfc_line_arg{
+  std::string line;
+  std::stringstream ss;
+};
+
+struct wake_arg{
+  pthread_event ping;
+  pthread_event pong;
+  volatile bool stop;
+};
+
+
+// =============================================================================
+void bench_parse_alias(void* arg){
+  sink += valve_alias::parse_alias(*(string*)arg).size();
+}
+
+// =============================================================================
+void bench_lookup(void* arg){
+  sink += (unsigned long)valve_alias::lookup(*(string*)arg);
+}
+
+// =============================================================================
+// frame building of set_channel, without the write to the boards
+void bench_frame(void* arg){
+  frame_arg* a = (frame_arg*) arg;
+  if (!valve_alias::check_frame(*a->mask)){
+    return;
+  }
+  unsigned char data[MAX_BOARDS][DIO_FRAME_SIZE];
+  for (unsigned int b(0); b < a->nb_boards; b++){
+    a->mask->to_ports(b, data[b]);
+    data[b][8] = 0;
+    data[b][9] = 1;
+    data[b][10] = 0;
+    data[b][11] = 0;
+  }
+  sink += data[0][0];
+}
+
+// =============================================================================
+void bench_set_channel(void* arg){
+  channel_arg* a = (channel_arg*) arg;
+  double skew (0.0);
+  sink += (set_channel(*a->boards, *a->mask, a->count & 1, skew) > 0);
+  // the emulator records every frame, the vector keeps its capacity when it is cleared
+  if (++a->count % 1024 == 0){
+    a->emulator->clear_frames();
+  }
+}
+
+// =============================================================================
+void bench_parse_mfc_data(void* arg){
+  mfc_line_arg* a = (mfc_line_arg*) arg;
+  flow_data flow;
+  sink += parse_mfc_data(a->ss, flow);
+}
+
+// =============================================================================
+void bench_chop_line(void* arg){
+  vector <string> words;
+  sink += chop_line(((mfc_line_arg*)arg)->line, words);
+}
+
+// =============================================================================
+void bench_to_stringHP(void* arg){
+  sink += to_stringHP(*(double*)arg, 5).size();
+}
+
+// =============================================================================
+void bench_datetime(void* arg){
+  sink += UNIX_to_datetime(*(double*)arg).size();
+}
+
+// =============================================================================
+void bench_datetime_format(void* arg){
+  sink += UNIX_to_datetime(*(double*)arg, "%Y%m%d-%H%M").size();
+}
+
+// =============================================================================
+void bench_get_instruction(void* arg){
+  Configuration* config = (Configuration*) arg;
+  instruct command;
+  sink += config->get_instruction(sink % config->get_nb_instructions(), command);
+}
+
+// =============================================================================
+void bench_signal_wait(void* arg){
+  pthread_event* event = (pthread_event*) arg;
+  event->signal();
+  event->wait();
+}
+
+// =============================================================================
+void* pong_thread(void* ptr_to_param){
+  wake_arg* a = (wake_arg*) ptr_to_param;
+  while (true){
+    a->ping.wait();
+    if (a->stop){
+      return NULL;
+    }
+    a->pong.signal();
+  }
+}
+
+// =============================================================================
+// round trip through another thread: two wake-ups per iteration
+void bench_wake(void* arg){
+  wake_arg* a = (wake_arg*) arg;
+  a->ping.signal();
+  a->pong.wait();
+}
+
+// =============================================================================
+void run_bench(const bench_case& bench, unsigned int iterations){
+  unsigned int n = max(1u, iterations / bench.divider);
+  for (unsigned int i(0); i < WARMUP_ITERATIONS / bench.divider; i++){
+    bench.op(bench.arg);
+  }
+  unsigned long allocations = nb_allocations;
+  double start = time_monotonic();
+  for (unsigned int i(0); i < n; i++){
+    bench.op(bench.arg);
+  }
+  double elapsed = time_monotonic() - start;
+  allocations = nb_allocations - allocations;
+  cout<<bench.name<<" "<<n<<" "<<to_stringHP(elapsed * 1e9 / n, 1)<<" "<<to_stringHP((double)allocations / n, 2)<<endl;
+}
+
+// =============================================================================
+// configuration with pulses, read like the one of the rig, the MFCs are on a pseudo-terminal that never answers
+bool load_config(Configuration& config, const string& rig, const string& dir, int& pty){
+  pty = posix_openpt(O_RDWR | O_NOCTTY);
+  if (pty == -1 || grantpt(pty) == -1 || unlockpt(pty) == -1){
+    perror("Could not create pseudo-terminal");
+    return false;
+  }
+  string filename = dir + "/micro_bench.config";
+  ofstream f(filename.c_str());
+  f<<"RIG "<<rig<<endl;
+  f<<"DEVICE emulator"<<endl;
+  f<<"LOGFILE "<<dir<<"/micro_bench.log"<<endl;
+  f<<"MFCLOG "<<dir<<"/micro_bench_mfc.log"<<endl;
+  f<<"COMPORT "<<ptsname(pty)<<endl;
+  f<<"MFC A 5 C"<<endl;
+  f<<"MFC B 5 B"<<endl;
+  f<<"MFC C 1 1"<<endl;
+  f<<"PARTNER Igor"<<endl;
+  f<<"FLIES 1"<<endl;
+  f<<"TRIGGER external"<<endl;
+  f<<"PULSEWAIT 0"<<endl;
+  f<<"FLYFLOW 2"<<endl;
+  for (unsigned int i(0); i < NB_BENCH_PULSES; i++){
+    f<<"PULSE Odour1_1V_A 500 "<<(i % 2 ? "0.5" : "0.2")<<" bench"<<endl;
+  }
+  f.close();
+  return config.read_config_file(filename);
+}
+
+
+// =============================================================================
+//            MAIN
+// =============================================================================
+
+int main(int argc, char* argv[]){
+
+  unsigned int iterations (DEFAULT_ITERATIONS);
+  string rig ("behavior");
+  for (int i(1); i < argc; i++){
+    string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc){
+      iterations = atoi(argv[++i]);
+    }else if (arg == "-r" && i + 1 < argc){
+      rig = argv[++i];
+    }else{
+      cerr<<"Usage: "<<argv[0]<<" [-n iterations] [-r rig]"<<endl;
+      return 1;
+    }
+  }
+  if (iterations == 0){
+    cerr<<"Usage: "<<argv[0]<<" [-n iterations] [-r rig]"<<endl;
+    return 1;
+  }
+
+  char dir_template[] = "/tmp/micro_bench.XXXXXX";
+  if (mkdtemp(dir_template) == NULL){
+    perror("Unable to create directory for the benchmark");
+    return 1;
+  }
+  // the configuration loads the rig profile
+  Configuration config;
+  int pty (-1);
+  if (!load_config(config, rig, dir_template, pty)){
+    return 1;
+  }
+
+  // one alias of each family
+  string odour ("Odour1_1V_A");
+  string control ("Control1_1V_A");
+  string carrier ("Carrier");
+  string blend ("Blend12_2V_A-A");
+  string test ("Test_food");
+
+  frame_arg frame;
+  frame.mask = &valve_alias::lookup(odour)->mask;
+  frame.nb_boards = valve_alias::get_profile().get_nb_boards();
+
+  emulated_dio_device emulator;
+  dio_boards boards;
+  boards.device = &emulator;
+  boards.nb = valve_alias::get_profile().get_nb_boards();
+  pthread_mutex_init(&boards.mutex, NULL);
+  boards.connected = true;
+  boards.lost_since = 0.0;
+  boards.restored_at = 0.0;
+  if (!emulator.open(boards.nb)){
+    return 1;
+  }
+  for (unsigned int b(0); b < boards.nb; b++){
+    default_frame(b, boards.shadow[b]);
+    emulator.configure(b, boards.shadow[b]);
+  }
+  channel_arg channel;
+  channel.boards = &boards;
+  channel.emulator = &emulator;
+  channel.mask = frame.mask;
+  channel.count = 0;
+
+  mfc_line_arg mfc_line;
+  mfc_line.line = "A +014.70 +025.00 +001.500 +001.500 +001.500 Air";
+  mfc_line.ss<<mfc_line.line;
+
+  double timestamp = time_real();
+  pthread_event event;
+  wake_arg wake;
+  wake.stop = false;
+  pthread_t thread;
+  pthread_create(&thread, NULL, pong_thread, &wake);
+
+  bench_case benches[] = {
+    {"parse_alias_odour", bench_parse_alias, &odour, 1},
+    {"parse_alias_control", bench_parse_alias, &control, 1},
+    {"parse_alias_carrier", bench_parse_alias, &carrier, 1},
+    {"parse_alias_blend", bench_parse_alias, &blend, 1},
+    {"parse_alias_test", bench_parse_alias, &test, 1},
+    {"lookup_odour", bench_lookup, &odour, 1},
+    {"frame_building", bench_frame, &frame, 1},
+    {"set_channel_emulator", bench_set_channel, &channel, 1},
+    {"parse_mfc_data", bench_parse_mfc_data, &mfc_line, 1},
+    {"chop_line", bench_chop_line, &mfc_line, 1},
+    {"to_stringHP", bench_to_stringHP, &timestamp, 1},
+    {"UNIX_to_datetime", bench_datetime, &timestamp, 1},
+    {"UNIX_to_datetime_format", bench_datetime_format, &timestamp, 1},
+    {"get_instruction", bench_get_instruction, &config, 1},
+    {"pthread_event_signal_wait", bench_signal_wait, &event, 1},
+    {"pthread_event_wake_round_trip", bench_wake, &wake, WAKE_DIVIDER},
+  };
+
+  // the valve controller runs with realtime priority
+  set_realtime();
+  cout<<endl<<"benchmark iterations ns/op allocs/op"<<endl;
+  for (unsigned int i(0); i < sizeof(benches) / sizeof(benches[0]); i++){
+    run_bench(benches[i], iterations);
+  }
+
+  wake.stop = true;
+  wake.ping.signal();
+  pthread_join(thread, NULL);
+  emulator.close();
+  close(pty);
+  return 0;
+}
@@ -0,0 +1,672 @@
+//
+//  partner_load.cpp
+//  load generator for the partner sockets of the valve controller (connect_to_Igor, connect_to_Flytracker):
+//  connects like a partner, sends the start delay, then sends queries at a given rate and measures the response latency
+//
+//  usage: partner_load [-p Igor|Flytracker] [-d start_delay_ms] [-r rate] [-t duration_s] [-m mix] [-s flow_interval_ms] [-x /name] [-w 1]
+//    -p  partner emulated (default Flytracker), selects the port (8124 or 8125) and the queries accepted
+//    -d  start delay sent in the handshake (default 0)
+//    -r  queries per second (default 0: next query as soon as the previous answer is received)
+//    -t  duration of the run in s (default 10)
+//    -m  mix of queries as TYPE:weight[,TYPE:weight...] with TYPE DATA, EVENTS, PULSE or FLOW (default DATA:1)
+//        FLOW is only answered by Flytracker. PULSE triggers a pulse with Flytracker, as a real partner does.
+//    -s  subscribes to all the topics (SUBSCRIBE_QUERY) after the handshake: the answers come as TOPIC_REPLY messages,
+//        the latency of PULSE is measured until its TOPIC_TRIGGER message, the pushed messages are counted per topic
+//    -x  reads the event stream in shared memory /name as well (SHMSTREAM, see shm_stream.h), and measures the delay
+//        from the publication of a record to its reading
+//    -w  asks for the packed frames of version 1 or 2 (HELLO_QUERY, see wire_format.h) after the handshake, with -s the
+//        pushed frames are counted per type; with version 2 FLOW only gets the MFCs that changed
+//    -c  sends PING_QUERY every ping_interval_ms between the queries, the valve controller then logs the timestamps of
+//        PULSE on its clock; the offset, drift and uncertainty estimated on this side are printed at the end
+//    -f  PULSE triggers the flies 0 to flies - 1 in turn (FLY_PULSE_QUERY), for a configuration with ARENA lines
+//
+//  With a rate, queries are scheduled at fixed times and the latency is measured from the scheduled time, so that
+//  a slow answer also counts against the queries that wait behind it. Throughput and the p50/p99/p999 latencies
+//  of each query type are printed at the end of the run.
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+#include "netutils.h"
+#include "data_format.h"
+#include "MFC_data.h"
+#include "utils.h"
+#include "shm_stream.h"
+#include "wire_format.h"
+#include "clock_sync.h"
+
+using namespace std;
+
+const uint16_t TCP_PORT1 = 8124; // port used for connection between Igor and valve controller
+const uint16_t TCP_PORT2 = 8125; // port used for connection between Flytracker and valve controller
+const unsigned int RECV_TIMEOUT = 5000; // ms
+
+/// statistics of a query type
+struct query_stats{
+  std::string name;
+  uint8_t query;
+  unsigned int weight;
+  unsigned long changed;  ///< answers with new data
+  unsigned int flies;  ///< PULSE: flies triggered in turn with FLY_PULSE_QUERY, 0 for PULSE_QUERY
+  unsigned int next_fly;
+  std::vector <double> latency;  ///< in s
+};
+
+/// messages pushed by the valve controller in push mode
+struct push_stats{
+  unsigned long events;  ///< TOPIC_EVENTS messages
+  unsigned long event_records;  ///< events in these messages
+  unsigned long triggers;  ///< TOPIC_TRIGGER messages
+  unsigned long flows;  ///< TOPIC_FLOW messages
+  unsigned long names;  ///< names received in FRAME_DICT
+  unsigned long bytes;  ///< bytes of the frames received
+};
+
+/// exchanges of the clocks (PING_QUERY)
+struct ping_stats{
+  double interval;  ///< s, 0 without pings
+  double next;  ///< time_monotonic of the next ping
+  double last_received;  ///< time_real at which the last clock_pong arrived
+  clock_sync clock;
+};
+
+
+// =============================================================================
+// parses the query mix, e.g. DATA:8,FLOW:1,PULSE:1
+bool parse_mix(const string& mix, vector <query_stats>& stats){
+  stringstream ss(mix);
+  string item;
+  while (getline(ss, item, ',')){
+    size_t pos = item.find(':');
+    query_stats q;
+    q.name = item.substr(0, pos);
+    q.weight = (pos == string::npos) ? 1 : atoi(item.c_str() + pos + 1);
+    q.changed = 0;
+    q.flies = 0;
+    q.next_fly = 0;
+    if (q.name == "DATA"){
+      q.query = DATA_QUERY;
+    }else if (q.name == "EVENTS"){
+      q.query = EVENTS_QUERY;
+    }else if (q.name == "PULSE"){
+      q.query = PULSE_QUERY;
+    }else if (q.name == "FLOW"){
+      q.query = FLOW_QUERY;
+    }else{
+      cerr<<"Unknown query: "<<q.name<<" (DATA, EVENTS, PULSE or FLOW)"<<endl;
+      return false;
+    }
+    if (q.weight > 0){
+      stats.push_back(q);
+    }
+  }
+  if (stats.empty()){
+    cerr<<"Empty query mix."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// connects to the valve controller on the local host
+int connect_to_valve_controller(uint16_t port){
+  int s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(s, (sockaddr*)&addr, sizeof(addr)) < 0){
+    perror("Unable to connect to the valve controller");
+    close(s);
+    return -1;
+  }
+  disable_nagle(s);
+  return s;
+}
+
+// =============================================================================
+// sends the query byte, followed by the fly for the pulses of the arenas
+bool send_query(int s, query_stats& q){
+  char query[2] = {(char)q.query, 0};
+  unsigned int length (1);
+  if (q.query == PULSE_QUERY && q.flies > 0){
+    query[0] = FLY_PULSE_QUERY;
+    query[1] = q.next_fly;
+    q.next_fly = (q.next_fly + 1) % q.flies;
+    length = 2;
+  }
+  if (send(s, query, length, 0) != (int)length){
+    perror("Send error: query");
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// sends a query and receives the complete answer, returns false if the connection failed
+bool run_query(int s, query_stats& q){
+  if (!send_query(s, q)){
+    return false;
+  }
+  if (q.query == EVENTS_QUERY){
+    // header first, then the records of the events
+    events_header header;
+    event_record records[EVENT_RING_SIZE];
+    if (block_recv(s, RECV_TIMEOUT, &header, sizeof(header)) != sizeof(header) || header.nb_events > EVENT_RING_SIZE){
+      cerr<<"No answer to "<<q.name<<" query."<<endl;
+      return false;
+    }
+    int length = header.nb_events * sizeof(event_record);
+    if (length > 0 && block_recv(s, RECV_TIMEOUT, records, length) != length){
+      cerr<<"Incomplete answer to "<<q.name<<" query."<<endl;
+      return false;
+    }
+    if (header.lost > 0){
+      cerr<<"Lost "<<header.lost<<" events before event "<<records[0].seq<<endl;
+    }
+    q.changed += (header.nb_events > 0);
+    return true;
+  }
+  bool answer (false);
+  if (block_recv(s, RECV_TIMEOUT, &answer, sizeof(answer)) != sizeof(answer)){
+    cerr<<"No answer to "<<q.name<<" query."<<endl;
+    return false;
+  }
+  if (q.query == PULSE_QUERY){
+    // the partner sends its timestamp after the confirmation of the trigger
+    double timestamp = time_real();
+    if (send(s, &timestamp, sizeof(timestamp), 0) != sizeof(timestamp)){
+      perror("Send error: partner timestamp");
+      return false;
+    }
+    return true;
+  }
+  if (answer){
+    q.changed++;
+    bool complete (false);
+    if (q.query == DATA_QUERY){
+      data_packet data;
+      complete = (block_recv(s, RECV_TIMEOUT, &data, sizeof(data)) == (int)sizeof(data));
+    }else{
+      MFC_flows flows;
+      complete = (block_recv(s, RECV_TIMEOUT, &flows, sizeof(flows)) == (int)sizeof(flows));
+    }
+    if (!complete){
+      cerr<<"Incomplete answer to "<<q.name<<" query."<<endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// =============================================================================
+// subscribes to all the topics, returns false if the valve controller refused
+bool subscribe(int s, uint32_t flow_interval_ms, bool framed){
+  subscribe_request request;
+  request.topics = TOPIC_EVENTS | TOPIC_TRIGGER | TOPIC_FLOW;
+  request.flow_interval_ms = flow_interval_ms;
+  if (send(s, &SUBSCRIBE_QUERY, sizeof(SUBSCRIBE_QUERY), 0) != sizeof(SUBSCRIBE_QUERY) || send(s, &request, sizeof(request), 0) != sizeof(request)){
+    perror("Send error: subscription");
+    return false;
+  }
+  bool accepted (false);
+  if (framed){
+    // FRAME_BOOL: header, then u8
+    char frame[FRAME_HEADER_SIZE + 1];
+    accepted = (block_recv(s, RECV_TIMEOUT, frame, sizeof(frame)) == sizeof(frame) && frame[1] == FRAME_BOOL && frame[FRAME_HEADER_SIZE] == 1);
+  }else if (block_recv(s, RECV_TIMEOUT, &accepted, sizeof(accepted)) != sizeof(accepted)){
+    accepted = false;
+  }
+  if (!accepted){
+    cerr<<"Subscription refused."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// asks for the frames of version, returns false if the valve controller does not know them
+bool hello(int s, uint16_t version){
+  char query[3] = {(char)HELLO_QUERY, (char)(version & 0xFF), (char)(version >> 8)};
+  if (send(s, query, sizeof(query), 0) != sizeof(query)){
+    perror("Send error: hello");
+    return false;
+  }
+  char frame[FRAME_HEADER_SIZE + 2];
+  if (block_recv(s, RECV_TIMEOUT, frame, sizeof(frame)) != sizeof(frame) || frame[1] != FRAME_HELLO){
+    cerr<<"No answer to HELLO query."<<endl;
+    return false;
+  }
+  wire_reader r(frame + FRAME_HEADER_SIZE, 2);
+  uint16_t accepted (0);
+  r.u16(accepted);
+  if (accepted == 0){
+    cerr<<"Frames of version "<<version<<" refused."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// receives frames until one of type wanted (pushed or answer), the pushed frames and the names are counted
+// \param answer payload of the frame wanted, if not NULL
+bool wait_for_frame(int s, uint8_t wanted, bool wanted_pushed, push_stats& pushed, uint16_t& count, vector <char>* answer = NULL){
+  vector <char> payload;
+  while (true){
+    char header[FRAME_HEADER_SIZE];
+    if (block_recv(s, RECV_TIMEOUT, header, sizeof(header)) != sizeof(header)){
+      cerr<<"No frame from the valve controller."<<endl;
+      return false;
+    }
+    wire_reader h(header, sizeof(header));
+    uint8_t version, type;
+    uint16_t flags;
+    uint32_t length;
+    h.u8(version);
+    h.u8(type);
+    h.u16(flags);
+    h.u32(length);
+    payload.resize(length + 1);
+    if (version == 0 || version > WIRE_VERSION || (length > 0 && block_recv(s, RECV_TIMEOUT, &payload[0], length) != (int)length)){
+      cerr<<"Invalid frame of type "<<(int)type<<"."<<endl;
+      return false;
+    }
+    pushed.bytes += sizeof(header) + length;
+    wire_reader r(&payload[0], length);
+    count = 0;
+    if (type == FRAME_DICT){
+      uint16_t first;
+      r.u16(first);
+      r.u16(count);
+      pushed.names += count;
+    }else if (type == FRAME_EVENTS){
+      uint32_t lost;
+      uint64_t next_seq;
+      r.u32(lost);
+      r.u64(next_seq);
+      r.u16(count);
+      if (length != 14 + count * PACKED_EVENT_SIZE){
+        cerr<<"Invalid length of FRAME_EVENTS: "<<length<<endl;
+        return false;
+      }
+    }else if (type == FRAME_FLOW || type == FRAME_BOOL){
+      uint8_t value;
+      r.u8(value);
+      count = value;
+    }
+    bool is_pushed = (flags & FRAME_PUSHED) != 0;
+    if (is_pushed && type == FRAME_EVENTS){
+      pushed.events++;
+      pushed.event_records += count;
+    }else if (is_pushed && type == FRAME_TRIGGER){
+      pushed.triggers++;
+    }else if (is_pushed && type == FRAME_FLOW){
+      pushed.flows++;
+    }
+    if (type == wanted && is_pushed == wanted_pushed){
+      if (answer != NULL){
+        answer->assign(payload.begin(), payload.begin() + length);
+      }
+      return true;
+    }
+  }
+}
+
+// =============================================================================
+// query with frames: DATA and EVENTS are answered by FRAME_EVENTS, FLOW by FRAME_FLOW, PULSE by FRAME_BOOL
+// (FRAME_TRIGGER once subscribed)
+bool run_framed_query(int s, query_stats& q, bool subscribed, push_stats& pushed){
+  if (!send_query(s, q)){
+    return false;
+  }
+  uint16_t count (0);
+  if (q.query == PULSE_QUERY){
+    if (!subscribed && !wait_for_frame(s, FRAME_BOOL, false, pushed, count)){
+      return false;
+    }
+    double timestamp = time_real();
+    if (send(s, &timestamp, sizeof(timestamp), 0) != sizeof(timestamp)){
+      perror("Send error: partner timestamp");
+      return false;
+    }
+    return !subscribed || wait_for_frame(s, FRAME_TRIGGER, true, pushed, count);
+  }
+  if (!wait_for_frame(s, q.query == FLOW_QUERY ? FRAME_FLOW : FRAME_EVENTS, false, pushed, count)){
+    return false;
+  }
+  q.changed += (count > 0);
+  return true;
+}
+
+// =============================================================================
+// receives pushed messages until one of topic wanted, which is counted too
+// \param answer payload of the message wanted, if not NULL
+bool wait_for_push(int s, uint32_t wanted, push_stats& pushed, vector <char>* answer = NULL){
+  vector <char> payload;
+  while (true){
+    push_header header;
+    if (block_recv(s, RECV_TIMEOUT, &header, sizeof(header)) != sizeof(header)){
+      cerr<<"No message from the valve controller."<<endl;
+      return false;
+    }
+    payload.resize(header.length);
+    if (header.length > 0 && block_recv(s, RECV_TIMEOUT, &payload[0], header.length) != (int)header.length){
+      cerr<<"Incomplete message of topic "<<header.topic<<"."<<endl;
+      return false;
+    }
+    if (header.topic == TOPIC_EVENTS){
+      pushed.events++;
+      pushed.event_records += ((events_header*)&payload[0])->nb_events;
+    }else if (header.topic == TOPIC_TRIGGER){
+      pushed.triggers++;
+    }else if (header.topic == TOPIC_FLOW){
+      pushed.flows++;
+    }
+    if (header.topic == wanted){
+      if (answer != NULL){
+        *answer = payload;
+      }
+      return true;
+    }
+  }
+}
+
+// =============================================================================
+// query of a subscribed partner: the answer is a TOPIC_REPLY message, PULSE is confirmed by TOPIC_TRIGGER
+bool run_subscribed_query(int s, query_stats& q, push_stats& pushed){
+  if (!send_query(s, q)){
+    return false;
+  }
+  if (q.query == PULSE_QUERY){
+    double timestamp = time_real();
+    if (send(s, &timestamp, sizeof(timestamp), 0) != sizeof(timestamp)){
+      perror("Send error: partner timestamp");
+      return false;
+    }
+    // Igor is not triggered by the query, only the Flytracker trigger is confirmed
+    return wait_for_push(s, TOPIC_TRIGGER, pushed);
+  }
+  return wait_for_push(s, TOPIC_REPLY, pushed);
+}
+
+// =============================================================================
+// exchange of the clocks, the answer is a clock_pong: raw, in a TOPIC_REPLY message, or a FRAME_PONG
+bool ping(int s, ping_stats& ps, bool subscribed, bool framed, push_stats& pushed){
+  clock_ping request;
+  request.partner_sent = time_real();
+  request.partner_received = ps.last_received;
+  if (send(s, &PING_QUERY, sizeof(PING_QUERY), 0) != sizeof(PING_QUERY) || send(s, &request, sizeof(request), 0) != sizeof(request)){
+    perror("Send error: ping");
+    return false;
+  }
+  clock_pong pong;
+  vector <char> answer;
+  uint16_t count (0);
+  bool received (false);
+  if (framed){
+    received = wait_for_frame(s, FRAME_PONG, false, pushed, count, &answer);
+    wire_reader r(answer.empty() ? NULL : &answer[0], answer.size());
+    received = received && r.f64(pong.partner_sent) && r.f64(pong.received) && r.f64(pong.sent);
+  }else if (subscribed){
+    received = wait_for_push(s, TOPIC_REPLY, pushed, &answer) && answer.size() == sizeof(pong);
+    if (received){
+      memcpy(&pong, &answer[0], sizeof(pong));
+    }
+  }else{
+    received = (block_recv(s, RECV_TIMEOUT, &pong, sizeof(pong)) == sizeof(pong));
+  }
+  ps.last_received = time_real();
+  if (!received){
+    cerr<<"No answer to PING query."<<endl;
+    return false;
+  }
+  ps.clock.add(pong.partner_sent, pong.received, pong.sent, ps.last_received);
+  return true;
+}
+
+/// reader of the shared memory stream
+struct stream_stats{
+  shm_stream_reader reader;
+  volatile bool stop;
+  unsigned long records[SHM_FLOW + 1];  ///< per shm_record_type
+  unsigned long lost;
+  std::vector <double> latency;  ///< in s, from publication to reading
+};
+
+// =============================================================================
+// thread that reads the records of the stream as they are published
+void* read_stream(void* ptr_to_stats){
+  stream_stats* st = (stream_stats*) ptr_to_stats;
+  uint64_t cursor = st->reader.get_next_seq();
+  while (!st->stop){
+    if (!st->reader.wait(cursor, 100)){
+      continue;
+    }
+    uint64_t lost (0);
+    const shm_record* r;
+    while ((r = st->reader.peek(cursor, lost)) != NULL){
+      double latency = time_monotonic() - r->published;
+      uint32_t type = r->type;
+      if (st->reader.still_valid(r, cursor) && type <= SHM_FLOW){
+        st->records[type]++;
+        st->latency.push_back(latency);
+      }else{
+        lost++;
+      }
+      st->lost += lost;
+      lost = 0;
+      cursor++;
+    }
+    st->lost += lost;
+  }
+  return NULL;
+}
+
+// =============================================================================
+// latency at quantile p of sorted latencies, in us
+double percentile(const vector <double>& sorted, double p){
+  if (sorted.empty()){
+    return 0;
+  }
+  size_t i = (size_t)ceil(p * sorted.size());
+  i = (i == 0) ? 0 : i - 1;
+  return sorted[min(i, sorted.size() - 1)] * 1000000;
+}
+
+// =============================================================================
+void print_stats(const string& name, vector <double> latency, unsigned long changed, double duration){
+  sort(latency.begin(), latency.end());
+  cout<<name<<" "<<latency.size()<<" "<<changed<<" "<<to_stringHP(latency.size() / duration, 1)
+      <<" "<<to_stringHP(percentile(latency, 0.5), 1)<<" "<<to_stringHP(percentile(latency, 0.99), 1)
+      <<" "<<to_stringHP(percentile(latency, 0.999), 1)<<" "<<to_stringHP(latency.empty() ? 0 : latency.back() * 1000000, 1)<<endl;
+}
+
+
+// =============================================================================
+//            MAIN
+// =============================================================================
+
+int main(int argc, char* argv[]){
+
+  string partner ("Flytracker");
+  uint32_t start_delay (0);
+  double rate (0);
+  double duration (10);
+  string mix ("DATA:1");
+  int flow_interval (-1);
+  string stream_name;
+  uint16_t wire (0);
+  ping_stats pings;
+  pings.interval = 0.0;
+  pings.next = 0.0;
+  pings.last_received = 0.0;
+  unsigned int flies (0);
+  for (int i(1); i + 1 < argc; i += 2){
+    string arg = argv[i];
+    if (arg == "-p"){
+      partner = argv[i + 1];
+    }else if (arg == "-d"){
+      start_delay = atoi(argv[i + 1]);
+    }else if (arg == "-r"){
+      rate = atof(argv[i + 1]);
+    }else if (arg == "-t"){
+      duration = atof(argv[i + 1]);
+    }else if (arg == "-m"){
+      mix = argv[i + 1];
+    }else if (arg == "-s"){
+      flow_interval = atoi(argv[i + 1]);
+    }else if (arg == "-x"){
+      stream_name = argv[i + 1];
+    }else if (arg == "-w"){
+      wire = atoi(argv[i + 1]);
+    }else if (arg == "-f"){
+      flies = atoi(argv[i + 1]);
+    }else if (arg == "-c"){
+      pings.interval = atoi(argv[i + 1]) / 1000.0;
+    }else{
+      cerr<<"Usage: "<<argv[0]<<" [-p Igor|Flytracker] [-d start_delay_ms] [-r rate] [-t duration_s] [-m DATA:w,PULSE:w,FLOW:w] [-s flow_interval_ms] [-x /name] [-w 1] [-c ping_interval_ms] [-f flies]"<<endl;
+      return 1;
+    }
+  }
+  if (argc % 2 == 0 || (partner != "Igor" && partner != "Flytracker") || rate < 0 || duration <= 0){
+    cerr<<"Usage: "<<argv[0]<<" [-p Igor|Flytracker] [-d start_delay_ms] [-r rate] [-t duration_s] [-m DATA:w,PULSE:w,FLOW:w] [-s flow_interval_ms] [-x /name] [-w 1] [-c ping_interval_ms] [-f flies]"<<endl;
+    return 1;
+  }
+
+  vector <query_stats> stats;
+  if (!parse_mix(mix, stats)){
+    return 1;
+  }
+  unsigned int total_weight (0);
+  for (unsigned int i(0); i < stats.size(); i++){
+    if (stats[i].query == FLOW_QUERY && partner == "Igor"){
+      cerr<<"Igor does not answer FLOW queries."<<endl;
+      return 1;
+    }
+    if (stats[i].query == PULSE_QUERY && partner == "Igor" && flow_interval >= 0){
+      cerr<<"Igor is not triggered by PULSE queries, there is no TOPIC_TRIGGER to wait for."<<endl;
+      return 1;
+    }
+    if (stats[i].query == PULSE_QUERY){
+      stats[i].flies = flies;
+    }
+    total_weight += stats[i].weight;
+  }
+
+  stream_stats stream;
+  stream.stop = false;
+  stream.lost = 0;
+  memset(stream.records, 0, sizeof(stream.records));
+  pthread_t stream_thread;
+  if (!stream_name.empty()){
+    if (!stream.reader.open(stream_name)){
+      return 1;
+    }
+    pthread_create(&stream_thread, NULL, read_stream, &stream);
+  }
+
+  int s = connect_to_valve_controller(partner == "Igor" ? TCP_PORT1 : TCP_PORT2);
+  if (s < 0){
+    return 1;
+  }
+  // handshake: the valve controller starts after the start delay
+  if (send(s, &start_delay, sizeof(start_delay), 0) != sizeof(start_delay)){
+    perror("Send error: start delay");
+    close(s);
+    return 1;
+  }
+  cout<<"Connected to the valve controller as "<<partner<<", start delay "<<start_delay<<" ms."<<endl;
+  push_stats pushed = {0, 0, 0, 0, 0, 0};
+  if (wire > 0 && !hello(s, wire)){
+    close(s);
+    return 1;
+  }
+  bool subscribed = (flow_interval >= 0);
+  if (subscribed && !subscribe(s, flow_interval, wire > 0)){
+    close(s);
+    return 1;
+  }
+
+  // queries follow the mix in a fixed interleaved order, so that every run sends the same sequence
+  vector <unsigned int> sequence;
+  for (unsigned int n(0); n < total_weight; n++){
+    for (unsigned int i(0); i < stats.size(); i++){
+      if (n < stats[i].weight){
+        sequence.push_back(i);
+      }
+    }
+  }
+
+  double start = time_monotonic();
+  double end = start + duration;
+  unsigned long sent (0);
+  bool failed (false);
+  while (!failed){
+    double scheduled = (rate > 0) ? start + sent / rate : time_monotonic();
+    if (scheduled >= end){
+      break;
+    }
+    double now = time_monotonic();
+    if (scheduled > now){
+      usleep((scheduled - now) * 1000000);
+    }
+    if (pings.interval > 0 && time_monotonic() >= pings.next){
+      pings.next = time_monotonic() + pings.interval;
+      failed = !ping(s, pings, subscribed, wire > 0, pushed);
+      if (failed){
+        break;
+      }
+    }
+    query_stats& q = stats[sequence[sent % sequence.size()]];
+    if (wire > 0){
+      failed = !run_framed_query(s, q, subscribed, pushed);
+    }else{
+      failed = subscribed ? !run_subscribed_query(s, q, pushed) : !run_query(s, q);
+    }
+    if (!failed){
+      q.latency.push_back(time_monotonic() - scheduled);
+    }
+    sent++;
+  }
+  double elapsed = time_monotonic() - start;
+  close(s);
+
+  cout<<endl<<"query count changed queries/s p50_us p99_us p999_us max_us"<<endl;
+  vector <double> all;
+  unsigned long changed (0);
+  for (unsigned int i(0); i < stats.size(); i++){
+    print_stats(stats[i].name, stats[i].latency, stats[i].changed, elapsed);
+    all.insert(all.end(), stats[i].latency.begin(), stats[i].latency.end());
+    changed += stats[i].changed;
+  }
+  print_stats("ALL", all, changed, elapsed);
+  if (!stream_name.empty()){
+    stream.stop = true;
+    pthread_join(stream_thread, NULL);
+    print_stats("STREAM", stream.latency, stream.latency.size(), elapsed);
+    cout<<"stream pulses "<<stream.records[SHM_PULSE]<<" triggers "<<stream.records[SHM_TRIGGER]<<" flows "<<stream.records[SHM_FLOW]<<" lost "<<stream.lost<<endl;
+  }
+  if (wire > 0){
+    cout<<"frames "<<pushed.bytes<<" bytes, "<<pushed.names<<" names"<<endl;
+  }
+  if (pings.clock.is_valid()){
+    cout<<"clock offset "<<to_stringHP(pings.clock.get_offset() * 1000000, 1)<<" us drift "<<to_stringHP(pings.clock.get_drift() * 1000000, 3)
+        <<" ppm error "<<to_stringHP(pings.clock.get_error() * 1000000, 1)<<" us after "<<pings.clock.get_exchanges()<<" pings"<<endl;
+  }
+  if (subscribed){
+    cout<<"pushed events "<<pushed.events<<" ("<<pushed.event_records<<" records) triggers "<<pushed.triggers<<" flows "<<pushed.flows<<endl;
+  }
+  if (failed){
+    cerr<<"Connection failed after "<<sent<<" queries."<<endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,863 @@
+//
+//  partner_server.cc
+//  event loop of the partner port (see partner_server.h)
+//
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "partner_server.h"
+#include "netutils.h"
+#include "utils.h"
+#include "alloc_tracker.h" // real-time regions, allocations counted with -DALLOC_TRACKING
+
+using namespace std;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // macOS, SO_NOSIGPIPE is set on the sockets instead
+#endif
+
+const unsigned int LISTEN_ID = MAX_PARTNER_CLIENTS;  ///< id of the listening socket in the poller
+const unsigned int WAKE_ID = MAX_PARTNER_CLIENTS + 1;  ///< id of the wake-up pipe of the event ring
+const unsigned int MAX_READY = MAX_PARTNER_CLIENTS + 2;
+const unsigned int MAX_PAYLOAD = sizeof(events_header) + EVENT_RING_SIZE * sizeof(event_record) + sizeof(MFC_flows);
+
+
+// =============================================================================
+// events the partner did not read in time, reported so that a gap in its data is explained
+static void report_lost_events(thread_param* param, uint32_t lost){
+  if (lost > 0){
+    cerr<<"Warning: the partner lost "<<lost<<" events, they were replaced before it queried them."<<endl;
+    param->ptr_config->log("EVENTS lost " + to_string(lost));
+  }
+}
+
+// =============================================================================
+// events_header and the events the partner did not read yet, written to payload (EVENTS_QUERY and TOPIC_EVENTS)
+// \return length of the payload
+static unsigned int fill_events(thread_param* param, uint64_t& cursor, char* payload){
+  events_header header;
+  event_record* records = (event_record*)(payload + sizeof(header));
+  header.nb_events = param->events.read(cursor, records, EVENT_RING_SIZE, header.lost);
+  header.next_seq = cursor;
+  report_lost_events(param, header.lost);
+  memcpy(payload, &header, sizeof(header));
+  return sizeof(header) + header.nb_events * sizeof(event_record);
+}
+
+// =============================================================================
+// answer to DATA_QUERY: bool, and the oldest event the partner did not read yet if true
+static unsigned int fill_next_event(thread_param* param, uint64_t& cursor, char* payload){
+  event_record record;
+  uint32_t lost (0);
+  bool changed = (param->events.read(cursor, &record, 1, lost) == 1);
+  report_lost_events(param, lost);
+  memcpy(payload, &changed, sizeof(changed));
+  if (!changed){
+    return sizeof(changed);
+  }
+  memcpy(payload + sizeof(changed), &record.data, sizeof(record.data));
+  return sizeof(changed) + sizeof(record.data);
+}
+
+// =============================================================================
+// create socket to listen for incoming connections
+static int open_local_listening_port(const uint16_t port){
+  // creates socket
+  int s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP); // IPv4 TCP socket, TCP to ensure reliable transfer
+  int reuse (1);
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)); // the port can be opened again right after the previous run
+  // specifies destination address of socket (IP address and port)
+  sockaddr_in i_addr;
+  memset(&i_addr, 0, sizeof(i_addr)); // initialize all fields to zero to ensure correct functionning on all OS, on MACOS there are additional fields that can cause problems when they remain uninitialized
+  i_addr.sin_family = AF_INET;
+  i_addr.sin_port = htons(port); //htons converts bits to correct network byte order
+  i_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); //htonl converts IP address in network byte order, INADDR_LOOPBACK = 127.0.0.1 (local host)
+
+  int result = bind(s,(sockaddr*)&i_addr, sizeof(i_addr));
+  if (result < 0){
+    perror("Opening port to listen failed");
+    close(s);
+    return -1;
+  }
+
+  if (listen(s,MAX_PARTNER_CLIENTS)<0){
+    perror("Unable to listen incoming connections");
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+// =============================================================================
+static bool set_non_blocking(int s){
+  int flags = fcntl(s, F_GETFL, 0);
+  return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+
+// =============================================================================
+fd_poller::fd_poller(){
+#ifdef __linux__
+  epfd = epoll_create1(0);
+  if (epfd < 0){
+    perror("Unable to create epoll instance");
+  }
+#endif
+}
+
+// =============================================================================
+fd_poller::~fd_poller(){
+#ifdef __linux__
+  if (epfd >= 0){
+    close(epfd);
+  }
+#endif
+}
+
+// =============================================================================
+bool fd_poller::watch(int fd, unsigned int id, bool out){
+#ifdef __linux__
+  epoll_event e;
+  memset(&e, 0, sizeof(e));
+  e.events = EPOLLIN | (out ? EPOLLOUT : 0);
+  e.data.u32 = id;
+  if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &e) == 0){
+    return true;
+  }
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &e) == 0;
+#else
+  for (unsigned int i(0); i < fds.size(); i++){
+    if (fds[i].fd == fd){
+      fds[i].events = POLLIN | (out ? POLLOUT : 0);
+      ids[i] = id;
+      return true;
+    }
+  }
+  pollfd p;
+  p.fd = fd;
+  p.events = POLLIN | (out ? POLLOUT : 0);
+  p.revents = 0;
+  fds.push_back(p);
+  ids.push_back(id);
+  return true;
+#endif
+}
+
+// =============================================================================
+void fd_poller::unwatch(int fd){
+#ifdef __linux__
+  epoll_event e; // ignored, needed by kernels before 2.6.9
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &e);
+#else
+  for (unsigned int i(0); i < fds.size(); i++){
+    if (fds[i].fd == fd){
+      fds.erase(fds.begin() + i);
+      ids.erase(ids.begin() + i);
+      return;
+    }
+  }
+#endif
+}
+
+// =============================================================================
+int fd_poller::wait(int timeout, ready_fd* ready, unsigned int max){
+#ifdef __linux__
+  epoll_event events[MAX_READY];
+  int n = epoll_wait(epfd, events, min(max, MAX_READY), timeout);
+  if (n < 0){
+    return (errno == EINTR) ? 0 : -1;
+  }
+  for (int i(0); i < n; i++){
+    ready[i].id = events[i].data.u32;
+    ready[i].in = (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+    ready[i].out = (events[i].events & EPOLLOUT) != 0;
+  }
+  return n;
+#else
+  int n = poll(&fds[0], fds.size(), timeout);
+  if (n < 0){
+    return (errno == EINTR) ? 0 : -1;
+  }
+  int nb (0);
+  for (unsigned int i(0); i < fds.size() && (unsigned int)nb < max; i++){
+    if (fds[i].revents != 0){
+      ready[nb].id = ids[i];
+      ready[nb].in = (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+      ready[nb].out = (fds[i].revents & POLLOUT) != 0;
+      nb++;
+    }
+  }
+  return nb;
+#endif
+}
+
+
+// =============================================================================
+partner_server::partner_server(thread_param& param, bool flytracker){
+  this->param = &param;
+  this->flytracker = flytracker;
+  flow_threshold = param.ptr_config->get_flow_threshold();
+  nb_flies = max(1u, param.ptr_config->get_nb_arenas());
+  listening = -1;
+  started = false;
+  start_at = 0.0;
+  payload.resize(MAX_PAYLOAD);
+  for (unsigned int i(0); i < MAX_PARTNER_CLIENTS; i++){
+    clients[i].s = -1;
+    // the buffers are allocated once, answering a query does not allocate
+    clients[i].input.reserve(CLIENT_INPUT_SIZE + MAX_APPEND_LENGTH);
+    clients[i].output.reserve(sizeof(push_header) + MAX_PAYLOAD);
+  }
+}
+
+// =============================================================================
+partner_server::~partner_server(){
+  for (unsigned int i(0); i < MAX_PARTNER_CLIENTS; i++){
+    if (clients[i].s >= 0){
+      close(clients[i].s);
+    }
+  }
+  if (listening >= 0){
+    close(listening);
+  }
+}
+
+// =============================================================================
+bool partner_server::open(uint16_t port){
+  listening = open_local_listening_port(port);
+  if (listening < 0){
+    return false;
+  }
+  if (!set_non_blocking(listening) || !poller.watch(listening, LISTEN_ID, false) || !poller.watch(param->events.get_wake_fd(), WAKE_ID, false)){
+    perror("Unable to watch the partner port");
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+void partner_server::run(){
+  ready_fd ready[MAX_READY];
+  while (!param->stop){
+    int n = poller.wait(next_timeout(time_monotonic()), ready, MAX_READY);
+    if (n < 0){
+      perror("Unable to wait for the partners");
+      return;
+    }
+    for (int i(0); i < n; i++){
+      if (ready[i].id == LISTEN_ID){
+        accept_clients();
+      }else if (ready[i].id == WAKE_ID){
+        // events and triggers are pushed below, to all the subscribed clients
+        param->events.clear_wake();
+      }else{
+        partner_client& c = clients[ready[i].id];
+        if (c.s >= 0 && ready[i].out){
+          c.writable = true;
+        }
+        if (c.s >= 0 && ready[i].in){
+          receive(c);
+        }
+      }
+    }
+
+    double now = time_monotonic();
+    if (start_at > 0.0 && now >= start_at){
+      start_at = 0.0;
+      param->event->signal();
+    }
+    for (unsigned int i(0); i < MAX_PARTNER_CLIENTS; i++){
+      if (clients[i].s >= 0){
+        push_updates(clients[i], now);
+      }
+      if (clients[i].s >= 0 && !flush(clients[i])){
+        close_client(clients[i], "connection lost");
+      }
+    }
+  }
+}
+
+// =============================================================================
+// the loop waits at most until the start signal or the next check of the flows of a subscribed client
+int partner_server::next_timeout(double now){
+  double next = now + SERVER_TIMEOUT / 1000.0;
+  if (start_at > 0.0){
+    next = min(next, start_at);
+  }
+  for (unsigned int i(0); i < MAX_PARTNER_CLIENTS; i++){
+    if (clients[i].s >= 0 && (clients[i].sub.topics & TOPIC_FLOW)){
+      next = min(next, clients[i].sub.next_flow);
+    }
+  }
+  return max(0, (int)ceil((next - now) * 1000));
+}
+
+// =============================================================================
+void partner_server::accept_clients(){
+  while (true){
+    int s = accept(listening, NULL, NULL);
+    if (s < 0){
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+        perror("Unable to accept incoming connections");
+      }
+      return;
+    }
+    unsigned int i (0);
+    while (i < MAX_PARTNER_CLIENTS && clients[i].s >= 0){
+      i++;
+    }
+    if (i == MAX_PARTNER_CLIENTS){
+      cerr<<"Connection refused, already "<<MAX_PARTNER_CLIENTS<<" partners connected."<<endl;
+      close(s);
+      continue;
+    }
+    // disable grouping of TCP packages to minimize delays
+    disable_nagle(s);
+#ifdef SO_NOSIGPIPE
+    int no_sigpipe (1);
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+#endif
+    if (!set_non_blocking(s) || !poller.watch(s, i, false)){
+      perror("Unable to watch the connection of the partner");
+      close(s);
+      continue;
+    }
+    partner_client& c = clients[i];
+    c.s = s;
+    c.state = CLIENT_HANDSHAKE;
+    c.input.clear();
+    c.output.clear();
+    c.output_sent = 0;
+    c.writable = true;
+    c.append_length = 0;
+    c.cursor = param->events.get_next_seq();
+    c.fly = 0;
+    c.fired = false;
+    c.flows = MFC_flows();
+    c.flows_generation = 0;
+    c.sub.topics = 0;
+    c.sub.trigger_cursor = 0;
+    c.sub.flow_interval = 0.0;
+    c.sub.next_flow = 0.0;
+    c.wire = 0;
+    c.names_sent = 0;
+    c.received_at = 0.0;
+    c.arrived_at = 0.0;
+    memset(&c.last_pong, 0, sizeof(c.last_pong));
+    c.clock.reset();
+  }
+}
+
+// =============================================================================
+void partner_server::close_client(partner_client& c, const char* reason){
+  cerr<<"Partner connection closed: "<<reason<<endl;
+  if (c.clock.is_valid()){
+    param->ptr_config->log("CLOCK offset " + to_stringHP(c.clock.get_offset(), 6) + " drift " + to_stringHP(c.clock.get_drift() * 1e6, 3)
+      + " ppm error " + to_stringHP(c.clock.get_error() * 1e6, 1) + " us after " + to_string(c.clock.get_exchanges()) + " pings");
+  }
+  poller.unwatch(c.s);
+  close(c.s);
+  c.s = -1;
+  c.sub.topics = 0;
+}
+
+// =============================================================================
+// reads what the socket has, and parses the complete messages
+void partner_server::receive(partner_client& c){
+  char buffer[CLIENT_INPUT_SIZE];
+  while (c.s >= 0){
+    ssize_t n = recv(c.s, buffer, sizeof(buffer), 0);
+    if (n == 0){
+      close_client(c, "closed by the partner");
+      return;
+    }
+    if (n < 0){
+      if (errno == EINTR){
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK){
+        close_client(c, strerror(errno));
+      }
+      return;
+    }
+    c.received_at = time_real();
+    c.arrived_at = time_monotonic();
+    c.input.insert(c.input.end(), buffer, buffer + n);
+    if (!parse(c)){
+      close_client(c, "invalid message");
+      return;
+    }
+  }
+}
+
+// =============================================================================
+// consumes the complete messages of the input, the state tells what comes next
+bool partner_server::parse(partner_client& c){
+  unsigned int pos (0);
+  bool complete (true);
+  while (complete){
+    const char* p = c.input.empty() ? NULL : &c.input[0] + pos;
+    unsigned int available = c.input.size() - pos;
+    if (c.state == CLIENT_HANDSHAKE){
+      uint32_t start_delay (0);  // in ms
+      complete = (available >= sizeof(start_delay));
+      if (complete){
+        memcpy(&start_delay, p, sizeof(start_delay));
+        pos += sizeof(start_delay);
+        // the partner reads the events that follow its start signal
+        c.cursor = param->events.get_next_seq();
+        if (!started){
+          started = true;
+          start_at = time_monotonic() + start_delay / 1000.0;
+        }
+        c.state = CLIENT_QUERY;
+      }
+    }else if (c.state == CLIENT_QUERY){
+      complete = (available >= 1);
+      if (complete){
+        uint8_t query = p[0];
+        pos += 1;
+        if (!answer_query(c, query)){
+          return false;
+        }
+      }
+    }else if (c.state == CLIENT_TIMESTAMP){
+      complete = (available >= sizeof(param->partner_timestamp));
+      if (complete){
+        rt_region region("Flytracker_trigger"); // no allocation from the timestamp to the trigger signal (see alloc_tracker.h)
+        memcpy(&param->partner_timestamp, p, sizeof(param->partner_timestamp));
+        pos += sizeof(param->partner_timestamp);
+        param->partner_clock_time = c.clock.is_valid() ? c.clock.to_controller(param->partner_timestamp) : -1.0;
+        param->partner_clock_error = c.clock.get_error();
+        // Igor triggers through the ITC18, the valve controller receives it from the polling function
+        if (flytracker && c.fired){
+          // the pulse is already open and the scheduler was signaled by fire_armed, the timestamp only completes its log line
+          param->armed.partner_timestamp = param->partner_timestamp;
+          param->armed.clock_time = param->partner_clock_time;
+          param->armed.clock_error = param->partner_clock_error;
+          __atomic_store_n(&param->armed.stamped, 1, __ATOMIC_RELEASE);
+          param->events.push_trigger(time_real(), param->partner_timestamp);
+        }else if (flytracker){
+          // with arenas the cursor of the fly takes the trigger, the timestamp is written before the trigger is counted
+          fly_trigger& t = param->flies[c.fly];
+          t.partner_timestamp = param->partner_timestamp;
+          t.clock_time = param->partner_clock_time;
+          t.clock_error = param->partner_clock_error;
+          __atomic_add_fetch(&t.pending, 1, __ATOMIC_RELEASE);
+          param->event->signal();
+          param->events.push_trigger(time_real(), param->partner_timestamp);
+        }
+        c.fly = 0;
+        c.fired = false;
+        c.state = CLIENT_QUERY;
+      }
+    }else if (c.state == CLIENT_APPEND_LENGTH){
+      complete = (available >= sizeof(c.append_length));
+      if (complete){
+        memcpy(&c.append_length, p, sizeof(c.append_length));
+        pos += sizeof(c.append_length);
+        if (c.append_length == 0 || c.append_length > MAX_APPEND_LENGTH){
+          cerr<<"Invalid length of appended instructions: "<<c.append_length<<endl;
+          return false;
+        }
+        c.state = CLIENT_APPEND_TEXT;
+      }
+    }else if (c.state == CLIENT_APPEND_TEXT){
+      complete = (available >= c.append_length);
+      if (complete){
+        // the instructions are validated and compiled by the configuration, the main thread picks them up when it reaches the end of the table
+        bool accepted = (param->ptr_config->append_instructions(string(p, c.append_length)) >= 0);
+        pos += c.append_length;
+        answer_bool(c, accepted);
+        c.state = CLIENT_QUERY;
+      }
+    }else if (c.state == CLIENT_SUBSCRIBE){
+      subscribe_request request;
+      complete = (available >= sizeof(request));
+      if (complete){
+        memcpy(&request, p, sizeof(request));
+        pos += sizeof(request);
+        bool accepted = ((request.topics & ~(TOPIC_EVENTS | TOPIC_TRIGGER | TOPIC_FLOW)) == 0);
+        if (!accepted){
+          cerr<<"Invalid subscription: unknown topics "<<request.topics<<endl;
+        }
+        // the first subscription is confirmed by a bool, a change of the topics by a TOPIC_REPLY message
+        answer_bool(c, accepted);
+        if (accepted){
+          if (c.sub.topics == 0){
+            c.sub.trigger_cursor = param->events.get_next_trigger();
+          }
+          c.sub.topics = request.topics;
+          // flows are not pushed faster than the MFCs are polled
+          c.sub.flow_interval = max(request.flow_interval_ms, (uint32_t)MFC_INTERVAL) / 1000.0;
+          c.sub.next_flow = 0.0;
+        }
+        c.state = CLIENT_QUERY;
+      }
+    }else if (c.state == CLIENT_HELLO){
+      uint16_t asked (0);
+      complete = (available >= sizeof(asked));
+      if (complete){
+        wire_reader r(p, sizeof(asked));
+        r.u16(asked);
+        pos += sizeof(asked);
+        // the highest version both sides know, the names are sent again in the frames
+        c.wire = min(asked, (uint16_t)WIRE_VERSION);
+        c.names_sent = 0;
+        wire_writer w(c.output, c.wire);
+        w.begin_frame(FRAME_HELLO);
+        w.u16(c.wire);
+        w.end_frame();
+        c.state = CLIENT_QUERY;
+      }
+    }else if (c.state == CLIENT_FLY){
+      complete = (available >= sizeof(c.fly));
+      if (complete){
+        c.fly = p[0];
+        pos += sizeof(c.fly);
+        if (c.fly >= nb_flies || !flytracker){
+          cerr<<"Invalid fly in pulse query: "<<(int)c.fly<<endl;
+          return false;
+        }
+        // then as PULSE_QUERY, for that fly
+        if (!answer_query(c, PULSE_QUERY)){
+          return false;
+        }
+      }
+    }else if (c.state == CLIENT_PING){
+      clock_ping ping;
+      complete = (available >= sizeof(ping));
+      if (complete){
+        memcpy(&ping, p, sizeof(ping));
+        pos += sizeof(ping);
+        answer_ping(c, ping);
+        c.state = CLIENT_QUERY;
+      }
+    }
+  }
+  c.input.erase(c.input.begin(), c.input.begin() + pos);
+  return true;
+}
+
+// =============================================================================
+// answers a query, or waits for its arguments; false if the query is invalid
+bool partner_server::answer_query(partner_client& c, uint8_t query){
+  // a data query gets the next event the partner did not read yet, an events query all of them
+  if (query == DATA_QUERY && c.wire > 0){
+    frame_events(c, 1, 0);
+  }else if (query == DATA_QUERY){
+    reply(c, &payload[0], fill_next_event(param, c.cursor, &payload[0]));
+  }else if (query == EVENTS_QUERY && c.wire > 0){
+    frame_events(c, EVENT_RING_SIZE, 0);
+  }else if (query == EVENTS_QUERY){
+    reply(c, &payload[0], fill_events(param, c.cursor, &payload[0]));
+  }else if (query == FLOW_QUERY && flytracker){
+    send_flows(c, false);
+  }else if (query == PULSE_QUERY){
+    // currently igor does not send pulse queries directly to the valve controller because these queries would arrive at end of wave (neuromatic constraint), whereas they need to arrive at start of wave
+    // instead Igor makes a list of pulse queries that are transferred to the ITC18 and the valve controller polls one of its input ports to find out whether there is apulse query
+    // without subscription the reception is confirmed before the partner sends its timestamp, with subscription the trigger is confirmed by TOPIC_TRIGGER
+    // with FASTTRIGGER the valves are opened first, the partner learns of the trigger once the pulse is on its way
+    if (flytracker){
+      param->query_received = c.arrived_at;
+      c.fired = fire_armed(c.arrived_at);
+    }
+    if (c.sub.topics == 0 && c.wire > 0){
+      answer_bool(c, true);
+    }else if (c.sub.topics == 0){
+      bool pulse_trigger_received = true;
+      queue(c, &pulse_trigger_received, sizeof(pulse_trigger_received));
+    }
+    c.state = CLIENT_TIMESTAMP;
+  }else if (query == APPEND_QUERY){
+    c.state = CLIENT_APPEND_LENGTH;
+  }else if (query == SUBSCRIBE_QUERY){
+    c.state = CLIENT_SUBSCRIBE;
+  }else if (query == HELLO_QUERY){
+    c.state = CLIENT_HELLO;
+  }else if (query == PING_QUERY){
+    c.state = CLIENT_PING;
+  }else if (query == FLY_PULSE_QUERY){
+    c.state = CLIENT_FLY;
+  }else{
+    cerr<<"Invalid query received: "<<(int)query<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// answer to a query: the bytes of the answer, in a TOPIC_REPLY message once the client subscribed
+void partner_server::reply(partner_client& c, const char* data, uint32_t length){
+  if (c.sub.topics != 0){
+    push(c, TOPIC_REPLY, data, length);
+  }else{
+    queue(c, data, length);
+  }
+}
+
+// =============================================================================
+// bool answer: FRAME_BOOL with frames, otherwise the bool itself (in a TOPIC_REPLY message once the client subscribed)
+void partner_server::answer_bool(partner_client& c, bool value){
+  if (c.wire == 0){
+    reply(c, (const char*)&value, sizeof(value));
+    return;
+  }
+  wire_writer w(c.output, c.wire);
+  w.begin_frame(FRAME_BOOL);
+  w.u8(value);
+  w.end_frame();
+}
+
+// =============================================================================
+// FRAME_EVENTS with the next max events of the client, preceded by a FRAME_DICT if they use names it does not have
+void partner_server::frame_events(partner_client& c, unsigned int max, uint16_t flags){
+  event_record* records = (event_record*)&payload[0];
+  uint32_t lost (0);
+  unsigned int n = param->events.read(c.cursor, records, max, lost);
+  report_lost_events(param, lost);
+  uint16_t alias[EVENT_RING_SIZE];
+  uint16_t odor[EVENT_RING_SIZE];
+  for (unsigned int i(0); i < n; i++){
+    alias[i] = names.intern(records[i].data.alias, sizeof(records[i].data.alias));
+    odor[i] = names.intern(records[i].data.odor, sizeof(records[i].data.odor));
+  }
+  wire_writer w(c.output, c.wire);
+  if (c.names_sent < names.size()){
+    w.begin_frame(FRAME_DICT, flags);
+    w.u16(c.names_sent);
+    w.u16(names.size() - c.names_sent);
+    for (uint16_t id(c.names_sent); id < names.size(); id++){
+      w.u8(names.name(id).size());
+      w.bytes(names.name(id).c_str(), names.name(id).size());
+    }
+    w.end_frame();
+    c.names_sent = names.size();
+  }
+  w.begin_frame(FRAME_EVENTS, flags);
+  w.u32(lost);
+  w.u64(c.cursor);
+  w.u16(n);
+  for (unsigned int i(0); i < n; i++){
+    w.u64(records[i].seq);
+    w.f64(records[i].data.timestamp);
+    w.f64(records[i].data.duration);
+    w.u8(records[i].data.event_type);
+    w.u16(alias[i]);
+    w.u16(odor[i]);
+  }
+  w.end_frame();
+}
+
+// =============================================================================
+// MFCs whose name, type, validity changed, or whose value changed by more than the threshold, since they were last sent to the client
+unsigned int partner_server::changed_flows(const partner_client& c, const MFC_flows& current, uint8_t* changed){
+  unsigned int n (0);
+  for (unsigned int i(0); i < MAX_MFC && (current.names[i] != 0 || c.flows.names[i] != 0); i++){
+    if (current.names[i] != c.flows.names[i] || current.flow_type[i] != c.flows.flow_type[i] || current.validity[i] != c.flows.validity[i]
+        || fabs(current.values[i] - c.flows.values[i]) > flow_threshold){
+      changed[n++] = i;
+    }
+  }
+  return n;
+}
+
+// =============================================================================
+// answers FLOW_QUERY, or pushes TOPIC_FLOW if the flows changed. Without frames and with frames of version 1 all the MFCs
+// are sent, with version 2 only the ones that changed, the client keeps the others
+void partner_server::send_flows(partner_client& c, bool pushed){
+  // the MFCs are only compared if something was published since the last comparison
+  MFC_flows current;
+  uint8_t changed[MAX_MFC];
+  unsigned int n (0);
+  if (param->ptr_config->get_MFC_generation() != c.flows_generation){
+    current = param->ptr_config->get_MFC_data(c.flows_generation);
+    n = changed_flows(c, current, changed);
+  }
+  if (pushed && n == 0){
+    return;
+  }
+  if (c.wire == 0){
+    bool MFC_changed = (n > 0);
+    if (MFC_changed){
+      c.flows = current;
+    }
+    if (pushed){
+      push(c, TOPIC_FLOW, (const char*)&current, sizeof(current));
+      return;
+    }
+    memcpy(&payload[0], &MFC_changed, sizeof(MFC_changed));
+    if (MFC_changed){
+      memcpy(&payload[sizeof(MFC_changed)], &current, sizeof(current));
+    }
+    reply(c, &payload[0], sizeof(MFC_changed) + (MFC_changed ? sizeof(current) : 0));
+    return;
+  }
+  if (n > 0 && c.wire < 2){
+    n = 0;
+    while (n < MAX_MFC && current.names[n] != 0){
+      changed[n] = n;
+      n++;
+    }
+  }
+  wire_writer w(c.output, c.wire);
+  w.begin_frame(FRAME_FLOW, pushed ? FRAME_PUSHED : 0);
+  w.u8(n > 0);
+  if (n > 0){
+    w.f64(current.timestamp);
+    w.u8(n);
+    for (unsigned int k(0); k < n; k++){
+      unsigned int i = changed[k];
+      w.u8(current.names[i]);
+      w.u8(current.flow_type[i]);
+      w.u8(current.validity[i]);
+      w.f64(current.values[i]);
+      // what the client has now
+      c.flows.names[i] = current.names[i];
+      c.flows.flow_type[i] = current.flow_type[i];
+      c.flows.validity[i] = current.validity[i];
+      c.flows.values[i] = current.values[i];
+    }
+    c.flows.timestamp = current.timestamp;
+  }
+  w.end_frame();
+}
+
+// =============================================================================
+// the ping completes the previous exchange with the time its answer arrived, and starts the next one
+void partner_server::answer_ping(partner_client& c, const clock_ping& ping){
+  if (c.last_pong.partner_sent > 0 && ping.partner_received > 0){
+    c.clock.add(c.last_pong.partner_sent, c.last_pong.received, c.last_pong.sent, ping.partner_received);
+  }
+  c.last_pong.partner_sent = ping.partner_sent;
+  c.last_pong.received = c.received_at;
+  c.last_pong.sent = time_real();
+  if (c.wire == 0){
+    reply(c, (const char*)&c.last_pong, sizeof(c.last_pong));
+    return;
+  }
+  wire_writer w(c.output, c.wire);
+  w.begin_frame(FRAME_PONG);
+  w.f64(c.last_pong.partner_sent);
+  w.f64(c.last_pong.received);
+  w.f64(c.last_pong.sent);
+  w.end_frame();
+}
+
+// =============================================================================
+// FASTTRIGGER: writes the frame of the pulse armed by the scheduler, the scheduler takes the pulse back if it wakes up first
+// once the frame is written the scheduler is signaled, so that the end of the pulse does not wait for the timestamp of the
+// partner, returns true if the frame was written here
+bool partner_server::fire_armed(double received){
+  armed_pulse& a = param->armed;
+  uint32_t ready = ARMED_READY;
+  if (param->boards == NULL
+      || !__atomic_compare_exchange_n(&a.state, &ready, (uint32_t)ARMED_FIRING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+    return false;
+  }
+  rt_region region("fast_trigger"); // no allocation from the query to the frame (see alloc_tracker.h)
+  a.received = received;
+  a.stamped = 0;
+  a.timestamp = set_channel(*param->boards, a.mask, true, a.skew);
+  a.opened = time_monotonic();
+  __atomic_store_n(&a.state, (uint32_t)ARMED_FIRED, __ATOMIC_RELEASE);
+  param->event->signal();
+  return true;
+}
+
+// =============================================================================
+void partner_server::frame_trigger(partner_client& c, const trigger_ack& ack){
+  wire_writer w(c.output, c.wire);
+  w.begin_frame(FRAME_TRIGGER, FRAME_PUSHED);
+  w.u64(ack.seq);
+  w.f64(ack.timestamp);
+  w.f64(ack.partner_timestamp);
+  w.end_frame();
+}
+
+// =============================================================================
+void partner_server::push(partner_client& c, uint32_t topic, const char* data, uint32_t length){
+  push_header header;
+  header.topic = topic;
+  header.length = length;
+  queue(c, &header, sizeof(header));
+  queue(c, data, length);
+}
+
+// =============================================================================
+void partner_server::queue(partner_client& c, const void* data, uint32_t length){
+  c.output.insert(c.output.end(), (const char*)data, (const char*)data + length);
+}
+
+// =============================================================================
+// writes the output as far as the socket accepts it, returns false if the connection failed or the client is too slow
+bool partner_server::flush(partner_client& c){
+  while (c.writable && c.output_sent < c.output.size()){
+    ssize_t n = send(c.s, &c.output[c.output_sent], c.output.size() - c.output_sent, MSG_NOSIGNAL);
+    if (n < 0){
+      if (errno == EINTR){
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK){
+        perror("Send error: Failed to send to the partner");
+        return false;
+      }
+      // the socket tells when it accepts more
+      c.writable = false;
+      poller.watch(c.s, &c - clients, true);
+    }else{
+      c.output_sent += n;
+    }
+  }
+  if (c.output_sent == c.output.size()){
+    if (c.output_sent > 0 && !c.writable){
+      poller.watch(c.s, &c - clients, false);
+    }
+    c.writable = true;
+    c.output.clear();
+    c.output_sent = 0;
+  }else if (c.output_sent > c.output.size() / 2){
+    c.output.erase(c.output.begin(), c.output.begin() + c.output_sent);
+    c.output_sent = 0;
+  }
+  if (c.output.size() - c.output_sent > CLIENT_OUTPUT_LIMIT){
+    cerr<<"The partner does not read its data, "<<c.output.size() - c.output_sent<<" bytes waiting."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// pushes the topics of the subscription that happened since the last time
+void partner_server::push_updates(partner_client& c, double now){
+  if (c.sub.topics == 0 || c.state == CLIENT_HANDSHAKE){
+    return;
+  }
+  trigger_ack ack;
+  if ((c.sub.topics & TOPIC_TRIGGER) && param->events.read_trigger(c.sub.trigger_cursor, ack)){
+    if (c.wire > 0){
+      frame_trigger(c, ack);
+    }else{
+      push(c, TOPIC_TRIGGER, (const char*)&ack, sizeof(ack));
+    }
+  }
+  if ((c.sub.topics & TOPIC_EVENTS) && c.cursor < param->events.get_next_seq()){
+    if (c.wire > 0){
+      frame_events(c, EVENT_RING_SIZE, FRAME_PUSHED);
+    }else{
+      push(c, TOPIC_EVENTS, &payload[0], fill_events(param, c.cursor, &payload[0]));
+    }
+  }
+  if ((c.sub.topics & TOPIC_FLOW) && now >= c.sub.next_flow){
+    c.sub.next_flow = now + c.sub.flow_interval;
+    send_flows(c, true);
+  }
+}
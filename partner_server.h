@@ -0,0 +1,162 @@
+//
+//  partner_server.h
+//  server of the partner port (connect_to_Igor, connect_to_Flytracker): one event loop that serves any number of
+//  clients, e.g. Igor or Flytracker and a monitoring dashboard or a second analysis process
+//
+//  The sockets are non-blocking and watched by epoll (poll() on other systems). Every client has the state of its
+//  protocol: what it has to send next (start delay, query, or the arguments of a query), the bytes received that are
+//  not parsed yet and the bytes not sent yet. The answers and the pushed messages go to the output of the client and
+//  are written when its socket accepts them, so a slow client never delays the others: it is disconnected when its
+//  output reaches CLIENT_OUTPUT_LIMIT.
+//
+//  The start delay of the first client starts the run, the following clients only read the events from their
+//  connection on. PULSE_QUERY of any client triggers with Flytracker. With FASTTRIGGER the query byte itself opens the
+//  valves of the pulse armed by the scheduler, before the reception is acknowledged and the timestamp read.
+//
+
+#ifndef __partner_server_h
+#define __partner_server_h
+
+#include <vector>
+#include <stdint.h>
+
+#include "valve_controller.h"  // thread_param
+#include "MFC_data.h"
+#include "wire_format.h"
+#include "clock_sync.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+const unsigned int MAX_PARTNER_CLIENTS = 16;  ///< clients connected at the same time, the next ones are refused
+const unsigned int CLIENT_OUTPUT_LIMIT = 1024 * 1024;  ///< bytes queued for a client, a client that lags further behind is disconnected
+const unsigned int CLIENT_INPUT_SIZE = 4096;  ///< bytes read from a socket at once
+const int SERVER_TIMEOUT = 100;  ///< ms, longest wait of the event loop, it checks the end of the program in between
+
+/// what the client sends next
+enum client_state {
+  CLIENT_HANDSHAKE,      ///< uint32_t start delay in ms
+  CLIENT_QUERY,          ///< uint8_t query
+  CLIENT_TIMESTAMP,      ///< double partner timestamp of PULSE_QUERY
+  CLIENT_APPEND_LENGTH,  ///< uint32_t length of APPEND_QUERY
+  CLIENT_APPEND_TEXT,    ///< instructions of APPEND_QUERY
+  CLIENT_SUBSCRIBE,      ///< subscribe_request of SUBSCRIBE_QUERY
+  CLIENT_HELLO,          ///< u16 version of HELLO_QUERY
+  CLIENT_PING,           ///< clock_ping of PING_QUERY
+  CLIENT_FLY             ///< uint8_t fly of FLY_PULSE_QUERY
+};
+
+/// push mode of a client (SUBSCRIBE_QUERY)
+struct subscription{
+  uint32_t topics;  ///< TOPIC_EVENTS | TOPIC_TRIGGER | TOPIC_FLOW, 0 without subscription
+  uint64_t trigger_cursor;  ///< next trigger to acknowledge
+  double flow_interval;  ///< s, minimum time between two TOPIC_FLOW messages
+  double next_flow;  ///< time_monotonic of the next check of the flows
+};
+
+/// connection of a client
+struct partner_client{
+  int s;  ///< socket, -1 if the place is free
+  int state;  ///< client_state
+  std::vector <char> input;  ///< bytes received and not parsed yet
+  std::vector <char> output;  ///< bytes not sent yet, from output_sent on
+  unsigned int output_sent;
+  bool writable;  ///< false while the socket does not accept more bytes
+  uint32_t append_length;  ///< length of the instructions of APPEND_QUERY
+  uint64_t cursor;  ///< next event to read
+  uint8_t fly;  ///< fly of the pulse being triggered, 0 for PULSE_QUERY
+  bool fired;  ///< the last PULSE_QUERY opened the armed pulse (FASTTRIGGER), its timestamp does not signal the scheduler again
+  MFC_flows flows;  ///< flows as the client has them, the flows of FLOW_QUERY and TOPIC_FLOW are compared to them
+  uint64_t flows_generation;  ///< generation of the flows last compared (Configuration::get_MFC_generation)
+  subscription sub;
+  uint16_t wire;  ///< version of the frames (wire_format.h), 0: structures of data_format.h
+  uint16_t names_sent;  ///< names of the dictionary the client already has
+  double received_at;  ///< time_real of the last bytes received, reception time of a ping
+  double arrived_at;  ///< time_monotonic of the last bytes received, reception time of a trigger
+  clock_pong last_pong;  ///< answer to the last ping, completed by the time of its reception in the next ping
+  clock_sync clock;  ///< offset of the clock of the client
+};
+
+/// descriptor ready after fd_poller::wait
+struct ready_fd{
+  unsigned int id;
+  bool in;   ///< readable, or closed by the peer
+  bool out;  ///< writable
+};
+
+/// readiness of the sockets: epoll on Linux, poll() on the other systems
+class fd_poller {
+
+public:
+  fd_poller();
+  ~fd_poller();
+
+  /// \brief watches fd for reading, and for writing if out; id is returned by wait. Watching it again changes out
+  bool watch(int fd, unsigned int id, bool out);
+
+  void unwatch(int fd);
+
+  /// \return number of descriptors ready (at most max), 0 after timeout ms, -1 in case of error
+  int wait(int timeout, ready_fd* ready, unsigned int max);
+
+private:
+#ifdef __linux__
+  int epfd;
+#else
+  std::vector <pollfd> fds;
+  std::vector <unsigned int> ids;
+#endif
+};
+
+
+/// event loop of the partner port
+class partner_server {
+
+public:
+  /// \param flytracker true: FLOW_QUERY is answered and PULSE_QUERY triggers
+  partner_server(thread_param& param, bool flytracker);
+  ~partner_server();
+
+  /// \brief opens the listening port on the local host
+  bool open(uint16_t port);
+
+  /// \brief serves the clients until param.stop, the first start delay signals the start event of param
+  void run();
+
+private:
+  void accept_clients();
+  void close_client(partner_client& c, const char* reason);
+  void receive(partner_client& c);
+  bool parse(partner_client& c);
+  bool answer_query(partner_client& c, uint8_t query);
+  void reply(partner_client& c, const char* payload, uint32_t length);
+  void push(partner_client& c, uint32_t topic, const char* payload, uint32_t length);
+  void queue(partner_client& c, const void* data, uint32_t length);
+  bool flush(partner_client& c);
+  void push_updates(partner_client& c, double now);
+  void answer_bool(partner_client& c, bool value);
+  void frame_events(partner_client& c, unsigned int max, uint16_t flags);
+  unsigned int changed_flows(const partner_client& c, const MFC_flows& current, uint8_t* changed);
+  void send_flows(partner_client& c, bool pushed);
+  void frame_trigger(partner_client& c, const trigger_ack& ack);
+  void answer_ping(partner_client& c, const clock_ping& ping);
+  bool fire_armed(double received);
+  int next_timeout(double now);
+
+  thread_param* param;
+  bool flytracker;
+  unsigned int nb_flies;  ///< flies that can be triggered: the arenas (ARENA), or 1
+  double flow_threshold;  ///< SLPM, smaller changes of a flow are not sent (FLOWTHRESHOLD)
+  int listening;  ///< socket of the port, -1 if not open
+  fd_poller poller;
+  partner_client clients[MAX_PARTNER_CLIENTS];
+  bool started;  ///< a start delay was received
+  double start_at;  ///< time_monotonic of the start signal, 0 once signaled
+  std::vector <char> payload;  ///< answer being built, the largest is the answer to EVENTS_QUERY
+  name_dictionary names;  ///< aliases and odors of the frames, each client gets the names it does not have yet
+};
+
+#endif
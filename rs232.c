@@ -210,7 +210,8 @@ http://man7.org/linux/man-pages/man3/termios.3.html
     return(-1);
   }
 
-  if(ioctl(comport_handle, TIOCMGET, &status) == -1){
+  /* pseudo-terminals (e.g. mfc_emulator) have no modem lines */
+  if(ioctl(comport_handle, TIOCMGET, &status) == -1 && errno != ENOTTY){
     perror("unable to get portstatus");
     close(comport_handle);
     return(-1);
@@ -0,0 +1,218 @@
+//
+//  rt_thread.cc
+//  scheduling of the threads of the valve controller (see rt_thread.h)
+//
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "rt_thread.h"
+#include "utils.h"
+
+using namespace std;
+
+static const char* THREAD_NAMES[NB_RT_THREADS] = {"trigger", "scheduler", "usb", "serial", "network", "setpoint", "logger"};
+
+/// threads started, for the preemption report
+static int thread_ids[NB_RT_THREADS] = {0, 0, 0, 0, 0, 0, 0};
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+// =============================================================================
+int rt_thread_index(const string& name){
+  for (unsigned int i(0); i < NB_RT_THREADS; i++){
+    if (name == THREAD_NAMES[i]){
+      return i;
+    }
+  }
+  return -1;
+}
+
+// =============================================================================
+const char* rt_thread_name(unsigned int idx){
+  return idx < NB_RT_THREADS ? THREAD_NAMES[idx] : "unknown";
+}
+
+// =============================================================================
+// CPU list: 2 or 0,1 or 0-3 or 0,2-3
+static bool parse_cpus(const string& list, vector <int>& cpus){
+  stringstream ss(list);
+  string item;
+  long nb_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  while (getline(ss, item, ',')){
+    size_t dash = item.find('-');
+    string first = item.substr(0, dash);
+    string last = (dash == string::npos) ? first : item.substr(dash + 1);
+    if (first.empty() || last.empty() || first.find_first_not_of("0123456789") != string::npos || last.find_first_not_of("0123456789") != string::npos){
+      return false;
+    }
+    int a = atoi(first.c_str());
+    int b = atoi(last.c_str());
+    if (a > b || b >= nb_cpus){
+      return false;
+    }
+    for (int c(a); c <= b; c++){
+      cpus.push_back(c);
+    }
+  }
+  return !cpus.empty();
+}
+
+// =============================================================================
+bool parse_thread_policy(const vector <string>& words, unsigned int first, thread_policy& p){
+  if (words.size() < first + 2){
+    cerr<<"The thread needs a policy and a priority."<<endl;
+    return false;
+  }
+  if (words[first] == "FIFO"){
+    p.policy = SCHED_FIFO;
+  }else if (words[first] == "RR"){
+    p.policy = SCHED_RR;
+  }else if (words[first] == "OTHER"){
+    p.policy = SCHED_OTHER;
+  }else{
+    cerr<<"The scheduling policy is unknown (FIFO, RR or OTHER)."<<endl;
+    return false;
+  }
+  p.priority = atoi(words[first + 1].c_str());
+  if (p.priority < sched_get_priority_min(p.policy) || p.priority > sched_get_priority_max(p.policy)){
+    cerr<<"The priority needs to be ["<<sched_get_priority_min(p.policy)<<" "<<sched_get_priority_max(p.policy)<<"] for this policy."<<endl;
+    return false;
+  }
+  p.cpus.clear();
+  if (words.size() > first + 2 && !parse_cpus(words[first + 2], p.cpus)){
+    cerr<<"The CPU list is invalid (e.g. 2 or 0,1 or 0-3), "<<sysconf(_SC_NPROCESSORS_CONF)<<" CPUs available."<<endl;
+    return false;
+  }
+  p.set = true;
+  return true;
+}
+
+// =============================================================================
+bool lock_memory(){
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+    perror("WARNING, mlockall() failed");
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+// touches the stack of the calling thread, so that its pages are faulted in before they are needed
+static void prefault_stack(){
+  unsigned char stack[PREFAULT_STACK_SIZE];
+  memset(stack, 0, sizeof(stack));
+  __asm__ __volatile__("" : : "r"(stack) : "memory"); // the compiler cannot drop the memset of a buffer that is never read
+}
+
+// =============================================================================
+static string policy_name(int policy){
+  switch (policy){
+    case SCHED_FIFO: return "FIFO";
+    case SCHED_RR: return "RR";
+    case SCHED_OTHER: return "OTHER";
+    default: return "policy" + to_string(policy);
+  }
+}
+
+// =============================================================================
+bool start_rt_thread(unsigned int idx, const thread_policy& p, string& layout){
+  bool applied (true);
+  if (p.set){
+    sched_param sp;
+    sp.sched_priority = p.priority;
+    int ret = pthread_setschedparam(pthread_self(), p.policy, &sp);
+    if (ret != 0){
+      cerr<<"WARNING, could not set the scheduling of thread "<<rt_thread_name(idx)<<": "<<strerror(ret)<<endl;
+      applied = false;
+    }
+#ifdef __linux__
+    if (!p.cpus.empty()){
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (unsigned int i(0); i < p.cpus.size(); i++){
+        CPU_SET(p.cpus[i], &set);
+      }
+      ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      if (ret != 0){
+        cerr<<"WARNING, could not pin thread "<<rt_thread_name(idx)<<": "<<strerror(ret)<<endl;
+        applied = false;
+      }
+    }
+#else
+    if (!p.cpus.empty()){
+      cerr<<"WARNING, CPU affinity is not supported on this platform, thread "<<rt_thread_name(idx)<<" is not pinned."<<endl;
+    }
+#endif
+  }
+  prefault_stack();
+
+  // layout actually in effect
+  int policy (0);
+  sched_param sp;
+  pthread_getschedparam(pthread_self(), &policy, &sp);
+  layout = string(rt_thread_name(idx)) + " " + policy_name(policy) + " " + to_string(sp.sched_priority) + " cpus ";
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+  string cpus;
+  for (int c(0); c < CPU_SETSIZE; c++){
+    if (CPU_ISSET(c, &set)){
+      cpus += (cpus.empty() ? "" : ",") + to_string(c);
+    }
+  }
+  layout += cpus;
+  int tid = syscall(SYS_gettid);
+#else
+  layout += "all";
+  int tid = -1;
+#endif
+
+  if (idx < NB_RT_THREADS){
+    pthread_mutex_lock(&threads_mutex);
+    thread_ids[idx] = tid;
+    pthread_mutex_unlock(&threads_mutex);
+  }
+  return applied;
+}
+
+// =============================================================================
+// context switches of the threads, from /proc (threads that already ended are reported as such)
+void report_rt_threads(vector <string>& lines){
+  pthread_mutex_lock(&threads_mutex);
+  for (unsigned int i(0); i < NB_RT_THREADS; i++){
+    if (thread_ids[i] == 0){
+      continue;
+    }
+    string status = "/proc/self/task/" + to_string(thread_ids[i]) + "/status";
+    ifstream f(status.c_str());
+    if (!f.is_open()){
+      lines.push_back(string(THREAD_NAMES[i]) + " ended");
+      continue;
+    }
+    string line;
+    string voluntary ("-1");
+    string preempted ("-1");
+    while (getline(f, line)){
+      vector <string> words;
+      chop_line(line, words);
+      if (words.size() == 2 && words[0] == "voluntary_ctxt_switches:"){
+        voluntary = words[1];
+      }else if (words.size() == 2 && words[0] == "nonvoluntary_ctxt_switches:"){
+        preempted = words[1];
+      }
+    }
+    lines.push_back(string(THREAD_NAMES[i]) + " preempted " + preempted + " switches " + voluntary);
+  }
+  pthread_mutex_unlock(&threads_mutex);
+}
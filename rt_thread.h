@@ -0,0 +1,58 @@
+//
+//  rt_thread.h
+//  scheduling of the threads of the valve controller: scheduling class, priority and CPU affinity of each thread
+//  (THREAD keyword of the configuration file), memory locking and preemption counts
+//
+//  threads:  trigger    poll_ITC18_trigger, busy-polls the trigger input of the board (Igor)
+//            scheduler  execute_config_instructions, gives the pulses
+//            usb        usb_monitor, reopens the boards after the USB link dropped
+//            serial     collect_flow_data, polls the MFCs and writes the MFC log
+//            network    connect_to_Igor or connect_to_Flytracker, answers the partner (and triggers with Flytracker)
+//            setpoint   executor of the scheduler, sends the set points of the MFCs (see event_scheduler.h)
+//            logger     executor of the scheduler, writes the lines of the logfile
+//
+//  A thread without THREAD line keeps the policy of the process (set_realtime: SCHED_FIFO, priority 50) and all CPUs.
+//  Every thread prefaults its stack when it starts, the memory of the process is locked at startup (mlockall).
+//
+
+#ifndef __rt_thread_h
+#define __rt_thread_h
+
+#include <string>
+#include <vector>
+
+const unsigned int NB_RT_THREADS = 7;
+const unsigned int PREFAULT_STACK_SIZE = 256 * 1024; ///< bytes of stack touched when a thread starts
+
+/// scheduling of a thread
+struct thread_policy{
+  bool set;                ///< false: the thread keeps the policy of the process
+  int policy;              ///< SCHED_FIFO, SCHED_RR or SCHED_OTHER
+  int priority;            ///< 1-99 for SCHED_FIFO and SCHED_RR, 0 for SCHED_OTHER
+  std::vector <int> cpus;  ///< CPUs the thread runs on, all if empty
+};
+
+/// \return index of a thread (trigger, scheduler, usb, serial, network, setpoint, logger), or -1 if unknown
+int rt_thread_index(const std::string& name);
+
+/// \return name of the thread with index idx
+const char* rt_thread_name(unsigned int idx);
+
+/// \brief parses the policy of a THREAD line: policy (FIFO, RR or OTHER), priority, optional CPU list (e.g. 2 or 0,1 or 0-3)
+/// \return false if the policy is invalid, the reason is printed
+bool parse_thread_policy(const std::vector <std::string>& words, unsigned int first, thread_policy& p);
+
+/// \brief locks the current and future memory of the process, so that pages are never swapped out nor faulted in later
+/// \return false if not permitted (needs root privileges or a large enough RLIMIT_MEMLOCK)
+bool lock_memory();
+
+/// \brief applies the policy to the calling thread, prefaults its stack and registers it for the preemption report
+/// \param layout description of the scheduling of the thread, e.g. "trigger FIFO 80 cpus 2"
+/// \return false if the policy could not be applied (the thread keeps running with the policy of the process)
+bool start_rt_thread(unsigned int idx, const thread_policy& p, std::string& layout);
+
+/// \brief preemptions of the threads that were started: involuntary and voluntary context switches
+/// \param lines one line per thread, e.g. "trigger preempted 12 switches 34567"
+void report_rt_threads(std::vector <std::string>& lines);
+
+#endif
@@ -0,0 +1,75 @@
+//
+//  seqlock.h
+//  value published by a writer and copied by readers that never block: a sequence lock with a generation counter
+//
+//  The sequence number is odd while the value is written. A reader copies the value between two reads of the sequence
+//  number and copies it again if the number was odd or changed, so a reader never waits for a lock and never delays
+//  the writer. The generation counts the writes that changed the value (operator== of T), a reader that keeps the
+//  generation of its last copy knows with one comparison whether there is something new.
+//
+//  The writers need to be serialized by the caller (one thread, or a mutex of the writers). T is copied with memcpy.
+//
+
+#ifndef __seqlock_h
+#define __seqlock_h
+
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
+
+template <class T>
+class seqlock {
+
+  static_assert(std::is_trivially_copyable<T>::value, "the value of a seqlock is copied with memcpy");
+
+public:
+  seqlock(){
+    seq = 0;
+    generation = 0;
+  }
+
+  /// \brief publishes value, the generation changes if value differs from the previous one (does not allocate)
+  void write(const T& value){
+    // the only writer reads the value without the sequence
+    bool changed = !(value == data);
+    uint64_t s = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&seq, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((void*)&data, (const void*)&value, sizeof(T));
+    if (changed){
+      __atomic_store_n(&generation, generation + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&seq, s + 2, __ATOMIC_RELEASE);
+  }
+
+  /// \brief copies the value, retries while a write overlaps the copy
+  /// \return generation of the copy
+  uint64_t read(T& value) const{
+    while (true){
+      uint64_t s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+      if ((s & 1) == 0){
+        memcpy((void*)&value, (const void*)&data, sizeof(T));
+        uint64_t g = __atomic_load_n(&generation, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seq, __ATOMIC_RELAXED) == s){
+          return g;
+        }
+      }
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+  }
+
+  /// \return generation of the last value written, without copying it
+  uint64_t get_generation() const{
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+  }
+
+private:
+  uint64_t seq;  ///< even: value complete, odd: value being written
+  uint64_t generation;
+  T data;
+};
+
+#endif
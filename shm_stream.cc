@@ -0,0 +1,247 @@
+//
+//  shm_stream.cc
+//  event stream in POSIX shared memory (see shm_stream.h)
+//
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+#include "shm_stream.h"
+#include "utils.h"
+
+using namespace std;
+
+const size_t SHM_RECORDS_OFFSET = 64;  ///< the records start on their own cache line
+
+static_assert(sizeof(shm_stream_header) <= SHM_RECORDS_OFFSET, "the header overlaps the records");
+static_assert(sizeof(data_packet) <= sizeof(shm_record().payload) && sizeof(trigger_ack) <= sizeof(shm_record().payload), "payload too small");
+
+
+// =============================================================================
+// bytes of a segment of capacity records
+static size_t segment_size(uint32_t capacity){
+  return SHM_RECORDS_OFFSET + (size_t)capacity * sizeof(shm_record);
+}
+
+// =============================================================================
+static void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+
+// =============================================================================
+shm_stream::shm_stream(){
+  header = NULL;
+  records = NULL;
+  size = 0;
+  pthread_mutex_init(&mutex, NULL);
+}
+
+// =============================================================================
+shm_stream::~shm_stream(){
+  if (header != NULL){
+    munmap(header, size);
+    shm_unlink(name.c_str());
+  }
+  pthread_mutex_destroy(&mutex);
+}
+
+// =============================================================================
+bool shm_stream::open(const string& name){
+  this->name = name;
+  shm_unlink(name.c_str()); // segment of a previous run, its readers keep their mapping
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+  if (fd < 0){
+    perror("Unable to create the shared memory of the event stream");
+    return false;
+  }
+  size = segment_size(SHM_STREAM_SIZE);
+  // the partners need to write the futex of the header, whatever the umask
+  if (fchmod(fd, 0666) != 0 || ftruncate(fd, size) != 0){
+    perror("Unable to size the shared memory of the event stream");
+    close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED){
+    perror("Unable to map the shared memory of the event stream");
+    shm_unlink(name.c_str());
+    return false;
+  }
+  // the pages are zero, every record has seq 0 until it is written
+  header = (shm_stream_header*) p;
+  records = (shm_record*)((char*)p + SHM_RECORDS_OFFSET);
+  header->version = SHM_STREAM_VERSION;
+  header->capacity = SHM_STREAM_SIZE;
+  header->record_size = sizeof(shm_record);
+  header->next_seq = 1;
+  header->futex = 0;
+  header->sleepers = 0;
+  __atomic_store_n(&header->magic, SHM_STREAM_MAGIC, __ATOMIC_RELEASE);
+  return true;
+}
+
+// =============================================================================
+bool shm_stream::is_open(){
+  return header != NULL;
+}
+
+// =============================================================================
+void shm_stream::publish(uint32_t type, const void* payload, uint32_t length){
+  if (header == NULL){
+    return;
+  }
+  pthread_mutex_lock(&mutex);
+  uint64_t seq = header->next_seq;
+  shm_record& r = records[seq % SHM_STREAM_SIZE];
+  // a reader that reads the record while it is written sees seq change
+  __atomic_store_n(&r.seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  r.type = type;
+  r.length = length;
+  r.published = time_monotonic();
+  memcpy(r.payload, payload, length);
+  __atomic_store_n(&r.seq, seq, __ATOMIC_RELEASE);
+  __atomic_store_n(&header->next_seq, seq + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&header->futex, 1, __ATOMIC_SEQ_CST);
+  bool sleeping = (__atomic_load_n(&header->sleepers, __ATOMIC_SEQ_CST) > 0);
+  pthread_mutex_unlock(&mutex);
+#ifdef __linux__
+  // the system call is only made when a reader sleeps
+  if (sleeping){
+    syscall(SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+#else
+  (void)sleeping;
+#endif
+}
+
+
+// =============================================================================
+shm_stream_reader::shm_stream_reader(){
+  header = NULL;
+  records = NULL;
+  size = 0;
+}
+
+// =============================================================================
+shm_stream_reader::~shm_stream_reader(){
+  if (header != NULL){
+    munmap(header, size);
+  }
+}
+
+// =============================================================================
+bool shm_stream_reader::open(const string& name){
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0){
+    perror("Unable to open the shared memory of the event stream");
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < SHM_RECORDS_OFFSET){
+    cerr<<"The shared memory of the event stream is not ready."<<endl;
+    close(fd);
+    return false;
+  }
+  size = st.st_size;
+  void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED){
+    perror("Unable to map the shared memory of the event stream");
+    return false;
+  }
+  header = (shm_stream_header*) p;
+  records = (shm_record*)((char*)p + SHM_RECORDS_OFFSET);
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHM_STREAM_MAGIC || header->version != SHM_STREAM_VERSION
+      || header->record_size != sizeof(shm_record) || header->capacity == 0 || segment_size(header->capacity) > size){
+    cerr<<"The shared memory of the event stream has another layout (version "<<header->version<<", expected "<<SHM_STREAM_VERSION<<")."<<endl;
+    munmap(header, size);
+    header = NULL;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+uint64_t shm_stream_reader::get_next_seq(){
+  return __atomic_load_n(&header->next_seq, __ATOMIC_ACQUIRE);
+}
+
+// =============================================================================
+const shm_record* shm_stream_reader::peek(uint64_t& cursor, uint64_t& lost){
+  lost = 0;
+  while (true){
+    uint64_t next = __atomic_load_n(&header->next_seq, __ATOMIC_ACQUIRE);
+    // oldest record still in the ring
+    uint64_t oldest = (next > header->capacity) ? next - header->capacity : 1;
+    if (cursor < oldest){
+      lost += oldest - cursor;
+      cursor = oldest;
+    }
+    if (cursor >= next){
+      return NULL;
+    }
+    const shm_record* r = &records[cursor % header->capacity];
+    if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) == cursor){
+      return r;
+    }
+    // overwritten since next_seq was read, the oldest record moved on
+  }
+}
+
+// =============================================================================
+bool shm_stream_reader::still_valid(const shm_record* r, uint64_t seq){
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq;
+}
+
+// =============================================================================
+bool shm_stream_reader::wait(uint64_t cursor, int timeout){
+  double start = time_monotonic();
+  double deadline = start + timeout / 1000.0;
+  // a record that follows closely is caught without system call
+  while (time_monotonic() - start < SHM_SPIN_TIME){
+    if (get_next_seq() > cursor){
+      return true;
+    }
+    cpu_relax();
+  }
+  while (get_next_seq() <= cursor){
+    double remaining = deadline - time_monotonic();
+    if (remaining <= 0){
+      return false;
+    }
+#ifdef __linux__
+    // the writer wakes the futex only if it sees a sleeper, the value of the futex is read after the sleeper is counted
+    __atomic_add_fetch(&header->sleepers, 1, __ATOMIC_SEQ_CST);
+    uint32_t value = __atomic_load_n(&header->futex, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->next_seq, __ATOMIC_SEQ_CST) <= cursor){
+      timespec ts;
+      ts.tv_sec = (time_t)remaining;
+      ts.tv_nsec = (long)((remaining - ts.tv_sec) * 1e9);
+      syscall(SYS_futex, &header->futex, FUTEX_WAIT, value, &ts, NULL, 0);
+    }
+    __atomic_sub_fetch(&header->sleepers, 1, __ATOMIC_SEQ_CST);
+#else
+    usleep(remaining * 1e6 < SHM_POLL_INTERVAL ? (useconds_t)(remaining * 1e6) : SHM_POLL_INTERVAL);
+#endif
+  }
+  return true;
+}
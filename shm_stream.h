@@ -0,0 +1,113 @@
+//
+//  shm_stream.h
+//  event stream in POSIX shared memory for the partners on the same host (SHMSTREAM keyword of the configuration file)
+//
+//  The valve controller writes a record for every change of the valves (data_packet), every trigger (trigger_ack) and
+//  every reading of the MFCs (MFC_flows) to a ring of SHM_STREAM_SIZE fixed-size records. A partner maps the segment
+//  with shm_stream_reader (compile shm_stream.cc and utils.cc with the partner, link -lrt -lpthread) and reads the
+//  records in place: no copy and no system call while records are available. The sequence number of a record is
+//  written last, and is checked again after the record was read, so a record overwritten while it was read is
+//  detected. A reader that lags behind by more than SHM_STREAM_SIZE records loses the oldest ones.
+//
+//  Readers that have nothing to read spin for SHM_SPIN_TIME, then sleep on a futex of the header (Linux) that the
+//  writer wakes only when a reader sleeps; on the other systems they poll every SHM_POLL_INTERVAL.
+//
+
+#ifndef __shm_stream_h
+#define __shm_stream_h
+
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "data_format.h"
+#include "MFC_data.h"
+
+const uint32_t SHM_STREAM_MAGIC = 0x56435354;  ///< "VCST"
+const uint32_t SHM_STREAM_VERSION = 1;  ///< changes with the layout of shm_stream_header and shm_record
+const uint32_t SHM_STREAM_SIZE = 1024;  ///< records in the ring
+const double SHM_SPIN_TIME = 50e-6;  ///< s, a reader spins that long before it sleeps
+const unsigned int SHM_POLL_INTERVAL = 100;  ///< us, sleep of a reader without futex
+
+enum shm_record_type {
+  SHM_PULSE = 1,    ///< data_packet, start or end of a pulse
+  SHM_TRIGGER = 2,  ///< trigger_ack
+  SHM_FLOW = 3      ///< MFC_flows
+};
+
+/// record of the ring, the payload is the structure of its type
+struct shm_record{
+  uint64_t seq;  ///< starts at 1, 0 while the record is written
+  uint32_t type;  ///< shm_record_type
+  uint32_t length;  ///< bytes of payload
+  double published;  ///< time_monotonic at which the record was written, for the notification latency
+  char payload[sizeof(MFC_flows)];  ///< the largest of data_packet, trigger_ack and MFC_flows
+};
+
+/// start of the segment, the records follow
+struct shm_stream_header{
+  uint32_t magic;  ///< written last, once the segment is ready
+  uint32_t version;
+  uint32_t capacity;  ///< SHM_STREAM_SIZE of the writer
+  uint32_t record_size;  ///< sizeof(shm_record) of the writer
+  uint64_t next_seq;  ///< sequence number of the next record
+  uint32_t futex;  ///< incremented at every record, the readers sleep on it
+  uint32_t sleepers;  ///< readers sleeping on the futex
+};
+
+
+/// writer of the valve controller
+class shm_stream {
+
+public:
+  shm_stream();
+  ~shm_stream();
+
+  /// \brief creates the segment (name: /something), a segment left by a previous run is replaced
+  bool open(const std::string& name);
+
+  bool is_open();
+
+  /// \brief writes a record, does not allocate; nothing is written if the stream is not open
+  void publish(uint32_t type, const void* payload, uint32_t length);
+
+private:
+  std::string name;
+  shm_stream_header* header;
+  shm_record* records;
+  size_t size;  ///< bytes mapped
+  pthread_mutex_t mutex;  ///< the scheduler, network and serial threads write
+};
+
+
+/// reader of a partner
+class shm_stream_reader {
+
+public:
+  shm_stream_reader();
+  ~shm_stream_reader();
+
+  /// \brief maps the segment of the valve controller, false if it does not exist or has another layout
+  bool open(const std::string& name);
+
+  /// \return sequence number of the next record, cursor of a reader that only wants the records to come
+  uint64_t get_next_seq();
+
+  /// \brief record at cursor, in place, or NULL if it is not written yet. The cursor moves to the oldest record
+  ///        still in the ring if the reader lagged behind, lost counts the records skipped
+  const shm_record* peek(uint64_t& cursor, uint64_t& lost);
+
+  /// \brief true if the record was not overwritten while it was read, to be checked after reading it
+  bool still_valid(const shm_record* r, uint64_t seq);
+
+  /// \brief waits until the record at cursor is written
+  /// \return false after timeout ms
+  bool wait(uint64_t cursor, int timeout);
+
+private:
+  shm_stream_header* header;
+  shm_record* records;
+  size_t size;
+};
+
+#endif
@@ -0,0 +1,243 @@
+//
+//  usb_refcount_check.cpp
+//  checks that every call of the aioUsbApi gives back the reference it takes on the shared USB handle of a board
+//  (getDevHandle / releaseDevHandle), on the success path and on the error paths (make refcount-check)
+//
+//  usage: usb_refcount_check
+//
+//  libusb is replaced by the stubs of this file: two USB-DIO-96 boards are listed, the transfers succeed in a first
+//  pass and fail in a second one. The board holds a reference like usb_dio_device does, after each call the count of
+//  references and the number of open handles need to be back to their values before the call.
+//  Exits with 1 if a call took or gave back a reference too many.
+//
+
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+
+#include "aioUsbApi.h"
+#include "libusb.h"
+
+using namespace std;
+
+const int NB_STUB_DEVICES = 2;
+
+extern aioDeviceInfo aioDevs;  ///< device list of the aioUsbApi, with the references of the handles
+
+struct libusb_device{
+  int id;
+};
+
+struct libusb_device_handle{
+  int id;
+};
+
+static libusb_device devices[NB_STUB_DEVICES];
+static libusb_device_handle handles[NB_STUB_DEVICES];
+static bool fail_transfers = false;  ///< the transfers of the second pass fail
+static int open_handles = 0;  ///< libusb_open - libusb_close
+
+
+// =============================================================================
+//            libusb stubs
+// =============================================================================
+
+int libusb_init(libusb_context** ctx){
+  return 0;
+}
+
+void libusb_exit(libusb_context* ctx){
+}
+
+ssize_t libusb_get_device_list(libusb_context* ctx, libusb_device*** list){
+  static libusb_device* table[NB_STUB_DEVICES + 1];
+  for (int i(0); i < NB_STUB_DEVICES; i++){
+    devices[i].id = i;
+    table[i] = &devices[i];
+  }
+  table[NB_STUB_DEVICES] = NULL;
+  *list = table;
+  return NB_STUB_DEVICES;
+}
+
+void libusb_free_device_list(libusb_device** list, int unref_devices){
+}
+
+libusb_device* libusb_ref_device(libusb_device* dev){
+  return dev;
+}
+
+void libusb_unref_device(libusb_device* dev){
+}
+
+int libusb_get_device_descriptor(libusb_device* dev, struct libusb_device_descriptor* desc){
+  memset(desc, 0, sizeof(*desc));
+  desc->idVendor = ACCES_VENDOR_ID;
+  desc->idProduct = USB_DIO_96_ID_DEV;
+  return 0;
+}
+
+int libusb_open(libusb_device* dev, libusb_device_handle** handle){
+  handles[dev->id].id = dev->id;
+  *handle = &handles[dev->id];
+  open_handles++;
+  return 0;
+}
+
+libusb_device_handle* libusb_open_device_with_vid_pid(libusb_context* ctx, uint16_t vendor_id, uint16_t product_id){
+  return NULL;
+}
+
+void libusb_close(libusb_device_handle* dev_handle){
+  open_handles--;
+}
+
+int libusb_claim_interface(libusb_device_handle* dev, int iface){
+  return 0;
+}
+
+int libusb_release_interface(libusb_device_handle* dev, int iface){
+  return 0;
+}
+
+int libusb_control_transfer(libusb_device_handle* dev_handle, uint8_t request_type, uint8_t request, uint16_t value,
+  uint16_t index, unsigned char* data, uint16_t length, unsigned int timeout){
+  if (fail_transfers){
+    return LIBUSB_ERROR_IO;
+  }
+  if (data != NULL && (request_type & LIBUSB_ENDPOINT_IN)){
+    memset(data, 0, length);
+  }
+  return length;
+}
+
+int libusb_bulk_transfer(libusb_device_handle* dev_handle, unsigned char endpoint, unsigned char* data, int length,
+  int* transferred, unsigned int timeout){
+  *transferred = fail_transfers ? 0 : length;
+  return fail_transfers ? LIBUSB_ERROR_IO : 0;
+}
+
+struct libusb_transfer* libusb_alloc_transfer(int iso_packets){
+  return (struct libusb_transfer*)calloc(1, sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer* transfer){
+  free(transfer);
+}
+
+// asynchronous transfers are never completed by the stubs, they are refused
+int libusb_submit_transfer(struct libusb_transfer* transfer){
+  return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer* transfer){
+  return LIBUSB_ERROR_NOT_FOUND;
+}
+
+int libusb_handle_events(libusb_context* ctx){
+  return LIBUSB_ERROR_INTERRUPTED;
+}
+
+
+// =============================================================================
+//            checks
+// =============================================================================
+
+static int nb_failures = 0;
+
+// =============================================================================
+// compares the references of the board before and after a call
+void check(const string& name, int refs_before, int open_before, unsigned long ret){
+  int refs = aioDevs.aioDevList[0].handleRefCount;
+  string pass = fail_transfers ? "failing transfers" : "transfers";
+  if (refs != refs_before || open_handles != open_before){
+    cerr<<"FAIL "<<name<<" ("<<pass<<", returned "<<ret<<"): references "<<refs_before<<" -> "<<refs
+      <<", open handles "<<open_before<<" -> "<<open_handles<<endl;
+    nb_failures++;
+  }else{
+    cout<<"ok   "<<name<<" ("<<pass<<")"<<endl;
+  }
+}
+
+#define CHECK(call) { \
+  int refs_before = aioDevs.aioDevList[0].handleRefCount; \
+  int open_before = open_handles; \
+  unsigned long ret = (call); \
+  check(#call, refs_before, open_before, ret); \
+}
+
+// =============================================================================
+// every call of the API that takes the handle of the board
+void check_calls(unsigned long dev){
+  unsigned char buf[256];
+  unsigned long size;
+  unsigned short value;
+  unsigned long transferred;
+  double hz (1000.0);
+  char cal[] = ":NONE:";
+  memset(buf, 0, sizeof(buf));
+
+  size = 16;
+  CHECK(AIO_Usb_ADC_GetConfig(dev, buf, &size));
+  size = 16;
+  CHECK(AIO_Usb_ADC_SetConfig(dev, buf, &size));
+  CHECK(AIO_Usb_ADC_RangeAll(dev, buf));
+  CHECK(AIO_Usb_ADC_Range1(dev, 15, 0, 1));  // the range of channel 15 only is accepted
+  CHECK(AIO_Usb_ADC_SetCal(dev, cal));
+  CHECK(AIO_Usb_ADC_GetImmediate(dev, &value));
+  CHECK(AIO_Usb_ADC_ADMode(dev, 0, 0));
+  CHECK(AIO_Usb_ADC_QueryCal(dev, buf));
+  CHECK(AIO_ADC_Usb_BulkAcquire(dev, buf, 64, hz));
+  CHECK(AIO_Usb_CTR_8254Mode(dev, 0, 0, 2));
+  CHECK(AIO_Usb_CTR_8254Load(dev, 0, 0, 100));
+  CHECK(AIO_Usb_CTR_8254ModeLoad(dev, 0, 0, 2, 100));
+  CHECK(AIO_Usb_CTR_8254ReadModeLoad(dev, 0, 0, 2, 100, &value));
+  CHECK(AIO_Usb_CTR_8254Read(dev, 0, 0, &value));
+  CHECK(AIO_Usb_DIO_Configure(dev, 0, buf, buf));
+  CHECK(AIO_Usb_DIO_ConfigureEx(dev, buf, buf, 0));
+  CHECK(AIO_Usb_WriteAll(dev, buf));
+  CHECK(AIO_Usb_Write1(dev, 3, 1));
+  CHECK(AIO_Usb_DIO_ReadAll(dev, buf));
+  CHECK(AIO_Usb_CustomEEPROMWrite(dev, 0, 16, buf));
+  CHECK(AIO_Usb_CustomEEPROMWrite(dev, 0x1F0, 0x20, buf));
+  CHECK(AIO_Usb_CustomEEPROMRead(dev, 0, 16, buf));
+  CHECK(AIO_Usb_CustomEEPROMRead(dev, 0x1F0, 0x20, buf));
+  CHECK(AIO_Usb_ClearFIFO(dev, 0));
+  CHECK(AIO_Usb_DIO_StreamSetClocks(dev, &hz, &hz));
+  AIO_Usb_DIO_StreamOpen(dev, STREAM_OP_READ);
+  CHECK(AIO_Usb_DIO_StreamFrame(dev, 16, buf, &transferred, &hz));
+  AIO_Usb_DIO_StreamOpen(dev, STREAM_OP_WRITE);
+  CHECK(AIO_Usb_DIO_StreamFrame(dev, 16, buf, &transferred, &hz));
+  AIO_Usb_DIO_StreamOpen(dev, STREAM_OP_NONE);
+}
+
+// =============================================================================
+int main(int argc, char* argv[]){
+  aioDeviceInfo info;
+  if (AIO_Init() != ERROR_SUCCESS || AIO_Usb_GetDevices(&info) != ERROR_SUCCESS){
+    cerr<<"The stub boards were not found."<<endl;
+    return 1;
+  }
+  unsigned long dev = info.aioDevList[0].devIdx;
+
+  // the reference of the valve controller, as in usb_dio_device::open
+  if (getDevHandle(dev) == NULL){
+    cerr<<"Could not get the handle of the stub board."<<endl;
+    return 1;
+  }
+  for (int pass(0); pass < 2; pass++){
+    fail_transfers = (pass == 1);
+    check_calls(dev);
+  }
+  releaseDevHandle(dev);
+  if (aioDevs.aioDevList[0].handleRefCount != 0 || open_handles != 0){
+    cerr<<"FAIL the handle is still open after the last reference: references "<<aioDevs.aioDevList[0].handleRefCount
+      <<", open handles "<<open_handles<<endl;
+    nb_failures++;
+  }
+  AIO_Usb_DIO_ClearDevices();
+
+  cout<<nb_failures<<" failure(s)"<<endl;
+  return (nb_failures > 0) ? 1 : 0;
+}
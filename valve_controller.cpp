@@ -26,6 +26,8 @@
 #include <cstdio>
 #include <vector>
 #include <bitset> // to perform bitwise operations
+#include <cstdarg>
+#include <cmath>
 
 #include <unistd.h>  // usleep
 #include <sys/time.h>  //
@@ -33,15 +35,8 @@
 #include <pthread.h> // enable threads
 #include "pthread_event.h" // enables threat events
 
-#include "aioUsbApi.h"  ///< include API of USB-DIO-96 device from www.accesio.com
-#include "libusb.h" ///< http://libusb.sourceforge.net/api-1.0/
 
-#ifdef BEHAVIOR
-#include "vo_alias_behavior.h"
-#endif
-#ifdef PHYSIOLOGY
-#include "vo_alias_physiology.h"
-#endif
+#include "vo_alias.h" // valve aliases of the rig profile
 
 #include "netutils.h" // sockets
 #include "data_format.h"  // format of data packets for send sockets
@@ -49,6 +44,11 @@
 #include "utils.h"  // various utility functions
 #include "data_format.h" // format of data packers for send and receive sockets
 #include "MFC_data.h"
+#include "valve_controller.h" // thread parameters and functions shared with the benchmarks
+#include "partner_server.h" // event loop of the partner port
+#include "alloc_tracker.h" // real-time regions, allocations counted with -DALLOC_TRACKING
+#include "rt_thread.h" // scheduling of the threads (THREAD keyword)
+#include "event_scheduler.h" // timer wheel and executors of the instructions
 
 using namespace std;
 
@@ -60,45 +60,113 @@ const uint16_t TCP_PORT1 = 8124; // port used for connection between Igor and va
 const uint16_t TCP_PORT2 = 8125; // port used for connection between Flytracker and valve controller
 
 const int TIMESTAMP_PRECISION = 5;
-const int MFC_INTERVAL = 100; // interval in ms between subsequent polling of MFC
+const double GRID_OVERRUN = 0.001; // s, a pulse given later than this after its slot of the grid is counted as an overrun
+const double GRID_ROUNDING = 1e-6; // fraction of a period below which the timeline is considered on a slot
+const double ARENA_POLL = 0.1; // s, longest sleep of the scheduler of the arenas, it checks the end of the program in between
 
 const int FAILED_IN_CONFIG = 1;
 
-/// info concerning partner function, used as type in vector, because different partners use different functions with different parameters
-struct partner_funct_param{
-  void* (*ptr_to_partner_function) (void*);/// pointer to function of partner
-  void* ptr_to_partner_param; /// pointer to parameters of function of partner
+const unsigned int RECOVERY_RETRY = 1000; // interval in us between two checks of a thread waiting for the boards to come back
+const unsigned int RECOVERY_POLL = 50000; // interval in us between attempts to reopen the boards after the USB link dropped
+const unsigned int RECOVERY_TIMEOUT = 10000000; // time in us a frame waits for the boards to come back before the run is aborted
+
+/// where plan_instructions stopped
+enum plan_status {PLAN_PULSE, PLAN_END, PLAN_WAITSTOP, PLAN_ERROR};
+
+/// state of the run used by the actions of the scheduler thread
+struct run_context{
+  Configuration* config;
+  dio_boards* boards;
+  thread_param* param;  ///< valve state handed to the socket thread of the partner
+  poll_param* polling;  ///< polling thread of Igor, NULL with other partners
+  pulse i_pulse;  ///< interval air
+  action_executor* setpoint;
+  action_executor* logger;
+  const pulse* unlogged;  ///< pulse opened by the network thread whose lines wait for the timestamp of the partner (FASTTRIGGER)
 };
 
+/// instruction cursor of a fly with its own arena (ARENA)
+struct fly_cursor{
+  int idx;  ///< next instruction of the fly
+  double timeline;  ///< the next pulse of the fly is not given before (WAIT of its instructions)
+  const pulse* next;  ///< pulse waiting for the trigger of the fly, NULL while the instructions before it are planned
+  const pulse* open;  ///< pulse whose valves are open, NULL during interval air
+  bool done;  ///< WAITSTOP, the cursor stops there
+};
 
-struct poll_param{
-  pthread_event* event;
-  pthread_mutex_t mutex;  // mutex for USB handle (USB handle is shared with the main thread)
-  pthread_mutex_t mutex_data; // mutex for changing triggered and ITC18_timestamp variables
-  bool triggered;
-  double ITC18_timestamp;
-  libusb_device_handle* usbhandle;
-  bool stop; // stop used to terminate detached thread when main terminates, without stop the detached thread tries to access data from main which has been destroyed already thereby causing a bus error or segmentation fault
+/// onsets of the pulses on the grid of PULSEGRID
+struct grid_stats{
+  double period;  ///< s, 0 without grid
+  double t0;  ///< time_monotonic of slot 0, the slot of the first pulse
+  long last_slot;  ///< slot of the last pulse, -1 before the first one
+  unsigned int pulses;
+  unsigned int overruns;  ///< pulses given more than GRID_OVERRUN after their slot
+  long skipped;  ///< slots left empty because the instructions between two pulses took longer than a period
+  double max_late;  ///< s
+  double sum_late;  ///< s
+  double drift;  ///< s, delay of the last pulse from its slot
 };
 
-struct thread_param{
-  pthread_event* event;
-  pthread_mutex_t mutex;
-  Configuration* ptr_config; 
-  bool changed;
-  data_packet data;
-  double partner_timestamp;
-  bool stop; // stop used to terminate detached thread when main terminates, set to true just before main finishes
+/// time from the arrival of PULSE_QUERY to the frame of its pulse (Flytracker with TRIGGER external)
+struct trigger_stats{
+  unsigned int pulses;
+  unsigned int fast;  ///< pulses whose frame was written by the network thread (FASTTRIGGER)
+  double max;  ///< s
+  double sum;  ///< s
 };
 
-// parameter structure for multiflow controller parameters, 
-struct MFC_param{
-  pthread_event* event;
-  pthread_mutex_t mutex;
-  Configuration* ptr_to_config;
-  bool stop; // stop used to terminate detached thread when main terminates
+/// parameters of the setpoint executor
+struct setpoint_context{
+  Configuration* config;
+  MFC_param* mfc_param;
 };
 
+// =============================================================================
+// applies the THREAD policy of the configuration to the calling thread, the layout in effect is printed and logged
+void start_thread(Configuration& config, const char* name){
+  int idx = rt_thread_index(name);
+  string layout;
+  start_rt_thread(idx, config.get_thread_policy(idx), layout);
+  cout<<"Thread "<<layout<<endl;
+  config.log("THREAD " + layout);
+}
+
+// =============================================================================
+// prints and logs the preemptions of the threads, at the end of the run
+void report_threads(Configuration& config){
+  vector <string> lines;
+  report_rt_threads(lines);
+  for (unsigned int i(0); i < lines.size(); i++){
+    cout<<"Thread "<<lines[i]<<endl;
+    config.log("THREAD " + lines[i]);
+  }
+}
+
+// =============================================================================
+// marks the USB link as down, the monitor thread reopens the boards (boards mutex must be locked)
+void mark_boards_lost(dio_boards& boards){
+  if (boards.connected){
+    boards.connected = false;
+    boards.lost_since = time_real();
+    cerr<<"USB connection to the boards lost."<<endl;
+  }
+}
+
+// =============================================================================
+// reads the 12 ports of a board, returns false if the USB link is down
+bool read_from_board(dio_boards& boards, unsigned int board, unsigned char* pData){
+  pthread_mutex_lock(&boards.mutex);
+  if (!boards.connected || board >= boards.nb){
+    pthread_mutex_unlock(&boards.mutex);
+    return false;
+  }
+  bool read = boards.device->read(board, pData);
+  if (!read){
+    mark_boards_lost(boards);
+  }
+  pthread_mutex_unlock(&boards.mutex);
+  return read;
+}
 
 
 // =============================================================================
@@ -107,22 +175,27 @@ struct MFC_param{
 // every time we access the usbhandle we need to block the mutex to ensure that only one thread used the usbhandle at a time
 void* poll_ITC18_trigger(void* ptr_to_param){
   poll_param* param = (poll_param*) ptr_to_param;
+  start_thread(*param->ptr_config, "trigger");
   bool triggered(true); // put triggered to true at start to ensure that ITC18 signal will be zero before the first trigger
   double timestamp(0.0);
   // read data port from USB device to check for incoming trigger signal
   while (!param->stop){
+    rt_region region("ITC18_trigger"); // no allocation while polling (see alloc_tracker.h)
     unsigned char pData[12];
     // block mutex so that usbhandle can be used for data reading
     pthread_mutex_lock(&param->mutex);
-    // read info from USBDIO96 to see whether trigger received
-    if (param->usbhandle == NULL){
+    if (param->stop){
       pthread_mutex_unlock(&param->mutex);
-      cerr<<"Polling thread terminated because USB handle null."<<endl;
       return NULL;
     }
-    
-    libusb_control_transfer(param->usbhandle, USB_READ_FROM_DEV, DIO_READ, 0, 0, pData, 12, TIMEOUT_1_SEC);
+    // read info from USBDIO96 to see whether trigger received
+    bool read = read_from_board(*param->boards, 0, pData);
     pthread_mutex_unlock(&param->mutex);
+    if (!read){
+      // USB link down: wait for the monitor thread to reopen the board instead of spinning on a dead handle
+      usleep(RECOVERY_RETRY);
+      continue;
+    }
     /*cout<<"pdata: ";
     for (int i (0);i<12;i++){ 
       cout<<(int)pData[i]<<" ";
@@ -144,6 +217,7 @@ void* poll_ITC18_trigger(void* ptr_to_param){
         param->ITC18_timestamp = timestamp;
         param->triggered = true; 
         pthread_mutex_unlock(&param->mutex_data);
+        param->events->push_trigger(timestamp, -1.0); // acknowledged to the subscribed partner
         triggered = true;
       }
     }else{
@@ -156,151 +230,179 @@ void* poll_ITC18_trigger(void* ptr_to_param){
 
 
 // =============================================================================
-bool initialise(int deviceIdx){						//Just sets up the board for our use: all but one byte to be used as output
-	unsigned char mask[2];
-	unsigned char data[12];		//for DIO_96
-	unsigned int triState = 0;
-  
-	mask[0]=255;	//sets the first 8 port direction bits to 1, i.e. output
-  //	mask[1]=0;	//sets the rest of the board for input
-	mask[1]=3;	//sets ports 8 and 9 for output, 10 and 11 for input. Port 11 is reserved for the trigger and port 10 can be GPIO
-	
-	
-	
-  /// OPEN INTERVAL AIR CHANNELS: BEHAVIOUR data[0]=8,data[1]=8, data[2]=8, data[5]=1, all other 0 
-	data[0]=8;	///opens channel for interval air by default, all other channels are closed and data [8-11] are put to 0
-	data[1]=8;
-	data[2]=8;
-	data[3]=0;
-	data[4]=0;
-	data[5]=1;
-	data[6]=0;
-	data[7]=0;
-	data[8]=0;
-	data[9]=0;
-	data[10]=0;
-	data[11]=0;
-	
-  
-  //writes and configures
-	int ret = AIO_Usb_DIO_Configure (deviceIdx, triState, mask, data);
-	
-	if (ret > ERROR_SUCCESS){
-		cout<<endl<<"DIO_Configure Failed dev ="<<deviceIdx<<", err="<<ret<<"."<<endl<<"Have you run the Access Loader?"<<endl;
-    //sprintf(temp, "\015DIO_Configure Failed dev=0x%0x err=%d\015Have you run AccesLoader?\015",(unsigned int)myDevIdx,ret);
-      false;
-	}
-  return true;
+// frame written when the program starts: interval air is open, all other channels are closed
+void default_frame(unsigned int board, unsigned char* data){
+  memset(data, 0, 12); // data [8-11] are put to 0, other boards start closed
+  if (board == 0){
+    /// OPEN INTERVAL AIR CHANNELS: BEHAVIOUR data[0]=8,data[1]=8, data[2]=8, data[5]=1, all other 0 
+	  data[0]=8;	///opens channel for interval air by default, all other channels are closed
+	  data[1]=8;
+	  data[2]=8;
+	  data[5]=1;
+  }
 }
 
-
 // =============================================================================
-bool write_to_USB(struct libusb_device_handle *handle, int deviceIdx, unsigned char *pData){
-
-	if (pData == NULL){
-		cerr<<"pData is NULL"<<endl;
-		return false;
-	}
-	if (handle == NULL){
-		cout<<" Device handle is NULL."<<endl;
-		return false;
-	}
-
-  //changed to 12 (DPM: not 14!) to accommodate 96-channel card
-  int ret = libusb_control_transfer(handle, USB_WRITE_TO_DEV, DIO_WRITE, 0, 0, pData, 12, TIMEOUT_1_SEC);
-
-  if (ret  < 0 ){
-		cerr<<" usb_control_msg failed on WRITE_TO_DEV "<<(unsigned int)deviceIdx << endl;
-		return false;
-	}else{
-		return true;
+// waits until the monitor thread has reopened the boards and restored the shadow frames
+// returns the time at which the frames were restored, or -1 if the boards did not come back within RECOVERY_TIMEOUT
+double wait_for_boards(dio_boards& boards){
+  for (unsigned int waited(0); waited < RECOVERY_TIMEOUT; waited += RECOVERY_RETRY){
+    pthread_mutex_lock(&boards.mutex);
+    bool connected = boards.connected;
+    double restored_at = boards.restored_at;
+    pthread_mutex_unlock(&boards.mutex);
+    if (connected){
+      return restored_at;
+    }
+    usleep(RECOVERY_RETRY);
   }
+  return -1;
 }
 
 
 // =============================================================================
-// opens all channels specified in channels 
-// channel IDs varies from 0 to 63 (64 channels total)
+// opens all channels specified in the mask
+// channel IDs varies from 0 to 63 on each board (64 channels per board)
 // there are 8 ports, each controlling 8 channels. each bit is a channel, if the bit is 1 the channel is open, if the bit is zero the channel is closed
+// the mask is precomputed from the alias (see vo_alias.h), so the frame is built with one copy per port
+// with several boards, all boards are written concurrently and skew is the time between the first and the last completion
 // returns timestamp in seconds, with ns precision (timestamp is monotonic)
-double set_channel(libusb_device_handle* usbhandle, int deviceIdx, vector <int> channels, bool odor){
+double set_channel(dio_boards& boards, const valve_mask& channels, bool odor, double& skew){
  
-  
-  unsigned char data[12];
-	data[0]=0;
-	data[1]=0;
-	data[2]=0;
-	data[3]=0;
-	data[4]=0;
-	data[5]=0;
-	data[6]=0;
-	data[7]=0;
-	
-	data[9]=odor; // this output will be 1 for each odor pulse, and 0 whenever carrier air flows, confirms in hardware that we have received the trigger, can be acquired through ITC18 into Igor, or possibly through arduino or serial port into any other program
-  
-  // determine for each channel, the port to which they belong and determine pin
-  vector <vector <int> > port_table;
-  port_table.resize(NB_PORTS);
-  for (unsigned int i(0); i < channels.size(); i++){
-    if (channels[i] < 0 || channels[i] >= NB_CHANNELS ){
-      cerr<<"Error, channel "<<channels[i]<<" invalid."<<endl;
-      return -1;
-    }
-    int port =  (channels[i])/BITS_PER_PORT; // determine port
-    port_table[port].push_back(channels[i] % BITS_PER_PORT); // modulo determines pin
+  // last safety check of the frame, aliases have already been checked when the rig profile was loaded
+  if (!valve_alias::check_frame(channels)){
+    return -1;
   }
-  
-  // generate values for each port based on associated channels
-  for (unsigned int p(0); p < NB_PORTS; p++){
-    bitset <BITS_PER_PORT> port_value;
-    port_value.reset();// default all pins are set to 0
-    for (unsigned int c(0); c< port_table[p].size(); c++){
-      port_value[port_table[p][c]]=1;  // set pins of channels to 1
-    }
-    data[p] = static_cast<unsigned char>(port_value.to_ulong());
+
+  unsigned char data[MAX_BOARDS][DIO_FRAME_SIZE];
+  for (unsigned int b(0); b < boards.nb; b++){
+    channels.to_ports(b, data[b]);
+    // ports 8-11 are not valves
+    data[b][8]=0;
+    data[b][10]=0;
+    data[b][11]=0;
+	  data[b][9]=odor; // this output will be 1 for each odor pulse, and 0 whenever carrier air flows, confirms in hardware that we have received the trigger, can be acquired through ITC18 into Igor, or possibly through arduino or serial port into any other program
   }
-	
-  /*
-   // INFO: below code can only set one pin per port to 1
-  for (int c(0); c< channels.size(); c++){
-    if (channels[c] >= 0 && channels[c] < NB_CHANNELS ) {
-      int port = (channels[c])/BITS_PER_PORT;
-      //data[port]=pow(2, channel % BITS_PER_PORT); // floating point, does not work on all microcontroller, slow, requires #include <cmath>
-      data[port]=(1 << (channels[c] % BITS_PER_PORT)); // shifts bits, works on all microcontrollers, fast
-    }else{
-      cerr<<"Error, channel "<<channels[c]<<" invalid."<<endl;
-      return -1;
+  
+  bool written (false);
+  double timestamp (0.0);
+  skew = 0;
+  pthread_mutex_lock(&boards.mutex);
+  // the frame is shadowed before it is written, so that it is restored if the link drops now
+  memcpy(boards.shadow, data, sizeof(data[0]) * boards.nb);
+  if (boards.connected){
+    double first (0.0);
+    written = boards.device->write(data, first, timestamp);
+    skew = timestamp - first;
+    if (!written){
+      mark_boards_lost(boards);
     }
   }
-	*/
+  pthread_mutex_unlock(&boards.mutex);
   
-	if (!write_to_USB(usbhandle, deviceIdx, data)){
+  if (!written){
+    // the monitor thread writes the shadowed frame when the boards are back
+    timestamp = wait_for_boards(boards);
+    if (timestamp > 0){
+      return timestamp;
+    }
     cerr<<"Failed to set channels:";
-    for(unsigned int i(0); i< channels.size(); i++){
-      cerr<<" "<<channels[i];
+    vector <int> list = channels.channels();
+    for(unsigned int i(0); i< list.size(); i++){
+      cerr<<" "<<list[i];
     }
     cerr<<endl;
     return -1;
   }
   
-  //double timestamp = time_monotonic();
-  double timestamp = time_real();
-  
   return timestamp;
 }
 
 
 // =============================================================================
-bool test_valves(libusb_device_handle* usbhandle, int deviceIdx){
+// reopens the boards after the USB link dropped: configures the boards and writes the shadow frames
+// called without the boards mutex, which is only taken to copy and commit the shadow frames: while the link is down,
+// the other threads only update the shadow frames and do not use the device
+bool recover_boards(dio_boards& boards){
+  unsigned char shadow[MAX_BOARDS][DIO_FRAME_SIZE];
+  pthread_mutex_lock(&boards.mutex);
+  memcpy(shadow, boards.shadow, sizeof(shadow[0]) * boards.nb);
+  pthread_mutex_unlock(&boards.mutex);
+
+  if (!boards.device->open(boards.nb)){
+    return false;
+  }
+  for (unsigned int b(0); b < boards.nb; b++){
+    if (!boards.device->configure(b, shadow[b])){
+      return false;
+    }
+  }
+
+  pthread_mutex_lock(&boards.mutex);
+  bool restored (true);
+  // a frame requested while the boards were configured is written now
+  if (memcmp(shadow, boards.shadow, sizeof(shadow[0]) * boards.nb) != 0){
+    double first, last;
+    restored = boards.device->write(boards.shadow, first, last);
+  }
+  if (restored){
+    boards.restored_at = time_real();
+    boards.connected = true;
+  }
+  pthread_mutex_unlock(&boards.mutex);
+  return restored;
+}
+
+// =============================================================================
+// watches the USB link: disconnections are reported by the device (hotplug events) when the platform supports them,
+// and by failed transfers otherwise. While the link is down, the boards are reopened every RECOVERY_POLL us, without
+// the mutex of the boards, and the duration of the outage is written to the logfile once the shadow frames are restored
+void* usb_monitor(void* ptr_to_param){
+  usb_monitor_param* param = (usb_monitor_param*) ptr_to_param;
+  dio_boards& boards = *param->boards;
+  start_thread(*param->ptr_config, "usb");
+  
+  while (!param->stop){
+    // the device cannot take the mutex of the boards while it waits for events, a write may be pumping them
+    bool unplugged = boards.device->watch(RECOVERY_POLL);
+    
+    pthread_mutex_lock(&boards.mutex);
+    if (unplugged){
+      mark_boards_lost(boards);
+    }
+    bool connected = boards.connected;
+    pthread_mutex_unlock(&boards.mutex);
+    if (!connected && recover_boards(boards)){
+      pthread_mutex_lock(&boards.mutex);
+      double outage = boards.restored_at - boards.lost_since;
+      pthread_mutex_unlock(&boards.mutex);
+      cout<<"USB connection to the boards restored after "<<to_stringHP(outage * 1000, 3)<<" ms."<<endl;
+      param->ptr_config->log(to_stringHP(time_real(), TIMESTAMP_PRECISION) + " USB_RECOVERED " + to_stringHP(outage * 1000, 3));
+    }
+  }
+  return NULL;
+}
+
+
+// =============================================================================
+bool test_valves(dio_boards& boards){
   
   unsigned int sommeil = 1000; // delay between two channel tests in ms
   
   // NEED TO IMPLEMENT TEST OF ALL AIR PATHS
+  // single channels that are part of an INTERLOCK TOGETHER rule of the rig profile are refused by set_channel, they are reported and skipped
   
   
-  for (unsigned int i(0); i< NB_CHANNELS; i++){
-    vector <int> test = make_vector<int>()<<i;
-    if (!set_channel(usbhandle, deviceIdx, test, i%2)){
+  for (unsigned int i(0); i< NB_CHANNELS * boards.nb; i++){
+    valve_mask test;
+    test.set(i);
+    const interlock_rule* rule = valve_alias::get_profile().get_interlock().violated_rule(test);
+    if (rule != NULL){
+      cerr<<"Channel "<<i<<" not tested alone, refused by interlock: "<<rule->text<<endl;
+      continue;
+    }
+    double skew (0.0);
+    if (set_channel(boards, test, i%2, skew) < 0){
       cerr<<"Failed to set channel: "<<i<<endl;
       return false;
     }
@@ -311,37 +413,11 @@ bool test_valves(libusb_device_handle* usbhandle, int deviceIdx){
 }
 
 
-// =============================================================================
-// create socket to listen for incoming connections
-int open_local_listening_port(const uint16_t port){
-  //cout<< "Opening  port"<<endl;
-  
-  // creates socket
-  int s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP); // IPv4 TCP socket, TCP to ensure reliable transfer
-  // specifies destination address of socket (IP address and port)
-  sockaddr_in i_addr;
-  memset(&i_addr, 0, sizeof(i_addr)); // initialize all fields to zero to ensure correct functionning on all OS, on MACOS there are additional fields that can cause problems when they remain uninitialized 
-  i_addr.sin_family = AF_INET;
-  i_addr.sin_port = htons(port); //htons converts bits to correct network byte order
-  i_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); //htonl converts IP address in network byte order, INADDR_LOOPBACK = 127.0.0.1 (local host)
-  
-  int result = bind(s,(sockaddr*)&i_addr, sizeof(i_addr));
-  if (result < 0){
-    perror("Opening port to listen failed");
-    return -1;
-  }
-  
-  if (listen(s,1)<0){
-    perror("Unable to listen incoming connections");
-    return -1;
-  }
-  return s;
-}
-
 // =============================================================================
 /// function that collects flowdata and writes it to the log file
 void* collect_flow_data(void* ptr_to_param){
   MFC_param* param = (MFC_param*) ptr_to_param;
+  start_thread(*param->ptr_to_config, "serial");
   
   // open file for logging flow data
   ofstream g1;
@@ -357,6 +433,10 @@ void* collect_flow_data(void* ptr_to_param){
   int ctr(0);
   do {
     param->ptr_to_config->log_flow_data(g1);    
+    if (param->stream != NULL){
+      MFC_flows flows = param->ptr_to_config->get_MFC_data();
+      param->stream->publish(SHM_FLOW, &flows, sizeof(flows));
+    }
     ctr++;
     usleep(MFC_INTERVAL*1000);
   }while(!param->stop);  // wait for stop signal
@@ -365,277 +445,578 @@ void* collect_flow_data(void* ptr_to_param){
 }
 
 // =============================================================================
+// serves the clients of the Igor port (see partner_server.h)
 void* connect_to_Igor (void* ptr_to_param){
-  
-  //cout<<"init socket connection with Igor"<<endl;
-  
-  int s1 = open_local_listening_port(TCP_PORT1);
-  if(s1<0){
-    return NULL;
+  // typecast to thread_param*, because thread functions take void*
+  thread_param* param = (thread_param*) ptr_to_param;
+  start_thread(*param->ptr_config, "network");
+  partner_server server(*param, false);
+  if (server.open(TCP_PORT1)){
+    server.run();
   }
-  //cout<<"port opened..."<<endl;
+  return NULL;
+}
 
-  
-  int s2 = accept(s1,NULL,NULL);
-  if (s2<0){
-    perror("Unable to accept incoming connections");
-    close(s1);
-    return NULL;
+// =============================================================================
+// serves the clients of the Flytracker port (see partner_server.h)
+void* connect_to_Flytracker (void* ptr_to_param){
+  thread_param* param = (thread_param*) ptr_to_param;
+  start_thread(*param->ptr_config, "network");
+  partner_server server(*param, true);
+  if (server.open(TCP_PORT2)){
+    server.run();
   }
-  // disable grouping of TCP packages to minimize delays
-  disable_nagle(s2);
-  
-  // receive start delay of connection
-  uint32_t start_delay = 0;  // in ms
-  if (recv(s2,&start_delay,sizeof(start_delay),0) != sizeof(start_delay)){
-    perror("Receive error: no start delay signal received.");
-    close(s1);
-    close(s2);
-    return NULL;
+  return NULL;
+}
+
+// =============================================================================
+// extract parameters from event
+// PULSE vial_code duration_in_ms [optional_description_of_the_odour_in_vials]
+// MFCSET addr flowrate
+// !!! changes event string!!!
+bool parse_event(string& event, string& event_type, vector <string>& event_parameters){
+  string delimitor = " ";  
+  size_t pos = 0;
+  pos = event.find(delimitor);
+  event_type = event.substr(0,pos);
+  event.erase(0, pos + delimitor.length());
+  while((pos = event.find(delimitor)) != string::npos){
+     event_parameters.push_back(event.substr(0,pos));
+     event.erase(0, pos + delimitor.length());
   }
-  
-  // typecast to thread_param*, because thread functions take void*
-  thread_param* param = (thread_param*) ptr_to_param;
-  usleep(start_delay*1000);
-  param->event->signal();
-  //cout<<"sending start signal"<<endl;
+  event_parameters.push_back(event.substr(0,pos));
+}
 
-  // send informations to partner
-  while (!param->stop){
-    uint8_t query;  ///< query from partner
-    if (recv(s2,&query,sizeof(query),0) != sizeof(query)){  ///< receive query
-      perror("Receive error: no query received from Igor.");
-      close(s1);
-      close(s2);
-      return NULL;
+
+// =============================================================================
+// setpoint executor: set points of the MFCs, on the serial port
+void run_setpoint(const executor_job& job, void* context){
+  setpoint_context* c = (setpoint_context*) context;
+  if (job.action.type == ACTION_MFCSET){
+    const flowchange* f = (const flowchange*) job.action.info;
+    // block MFC mutex, set flow, unblock mutex,
+    pthread_mutex_lock(&c->mfc_param->mutex);
+    c->config->set_flow(f->ID, f->flow);
+    pthread_mutex_unlock(&c->mfc_param->mutex);
+    cout<<"flow of "<< f->ID<<" now: "<<f->flow<<endl;
+  }else if (job.action.type == ACTION_MFCSET2){
+    const double_flowchange* f = (const double_flowchange*) job.action.info;
+    pthread_mutex_lock(&c->mfc_param->mutex);
+    c->config->balance_carrier_boost(f->ID_carrier, f->flow_carrier, f->ID_boost, f->flow_boost);
+    pthread_mutex_unlock(&c->mfc_param->mutex);
+  }
+}
+
+// =============================================================================
+// logger executor: lines of the logfile
+void run_logger(const executor_job& job, void* context){
+  ((Configuration*)context)->log(job.text);
+}
+
+// =============================================================================
+// hands a line of the logfile to the logger, the line is formatted in the job so that nothing is allocated
+void post_log(run_context& run, const char* format, ...){
+  executor_job job;
+  job.action.type = ACTION_LOG;
+  job.action.due = 0.0;
+  job.action.info = NULL;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(job.text, sizeof(job.text), format, args);
+  va_end(args);
+  run.logger->post(job);
+}
+
+// =============================================================================
+// writes a frame to the boards, the USB handle is shared with the polling thread of Igor
+double write_frame(run_context& run, const valve_mask& mask, bool odor, double& skew){
+  double timestamp (0.0);
+  if (run.polling != NULL){
+    pthread_mutex_lock(&run.polling->mutex);
+    timestamp = set_channel(*run.boards, mask, odor, skew);
+    pthread_mutex_unlock(&run.polling->mutex);
+  }else{
+    timestamp = set_channel(*run.boards, mask, odor, skew);
+  }
+  return timestamp;
+}
+
+// =============================================================================
+// adds the change of the valves to the events of the partner
+void update_partner_data(run_context& run, int event_type, int duration, double timestamp, const pulse& p){
+  data_packet new_data;
+  new_data.event_type = event_type; // 1: pulse start, 2: pulse end
+  new_data.duration = duration; // pulse duration in ms
+  new_data.timestamp = timestamp; // timestamp in us
+  strncpy(new_data.alias, p.odor_alias.c_str(), sizeof(new_data.alias) - 1);
+  new_data.alias[sizeof(new_data.alias) - 1] = 0; // make sure array terminates with 0
+  strncpy(new_data.odor, p.name.c_str(), sizeof(new_data.odor) - 1);
+  new_data.odor[sizeof(new_data.odor) - 1] = 0; // make sure array terminates with 0
+  run.param->events.push(new_data);
+}
+
+// =============================================================================
+// lines of the pulse in the logfile, partner_timestamp: -1 if the timestamp of the partner is not known,
+// clock_time: partner_timestamp on the clock of the controller, -1 without estimate, and its uncertainty clock_error
+void log_pulse(run_context& run, const pulse& next_pulse, double timestamp_start, double skew_start, const armed_pulse* fired,
+  double received, double opened_at, double partner_timestamp, double clock_time, double clock_error){
+  // get trigger time of ITC18
+  bool ITC_trigger (false);
+  double ITC_time(0.0);
+  if (run.polling != NULL){
+    pthread_mutex_lock(&run.polling->mutex_data);
+    ITC_trigger = run.polling->triggered;
+    ITC_time = run.polling->ITC18_timestamp;
+    pthread_mutex_unlock(&run.polling->mutex_data);
+  }
+
+  if (ITC_trigger){
+    // message for logfile: timestamp_start timestamp_partner timestamp_ITC odor_alias pulse_duration pulse name 
+    post_log(run, "%.*f %.1f %.*f %s %d %s", TIMESTAMP_PRECISION, timestamp_start, -1.0, TIMESTAMP_PRECISION, ITC_time,
+      next_pulse.odor_alias.c_str(), next_pulse.duration, next_pulse.name.c_str());
+  }else{
+    post_log(run, "%.*f %.*f %.1f %s %d %s", TIMESTAMP_PRECISION, timestamp_start, TIMESTAMP_PRECISION, partner_timestamp, -1.0,
+      next_pulse.odor_alias.c_str(), next_pulse.duration, next_pulse.name.c_str());
+    if (clock_time >= 0){
+      // partner timestamp on the clock of the valve controller, and its uncertainty in us (PING_QUERY)
+      post_log(run, "%.*f CLOCK %.*f %.1f %s", TIMESTAMP_PRECISION, timestamp_start, TIMESTAMP_PRECISION, clock_time,
+        clock_error * 1000000, next_pulse.odor_alias.c_str());
     }
-    // if it is a data query, send data if something changed, otherwise only send info that nothing changed
-    if (query == DATA_QUERY){
-      pthread_mutex_lock(&param->mutex);
-      bool changed_copy = param-> changed;
-      data_packet data_copy = param->data;
-      pthread_mutex_unlock(&param->mutex);
-      if (send(s2,&changed_copy,sizeof(changed_copy),0)!= sizeof(changed_copy)){
-        perror("Send error: Failed to send state.");
-        close(s1);
-        close(s2);
-        return NULL;
-      }
-      if (changed_copy){
-        if (send(s2,&data_copy,sizeof(data_copy),0)!= sizeof(data_copy)){
-          perror("Send error: Failed to send data.");
-          close(s1);
-          close(s2);
-          return NULL;
+  }
+  if (run.boards->nb > 1){
+    // skew between the completion of the writes to the boards, in us
+    post_log(run, "%.*f SKEW %.1f %s", TIMESTAMP_PRECISION, timestamp_start, skew_start * 1000000, next_pulse.odor_alias.c_str());
+  }
+  if (received > 0){
+    // time from the arrival of the query to the frame in us, and who wrote the frame
+    post_log(run, "%.*f TRIGGER %.1f %s %s", TIMESTAMP_PRECISION, timestamp_start, (opened_at - received) * 1000000,
+      (fired != NULL) ? "fast" : "scheduler", next_pulse.odor_alias.c_str());
+  }
+}
+
+// =============================================================================
+// opens the valves of the pulse (scheduler thread), returns the time_monotonic of the frame or -1
+// fired: the frame was already written by the network thread (FASTTRIGGER), received: time_monotonic of the trigger, 0 if none
+double give_pulse(run_context& run, const pulse& next_pulse, const armed_pulse* fired = NULL, double received = 0.0){
+  // from the trigger to the log line nothing is allocated (checked with make alloc-check, see alloc_tracker.h)
+  rt_region region("pulse");
+
+  double skew_start (0.0);
+  double timestamp_start, opened_at;
+  if (fired != NULL){
+    timestamp_start = fired->timestamp;
+    skew_start = fired->skew;
+    opened_at = fired->opened;
+  }else{
+    timestamp_start = write_frame(run, next_pulse.mask, 1, skew_start);
+    opened_at = time_monotonic();
+  }
+
+  // update which flows go to fly and waste depending on pulse
+  run.config->update_flow_destination(next_pulse.odor_alias);
+  cout<<"Pulse: "<<next_pulse.name<<endl;
+  if (timestamp_start <= 0){
+    // setting channels failed
+    cerr<<"Error: Setting channel failed."<<endl;
+    return -1.0;
+  }
+  update_partner_data(run, 1, next_pulse.duration, timestamp_start, next_pulse);
+
+  if (fired != NULL && !__atomic_load_n(&fired->stamped, __ATOMIC_ACQUIRE)){
+    // the timestamp of the partner comes after the frame written by the network thread, the lines wait for it
+    run.unlogged = &next_pulse;
+  }else if (fired != NULL){
+    log_pulse(run, next_pulse, timestamp_start, skew_start, fired, received, opened_at, fired->partner_timestamp, fired->clock_time,
+      fired->clock_error);
+  }else{
+    log_pulse(run, next_pulse, timestamp_start, skew_start, fired, received, opened_at, run.param->partner_timestamp,
+      run.param->partner_clock_time, run.param->partner_clock_error);
+  }
+  return opened_at;
+}
+
+// =============================================================================
+// writes the lines of the pulse opened by the network thread once the timestamp of the partner arrived, or at the end of
+// the pulse without it
+void log_unlogged(run_context& run, bool end){
+  if (run.unlogged == NULL){
+    return;
+  }
+  const armed_pulse& a = run.param->armed;
+  bool stamped = __atomic_load_n(&a.stamped, __ATOMIC_ACQUIRE);
+  if (stamped || end){
+    log_pulse(run, *run.unlogged, a.timestamp, a.skew, &a, a.received, a.opened, stamped ? a.partner_timestamp : -1.0,
+      stamped ? a.clock_time : -1.0, a.clock_error);
+    run.unlogged = NULL;
+  }
+}
+
+// =============================================================================
+// switches to interval air at the end of a pulse (scheduler thread)
+bool end_pulse(run_context& run){
+  rt_region region("pulse");
+
+  double skew_end (0.0);
+  double timestamp_end = write_frame(run, run.i_pulse.mask, 0, skew_end);
+  run.config->update_flow_destination(run.i_pulse.odor_alias);
+  if (timestamp_end <= 0){
+    // setting channels failed
+    cerr<<"Setting channel failed."<<endl;
+    return false;
+  }
+  update_partner_data(run, 2, 0, timestamp_end, run.i_pulse);
+  log_unlogged(run, true);
+
+  // message for logfile
+  post_log(run, "%.*f -1 -1 Interval %g %s", TIMESTAMP_PRECISION, timestamp_end, (run.i_pulse.duration + run.config->get_pulsewait()) * 1000, run.i_pulse.name.c_str());
+  if (run.boards->nb > 1){
+    post_log(run, "%.*f SKEW %.1f Interval", TIMESTAMP_PRECISION, timestamp_end, skew_end * 1000000);
+  }
+  return true;
+}
+
+// =============================================================================
+// executes the actions of the wheel until it is empty and the timeline reached time until
+bool run_wheel(run_context& run, timer_wheel& wheel, double until){
+  scheduled_action action;
+  while (true){
+    log_unlogged(run, false);
+    double now = time_monotonic();
+    if (wheel.pop(now, action)){
+      if (action.type == ACTION_INTERVAL){
+        if (!end_pulse(run)){
+          return false;
         }
-        // Update status of changed to false
-        pthread_mutex_lock(&param->mutex);
-        param-> changed = false;
-        pthread_mutex_unlock(&param->mutex);
+      }else{
+        executor_job job;
+        job.action = action;
+        job.text[0] = 0;
+        run.setpoint->post(job);
       }
-    }else if (query == PULSE_QUERY){
-	    // currently igor does not send pulse queries directly to the valve controller because these queries would arrive at end of wave (neuromatic constraint), whereas they need to arrive at start of wave
-      // instead Igor makes a list of pulse queries that are transferred to the ITC18 and the valve controller polls one of its input ports to find out whether there is apulse query
-      // update info for instruction execution to function correctly
-      
-      // confirm reception of trigger signal 
-      bool pulse_trigger_received = true;
-      if (send(s2,&pulse_trigger_received,sizeof(pulse_trigger_received),0)!= sizeof(pulse_trigger_received)){
-        perror("Send error: Failed to send confirmation of trigger reception.");
-        close(s1);
-        close(s2);
-        return NULL;
+      continue;
+    }
+    double due;
+    if (!wheel.next_due(due)){
+      if (now >= until){
+        return true;
       }
-	    if (recv(s2,&param->partner_timestamp,sizeof(param->partner_timestamp),0) != sizeof(param->partner_timestamp)){  // receive IGOR timestamp
-        perror("Receive error: no timestamp received from Igor.");
-        close(s1);
-        close(s2);
-        return NULL;
-	    }
-      // no need to send trigger signal because Igor sends trigger signal through ITC and valve controller receives it from polling function
-	    //param->event->signal();
-    }else{
-      cerr<<"Invalid query received. Closing connection."<<endl;
-      close(s1);
-      close(s2);
-      return NULL;
+      due = until;
+    }
+    if (due > now){
+      usleep((due - now) * 1000000);
     }
-    
   }
-  
-  return NULL;
 }
 
 // =============================================================================
-// compare old and current MFC flow data, return true if they differ
-bool MFC_data_compare(const MFC_flows& copy_MFC_data, const MFC_flows& current_MFC_data){
-  //cout<<"comparing MFC data"<<endl;
-  bool different(false);
-  int i(0);
-  do{
-    if((copy_MFC_data.values[i] != current_MFC_data.values[i]) || (copy_MFC_data.validity[i] != current_MFC_data.validity[i]) || (copy_MFC_data.names[i] != current_MFC_data.names[i])){
-      different = true;
+// schedules the instructions that follow the last pulse, up to the next pulse, the end of the table or WAITSTOP
+// a set point whose MFC does not feed the flies during the open pulse goes out while the pulse is open, the others
+// keep their place on the timeline (after PULSEWAIT); the timeline reaches the time of the next pulse
+// with planned, the set points up to instruction planned - 1 were already scheduled by another cursor and are skipped
+int plan_instructions(Configuration& config, timer_wheel& wheel, int& idx_instruct, instruct& command, double& timeline,
+  const pulse* open_pulse, double opened_at, int* planned = NULL){
+
+  while (config.get_instruction(idx_instruct, command)){
+    if (command.etype == "PULSE"){
+      return PLAN_PULSE;
     }
-    i++;
-  }while(i<MAX_MFC && !different && current_MFC_data.names[i]!=0);
-  return different;
+    idx_instruct++;
+    if (command.etype == "WAIT"){
+      double delay = *((double*)command.einfo);
+      timeline += delay; // WAIT specified in s
+    }else if ((command.etype == "MFCSET" || command.etype == "MFCSET2") && planned != NULL && idx_instruct <= *planned){
+      continue;
+    }else if (command.etype == "MFCSET" || command.etype == "MFCSET2"){
+      if (planned != NULL){
+        *planned = idx_instruct;
+      }
+      scheduled_action action;
+      action.type = (command.etype == "MFCSET") ? ACTION_MFCSET : ACTION_MFCSET2;
+      action.info = command.einfo;
+      action.due = timeline;
+      if (open_pulse != NULL && action.type == ACTION_MFCSET && !config.is_flow_to_flies(((flowchange*)command.einfo)->ID, open_pulse->odor_alias)){
+        action.due = opened_at;
+      }
+      if (!wheel.schedule(action)){
+        cerr<<"Error: too many set points between two pulses."<<endl;
+        return PLAN_ERROR;
+      }
+    }else if (command.etype == "WAITSTOP"){
+      return PLAN_WAITSTOP;
+    }
+  }
+  return PLAN_END;
 }
 
+// =============================================================================
+// frame of the arenas: the valves of the open pulse of each fly, or its interval air
+double write_arenas(run_context& run, const fly_cursor* flies, unsigned int nb_flies, double& skew){
+  valve_mask mask;
+  bool odor (false);
+  for (unsigned int f(0); f < nb_flies; f++){
+    mask |= (flies[f].open != NULL) ? flies[f].open->fly_masks[f] : run.i_pulse.fly_masks[f];
+    odor = odor || (flies[f].open != NULL);
+  }
+  return write_frame(run, mask, odor, skew);
+}
 
 // =============================================================================
-void* connect_to_Flytracker (void* ptr_to_param){
-  
-  int s1 = open_local_listening_port(TCP_PORT2);
-  if(s1<0){
-    return NULL;
+// the flows go to the flies through the valves of every open pulse, or through the interval air if none is open
+void update_arena_flows(run_context& run, const fly_cursor* flies, unsigned int nb_flies){
+  uint8_t flow_types (0);
+  bool open (false);
+  for (unsigned int f(0); f < nb_flies; f++){
+    if (flies[f].open != NULL){
+      const alias_entry* entry = valve_alias::lookup(flies[f].open->odor_alias);
+      flow_types |= (entry != NULL) ? entry->flow_types : 0;
+      open = true;
+    }
   }
-  
-  int s2 = accept(s1,NULL,NULL);
-  if (s2<0){
-    perror("Unable to accept incoming connections");
-    close(s1);
-    return NULL;
+  if (open){
+    run.config->update_flow_destination(flow_types);
+  }else{
+    run.config->update_flow_destination(run.i_pulse.odor_alias);
   }
-  // disable grouping of TCP packages to minimize delays
-  disable_nagle(s2);
-  
-  // receive start delay of connection
-  uint32_t start_delay = 0;
-  if (recv(s2,&start_delay,sizeof(start_delay),0) != sizeof(start_delay)){
-    perror("Receive error");
-    close(s1);
-    close(s2);
-    return NULL;
+}
+
+// =============================================================================
+// opens the valves of the next pulse of fly f in its arena (scheduler thread), returns the time_monotonic of the frame or -1
+double give_fly_pulse(run_context& run, fly_cursor* flies, unsigned int nb_flies, unsigned int f){
+  rt_region region("pulse");
+
+  const pulse& p = *flies[f].next;
+  const fly_trigger& trigger = run.param->flies[f];
+  flies[f].open = flies[f].next;
+  flies[f].next = NULL;
+  double skew (0.0);
+  double timestamp_start = write_arenas(run, flies, nb_flies, skew);
+  double opened_at = time_monotonic();
+  update_arena_flows(run, flies, nb_flies);
+  cout<<"Pulse: "<<p.name<<" fly "<<f<<endl;
+  if (timestamp_start <= 0){
+    cerr<<"Error: Setting channel failed."<<endl;
+    return -1.0;
   }
-  
-  // typecast to thread_param*, because thread functions take void*
-  thread_param* param = (thread_param*) ptr_to_param;
-  
-  usleep(start_delay*1000);
-  param->event->signal();
-  
-  MFC_flows copy_MFC_data; // old flow data from MFC (data comes from olling function collect_flow_data)
-  
-  // send informations to partner
-  while (!param->stop){
-    uint8_t query;  ///< query from partner
-    if (recv(s2,&query,sizeof(query),0) != sizeof(query)){  ///< receive query
-      perror("Receive error: no query received from Flytracker.");
-      close(s1);
-      close(s2);
-      return NULL;
-    }
-    // if it is a data query, send data if something changed, otherwise only send info that nothing changed
-    if (query == DATA_QUERY){ // request for info on current odor pulse
-      //cout<<"received data query"<<endl;
-      pthread_mutex_lock(&param->mutex);
-      bool changed_copy = param-> changed;
-      data_packet data_copy = param->data;
-      pthread_mutex_unlock(&param->mutex);
-      if (send(s2,&changed_copy,sizeof(changed_copy),0)!= sizeof(changed_copy)){
-        perror("Send error: Failed to send state.");
-        close(s1);
-        close(s2);
-        return NULL;
+  update_partner_data(run, 1, p.duration, timestamp_start, p);
+  // same line as with a single cursor, followed by the fly
+  post_log(run, "%.*f %.*f %.1f %s %d %s FLY %u", TIMESTAMP_PRECISION, timestamp_start, TIMESTAMP_PRECISION, trigger.partner_timestamp, -1.0,
+    p.odor_alias.c_str(), p.duration, p.name.c_str(), f);
+  if (trigger.clock_time >= 0){
+    post_log(run, "%.*f CLOCK %.*f %.1f %s FLY %u", TIMESTAMP_PRECISION, timestamp_start, TIMESTAMP_PRECISION, trigger.clock_time,
+      trigger.clock_error * 1000000, p.odor_alias.c_str(), f);
+  }
+  if (run.boards->nb > 1){
+    post_log(run, "%.*f SKEW %.1f %s", TIMESTAMP_PRECISION, timestamp_start, skew * 1000000, p.odor_alias.c_str());
+  }
+  return opened_at;
+}
+
+// =============================================================================
+// switches the arena of fly f to interval air at the end of its pulse (scheduler thread)
+bool end_fly_pulse(run_context& run, fly_cursor* flies, unsigned int nb_flies, unsigned int f){
+  rt_region region("pulse");
+
+  flies[f].open = NULL;
+  double skew (0.0);
+  double timestamp_end = write_arenas(run, flies, nb_flies, skew);
+  // the flows still go where the pulses of the other flies send them
+  update_arena_flows(run, flies, nb_flies);
+  if (timestamp_end <= 0){
+    cerr<<"Setting channel failed."<<endl;
+    return false;
+  }
+  update_partner_data(run, 2, 0, timestamp_end, run.i_pulse);
+  post_log(run, "%.*f -1 -1 Interval %g %s FLY %u", TIMESTAMP_PRECISION, timestamp_end, (run.i_pulse.duration + run.config->get_pulsewait()) * 1000,
+    run.i_pulse.name.c_str(), f);
+  return true;
+}
+
+// =============================================================================
+// flies with their own arena: every fly goes through the instructions with its own cursor, and its pulses wait for its
+// own triggers, so that the flies are stimulated independently. The set points are shared by the arenas, they are
+// scheduled once, by the first cursor that reaches them (they all come before the first pulse, see check_arena_flows)
+bool execute_arenas(run_context& run, timer_wheel& wheel, pthread_event& trigger_event){
+  Configuration& config = *run.config;
+  const unsigned int nb_flies = config.get_nb_arenas();
+  fly_cursor flies[MAX_FLIES];
+  for (unsigned int f(0); f < nb_flies; f++){
+    flies[f].idx = 0;
+    flies[f].timeline = time_monotonic();
+    flies[f].next = NULL;
+    flies[f].open = NULL;
+    flies[f].done = false;
+  }
+  int planned (0);
+  bool waitstop (false);
+  instruct command;
+  while (!run.param->stop){
+    double now = time_monotonic();
+    // ends of the pulses and set points that are due
+    scheduled_action action;
+    while (wheel.pop(now, action)){
+      if (action.type == ACTION_INTERVAL){
+        if (!end_fly_pulse(run, flies, nb_flies, (fly_cursor*)action.info - flies)){
+          return false;
+        }
+      }else{
+        executor_job job;
+        job.action = action;
+        job.text[0] = 0;
+        run.setpoint->post(job);
       }
-      if (changed_copy){
-        if (send(s2,&data_copy,sizeof(data_copy),0)!= sizeof(data_copy)){
-          perror("Send error: Failed to send data.");
-          close(s1);
-          close(s2);
-          return NULL;
+    }
+
+    bool finished (true);
+    int executed (config.get_nb_instructions());
+    double wake = now + ARENA_POLL;
+    for (unsigned int f(0); f < nb_flies; f++){
+      fly_cursor& fly = flies[f];
+      bool at_end (fly.done);
+      if (!fly.done && fly.next == NULL && fly.open == NULL){
+        int status = plan_instructions(config, wheel, fly.idx, command, fly.timeline, NULL, 0.0, &planned);
+        if (status == PLAN_ERROR){
+          return false;
+        }
+        if (status == PLAN_PULSE){
+          fly.next = (const pulse*)command.einfo;
+          fly.idx++;
+          if (fly.next->fly_masks.size() != nb_flies){
+            cerr<<"Error: no valves for the arena of fly "<<f<<" in pulse "<<fly.next->name<<"."<<endl;
+            return false;
+          }
+        }else if (status == PLAN_WAITSTOP){
+          fly.done = true;
+          waitstop = true;
         }
-        // Update status of changed to false
-        pthread_mutex_lock(&param->mutex);
-        param-> changed = false;
-        pthread_mutex_unlock(&param->mutex);
-        //cout<<"Pulse data send"<<endl;
-      }/*else{
-        cout<<"Valve controller has no new pulse data."<<endl;
-      }*/
-
-    }else if (query == PULSE_QUERY){ // triggers delivery of pulse
-      // need to receive the ID of fly that should receive pulse, and update info for instruction execution to function correctly
-      // TO BE IMPLEMENTED
-
-      //cout<<"received pulse query"<<endl;
-      // confirm reception of trigger signal 
-      bool pulse_trigger_received = true;
-      if (send(s2,&pulse_trigger_received,sizeof(pulse_trigger_received),0)!= sizeof(pulse_trigger_received)){
-        perror("Send error: Failed to send confirmation of trigger reception.");
-        close(s1);
-        close(s2);
-        return NULL;
+        // at the end of the table the cursor plans again at the next round, in case instructions were appended
+        at_end = (status != PLAN_PULSE);
       }
-      if (recv(s2,&param->partner_timestamp,sizeof(param->partner_timestamp),0) != sizeof(param->partner_timestamp)){  // receive IGOR timestamp
-        perror("Receive error: no timestamp received from Flytracker.");
-        close(s1);
-        close(s2);
-        return NULL;
+      // the trigger waits until the instructions before the pulse are executed, triggers received meanwhile give one pulse
+      // (as the trigger event of a single cursor)
+      if (fly.next != NULL && fly.timeline <= now && __atomic_exchange_n(&run.param->flies[f].pending, 0, __ATOMIC_ACQ_REL) > 0){
+        double opened_at = give_fly_pulse(run, flies, nb_flies, f);
+        if (opened_at < 0){
+          return false;
+        }
+        scheduled_action end;
+        end.type = ACTION_INTERVAL;
+        end.due = opened_at + fly.open->duration / 1000.0;
+        end.info = &fly;
+        if (!wheel.schedule(end)){
+          // the pulse would stay open: the arena goes back to interval air and the run stops
+          cerr<<"Error: too many actions scheduled, the end of the pulse of fly "<<f<<" cannot be scheduled."<<endl;
+          end_fly_pulse(run, flies, nb_flies, f);
+          return false;
+        }
+        fly.timeline = end.due;
       }
-      // send trigger signal 
-      param->event->signal();
-
-    }else if (query == FLOW_QUERY){
-      //cout<<"received flow query"<<endl;
-      // find out if MFC_data changed -> compare current data to copy
-      MFC_flows current_MFC_data = param->ptr_config->get_MFC_data();
-      //cout<<"current flow: "<<current_MFC_data.values[0]<<endl;
-      bool MFC_changed = MFC_data_compare(copy_MFC_data, current_MFC_data); // true if data differs
-      if (send(s2,&MFC_changed,sizeof(MFC_changed),0)!= sizeof(MFC_changed)){
-        perror("Send error: Failed to send confirmation of flow query.");
-        close(s1);
-        close(s2);
-        return NULL;
+      if (fly.next != NULL && fly.timeline > now){
+        wake = min(wake, fly.timeline);
       }
-      if(MFC_changed){ // send current flow data
-        //cout<<"sending new MFC data"<<endl;
-        if (send(s2,&current_MFC_data,sizeof(current_MFC_data),0)!= sizeof(current_MFC_data)){
-          perror("Send error: Failed to send MFC data.");
-          close(s1);
-          close(s2);
-          return NULL;
-        }
-        // update copy with current MFC data
-        memcpy(&copy_MFC_data,&current_MFC_data, sizeof(copy_MFC_data));
-      }/*else{
-        cout<<"MFC unchanged"<<endl;
-      }*/
-      
-    }else{
-      cerr<<"Invalid query received. Closing connection."<<endl;
-      close(s1);
-      close(s2);
-      return NULL;
+      finished = finished && at_end && fly.open == NULL;
+      executed = min(executed, fly.idx);
+    }
+    // the run ends when no fly has an instruction left, unless instructions were appended meanwhile
+    if (finished && wheel.size() == 0 && (waitstop || config.close_table(executed))){
+      break;
+    }
+    double due;
+    if (wheel.next_due(due)){
+      wake = min(wake, due);
+    }
+    // a trigger wakes the scheduler before
+    if (wake > now){
+      trigger_event.timed_wait((wake - now) * 1000000);
     }
-    
   }
+  if (waitstop){
+    cout<<"Waiting for manual stop..."<<endl;
+    while(1){
+      sleep(1);
+    }
+  }
+  return true;
+}
 
-
-  return NULL;
+// =============================================================================
+// slot of the grid for a pulse that can be given at time timeline: the first slot from timeline on, the grid
+// starts with the first pulse
+double grid_slot(grid_stats& grid, double timeline){
+  if (grid.last_slot < 0){
+    grid.t0 = timeline;
+    grid.last_slot = 0;
+    return grid.t0;
+  }
+  // the timeline is a sum of durations, it can be a rounding error away from the slot it reaches
+  long slot = (long)ceil((timeline - grid.t0) / grid.period - GRID_ROUNDING);
+  slot = max(slot, grid.last_slot + 1);
+  grid.skipped += slot - grid.last_slot - 1;
+  grid.last_slot = slot;
+  return grid.t0 + slot * grid.period;
 }
 
 // =============================================================================
-// extract parameters from event
-// PULSE vial_code duration_in_ms [optional_description_of_the_odour_in_vials]
-// MFCSET addr flowrate
-// !!! changes event string!!!
-bool parse_event(string& event, string& event_type, vector <string>& event_parameters){
-  string delimitor = " ";  
-  size_t pos = 0;
-  pos = event.find(delimitor);
-  event_type = event.substr(0,pos);
-  event.erase(0, pos + delimitor.length());
-  while((pos = event.find(delimitor)) != string::npos){
-     event_parameters.push_back(event.substr(0,pos));
-     event.erase(0, pos + delimitor.length());
+// onset of a pulse given in its slot
+void grid_onset(grid_stats& grid, double slot_time, double opened_at){
+  double late = opened_at - slot_time;
+  grid.pulses++;
+  grid.sum_late += late;
+  grid.max_late = max(grid.max_late, late);
+  grid.drift = late;
+  if (late > GRID_OVERRUN){
+    grid.overruns++;
   }
-  event_parameters.push_back(event.substr(0,pos));
 }
 
+// =============================================================================
+// prints and logs the timing of the pulses on the grid, at the end of the run
+void report_grid(Configuration& config, const grid_stats& grid){
+  char message[LOG_MESSAGE_SIZE];
+  snprintf(message, sizeof(message), "GRID period %g pulses %u drift %.3f ms max_late %.3f ms mean_late %.3f ms overruns %u skipped %ld",
+    grid.period, grid.pulses, grid.drift * 1000, grid.max_late * 1000, grid.pulses ? grid.sum_late * 1000 / grid.pulses : 0.0, grid.overruns, grid.skipped);
+  cout<<message<<endl;
+  config.log(message);
+}
+
+// =============================================================================
+// latency of a pulse triggered by PULSE_QUERY
+void trigger_latency(trigger_stats& triggers, double received, double opened_at, bool fast){
+  double latency = opened_at - received;
+  triggers.pulses++;
+  triggers.fast += fast ? 1 : 0;
+  triggers.sum += latency;
+  triggers.max = max(triggers.max, latency);
+}
+
+// =============================================================================
+// prints and logs the time from the arrival of the queries to the frames of their pulses, at the end of the run
+void report_triggers(Configuration& config, const trigger_stats& triggers){
+  char message[LOG_MESSAGE_SIZE];
+  snprintf(message, sizeof(message), "TRIGGERS pulses %u fast %u mean %.1f us max %.1f us",
+    triggers.pulses, triggers.fast, triggers.pulses ? triggers.sum * 1000000 / triggers.pulses : 0.0, triggers.max * 1000000);
+  cout<<message<<endl;
+  config.log(message);
+}
 
 // =============================================================================
-bool execute_config_instructions(Configuration& config, const int& deviceIdx, libusb_device_handle*& usbhandle, 
+// FASTTRIGGER: takes back the pulse armed before the wait for the trigger, or waits until the network thread wrote its frame
+// \return the pulse fired by the network thread, NULL if the scheduler writes the frame
+const armed_pulse* disarm(thread_param& param){
+  uint32_t ready = ARMED_READY;
+  if (__atomic_compare_exchange_n(&param.armed.state, &ready, (uint32_t)ARMED_NONE, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+    return NULL;
+  }
+  // the timestamp of a query that fired nothing (another client) can wake the scheduler while the frame is written
+  while (__atomic_load_n(&param.armed.state, __ATOMIC_ACQUIRE) != ARMED_FIRED){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  }
+  return &param.armed;
+}
+
+// =============================================================================
+bool execute_config_instructions(Configuration& config, dio_boards& boards, 
   vector <partner_funct_param>& partner_function_table, const int& polling_function_idx, pthread_event& start_event, pthread_event& trigger_event, 
   pthread_event& mfc_event, MFC_param& mfc_param, thread_param& param){
 
@@ -643,283 +1024,150 @@ bool execute_config_instructions(Configuration& config, const int& deviceIdx, li
   config.init_MFC_data();
   config.update_flow_destination("Carrier");
 
-  /*pulse test_i_pulse;
-  config.get_interval_pulse(test_i_pulse);
-  cout<<"Interval duration: "<<test_i_pulse.duration<<endl;
-  */
- 
-  // execute all instructions before first pulse
+  // the partner and the interval pulse do not change during the run, they are read once before the real-time region
+  const bool external_trigger = (config.get_trigger() == "external");
+  const bool igor = (config.get_partner() == "Igor");
+  const bool flytracker = (config.get_partner() == "Flytracker");
+  const bool fast_trigger = config.get_fast_trigger() && param.boards != NULL;
+  run_context run;
+  run.config = &config;
+  run.boards = &boards;
+  run.param = &param;
+  run.polling = igor ? (poll_param*)partner_function_table[polling_function_idx].ptr_to_partner_param : NULL;
+  if (!config.get_interval_pulse(run.i_pulse)){
+    cerr<<"Error during pulse request. Failure when switchting to interval pulse. "<<endl;
+    return false;
+  }
+
+  // set points and log lines are executed by their own threads, the valves by this one
+  setpoint_context setpoint_param;
+  setpoint_param.config = &config;
+  setpoint_param.mfc_param = &mfc_param;
+  action_executor setpoint;
+  action_executor logger;
+  if (!setpoint.start(config, "setpoint", run_setpoint, &setpoint_param) || !logger.start(config, "logger", run_logger, &config)){
+    return false;
+  }
+  run.setpoint = &setpoint;
+  run.logger = &logger;
+  run.unlogged = NULL;
+
+  timer_wheel wheel(time_monotonic());
+  double timeline = time_monotonic(); // due time of the next instruction
+  const pulse* open_pulse (NULL);
+  double opened_at (0.0);
   instruct command;
   int idx_instruct (0);
-  bool move_on = false;
-  do {
-    if (!config.get_instruction(idx_instruct, command)){
-      cerr<<"Error: unable to retrieve command from instruction table."<<endl;
-      return false;
+  bool success (true);
+  grid_stats grid;
+  memset(&grid, 0, sizeof(grid));
+  grid.period = config.get_pulsegrid();
+  grid.last_slot = -1;
+  trigger_stats triggers;
+  memset(&triggers, 0, sizeof(triggers));
+  
+  // with arenas every fly has its own cursor
+  const bool arenas = (config.get_nb_arenas() > 0);
+  if (arenas){
+    success = execute_arenas(run, wheel, start_event);
+  }
+
+  // instructions appended by the partner while the run is executed are planned as well, as long as the end of the table is not reached
+  while (success && !arenas){
+    int next = plan_instructions(config, wheel, idx_instruct, command, timeline, open_pulse, opened_at);
+    // with PULSEGRID the pulse waits for its slot of the grid, otherwise it is given when the timeline reaches it
+    double onset = timeline;
+    if (next == PLAN_PULSE && grid.period > 0){
+      onset = grid_slot(grid, timeline);
     }
-    idx_instruct++;
-    //cout<<"at start command.etype: "<<command.etype<<endl;
-
-    if (command.etype != "PULSE"){
-      if (command.etype == "WAIT"){
-        double delay = *((double*)command.einfo);
-        usleep(delay*1000000);// wait specified in s, but here needed in us
-      }else if (command.etype == "MFCSET"){
-        flowchange tmp;
-        tmp.ID = ((flowchange*)command.einfo)->ID;
-        tmp.flow = ((flowchange*)command.einfo)->flow;
-        cout<<"flow of "<< tmp.ID<<" now: "<<tmp.flow<<endl;
-        
-        // block MFC mutex, set flow, unblock mutex,
-        pthread_mutex_lock(&mfc_param.mutex);
-        config.set_flow(tmp.ID, tmp.flow);
-        pthread_mutex_unlock(&mfc_param.mutex);
-        // write event to log TO BE IMPLEMENTED
-        double timestamp_MFCSET = time_real();
-      }else if (command.etype == "MFCSET2"){
-        double_flowchange tmp;
-        tmp.ID_carrier = ((double_flowchange*)command.einfo)->ID_carrier;
-        tmp.flow_carrier = ((double_flowchange*)command.einfo)->flow_carrier;
-        //cout<<"flow of "<< tmp.ID<<" now: "<<tmp.flow<<endl;
-        tmp.ID_boost = ((double_flowchange*)command.einfo)->ID_boost;
-        tmp.flow_boost = ((double_flowchange*)command.einfo)->flow_boost;
-                
-        // block MFC mutex, set flow, unblock mutex,
-        pthread_mutex_lock(&mfc_param.mutex);
-        config.balance_carrier_boost(tmp.ID_carrier, tmp.flow_carrier, tmp.ID_boost, tmp.flow_boost);
-        pthread_mutex_unlock(&mfc_param.mutex);
-        // write event to log TO BE IMPLEMENTED
-        double timestamp_MFCSET = time_real();
-      }else if (command.etype == "WAITSTOP"){
-        cout<<"Waiting for early manual stop..."<<endl;
-        while(1){
-          sleep(1);
-        }
+    if (next == PLAN_ERROR || !run_wheel(run, wheel, onset)){
+      success = false;
+      break;
+    }
+    if (next == PLAN_END && !config.close_table(idx_instruct)){
+      // appended while the last actions were executed
+      continue;
+    }
+    if (next == PLAN_WAITSTOP){
+      cout<<"Waiting for manual stop..."<<endl;
+      while(1){
+        sleep(1);
       }
-    }else{
-      move_on = true;
     }
-  }while(idx_instruct < config.get_nb_instructions() && !move_on);
-
-
+    if (next != PLAN_PULSE){
+      break;
+    }
 
-  
-  // get number of pulses (should all be before waitstop to be executed)
-  //cout<<"executing pulses"<<endl;
-  int nb_pulses = config.get_nb_pulses();
-  int idx_pulse (0);
-  while(idx_pulse < nb_pulses){
-    
-    //cout<<"giving pulse: "<<idx_pulse<<"out of "<<nb_pulses<<endl;
-    // get information of next pulse
-    pulse next_pulse;
-    if ( command.etype == "PULSE"){ 
-
-      string valve_alias = ((pulse*)command.einfo)->odor_alias;
-      vector <int> valve_blocks = valve_alias::parse_alias(valve_alias);
-      if (valve_blocks.empty()){
-        cerr<<"Error: no valve blocks specified."<<endl;
-        return false;
-      }
-      next_pulse.valve_blocks = valve_blocks;
-      next_pulse.duration = ((pulse*)command.einfo)-> duration;
-      next_pulse.name = ((pulse*)command.einfo)->name;
-      next_pulse.odor_alias = ((pulse*)command.einfo)->odor_alias;
-      next_pulse.MFC_flow =  ((pulse*)command.einfo)->MFC_flow;
+    // next pulse is used in place in the instruction table, copying it would allocate its vector, map and strings
+    const pulse& next_pulse = *(pulse*)command.einfo;
+    idx_instruct++;
+    // valves were resolved from the alias when the pulse was parsed
+    if (next_pulse.mask.empty()){
+      cerr<<"Error: no valve blocks specified."<<endl;
+      success = false;
+      break;
     }
-        
+
     // wait for trigger if specified
-    double timestamp_check(0.0);
-    if (config.get_trigger()== "external"){
-      if(config.get_partner() == "Igor"){
+    const armed_pulse* fired (NULL);
+    if (external_trigger){
+      if(igor){
         // wait for event from polling thread
-        //cout<<" waiting for trigger"<<endl;
         trigger_event.wait();
-        //((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->event->wait();
-      }else if(config.get_partner() == "Flytracker"){
+      }else if(flytracker && fast_trigger){
+        // the network thread opens the valves as soon as the query arrives, the mask is written before the pulse is ready
+        param.armed.mask = next_pulse.mask;
+        __atomic_store_n(&param.armed.state, (uint32_t)ARMED_READY, __ATOMIC_RELEASE);
+        start_event.wait();
+        fired = disarm(param);
+      }else if(flytracker){
         start_event.wait();
       }
-      timestamp_check = time_real();
-      //cout<<"trigger received"<<endl;
-      // TO IMPLEMENT FOR FLYTRACKER: find out which fly gets pulse, adjust valve_blocks accordingly
-    }
-    
-    // give pulse
-    double timestamp_start (0.0);
-    if (config.get_partner() == "Igor"){
-      // need to lock mutex to use usb handle, otherwise risk of conflict
-      pthread_mutex_lock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex);
-      timestamp_start = set_channel(((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->usbhandle, deviceIdx, next_pulse.valve_blocks, 1);
-      pthread_mutex_unlock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex);
-    }else{
-      timestamp_start = set_channel(usbhandle, deviceIdx, next_pulse.valve_blocks, 1);
     }
-    idx_pulse++;
 
-    // update which flows go to fly and waste depending on pulse
-    config.update_flow_destination(next_pulse.odor_alias);
-    
-    
-    cout<<"Pulse: "<<next_pulse.name<<endl;
-    if (timestamp_start == 0){
-      // setting channels failed
-      cerr<<"Error: Setting channel failed."<<endl;
-      return false;
-    }else{
-      // collect info of pulse and update param structure
-      bool just_changed = true;
-      data_packet new_data;
-      new_data.event_type = 1; // pulse start event
-      new_data.duration = next_pulse.duration; // pulse duration in ms
-      new_data.timestamp = timestamp_start; // timestamp in us
-      strncpy(new_data.alias, next_pulse.odor_alias.c_str(), sizeof(new_data.alias));
-      strncpy(new_data.odor, next_pulse.name.c_str(), sizeof(new_data.odor));
-      new_data.odor[sizeof(new_data.odor) - 1] = 0; // make sure array terminates with 0
-      new_data.alias[sizeof(new_data.alias) - 1] = 0; // make sure array terminates with 0
-      //cout << "new_data alias = " << new_data.alias << ", odor = " << new_data.odor << endl;
-      pthread_mutex_lock(&param.mutex);
-      param.changed = just_changed;
-      param.data = new_data;
-      pthread_mutex_unlock(&param.mutex);
+    double received = (fired != NULL) ? fired->received : (external_trigger && flytracker) ? param.query_received : 0.0;
+    opened_at = give_pulse(run, next_pulse, fired, received);
+    if (fired != NULL){
+      __atomic_store_n(&param.armed.state, (uint32_t)ARMED_NONE, __ATOMIC_RELEASE);
     }
-    
-    // get trigger time of ITC18
-    bool ITC_trigger (false);
-    double ITC_time(0.0);
-    if (config.get_partner() == "Igor"){
-      pthread_mutex_lock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex_data);
-      ITC_trigger = ((poll_param*)partner_function_table[polling_function_idx].ptr_to_partner_param)->triggered;
-      ITC_time =  ((poll_param*)partner_function_table[polling_function_idx].ptr_to_partner_param)->ITC18_timestamp;
-      pthread_mutex_unlock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex_data);
+    if (opened_at < 0){
+      success = false;
+      break;
     }
-    
-    string message;
-    if (ITC_trigger){
-      // message for logfile: timestamp_start timestamp_partner timestamp_ITC odor_alias pulse_duration pulse name 
-      message = to_stringHP(timestamp_start, TIMESTAMP_PRECISION) + " " + to_stringHP(-1.0, 1) + " " + to_stringHP(ITC_time, TIMESTAMP_PRECISION) + " " + next_pulse.odor_alias + " " + to_string(next_pulse.duration) + " " + next_pulse.name;
-    }else{
-      message = to_stringHP(timestamp_start, TIMESTAMP_PRECISION) + " " + to_stringHP(param.partner_timestamp, TIMESTAMP_PRECISION) + " " + to_stringHP(-1.0, 1) + " " + next_pulse.odor_alias + " " + to_string(next_pulse.duration) + " " + next_pulse.name;
-    }
-    config.log(message);
-    double delay = timestamp_start - ITC_time;
-    //cout<<"ITC time: "<<fixed<<ITC_time<<" Channels set: "<<fixed<<timestamp_start<<" Delay: "<<fixed<<delay<<endl;
-    usleep(next_pulse.duration*1000); // sleep for duration of pulse, pulse specified in ms seconds, here needed in us
-    
-    // switch to interval air
-    pulse i_pulse;
-    if (!config.get_interval_pulse(i_pulse)){
-      cerr<<"Error during pulse request. Failure when switchting to interval pulse. "<<endl;
-      return false;
+    if (received > 0){
+      trigger_latency(triggers, received, opened_at, fired != NULL);
     }
-    double timestamp_end (0.0);
-    if (config.get_partner() == "Igor"){
-      pthread_mutex_lock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex);
-      
-      // ONLY for testing the blender setup> need to remove i_pulse afterwards because it overwrites the one from the config file
-      /*pulse i_pulse;
-       i_pulse.odor_alias = "Carrier"  ;///< odor alias, defines blocks of valves that should be opened for this givien odor. defined in vo_alias.h, listed in alias.txt
-       i_pulse.valve_blocks = make_vector<int>() << 0 << 8 << 21 ;  ///< block of valves that need to be opened
-       i_pulse.duration = 1;  ///< duration of pulse
-       i_pulse.name = "carrier air";  ///< user-defined name for pulse, e.g. name of odour
-       // end carrier air interval pulse testing
-       */
-      timestamp_end = set_channel(((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->usbhandle, deviceIdx, i_pulse.valve_blocks, 0);
-      pthread_mutex_unlock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex);
-    }else{
-      timestamp_end = set_channel(usbhandle, deviceIdx, i_pulse.valve_blocks, 0);
-    }
-    
-    config.update_flow_destination(i_pulse.odor_alias);
-    
-    if (timestamp_end == 0){
-      // setting channels failed
-      cerr<<"Setting channel failed."<<endl;
-      return false;
-      
-    }else{
-      // collect info of interval pulse and update param structure
-      bool just_changed = true;
-      data_packet new_data;
-      new_data.event_type = 2; // pulse end event
-      new_data.duration = 0;
-      new_data.timestamp = timestamp_end; // timestamp in us
-      strncpy(new_data.alias, i_pulse.odor_alias.c_str(), sizeof(new_data.alias));
-      strncpy(new_data.odor, i_pulse.name.c_str(), sizeof(new_data.odor));
-      new_data.odor[sizeof(new_data.odor) - 1] = 0; // make sure array terminates with 0
-      new_data.alias[sizeof(new_data.alias) - 1] = 0; // make sure array terminates with 0
-      //cout << "new_data alias = " << new_data.alias << ", odor = " << new_data.odor << endl;
-      pthread_mutex_lock(&param.mutex);
-      param.changed = just_changed;
-      param.data = new_data;
-      pthread_mutex_unlock(&param.mutex);
+    open_pulse = &next_pulse;
+    // the pulse lasts its duration from the frame, pulse specified in ms
+    scheduled_action end;
+    end.type = ACTION_INTERVAL;
+    end.due = opened_at + next_pulse.duration / 1000.0;
+    end.info = NULL;
+    if (!wheel.schedule(end)){
+      // the pulse would stay open: back to interval air and the run stops
+      cerr<<"Error: too many actions scheduled, the end of the pulse cannot be scheduled."<<endl;
+      end_pulse(run);
+      success = false;
+      break;
     }
-    // message for logfile
-    message = to_stringHP(timestamp_end, TIMESTAMP_PRECISION) + " -1 -1 Interval " + to_string( (i_pulse.duration + config.get_pulsewait() )*1000) + " " + i_pulse.name;
-    config.log(message);
-    
-    
-    // get next instruction in table, and update instruction counter
-    if (!config.get_instruction(idx_instruct, command)){
-      cerr<<"Error: unable to retrieve command from instruction table."<<endl;
-      return false;
-    }
-    idx_instruct++;
-    //cout<<"next command.etype: "<<command.etype<<endl;
-
-      
-    while (command.etype != "PULSE" && idx_instruct <= config.get_nb_instructions()){
-     
-      if (command.etype == "WAIT"){
-        double delay = *((double*)command.einfo);
-        usleep(delay*1000000);// pulse entered in s, but here needed in microseconds
-        //cout<<"real command.etype: "<<command.etype<<endl;
-
-      }else if (command.etype == "MFCSET"){
-        flowchange tmp;
-        tmp.ID = ((flowchange*)command.einfo)->ID;
-        tmp.flow = ((flowchange*)command.einfo)->flow;
-        cout<<"flow of "<< tmp.ID<<" now: "<<tmp.flow<<endl;
-        
-        // block MFC mutex, set flow, unblock mutex,
-        pthread_mutex_lock(&mfc_param.mutex);
-        config.set_flow(tmp.ID, tmp.flow);
-        pthread_mutex_unlock(&mfc_param.mutex);
-        // write event to log TO BE IMPLEMENTED
-        double timestamp_MFCSET = time_real();
-      }else if (command.etype == "MFCSET2"){
-        double_flowchange tmp;
-        tmp.ID_carrier = ((double_flowchange*)command.einfo)->ID_carrier;
-        tmp.flow_carrier = ((double_flowchange*)command.einfo)->flow_carrier;
-        //cout<<"flow of "<< tmp.ID<<" now: "<<tmp.flow<<endl;
-        tmp.ID_boost = ((double_flowchange*)command.einfo)->ID_boost;
-        tmp.flow_boost = ((double_flowchange*)command.einfo)->flow_boost;
-        
-        // block MFC mutex, set flow, unblock mutex,
-        pthread_mutex_lock(&mfc_param.mutex);
-        config.balance_carrier_boost(tmp.ID_carrier, tmp.flow_carrier, tmp.ID_boost, tmp.flow_boost);
-        pthread_mutex_unlock(&mfc_param.mutex);
-        // write event to log TO BE IMPLEMENTED
-        double timestamp_MFCSET = time_real();
-      }else if (command.etype == "WAITSTOP"){
-      	cout<<"Waiting for manual stop..."<<endl;
-        while(1){
-          sleep(1);
-        }
-        
-      }
-    
-      if (!config.get_instruction(idx_instruct, command)){
-        cerr<<"Error: unable to retrieve command from instruction table."<<endl;
-        return false;
-      }
-      idx_instruct++;
-      //cout<<"next command.etype2: "<<command.etype<<endl;
-
+    // on the grid the timeline continues from the slot, so that a late pulse does not delay the next ones
+    timeline = end.due;
+    if (grid.period > 0){
+      grid_onset(grid, onset, opened_at);
+      timeline = onset + next_pulse.duration / 1000.0;
     }
+  }
 
+  // set points and log lines already handed over are executed before the run ends
+  setpoint.stop();
+  logger.stop();
+  if (grid.period > 0){
+    report_grid(config, grid);
   }
-  
-  return true;
+  if (triggers.pulses > 0){
+    report_triggers(config, triggers);
+  }
+  return success;
 }
 
 
@@ -929,6 +1177,8 @@ bool execute_config_instructions(Configuration& config, const int& deviceIdx, li
 
 /// TO IMPLEMENT: USE EXCEPTIONS FOR ERROR HANDLING
 
+// the benchmarks link the valve controller with their own main (see bench_latency.cpp)
+#ifndef VALVE_CONTROLLER_LIBRARY
 
 int main(int argc, char* argv[]){
   
@@ -949,33 +1199,39 @@ int main(int argc, char* argv[]){
   if (!set_realtime()) {
     cerr << "Could not set realtime priority, are you root? ;)" << endl;
   }
-	
-  // connect to device USB-DIO-96 from www.accesio.com
-  AIO_Init();		// This should be called BEFORE any other function in the API
-	// to populate the list of Acces devices, comes from aioUsbApi.h
-  aioDeviceInfo aioDevices;
-  int ret (0); // collects return value from function calls
-  ret = AIO_Usb_GetDevices(&aioDevices);
-  if (ret > ERROR_SUCCESS){
-    cerr<<"Could not connect to USB-DIO-96 device."<<endl;
-    return (ret);
-  }	
-  int deviceIdx = aioDevices.aioDevList[0].devIdx;		// use the first device found
-  ret = AIO_UsbValidateDeviceIndex(deviceIdx);
-  if (ret > ERROR_SUCCESS){
-    cerr<<"Invalid device Index = "<< deviceIdx<<endl;
-    return (ret);
+  // pages are locked before the threads start, their stacks are prefaulted by start_thread
+  if (!lock_memory()) {
+    cerr << "Could not lock memory, pages may be faulted in during the run." << endl;
   }
-  
-  // get USB handle for device
-  libusb_device_handle* usbhandle=NULL;
-  usbhandle=getDevHandle(deviceIdx);
-  if (usbhandle == NULL){
-    cerr<<"Could not get device handle device Idx="<< deviceIdx<<endl;
+	
+  // connect to device USB-DIO-96 from www.accesio.com, or to its emulator
+  // one board per 64 valves of the rig profile, boards are used in the order they are found
+  dio_boards boards;
+  boards.device = dio_device::create(config.get_device());
+  boards.nb = valve_alias::get_profile().get_nb_boards();
+  pthread_mutex_init(&boards.mutex, NULL);
+  boards.connected = true;
+  boards.lost_since = 0.0;
+  boards.restored_at = 0.0;
+  if (!boards.device->open(boards.nb)){
+    delete boards.device;
     return 1;
   }
+  if (boards.nb > 1){
+    cout<<boards.nb<<" USB-DIO-96 boards in use."<<endl;
+  }
 
  
+  // event stream in shared memory for the partners on the same host
+  shm_stream stream;
+  if (!config.get_shmstream().empty()){
+    if (!stream.open(config.get_shmstream())){
+      delete boards.device;
+      return 1;
+    }
+    cout<<"Events published in shared memory "<<config.get_shmstream()<<"."<<endl;
+  }
+
   // thread for multiflowcontroller
   pthread_t mfcThread;
   pthread_event mfc_event;
@@ -983,6 +1239,7 @@ int main(int argc, char* argv[]){
   mfc_param.event = &mfc_event;
   mfc_param.stop = false;
   mfc_param.ptr_to_config = &config;
+  mfc_param.stream = stream.is_open() ? &stream : NULL;
   pthread_mutex_init(&mfc_param.mutex, NULL);
   mfc_param.event = &mfc_event;
   pthread_create(&mfcThread,NULL,collect_flow_data,&mfc_param);
@@ -991,18 +1248,27 @@ int main(int argc, char* argv[]){
   
   // initialize valve states
   // Initialise the Acces DIO board so that pins have a default direction and state (so that air starts to flow through ODD)
-	if (!initialise(deviceIdx)){
-    cerr<<"Initialization failed."<<endl;
-    libusb_close(usbhandle);
-    usbhandle=NULL;
-    return 1;
+  for (unsigned int b(0); b < boards.nb; b++){
+    default_frame(b, boards.shadow[b]);
+	  if (!boards.device->configure(b, boards.shadow[b])){
+      cerr<<"Initialization failed."<<endl;
+      delete boards.device;
+      return 1;
+    }
   }
   
+  // thread that reopens the boards if the USB link drops
+  pthread_t usbThread;
+  usb_monitor_param usb_param;
+  usb_param.boards = &boards;
+  usb_param.ptr_config = &config;
+  usb_param.stop = false;
+  pthread_create(&usbThread, NULL, usb_monitor, &usb_param);
+  
   // run a valve test
-  /*if (!test_valves(usbhandle, deviceIdx)){
+  /*if (!test_valves(boards)){
     cerr<<"Problem during valve testing."<<endl;
-    libusb_close(usbhandle);
-    usbhandle=NULL;
+    delete boards.device;
     return 1;
   }*/
   
@@ -1015,12 +1281,18 @@ int main(int argc, char* argv[]){
   // parameters for socket connection with Igor or Flytracker. if called, runs in separate thread, but only called when there is a partner 
   pthread_event start_event;
   thread_param param;
-  param.changed = false;
   param.stop = false;
   pthread_mutex_init(&param.mutex, NULL);
   param.event = &start_event;
   param.ptr_config = &config;
   param.partner_timestamp = -1.0;
+  param.partner_clock_time = -1.0;
+  param.partner_clock_error = 0.0;
+  param.query_received = 0.0;
+  param.boards = config.get_fast_trigger() ? &boards : NULL;
+  if (stream.is_open()){
+    param.events.attach_stream(&stream);
+  }
 
   // event for trigger signal from polling_ITC18_trigger function
   // only used with Igor, but needs to be specified
@@ -1041,7 +1313,9 @@ int main(int argc, char* argv[]){
     polling_param.stop = false;
     pthread_mutex_init(&polling_param.mutex, NULL);
     pthread_mutex_init(&polling_param.mutex_data, NULL);
-    polling_param.usbhandle = usbhandle;
+    polling_param.boards = &boards; // trigger input is on the first board
+    polling_param.events = &param.events;
+    polling_param.ptr_config = &config;
     polling_param.event = &trigger_event;
     igor.ptr_to_partner_function = poll_ITC18_trigger;
     igor.ptr_to_partner_param = &polling_param;
@@ -1104,9 +1378,11 @@ int main(int argc, char* argv[]){
 
   // read instructions from config file
   cout<<"starting reading events from config file..."<<endl;
-  if (!execute_config_instructions(config, deviceIdx, usbhandle, partner_function_table, polling_function_idx, start_event, trigger_event, mfc_event, mfc_param, param)){
+  start_thread(config, "scheduler");
+  if (!execute_config_instructions(config, boards, partner_function_table, polling_function_idx, start_event, trigger_event, mfc_event, mfc_param, param)){
     return_value = FAILED_IN_CONFIG;
   }
+  report_threads(config);
     
   
   // trigger stop of collection of mass flow data, closes file automatically
@@ -1116,16 +1392,17 @@ int main(int argc, char* argv[]){
   
  
   // close USB connection
+  usb_param.stop = true;
+  pthread_join(usbThread, NULL);
   if (config.get_partner() == "Igor"){
     pthread_mutex_lock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex);
     ((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->stop = true;
-    libusb_close(usbhandle);
-    usbhandle=NULL;
+    boards.device->close();
     pthread_mutex_unlock(&((poll_param*)(partner_function_table[polling_function_idx].ptr_to_partner_param))->mutex);
   }else{
-    libusb_close(usbhandle);
-    usbhandle=NULL;
+    boards.device->close();
   }
+  delete boards.device;
   
   // set stop of socket function to true to signal termination of program to the socket thread
   pthread_mutex_lock(&((thread_param*)(partner_function_table[socket_function_idx].ptr_to_partner_param))->mutex);
@@ -1137,4 +1414,4 @@ int main(int argc, char* argv[]){
     
   return return_value;
 }
-
+#endif // VALVE_CONTROLLER_LIBRARY
@@ -0,0 +1,161 @@
+//
+//  valve_controller.h
+//  parameters of the threads of the valve controller and the functions that run them,
+//  shared by valve_controller.cpp and the benchmarks that drive the same code with emulated devices (see bench_latency.cpp)
+//
+
+#ifndef __valve_controller_h
+#define __valve_controller_h
+
+#include <vector>
+#include <pthread.h>
+
+#include "pthread_event.h"
+#include "dio_device.h" // USB-DIO-96 boards (www.accesio.com) or emulator
+#include "vo_alias.h"
+#include "data_format.h"
+#include "event_ring.h" // events of the valves for the partners
+#include "configuration.h"
+
+const int MFC_INTERVAL = 100; ///< interval in ms between subsequent polling of MFC (collect_flow_data)
+
+/// info concerning partner function, used as type in vector, because different partners use different functions with different parameters
+struct partner_funct_param{
+  void* (*ptr_to_partner_function) (void*);/// pointer to function of partner
+  void* ptr_to_partner_param; /// pointer to parameters of function of partner
+};
+
+
+/// USB-DIO-96 boards driven by the valve controller, in the order they are listed by libusb
+/// board b drives valves b*64 to b*64+63 (see vo_alias.h)
+/// the mutex protects the device, whose boards are reopened by the monitor thread without it while the link is down
+struct dio_boards{
+  dio_device* device;  ///< boards or emulator (DEVICE keyword of the configuration file)
+  unsigned int nb;  ///< number of boards needed by the rig
+  unsigned char shadow[MAX_BOARDS][DIO_FRAME_SIZE];  ///< last frame requested for each board, restored after reconnection
+  pthread_mutex_t mutex;
+  bool connected;  ///< false from the first failed transfer until the boards are reopened
+  double lost_since;  ///< time at which the USB link dropped
+  double restored_at;  ///< time at which the shadow frames were last restored
+};
+
+struct poll_param{
+  pthread_event* event;
+  pthread_mutex_t mutex;  // mutex for USB handle (USB handle is shared with the main thread)
+  pthread_mutex_t mutex_data; // mutex for changing triggered and ITC18_timestamp variables
+  bool triggered;
+  double ITC18_timestamp;
+  dio_boards* boards;  ///< trigger input is read on the first board
+  event_ring* events;  ///< triggers are acknowledged to the subscribed partner
+  Configuration* ptr_config;
+  bool stop; // stop used to terminate detached thread when main terminates, without stop the detached thread tries to access data from main which has been destroyed already thereby causing a bus error or segmentation fault
+};
+
+/// triggers of a fly (FLY_PULSE_QUERY), served by the cursor of the fly when the flies have their arenas (ARENA)
+struct fly_trigger{
+  uint32_t pending;  ///< triggers since the last pulse of the fly, incremented by the network thread, cleared by the scheduler
+  double partner_timestamp;  ///< of the last trigger
+  double clock_time;  ///< partner_timestamp on the clock of the controller, -1 without estimate of the clocks
+  double clock_error;  ///< s, uncertainty of clock_time
+  fly_trigger(){
+    pending = 0;
+    partner_timestamp = -1.0;
+    clock_time = -1.0;
+    clock_error = 0.0;
+  }
+};
+
+/// states of the armed pulse (FASTTRIGGER), changed with atomic operations
+enum armed_state {
+  ARMED_NONE,    ///< nothing armed, a trigger only wakes the scheduler
+  ARMED_READY,   ///< the scheduler waits for the trigger of the pulse, the network thread may write its frame
+  ARMED_FIRING,  ///< the network thread is writing the frame
+  ARMED_FIRED    ///< the frame was written, the scheduler takes its timestamp and logs the pulse
+};
+
+/// pulse whose frame the network thread writes as soon as PULSE_QUERY arrives (FASTTRIGGER)
+/// the scheduler arms it before it waits for the trigger and takes it back when it wakes up, whoever moves the state
+/// away from ARMED_READY first writes the frame
+struct armed_pulse{
+  uint32_t state;  ///< armed_state
+  valve_mask mask;  ///< frame of the pulse, written by the scheduler before ARMED_READY
+  double received;  ///< time_monotonic at which the query arrived
+  double opened;  ///< time_monotonic once the frame was written
+  double timestamp;  ///< of the frame (set_channel), -1 in case of error
+  double skew;
+  uint32_t stamped;  ///< the timestamp of the partner arrived after the frame, it is then in partner_timestamp
+  double partner_timestamp;  ///< copied by the network thread before stamped, other clients overwrite the one of thread_param
+  double clock_time;  ///< partner_timestamp on the clock of the controller, -1 without estimate of the clocks
+  double clock_error;  ///< s, uncertainty of clock_time
+  armed_pulse(){
+    state = ARMED_NONE;
+    stamped = 0;
+    partner_timestamp = -1.0;
+    clock_time = -1.0;
+    clock_error = 0.0;
+    received = 0.0;
+    opened = 0.0;
+    timestamp = -1.0;
+    skew = 0.0;
+  }
+};
+
+struct thread_param{
+  pthread_event* event;
+  pthread_mutex_t mutex;
+  Configuration* ptr_config; 
+  event_ring events;  ///< changes of the valves, each connection of the partner reads them with its own cursor
+  double partner_timestamp;
+  double partner_clock_time;  ///< partner_timestamp converted to time_real of the controller, -1 without estimate of the clocks (PING_QUERY)
+  double partner_clock_error;  ///< s, uncertainty of partner_clock_time
+  fly_trigger flies[MAX_FLIES];
+  double query_received;  ///< time_monotonic at which the last PULSE_QUERY arrived, 0 before the first one
+  dio_boards* boards;  ///< boards written by the network thread with FASTTRIGGER, NULL otherwise
+  armed_pulse armed;
+  bool stop; // stop used to terminate detached thread when main terminates, set to true just before main finishes
+};
+
+/// parameters of the thread that watches the USB link and reopens the boards
+struct usb_monitor_param{
+  dio_boards* boards;
+  Configuration* ptr_config;
+  volatile bool stop;
+};
+
+// parameter structure for multiflow controller parameters, 
+struct MFC_param{
+  pthread_event* event;
+  pthread_mutex_t mutex;
+  Configuration* ptr_to_config;
+  shm_stream* stream;  ///< the readings of the MFCs are published on it, NULL without stream
+  bool stop; // stop used to terminate detached thread when main terminates
+};
+
+
+/// applies the THREAD policy of the configuration to the calling thread (see rt_thread.h), the layout is logged
+void start_thread(Configuration& config, const char* name);
+
+/// logs the preemptions of the threads
+void report_threads(Configuration& config);
+
+/// frame written when the program starts: interval air is open, all other channels are closed
+void default_frame(unsigned int board, unsigned char* data);
+
+/// \brief opens the channels of the mask on all boards, port 9 is set to odor
+/// \param skew time between the completion of the first and of the last board
+/// \return timestamp of the frame, or -1 in case of error
+double set_channel(dio_boards& boards, const valve_mask& channels, bool odor, double& skew);
+
+/// thread functions, ptr_to_param is a poll_param, usb_monitor_param, MFC_param or thread_param
+void* poll_ITC18_trigger(void* ptr_to_param);
+void* usb_monitor(void* ptr_to_param);
+void* collect_flow_data(void* ptr_to_param);
+void* connect_to_Igor(void* ptr_to_param);
+void* connect_to_Flytracker(void* ptr_to_param);
+
+/// \brief executes the instructions of the configuration, pulses wait for the trigger of the partner if the trigger is external
+bool execute_config_instructions(Configuration& config, dio_boards& boards,
+  std::vector <partner_funct_param>& partner_function_table, const int& polling_function_idx, pthread_event& start_event, pthread_event& trigger_event,
+  pthread_event& mfc_event, MFC_param& mfc_param, thread_param& param);
+
+#endif
@@ -0,0 +1,640 @@
+
+#include "vo_alias.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+
+using namespace std;
+
+
+/// behavior rig: 2 vials per odour, 1 control vial, manifold waste valves used in NC position, other waste and carrier in NO position
+static const char* PROFILE_BEHAVIOR =
+  "VALVE V_ODOR1_VIALA 0\n"
+  "VALVE V_CONTROL1_VIALA 1\n"
+  "VALVE V_ODOR1_VIALB 2\n"
+  "VALVE V_ODOR1_WASTE 3\n"      // normally open
+  "VALVE V_ODOR2_VIALA 8\n"
+  "VALVE V_CONTROL2_VIALA 9\n"
+  "VALVE V_ODOR2_VIALB 10\n"
+  "VALVE V_ODOR2_WASTE 11\n"     // normally open
+  "VALVE V_ODOR3_VIALA 16\n"
+  "VALVE V_CONTROL3_VIALA 17\n"
+  "VALVE V_ODOR3_VIALB 18\n"
+  "VALVE V_ODOR3_WASTE 19\n"     // normally open
+  "VALVE V_BLEND1 24\n"
+  "VALVE V_BLEND12 25\n"
+  "VALVE V_BLEND123 26\n"
+  "VALVE V_BLEND13 27\n"
+  "VALVE V_BLEND2 28\n"
+  "VALVE V_BLEND23 29\n"
+  "VALVE V_BLEND3 30\n"
+  "VALVE V_BLEND0 31\n"          // blender for control, coactive with V_CONTROLX_VIALX
+  "VALVE V_WASTE1 32\n"          // normally open, coactive with blocks 24,25,26,27,36
+  "VALVE V_WASTE2 33\n"          // normally open, coactive with blocks 25,26,28,29,37
+  "VALVE V_WASTE3 34\n"          // normally open, coactive with blocks 26,27,28,29,30,38
+  "VALVE V_CARRIER 35\n"         // normally open, coactive with every pulse
+  "VALVE V_BLEND_C1 36\n"
+  "VALVE V_BLEND_C2 37\n"
+  "VALVE V_BLEND_C3 38\n"
+  "VALVE V_CONTROL 39\n"         // coactive with V_CONTROLX_VIALX
+  "VALVE V_BOOST 40\n"           // normally open
+  "VIALS 1 V_ODOR1_VIALA V_ODOR1_VIALB\n"
+  "VIALS 2 V_ODOR2_VIALA V_ODOR2_VIALB\n"
+  "VIALS 3 V_ODOR3_VIALA V_ODOR3_VIALB\n"
+  "CONTROL_VIALS 1 V_CONTROL1_VIALA\n"
+  "CONTROL_VIALS 2 V_CONTROL2_VIALA\n"
+  "CONTROL_VIALS 3 V_CONTROL3_VIALA\n"
+  "CARRIER V_ODOR1_WASTE V_ODOR2_WASTE V_ODOR3_WASTE V_BOOST\n"
+  "ODOUR 1 V_BLEND1 V_WASTE1 V_ODOR2_WASTE V_ODOR3_WASTE V_CARRIER\n"
+  "ODOUR 2 V_BLEND2 V_WASTE2 V_ODOR1_WASTE V_ODOR3_WASTE V_CARRIER\n"
+  "ODOUR 3 V_BLEND3 V_WASTE3 V_ODOR1_WASTE V_ODOR2_WASTE V_CARRIER\n"
+  "CONTROL 1 V_BLEND_C1 V_WASTE1 V_ODOR2_WASTE V_ODOR3_WASTE V_CARRIER V_BLEND0 V_CONTROL\n"
+  "CONTROL 2 V_BLEND_C2 V_WASTE2 V_ODOR1_WASTE V_ODOR3_WASTE V_CARRIER V_BLEND0 V_CONTROL\n"
+  "CONTROL 3 V_BLEND_C3 V_WASTE3 V_ODOR1_WASTE V_ODOR2_WASTE V_CARRIER V_BLEND0 V_CONTROL\n"
+  "BLEND 12 V_BLEND12 V_ODOR3_WASTE V_WASTE1 V_WASTE2 V_CARRIER\n"
+  "BLEND 13 V_BLEND13 V_ODOR2_WASTE V_WASTE1 V_WASTE3 V_CARRIER\n"
+  "BLEND 23 V_BLEND23 V_ODOR1_WASTE V_WASTE2 V_WASTE3 V_CARRIER\n"
+  "BLEND 123 V_BLEND123 V_WASTE1 V_WASTE2 V_WASTE3 V_CARRIER\n"
+  "ALIAS Test_food 0 11 13 22 23\n"
+  "ALIAS Test_cVA 3 5 8 20 23\n"
+  "ALIAS Test_carrier 0 8 21\n"
+  "ALIAS Test_blend 3 5 11 13 19 23\n"
+  "INTERLOCK TOGETHER V_BLEND1 V_WASTE1 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND2 V_WASTE2 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND3 V_WASTE3 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND12 V_WASTE1 V_WASTE2 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND13 V_WASTE1 V_WASTE3 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND23 V_WASTE2 V_WASTE3 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND123 V_WASTE1 V_WASTE2 V_WASTE3 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND_C1 V_WASTE1 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND_C2 V_WASTE2 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND_C3 V_WASTE3 V_CARRIER\n"
+  "INTERLOCK TOGETHER V_BLEND0 V_CONTROL\n"
+  "INTERLOCK EXCLUSIVE V_BLEND1 V_BLEND2 V_BLEND3 V_BLEND12 V_BLEND13 V_BLEND23 V_BLEND123 V_BLEND_C1 V_BLEND_C2 V_BLEND_C3\n"
+  "INTERLOCK NORMALLY_OPEN V_CARRIER V_BOOST\n";
+
+/// physiology rig: 4 vials per odour, 3 control vials
+static const char* PROFILE_PHYSIOLOGY =
+  "VALVE V_ODOR1_VIALA 0\n"
+  "VALVE V_CONTROL1_VIALA 1\n"
+  "VALVE V_ODOR1_VIALB 2\n"
+  "VALVE V_CONTROL1_VIALB 3\n"
+  "VALVE V_ODOR1_VIALC 4\n"
+  "VALVE V_CONTROL1_VIALC 5\n"
+  "VALVE V_ODOR1_VIALD 6\n"
+  "VALVE V_ODOR1_WASTE 7\n"
+  "VALVE V_ODOR2_VIALA 8\n"
+  "VALVE V_CONTROL2_VIALA 9\n"
+  "VALVE V_ODOR2_VIALB 10\n"
+  "VALVE V_CONTROL2_VIALB 11\n"
+  "VALVE V_ODOR2_VIALC 12\n"
+  "VALVE V_CONTROL2_VIALC 13\n"
+  "VALVE V_ODOR2_VIALD 14\n"
+  "VALVE V_ODOR2_WASTE 15\n"
+  "VALVE V_ODOR3_VIALA 16\n"
+  "VALVE V_CONTROL3_VIALA 17\n"
+  "VALVE V_ODOR3_VIALB 18\n"
+  "VALVE V_CONTROL3_VIALB 19\n"
+  "VALVE V_ODOR3_VIALC 20\n"
+  "VALVE V_CONTROL3_VIALC 21\n"
+  "VALVE V_ODOR3_VIALD 22\n"
+  "VALVE V_ODOR3_WASTE 23\n"
+  "VALVE V_BLEND1 24\n"
+  "VALVE V_BLEND12 25\n"
+  "VALVE V_BLEND123 26\n"
+  "VALVE V_BLEND13 27\n"
+  "VALVE V_BLEND2 28\n"
+  "VALVE V_BLEND23 29\n"
+  "VALVE V_BLEND3 30\n"
+  "VALVE V_BLEND0 31\n"
+  "VALVE V_WASTE1 32\n"
+  "VALVE V_WASTE2 33\n"
+  "VALVE V_WASTE3 34\n"
+  "VALVE V_CARRIER 35\n"
+  "VALVE V_BLEND_C1 36\n"
+  "VALVE V_BLEND_C2 37\n"
+  "VALVE V_BLEND_C3 38\n"
+  "VALVE V_CONTROL 39\n"
+  "VALVE V_BOOST 40\n"
+  "VIALS 1 V_ODOR1_VIALA V_ODOR1_VIALB V_ODOR1_VIALC V_ODOR1_VIALD\n"
+  "VIALS 2 V_ODOR2_VIALA V_ODOR2_VIALB V_ODOR2_VIALC V_ODOR2_VIALD\n"
+  "VIALS 3 V_ODOR3_VIALA V_ODOR3_VIALB V_ODOR3_VIALC V_ODOR3_VIALD\n"
+  "CONTROL_VIALS 1 V_CONTROL1_VIALA V_CONTROL1_VIALB V_CONTROL1_VIALC\n"
+  "CONTROL_VIALS 2 V_CONTROL2_VIALA V_CONTROL2_VIALB V_CONTROL2_VIALC\n"
+  "CONTROL_VIALS 3 V_CONTROL3_VIALA V_CONTROL3_VIALB V_CONTROL3_VIALC\n"
+  "CARRIER V_CARRIER V_WASTE1 V_WASTE2 V_WASTE3 V_ODOR1_WASTE V_ODOR2_WASTE V_ODOR3_WASTE\n"
+  "ODOUR 1 V_BLEND1 V_WASTE2 V_WASTE3 V_ODOR2_WASTE V_ODOR3_WASTE\n"
+  "ODOUR 2 V_BLEND2 V_WASTE1 V_WASTE3 V_ODOR1_WASTE V_ODOR3_WASTE\n"
+  "ODOUR 3 V_BLEND3 V_WASTE1 V_WASTE2 V_ODOR1_WASTE V_ODOR2_WASTE\n"
+  "CONTROL 1 V_BLEND_C1 V_WASTE2 V_WASTE3 V_ODOR2_WASTE V_ODOR3_WASTE V_BLEND0 V_CONTROL\n"
+  "CONTROL 2 V_BLEND_C2 V_WASTE1 V_WASTE3 V_ODOR1_WASTE V_ODOR3_WASTE V_BLEND0 V_CONTROL\n"
+  "CONTROL 3 V_BLEND_C3 V_WASTE1 V_WASTE2 V_ODOR1_WASTE V_ODOR2_WASTE V_BLEND0 V_CONTROL\n"
+  "BLEND 12 V_BLEND12 V_ODOR3_WASTE V_WASTE3\n"
+  "BLEND 13 V_BLEND13 V_ODOR2_WASTE V_WASTE2\n"
+  "BLEND 23 V_BLEND23 V_ODOR1_WASTE V_WASTE1\n"
+  "BLEND 123 V_BLEND123\n"
+  "ALIAS Test_food 0 11 13 22 23\n"
+  "ALIAS Test_cVA 3 5 8 20 23\n"
+  "ALIAS Test_carrier 0 8 21\n"
+  "ALIAS Test_blend 3 5 11 13 19 23\n"
+  "INTERLOCK TOGETHER V_BLEND1 V_WASTE2 V_WASTE3 V_ODOR2_WASTE V_ODOR3_WASTE\n"
+  "INTERLOCK TOGETHER V_BLEND2 V_WASTE1 V_WASTE3 V_ODOR1_WASTE V_ODOR3_WASTE\n"
+  "INTERLOCK TOGETHER V_BLEND3 V_WASTE1 V_WASTE2 V_ODOR1_WASTE V_ODOR2_WASTE\n"
+  "INTERLOCK TOGETHER V_BLEND12 V_ODOR3_WASTE V_WASTE3\n"
+  "INTERLOCK TOGETHER V_BLEND13 V_ODOR2_WASTE V_WASTE2\n"
+  "INTERLOCK TOGETHER V_BLEND23 V_ODOR1_WASTE V_WASTE1\n"
+  "INTERLOCK TOGETHER V_BLEND_C1 V_WASTE2 V_WASTE3 V_ODOR2_WASTE V_ODOR3_WASTE\n"
+  "INTERLOCK TOGETHER V_BLEND_C2 V_WASTE1 V_WASTE3 V_ODOR1_WASTE V_ODOR3_WASTE\n"
+  "INTERLOCK TOGETHER V_BLEND_C3 V_WASTE1 V_WASTE2 V_ODOR1_WASTE V_ODOR2_WASTE\n"
+  "INTERLOCK TOGETHER V_BLEND0 V_CONTROL\n"
+  "INTERLOCK EXCLUSIVE V_BLEND1 V_BLEND2 V_BLEND3 V_BLEND12 V_BLEND13 V_BLEND23 V_BLEND123 V_BLEND_C1 V_BLEND_C2 V_BLEND_C3\n"
+  "INTERLOCK NORMALLY_OPEN V_CARRIER V_BOOST\n";
+
+
+rig_profile valve_alias::profile;
+
+
+// =============================================================================
+vector<int> valve_mask::channels() const {
+  vector<int> result;
+  for (unsigned int v(0); v < MAX_BOARDS * NB_VALVE_CHANNELS; v++){
+    if (test(v)){
+      result.push_back(v);
+    }
+  }
+  return result;
+}
+
+// =============================================================================
+uint8_t flow_type_bit(char flow_type){
+  switch (flow_type){
+    case '1': return FLOW_BIT_ODOR1;
+    case '2': return FLOW_BIT_ODOR2;
+    case '3': return FLOW_BIT_ODOR3;
+    case 'C': return FLOW_BIT_CARRIER;
+    case 'B': return FLOW_BIT_BOOST;
+    default: return 0;
+  }
+}
+
+// =============================================================================
+vector<char> flow_types_from_bits(uint8_t bits){
+  static const char types[] = {'1', '2', '3', 'C', 'B'};
+  vector<char> result;
+  for (unsigned int i(0); i < sizeof(types); i++){
+    if (bits & flow_type_bit(types[i])){
+      result.push_back(types[i]);
+    }
+  }
+  return result;
+}
+
+// =============================================================================
+// all non-empty subsets of vials, as strings of vial letters in increasing order (A, B, AB, C, AC, ...)
+static vector<string> vial_subsets(unsigned int nb_vials){
+  vector<string> result;
+  for (unsigned int bits(1); bits < (1u << nb_vials); bits++){
+    string s;
+    for (unsigned int v(0); v < nb_vials; v++){
+      if (bits & (1u << v)){
+        s += (char)('A' + v);
+      }
+    }
+    result.push_back(s);
+  }
+  return result;
+}
+
+
+// =============================================================================
+bool interlock::add_rule(const interlock_rule& rule){
+  if (rule.type > INTERLOCK_NORMALLY_OPEN || rule.group.empty()){
+    return false;
+  }
+  rules.push_back(rule);
+  return true;
+}
+
+// =============================================================================
+const interlock_rule* interlock::violated_rule(const valve_mask& frame) const {
+  for (unsigned int i(0); i < rules.size(); i++){
+    if (!satisfies(rules[i], frame)){
+      return &rules[i];
+    }
+  }
+  return NULL;
+}
+
+// =============================================================================
+unsigned int interlock::size() const {
+  return rules.size();
+}
+
+
+// =============================================================================
+rig_profile::rig_profile(){
+  loaded = false;
+  nb_boards = 0;
+}
+
+// =============================================================================
+const string& rig_profile::get_name() const {
+  return name;
+}
+
+// =============================================================================
+bool rig_profile::is_loaded() const {
+  return loaded;
+}
+
+// =============================================================================
+unsigned int rig_profile::get_nb_aliases() const {
+  return table.size();
+}
+
+// =============================================================================
+unsigned int rig_profile::get_nb_boards() const {
+  return nb_boards;
+}
+
+// =============================================================================
+int rig_profile::get_valve(const string& valve_name) const {
+  map <string, int>::const_iterator iter = valves.find(valve_name);
+  if (iter == valves.end()){
+    return -1;
+  }
+  return iter->second;
+}
+
+// =============================================================================
+const interlock& rig_profile::get_interlock() const {
+  return rules;
+}
+
+// =============================================================================
+const alias_entry* rig_profile::lookup(const string& alias) const {
+  unordered_map <string, alias_entry>::const_iterator iter = table.find(alias);
+  if (iter == table.end()){
+    return NULL;
+  }
+  return &iter->second;
+}
+
+// =============================================================================
+bool rig_profile::load(const string& name_or_path){
+  *this = rig_profile();
+  bool valid (false);
+  if (name_or_path == "behavior"){
+    stringstream ss(PROFILE_BEHAVIOR);
+    valid = parse(ss);
+  }else if (name_or_path == "physiology"){
+    stringstream ss(PROFILE_PHYSIOLOGY);
+    valid = parse(ss);
+  }else{
+    ifstream f(name_or_path.c_str());
+    if (!f.is_open()){
+      cerr<<"Cannot open rig profile "<<name_or_path<<". Use behavior, physiology or the path of a profile file."<<endl;
+      return false;
+    }
+    valid = parse(f);
+  }
+  if (!valid){
+    cerr<<"Invalid rig profile: "<<name_or_path<<endl;
+    return false;
+  }
+  name = name_or_path;
+  enumerate();
+  if (!check_aliases()){
+    cerr<<"Invalid rig profile: "<<name_or_path<<endl;
+    return false;
+  }
+  loaded = true;
+  return true;
+}
+
+// =============================================================================
+// converts the valves listed from word first onwards (names or channel numbers) to channels
+bool rig_profile::parse_valves(const vector<string>& words, unsigned int first, vector<int>& out, const string& line){
+  out.clear();
+  for (unsigned int i(first); i < words.size(); i++){
+    if (words[i].empty()){
+      continue;
+    }
+    int channel (-1);
+    if (isdigit(words[i][0])){
+      channel = atoi(words[i].c_str());
+    }else{
+      channel = get_valve(words[i]);
+    }
+    if (channel < 0 || channel >= (int)(MAX_BOARDS * NB_VALVE_CHANNELS)){
+      cerr<<"Error in rig profile in line: "<<line<<endl;
+      cerr<<"Unknown valve or invalid channel: "<<words[i]<<endl;
+      return false;
+    }
+    out.push_back(channel);
+  }
+  if (out.empty()){
+    cerr<<"Error in rig profile in line: "<<line<<endl;
+    cerr<<"No valves specified."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+bool rig_profile::parse_interlock(const vector<string>& words, const string& line){
+  interlock_rule rule;
+  unsigned int first (2);
+  if (words[1] == "TOGETHER"){
+    rule.type = INTERLOCK_TOGETHER;
+    vector <int> trigger;
+    if (words.size() < 4 || !parse_valves(words, 2, trigger, line)){
+      cerr<<"Error in rig profile in line: "<<line<<endl;
+      cerr<<"TOGETHER needs a valve followed by the valves that open with it."<<endl;
+      return false;
+    }
+    rule.trigger.set(trigger[0]);
+    first = 3;
+  }else if (words[1] == "EXCLUSIVE"){
+    rule.type = INTERLOCK_EXCLUSIVE;
+  }else if (words[1] == "NORMALLY_OPEN"){
+    rule.type = INTERLOCK_NORMALLY_OPEN;
+  }else{
+    cerr<<"Error in rig profile in line: "<<line<<endl;
+    cerr<<"Interlocks are TOGETHER, EXCLUSIVE or NORMALLY_OPEN."<<endl;
+    return false;
+  }
+  vector <int> group;
+  if (!parse_valves(words, first, group, line)){
+    return false;
+  }
+  for (unsigned int i(0); i < group.size(); i++){
+    rule.group.set(group[i]);
+  }
+  rule.text = line;
+  return rules.add_rule(rule);
+}
+
+// =============================================================================
+// checks the frame of every alias against the interlock rules, so that a bad alias is found when the program starts
+bool rig_profile::check_aliases() const {
+  bool valid (true);
+  for (unordered_map <string, alias_entry>::const_iterator iter = table.begin(); iter != table.end(); iter++){
+    const interlock_rule* rule = rules.violated_rule(iter->second.mask);
+    if (rule != NULL){
+      cerr<<"Alias "<<iter->first<<" violates interlock: "<<rule->text<<endl;
+      valid = false;
+    }
+  }
+  return valid;
+}
+
+// =============================================================================
+bool rig_profile::parse(istream& in){
+  string s;
+  while (getline(in, s)){
+    if (s.empty() || s[0] == '#'){
+      continue;
+    }
+    vector <string> words;
+    unsigned int nb_words = chop_line(s, words);
+    if (nb_words < 3){
+      cerr<<"Error in rig profile in line: "<<s<<endl;
+      cerr<<"Parameters are missing."<<endl;
+      return false;
+    }
+
+    if (words[0] == "VALVE"){
+      int channel = atoi(words[2].c_str());
+      if (!isdigit(words[2][0]) || channel >= (int)(MAX_BOARDS * NB_VALVE_CHANNELS)){
+        cerr<<"Error in rig profile in line: "<<s<<endl;
+        cerr<<"The channel of a valve needs to be between 0 and "<<MAX_BOARDS * NB_VALVE_CHANNELS - 1<<"."<<endl;
+        return false;
+      }
+      valves[words[1]] = channel;
+
+    }else if (words[0] == "INTERLOCK"){
+      if (!parse_interlock(words, s)){
+        return false;
+      }
+
+    }else if (words[0] == "ALIAS"){
+      if (!parse_valves(words, 2, fixed_aliases[words[1]], s)){
+        return false;
+      }
+
+    }else if (words[0] == "CARRIER"){
+      if (!parse_valves(words, 1, carrier, s)){
+        return false;
+      }
+
+    }else if (words[0] == "BLEND"){
+      if (words[1] != "12" && words[1] != "13" && words[1] != "23" && words[1] != "123"){
+        cerr<<"Error in rig profile in line: "<<s<<endl;
+        cerr<<"Blends are 12, 13, 23 or 123."<<endl;
+        return false;
+      }
+      if (!parse_valves(words, 2, blend_base[words[1]], s)){
+        return false;
+      }
+
+    }else if (words[0] == "VIALS" || words[0] == "CONTROL_VIALS" || words[0] == "ODOUR" || words[0] == "CONTROL"){
+      int n = ctoi(words[1][0]);
+      if (words[1].length() != 1 || n < 1 || n > 3){
+        cerr<<"Error in rig profile in line: "<<s<<endl;
+        cerr<<"Odours and controls are numbered 1 to 3."<<endl;
+        return false;
+      }
+      vector <int>* target (NULL);
+      if (words[0] == "VIALS"){
+        target = &vials[n - 1];
+      }else if (words[0] == "CONTROL_VIALS"){
+        target = &control_vials[n - 1];
+      }else if (words[0] == "ODOUR"){
+        target = &odour_base[n - 1];
+      }else{
+        target = &control_base[n - 1];
+      }
+      if (!parse_valves(words, 2, *target, s)){
+        return false;
+      }
+      // aliases name vials with single letters and give the vial count with one digit
+      if ((words[0] == "VIALS" || words[0] == "CONTROL_VIALS") && target->size() > 4){
+        cerr<<"Error in rig profile in line: "<<s<<endl;
+        cerr<<"At most 4 vials (A-D) per odour or control."<<endl;
+        return false;
+      }
+
+    }else{
+      cerr<<"Error in rig profile in line: "<<s<<endl;
+      cerr<<"Keyword unknown."<<endl;
+      return false;
+    }
+  }
+
+  if (carrier.empty()){
+    cerr<<"Rig profile without CARRIER valves."<<endl;
+    return false;
+  }
+  return true;
+}
+
+// =============================================================================
+void rig_profile::add_alias(const string& alias, const vector<int>& alias_valves, uint8_t flow_types){
+  alias_entry entry;
+  entry.valves = alias_valves;
+  for (unsigned int i(0); i < alias_valves.size(); i++){
+    entry.mask.set(alias_valves[i]);
+  }
+  entry.flow_types = flow_types;
+  table[alias] = entry;
+  for (unsigned int b(nb_boards); b < MAX_BOARDS; b++){
+    if (entry.mask.touches(b)){
+      nb_boards = b + 1;
+    }
+  }
+}
+
+// =============================================================================
+// enumerates every legal alias of the rig:
+//   Carrier, OdourN_nV_X..., ControlN_1V_X, BlendXY_nV_X...-X..., Blend123_nV_X...-X...-X... and the fixed aliases
+// vial lists are non-empty, in increasing order, and each vial appears once
+void rig_profile::enumerate(){
+  table.clear();
+  nb_boards = 1;
+  add_alias("Carrier", carrier, FLOW_BIT_CARRIER | FLOW_BIT_BOOST);
+
+  for (map <string, vector <int> >::iterator iter = fixed_aliases.begin(); iter != fixed_aliases.end(); iter++){
+    add_alias(iter->first, iter->second, FLOW_BIT_CARRIER);
+  }
+
+  vector <string> subsets[3];
+  for (unsigned int o(0); o < 3; o++){
+    subsets[o] = vial_subsets(vials[o].size());
+  }
+
+  for (unsigned int o(0); o < 3; o++){
+    uint8_t flows = FLOW_BIT_CARRIER | flow_type_bit('1' + o);
+
+    // odours
+    if (!odour_base[o].empty()){
+      for (unsigned int i(0); i < subsets[o].size(); i++){
+        const string& list = subsets[o][i];
+        vector <int> v = odour_base[o];
+        for (unsigned int k(0); k < list.length(); k++){
+          v.push_back(vials[o][list[k] - 'A']);
+        }
+        add_alias("Odour" + to_string(o + 1) + "_" + to_string(list.length()) + "V_" + list, v, flows);
+      }
+    }
+
+    // controls (one vial at a time)
+    if (!control_base[o].empty()){
+      for (unsigned int c(0); c < control_vials[o].size(); c++){
+        vector <int> v = control_base[o];
+        v.insert(v.begin() + 1, control_vials[o][c]);
+        add_alias("Control" + to_string(o + 1) + "_1V_" + string(1, (char)('A' + c)), v, flows);
+      }
+    }
+  }
+
+  // two odour blends
+  static const char* pairs[3] = {"12", "13", "23"};
+  for (unsigned int p(0); p < 3; p++){
+    map <string, vector <int> >::iterator base = blend_base.find(pairs[p]);
+    if (base == blend_base.end()){
+      continue;
+    }
+    unsigned int o1 = pairs[p][0] - '1';
+    unsigned int o2 = pairs[p][1] - '1';
+    uint8_t flows = FLOW_BIT_CARRIER | flow_type_bit(pairs[p][0]) | flow_type_bit(pairs[p][1]);
+    for (unsigned int i(0); i < subsets[o1].size(); i++){
+      for (unsigned int j(0); j < subsets[o2].size(); j++){
+        const string& l1 = subsets[o1][i];
+        const string& l2 = subsets[o2][j];
+        vector <int> v = base->second;
+        for (unsigned int k(0); k < l1.length(); k++){
+          v.push_back(vials[o1][l1[k] - 'A']);
+        }
+        for (unsigned int k(0); k < l2.length(); k++){
+          v.push_back(vials[o2][l2[k] - 'A']);
+        }
+        add_alias("Blend" + string(pairs[p]) + "_" + to_string(l1.length() + l2.length()) + "V_" + l1 + "-" + l2, v, flows);
+      }
+    }
+  }
+
+  // three odour blend
+  map <string, vector <int> >::iterator base = blend_base.find("123");
+  if (base != blend_base.end()){
+    uint8_t flows = FLOW_BIT_CARRIER | FLOW_BIT_ODOR1 | FLOW_BIT_ODOR2 | FLOW_BIT_ODOR3;
+    for (unsigned int i(0); i < subsets[0].size(); i++){
+      for (unsigned int j(0); j < subsets[1].size(); j++){
+        for (unsigned int k(0); k < subsets[2].size(); k++){
+          const string* lists[3] = { &subsets[0][i], &subsets[1][j], &subsets[2][k] };
+          vector <int> v = base->second;
+          unsigned int count (0);
+          for (unsigned int o(0); o < 3; o++){
+            for (unsigned int n(0); n < lists[o]->length(); n++){
+              v.push_back(vials[o][(*lists[o])[n] - 'A']);
+            }
+            count += lists[o]->length();
+          }
+          add_alias("Blend123_" + to_string(count) + "V_" + *lists[0] + "-" + *lists[1] + "-" + *lists[2], v, flows);
+        }
+      }
+    }
+  }
+}
+
+
+// =============================================================================
+bool valve_alias::load_profile(const string& name_or_path){
+  if (!profile.load(name_or_path)){
+    return false;
+  }
+  cout<<"Rig profile "<<profile.get_name()<<" loaded: "<<profile.get_nb_aliases()<<" aliases, "<<profile.get_interlock().size()<<" interlocks, "<<profile.get_nb_boards()<<" board(s)."<<endl;
+  return true;
+}
+
+// =============================================================================
+const rig_profile& valve_alias::get_profile(){
+  return profile;
+}
+
+// =============================================================================
+const alias_entry* valve_alias::lookup(const string& alias){
+  if (!profile.is_loaded()){
+    cerr<<"No rig profile loaded. Specify RIG in the configuration file before using aliases."<<endl;
+    return NULL;
+  }
+  const alias_entry* entry = profile.lookup(alias);
+  if (entry == NULL){
+    cerr<<"Unrecognised alias: "<<alias<<"."<<endl;
+  }
+  return entry;
+}
+
+// =============================================================================
+bool valve_alias::check_frame(const valve_mask& frame){
+  if (profile.get_interlock().check(frame)){
+    return true;
+  }
+  const interlock_rule* rule = profile.get_interlock().violated_rule(frame);
+  cerr<<"Frame refused, it violates interlock: "<<(rule != NULL ? rule->text : "")<<endl;
+  return false;
+}
+
+// =============================================================================
+/// Converts a valve alias (e.g. Odour2_2V_AB or Blend123_6V_AB-AB-AB)
+/// to a vector with the list of valves that have to be opened
+vector<int> valve_alias::parse_alias(const string name){
+  const alias_entry* entry = lookup(name);
+  if (entry == NULL){
+    return vector<int>();
+  }
+  return entry->valves;
+}
@@ -0,0 +1,274 @@
+//
+//  vo_alias.h
+//  valve aliases of the odour delivery device (e.g. Odour2_2V_AB or Blend123_6V_AB-AB-AB)
+//
+//  The valve constants and vial tables of a rig are described by a rig profile, loaded at startup
+//  (RIG keyword of the configuration file). Two profiles are built in: behavior and physiology,
+//  any other value is read as the path of a profile file with the same syntax. Without RIG the profile of the
+//  build is used (DEFAULT_RIG: make physiology or make behavior, behavior otherwise):
+//
+//  # comment
+//  VALVE name channel                    valve channel, channel % 64 on USB-DIO-96 board channel / 64 (ports 8-11 are reserved)
+//  VIALS odour valve_A valve_B [...]     valves of vials A, B, ... of odour 1-3
+//  CONTROL_VIALS control valve_A [...]   valves of control vials A, B, ... of control 1-3
+//  CARRIER valve [...]                   valves opened by the Carrier alias
+//  ODOUR odour valve [...]               valves opened with every OdourN alias (vial valves are added)
+//  CONTROL control valve [...]           valves opened with every ControlN alias (vial valve is added)
+//  BLEND odours valve [...]              valves opened with every BlendXY alias (odours is 12, 13, 23 or 123)
+//  ALIAS name valve [...]                alias with a fixed list of valves (e.g. for testing)
+//  INTERLOCK TOGETHER valve valve [...]  if the first valve is open, all other valves must be open too
+//  INTERLOCK EXCLUSIVE valve valve [...] at most one of the valves is open
+//  INTERLOCK NORMALLY_OPEN valve [...]   valves that let air through when not energized, they are never all energized at once
+//
+//  valves are given by name (declared with VALVE before) or by channel number.
+//  Every legal alias is enumerated once when the profile is loaded, lookups are then a single hash table access.
+//  The frames of all aliases are checked against the interlock rules when the profile is loaded, and every frame
+//  is checked again before it is written to the board (see set_channel).
+//
+
+#ifndef __vo_alias_h
+#define __vo_alias_h
+
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <istream>
+#include <stdint.h>
+#include "utils.h"
+
+
+/// built-in profile of the configuration files without RIG, chosen when the program is built (-D PHYSIOLOGY or -D BEHAVIOR)
+#ifdef PHYSIOLOGY
+const char* const DEFAULT_RIG = "physiology";
+#else
+const char* const DEFAULT_RIG = "behavior";
+#endif
+
+const unsigned int NB_BOARD_CHANNELS = 96; ///< channels of one USB-DIO-96 board (12 ports of 8 bits)
+const unsigned int NB_VALVE_CHANNELS = 64; ///< channels that can drive valves (ports 0-7), port 9 flags odour pulses, ports 10-11 are inputs
+const unsigned int MAX_BOARDS = 4;         ///< boards driven together, valve v is channel v % 64 of board v / 64
+const unsigned int NB_MASK_WORDS = 3 * MAX_BOARDS;
+
+
+/// mask of the channels of all boards, 96 bits per board: bit i of a board is channel i (port i/8, pin i%8)
+/// valves are numbered across boards (see MAX_BOARDS)
+struct valve_mask {
+  uint32_t w[NB_MASK_WORDS];
+
+  valve_mask(){
+    for (unsigned int i(0); i < NB_MASK_WORDS; i++){
+      w[i] = 0;
+    }
+  }
+  static unsigned int bit(unsigned int valve){
+    return (valve / NB_VALVE_CHANNELS) * NB_BOARD_CHANNELS + valve % NB_VALVE_CHANNELS;
+  }
+  void set(unsigned int valve){
+    unsigned int b = bit(valve);
+    w[b >> 5] |= (1u << (b & 31));
+  }
+  bool test(unsigned int valve) const {
+    unsigned int b = bit(valve);
+    return (w[b >> 5] >> (b & 31)) & 1u;
+  }
+  bool empty() const {
+    uint32_t r (0);
+    for (unsigned int i(0); i < NB_MASK_WORDS; i++){
+      r |= w[i];
+    }
+    return r == 0;
+  }
+  unsigned int count() const {
+    unsigned int n (0);
+    for (unsigned int i(0); i < NB_MASK_WORDS; i++){
+      n += __builtin_popcount(w[i]);
+    }
+    return n;
+  }
+  valve_mask& operator|= (const valve_mask& m){
+    for (unsigned int i(0); i < NB_MASK_WORDS; i++){
+      w[i] |= m.w[i];
+    }
+    return *this;
+  }
+  valve_mask operator& (const valve_mask& m) const {
+    valve_mask r;
+    for (unsigned int i(0); i < NB_MASK_WORDS; i++){
+      r.w[i] = w[i] & m.w[i];
+    }
+    return r;
+  }
+  bool operator== (const valve_mask& m) const {
+    for (unsigned int i(0); i < NB_MASK_WORDS; i++){
+      if (w[i] != m.w[i]){
+        return false;
+      }
+    }
+    return true;
+  }
+  bool operator!= (const valve_mask& m) const {
+    return !(*this == m);
+  }
+  /// true if channels of the board are set
+  bool touches(unsigned int board) const {
+    return (w[3 * board] | w[3 * board + 1] | w[3 * board + 2]) != 0;
+  }
+  /// writes the channels of a board into the 12 port bytes of a DIO frame
+  void to_ports(unsigned int board, unsigned char* data) const {
+    for (unsigned int p(0); p < NB_BOARD_CHANNELS / 8; p++){
+      data[p] = (unsigned char)(w[3 * board + (p >> 2)] >> (8 * (p & 3)));
+    }
+  }
+  /// list of valves set in the mask
+  std::vector<int> channels() const;
+};
+
+
+/// flow types (see configuration.h) as bits of a set
+const uint8_t FLOW_BIT_ODOR1 = 1;
+const uint8_t FLOW_BIT_ODOR2 = 2;
+const uint8_t FLOW_BIT_ODOR3 = 4;
+const uint8_t FLOW_BIT_CARRIER = 8;
+const uint8_t FLOW_BIT_BOOST = 16;
+
+/// converts a flow type ('1', '2', '3', 'C', 'B') to its bit, 0 if invalid
+uint8_t flow_type_bit(char flow_type);
+/// converts a set of flow type bits to the list of flow types
+std::vector<char> flow_types_from_bits(uint8_t bits);
+
+
+/// precompiled alias: valves to open and flows that go to the fly
+struct alias_entry {
+  std::vector<int> valves; ///< valves to open, in the order of the profile
+  valve_mask mask;         ///< same valves as a mask
+  uint8_t flow_types;      ///< set of FLOW_BIT_* of flows going to the fly
+};
+
+
+/// types of interlock rules
+const uint8_t INTERLOCK_TOGETHER = 0;      ///< if trigger is open, every channel of group is open
+const uint8_t INTERLOCK_EXCLUSIVE = 1;     ///< at most one channel of group is open
+const uint8_t INTERLOCK_NORMALLY_OPEN = 2; ///< channels of group are not all energized (closed) at once
+
+struct interlock_rule {
+  uint8_t type;
+  valve_mask trigger;  ///< valve that triggers the rule (TOGETHER only)
+  valve_mask group;    ///< valves constrained by the rule
+  std::string text;    ///< line of the profile, for error messages
+};
+
+
+/// valve interlock rules of a rig, expressed as constraints on the mask of a frame
+class interlock {
+
+public:
+  bool add_rule(const interlock_rule& rule);
+
+  /// \return true if the frame satisfies every rule, a few mask operations per rule
+  bool check(const valve_mask& frame) const {
+    for (unsigned int i(0); i < rules.size(); i++){
+      if (!satisfies(rules[i], frame)){
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// \return the first rule violated by the frame, or NULL
+  const interlock_rule* violated_rule(const valve_mask& frame) const;
+
+  unsigned int size() const;
+
+private:
+  static bool satisfies(const interlock_rule& rule, const valve_mask& frame){
+    switch (rule.type){
+      case INTERLOCK_TOGETHER:
+        return (frame & rule.trigger).empty() || (frame & rule.group) == rule.group;
+      case INTERLOCK_EXCLUSIVE:
+        return (frame & rule.group).count() <= 1;
+      case INTERLOCK_NORMALLY_OPEN:
+        return (frame & rule.group) != rule.group;
+      default:
+        return false;
+    }
+  }
+
+  std::vector <interlock_rule> rules;
+};
+
+
+/// valve constants and vial tables of a rig, with the table of all legal aliases
+class rig_profile {
+
+public:
+  rig_profile();
+
+  /// \brief loads a built-in profile (behavior, physiology) or a profile file
+  /// \return true if the profile is valid and all aliases could be enumerated
+  bool load(const std::string& name_or_path);
+
+  /// \return the precompiled alias, or NULL if the alias is not legal on this rig
+  const alias_entry* lookup(const std::string& alias) const;
+
+  /// \return channel of a named valve, or -1 if unknown
+  int get_valve(const std::string& name) const;
+
+  const interlock& get_interlock() const;
+
+  const std::string& get_name() const;
+  bool is_loaded() const;
+  unsigned int get_nb_aliases() const;
+  /// \return number of boards driven by the valves of the rig
+  unsigned int get_nb_boards() const;
+
+private:
+  bool parse(std::istream& in);
+  bool parse_valves(const std::vector<std::string>& words, unsigned int first, std::vector<int>& out, const std::string& line);
+  bool parse_interlock(const std::vector<std::string>& words, const std::string& line);
+  void enumerate();
+  bool check_aliases() const;
+  void add_alias(const std::string& alias, const std::vector<int>& valves, uint8_t flow_types);
+
+  std::string name;
+  bool loaded;
+  unsigned int nb_boards;
+  std::map <std::string, int> valves;            ///< named valves and their channel
+  std::vector <int> vials[3];                    ///< valves of vials A, B, ... for odours 1-3
+  std::vector <int> control_vials[3];            ///< valves of control vials A, B, ... for controls 1-3
+  std::vector <int> carrier;                     ///< valves of the Carrier alias
+  std::vector <int> odour_base[3];               ///< valves opened with every alias of odours 1-3
+  std::vector <int> control_base[3];             ///< valves opened with every alias of controls 1-3
+  std::map <std::string, std::vector <int> > blend_base;   ///< valves opened with every blend, indexed by odours (12, 13, 23, 123)
+  std::map <std::string, std::vector <int> > fixed_aliases; ///< aliases with a fixed list of valves
+  std::unordered_map <std::string, alias_entry> table;     ///< every legal alias
+  interlock rules;                                         ///< interlock rules of the rig
+};
+
+
+class valve_alias {
+
+public:
+  /// \brief loads the rig profile used for all alias conversions (see rig_profile::load)
+  static bool load_profile(const std::string& name_or_path);
+
+  static const rig_profile& get_profile();
+
+  /// \brief Converts a valve alias (e.g. Odour2_2V_AB or Blend123_6V_AB-AB-AB)
+  ///   to a vector with the list of valves that have to be opened
+  /// \param alias The alias to convert
+  /// \return a vector with the list of valves, or an empty vector in case of error
+  static std::vector<int> parse_alias(const std::string alias);
+
+  /// \return the precompiled alias (valve mask and flow types), or NULL in case of error
+  static const alias_entry* lookup(const std::string& alias);
+
+  /// \brief checks a frame against the interlock rules of the rig, prints the violated rule in case of error
+  /// \return true if the frame can be written to the board
+  static bool check_frame(const valve_mask& frame);
+
+private:
+  static rig_profile profile;
+};
+
+#endif
@@ -0,0 +1,158 @@
+//
+//  wire_format.cc
+//  packed and versioned frames of the partner protocol (see wire_format.h)
+//
+
+#include <cstring>
+
+#include "wire_format.h"
+
+using namespace std;
+
+
+// =============================================================================
+wire_writer::wire_writer(vector <char>& out, uint8_t version){
+  this->out = &out;
+  this->version = version;
+  frame_start = 0;
+}
+
+// =============================================================================
+void wire_writer::u8(uint8_t v){
+  out->push_back((char)v);
+}
+
+// =============================================================================
+void wire_writer::u16(uint16_t v){
+  u8(v & 0xFF);
+  u8(v >> 8);
+}
+
+// =============================================================================
+void wire_writer::u32(uint32_t v){
+  u16(v & 0xFFFF);
+  u16(v >> 16);
+}
+
+// =============================================================================
+void wire_writer::u64(uint64_t v){
+  u32(v & 0xFFFFFFFF);
+  u32(v >> 32);
+}
+
+// =============================================================================
+// IEEE 754 double, with the byte order of the integers
+void wire_writer::f64(double v){
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  u64(bits);
+}
+
+// =============================================================================
+void wire_writer::bytes(const void* data, unsigned int length){
+  out->insert(out->end(), (const char*)data, (const char*)data + length);
+}
+
+// =============================================================================
+void wire_writer::begin_frame(uint8_t type, uint16_t flags){
+  frame_start = out->size();
+  u8(version);
+  u8(type);
+  u16(flags);
+  u32(0);
+}
+
+// =============================================================================
+void wire_writer::end_frame(){
+  uint32_t length = out->size() - frame_start - FRAME_HEADER_SIZE;
+  for (unsigned int i(0); i < 4; i++){
+    (*out)[frame_start + 4 + i] = (char)((length >> (8 * i)) & 0xFF);
+  }
+}
+
+
+// =============================================================================
+wire_reader::wire_reader(const char* data, unsigned int length){
+  this->data = (const unsigned char*)data;
+  this->length = length;
+  pos = 0;
+}
+
+// =============================================================================
+bool wire_reader::u8(uint8_t& v){
+  if (pos + 1 > length){
+    v = 0;
+    return false;
+  }
+  v = data[pos++];
+  return true;
+}
+
+// =============================================================================
+bool wire_reader::u16(uint16_t& v){
+  uint8_t lo, hi;
+  bool ok = u8(lo) && u8(hi);
+  v = ok ? (uint16_t)(lo | (hi << 8)) : 0;
+  return ok;
+}
+
+// =============================================================================
+bool wire_reader::u32(uint32_t& v){
+  uint16_t lo, hi;
+  bool ok = u16(lo) && u16(hi);
+  v = ok ? ((uint32_t)hi << 16) | lo : 0;
+  return ok;
+}
+
+// =============================================================================
+bool wire_reader::u64(uint64_t& v){
+  uint32_t lo, hi;
+  bool ok = u32(lo) && u32(hi);
+  v = ok ? ((uint64_t)hi << 32) | lo : 0;
+  return ok;
+}
+
+// =============================================================================
+bool wire_reader::f64(double& v){
+  uint64_t bits;
+  bool ok = u64(bits);
+  memcpy(&v, &bits, sizeof(v));
+  return ok;
+}
+
+// =============================================================================
+bool wire_reader::bytes(void* out, unsigned int n){
+  if (pos + n > length){
+    return false;
+  }
+  memcpy(out, data + pos, n);
+  pos += n;
+  return true;
+}
+
+
+// =============================================================================
+uint16_t name_dictionary::intern(const char* name, unsigned int max){
+  string s(name, strnlen(name, max));
+  map <string, uint16_t>::iterator it = ids.find(s);
+  if (it != ids.end()){
+    return it->second;
+  }
+  if (names.size() >= NO_NAME){
+    return NO_NAME;
+  }
+  uint16_t id = names.size();
+  ids[s] = id;
+  names.push_back(s);
+  return id;
+}
+
+// =============================================================================
+uint16_t name_dictionary::size(){
+  return names.size();
+}
+
+// =============================================================================
+const string& name_dictionary::name(uint16_t id){
+  return names[id];
+}
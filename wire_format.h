@@ -0,0 +1,108 @@
+//
+//  wire_format.h
+//  packed and versioned frames of the partner protocol, used once the partner sent HELLO_QUERY (see data_format.h)
+//
+//  Without HELLO_QUERY the answers are the structures of data_format.h as they are in memory (padding, byte order of
+//  the host, fixed-size strings). With it every answer and every pushed message is a frame: a frame_header followed by
+//  length bytes, all the fields little-endian and without padding. The alias and odor of the events are numbers, the
+//  names are sent once per connection in a FRAME_DICT that comes before the first frame that uses them.
+//
+//  frame_header   u8 version (the one of FRAME_HELLO), u8 type (frame_type), u16 flags (FRAME_PUSHED), u32 length of what follows
+//  FRAME_HELLO    u16 version used from now on, 0 if the version asked is not supported (the connection stays unframed)
+//  FRAME_DICT     u16 first id, u16 count, then count times: u8 length, length bytes of the name
+//  FRAME_EVENTS   u32 lost, u64 next_seq, u16 count, then count packed events (DATA_QUERY: count 0 or 1)
+//                 packed event: u64 seq, f64 timestamp, f64 duration in ms, u8 event_type, u16 alias id, u16 odor id
+//  FRAME_TRIGGER  u64 seq, f64 timestamp, f64 partner_timestamp
+//  FRAME_FLOW     u8 changed, if changed: f64 timestamp, u8 count, then count times: u8 name, u8 flow_type, u8 validity, f64 value
+//                 version 1: all the MFCs, version 2: only the MFCs that changed since the last FRAME_FLOW of the connection
+//  FRAME_BOOL     u8 value (PULSE_QUERY before the timestamp, APPEND_QUERY, SUBSCRIBE_QUERY)
+//  FRAME_PONG     f64 partner_sent, f64 received, f64 sent (clock_pong of PING_QUERY)
+//
+
+#ifndef __wire_format_h
+#define __wire_format_h
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+const uint8_t WIRE_VERSION = 2;  ///< highest version of the frames
+const unsigned int FRAME_HEADER_SIZE = 8;
+const unsigned int PACKED_EVENT_SIZE = 29;
+const uint16_t NO_NAME = 0xFFFF;  ///< id of a name that did not fit in the dictionary
+const uint16_t FRAME_PUSHED = 1;  ///< flag of the frames pushed to a subscribed partner (SUBSCRIBE_QUERY), the others answer a query
+
+enum frame_type {
+  FRAME_HELLO = 1,
+  FRAME_DICT = 2,
+  FRAME_EVENTS = 3,
+  FRAME_TRIGGER = 4,
+  FRAME_FLOW = 5,
+  FRAME_BOOL = 6,
+  FRAME_PONG = 7
+};
+
+
+/// appends little-endian fields and frames to a buffer
+class wire_writer {
+
+public:
+  /// \param version written in the headers of the frames
+  explicit wire_writer(std::vector <char>& out, uint8_t version = WIRE_VERSION);
+
+  void u8(uint8_t v);
+  void u16(uint16_t v);
+  void u32(uint32_t v);
+  void u64(uint64_t v);
+  void f64(double v);
+  void bytes(const void* data, unsigned int length);
+
+  /// \brief starts a frame, its length is written by end_frame
+  void begin_frame(uint8_t type, uint16_t flags = 0);
+  void end_frame();
+
+private:
+  std::vector <char>* out;
+  uint8_t version;
+  size_t frame_start;
+};
+
+
+/// reads little-endian fields, a partner decodes the frames with it
+class wire_reader {
+
+public:
+  wire_reader(const char* data, unsigned int length);
+
+  /// \return false if the buffer ended before the field, the field is then 0
+  bool u8(uint8_t& v);
+  bool u16(uint16_t& v);
+  bool u32(uint32_t& v);
+  bool u64(uint64_t& v);
+  bool f64(double& v);
+  bool bytes(void* data, unsigned int length);
+
+private:
+  const unsigned char* data;
+  unsigned int length;
+  unsigned int pos;
+};
+
+
+/// names of the aliases and odors, numbered in the order they appear
+class name_dictionary {
+
+public:
+  /// \return id of the name (at most max characters are used), NO_NAME if the dictionary is full
+  uint16_t intern(const char* name, unsigned int max);
+
+  uint16_t size();
+  const std::string& name(uint16_t id);
+
+private:
+  std::map <std::string, uint16_t> ids;
+  std::vector <std::string> names;
+};
+
+#endif